@@ -0,0 +1,584 @@
+#include "../src/masstree.h"
+#include "../src/checkpoint.h"
+#include "../src/client.h"
+#include "../src/log_writer.h"
+#include "../src/server.h"
+#include "../src/numa.h"
+#include "../src/sharded_masstree.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <pthread.h>
+#ifdef MASSTREE_HAS_LIBNUMA
+#include <numa.h>
+#endif
+
+using namespace masstree;
+
+/**
+ * 先頭のslices_len - 1個のsliceを狭い範囲から選ぶことで、
+ * 共通のprefixを持ったkeyを作り、Layerが重なるようにする。
+ */
+static std::vector<Key> make_keys(size_t count, size_t slices_len, std::mt19937_64 &rng){
+  std::vector<Key> keys{};
+  keys.reserve(count);
+  for(size_t i = 0; i < count; ++i){
+    std::vector<KeySlice> slices{};
+    for(size_t j = 0; j + 1 < slices_len; ++j){
+      slices.push_back(rng() % 4);
+    }
+    slices.push_back(rng());
+    keys.emplace_back(slices, 8);
+  }
+  return keys;
+}
+
+/**
+ * lookup一回あたりのversionのload回数と、所要時間を測る。
+ * load回数はNDEBUGが定義されていないbuildでのみ数えられる。
+ */
+static void bench_loads(){
+  constexpr size_t COUNT = 100000;
+  std::mt19937_64 rng(0);
+
+  for(size_t slices_len: {1, 2, 4}){
+    Masstree tree{};
+    GC gc{};
+    auto keys = make_keys(COUNT, slices_len, rng);
+    for(auto &k: keys){
+      tree.put(k, new Value(1), gc);
+    }
+
+#ifndef NDEBUG
+    version_load_count = 0;
+#endif
+    auto start = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for(auto &k: keys){
+      if(tree.get(k) != nullptr) ++found;
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    printf("slices=%zu keys=%zu found=%zu ns/get=%.1f", slices_len, COUNT, found, (double)ns / COUNT);
+#ifndef NDEBUG
+    printf(" loads/get=%.2f", (double)version_load_count / COUNT);
+#endif
+    printf("\n");
+  }
+}
+
+/**
+ * このthreadをtopologyのi番目のnodeのCPUに固定する。
+ * libnumaがあればnuma_run_on_nodeを、無ければsysfsで読んだcpulistを使う。
+ */
+static void pin_to_node(const NumaTopology &topology, size_t i){
+#ifdef MASSTREE_HAS_LIBNUMA
+  if(numa_available() >= 0){
+    numa_run_on_node(topology.nodes[i]);
+    return;
+  }
+#endif
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for(auto cpu: topology.cpus[i]){
+    CPU_SET(cpu, &set);
+  }
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/**
+ * socketごとにthreads_per_node個のthreadを固定し、socketごとのshardにput/getする。
+ * Nodeを全て::operator newで確保した時と、NumaNodeAllocPolicyで置いた時を比べる。
+ * shard sのkeyは先頭のsliceの上位8bitがsで、二つ目のsliceからがLayer1に入る。
+ */
+static void bench_numa(size_t threads_per_node){
+  constexpr size_t COUNT = 200000;
+  auto topology = NumaTopology::load();
+  auto node_count = topology.nodes.size();
+
+  // 各threadのkeyは、NodeAllocPolicyを変える前に作っておく
+  std::vector<std::vector<Key>> keys(node_count * threads_per_node);
+  for(size_t t = 0; t < keys.size(); ++t){
+    std::mt19937_64 rng(t);
+    keys[t] = make_keys(COUNT, 2, rng);
+    for(auto &k: keys[t]){
+      k.slices[0] |= static_cast<KeySlice>(t / threads_per_node) << 56;
+    }
+  }
+
+  auto run = [&](const char *name){
+    std::vector<Key> boundaries{};
+    for(size_t s = 1; s < node_count; ++s){
+      boundaries.emplace_back(std::vector<KeySlice>{static_cast<KeySlice>(s) << 56}, 8);
+    }
+    ShardedMasstree tree(boundaries);
+    for(size_t s = 0; s < node_count; ++s){
+      tree.setShardNode(s, topology.nodes[s]);
+    }
+
+    auto phase = [&](bool put){
+      auto start = std::chrono::steady_clock::now();
+      std::vector<std::thread> threads{};
+      for(size_t t = 0; t < keys.size(); ++t){
+        threads.emplace_back([&, t, put](){
+          pin_to_node(topology, t / threads_per_node);
+          GC gc{};
+          for(auto &k: keys[t]){
+            if(put){
+              tree.put(k, new Value(1), gc);
+            }else{
+              tree.get(k);
+            }
+          }
+        });
+      }
+      for(auto &th: threads){
+        th.join();
+      }
+      auto end = std::chrono::steady_clock::now();
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+      // 各threadから見た一回あたりの時間
+      return (double)ns / COUNT;
+    };
+    auto put_ns = phase(true);
+    auto get_ns = phase(false);
+    printf("policy=%s nodes=%zu threads/node=%zu ns/put=%.1f ns/get=%.1f\n",
+           name, node_count, threads_per_node, put_ns, get_ns);
+  };
+
+  run("default");
+  // treeのNodeは解放されないので、policyはここから最後まで生かしておけばよい
+  NumaNodeAllocPolicy policy{};
+  set_node_alloc_policy(&policy);
+  run("numa");
+  set_node_alloc_policy(nullptr);
+}
+
+/**
+ * masstree_serverに、clients個の接続からdepth個ずつpipeliningしてrequestを送る。
+ * 各接続は自分のkeyを入れてから、getを9割、putを1割で送り続ける。
+ * socket_pathが空の時は、このprocessの中でServerを立てる。
+ */
+static void bench_server(size_t clients, size_t depth, const std::string &socket_path){
+  constexpr size_t KEYS = 10000;
+  constexpr size_t REQUESTS = 500000;
+
+  Masstree tree{};
+  std::unique_ptr<Server> server{};
+  auto path = socket_path;
+  if(path.empty()){
+    path = "/tmp/masstree_bench_" + std::to_string(getpid()) + ".sock";
+    Server::Options options{};
+    options.unix_path = path;
+    server = std::make_unique<Server>(tree, options);
+    if(!server->start()){
+      perror("server");
+      return;
+    }
+  }
+
+  auto key_of = [](size_t client, size_t i){
+    return "client" + std::to_string(client) + "/key" + std::to_string(i);
+  };
+
+  std::vector<Client> conns(clients);
+  for(size_t c = 0; c < clients; ++c){
+    if(!conns[c].connectUnix(path)){
+      perror("connect");
+      return;
+    }
+    for(size_t i = 0; i < KEYS; ++i){
+      conns[c].sendPut(key_of(c, i), static_cast<int32_t>(i));
+    }
+    conns[c].flush();
+    protocol::Response resp{};
+    while(conns[c].inflight() != 0){
+      conns[c].receive(resp);
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads{};
+  std::atomic<size_t> found{0};
+  for(size_t c = 0; c < clients; ++c){
+    threads.emplace_back([&, c](){
+      auto &conn = conns[c];
+      std::mt19937_64 rng(c);
+      protocol::Response resp{};
+      size_t hits = 0;
+      for(size_t sent = 0; sent < REQUESTS; sent += depth){
+        for(size_t j = 0; j < depth; ++j){
+          auto key = key_of(c, rng() % KEYS);
+          if(rng() % 10 == 0){
+            conn.sendPut(key, 1);
+          }else{
+            conn.sendGet(key);
+          }
+        }
+        if(!conn.flush()){
+          return;
+        }
+        for(size_t j = 0; j < depth; ++j){
+          if(!conn.receive(resp)){
+            return;
+          }
+          hits += resp.status == protocol::Status::Ok;
+        }
+      }
+      found += hits;
+    });
+  }
+  for(auto &th: threads){
+    th.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+  auto sec = std::chrono::duration<double>(end - start).count();
+  auto total = ((REQUESTS + depth - 1) / depth) * depth * clients;
+  printf("clients=%zu depth=%zu requests=%zu ok=%zu ops/s=%.0f\n",
+         clients, depth, total, found.load(), total / sec);
+}
+
+/**
+ * threads個のthreadでlogged_putし、group commitの効果を見る。
+ * 最後にsyncするまで、putのthreadはfsyncを待たない。
+ */
+static void bench_log(size_t threads, size_t group_ops, bool use_io_uring, const std::string &path){
+  constexpr size_t COUNT = 200000;
+  unlink(path.c_str());
+  Masstree tree{};
+  LogWriter writer{};
+  LogWriter::Options options{};
+  options.group_ops = group_ops;
+  options.use_io_uring = use_io_uring;
+  if(!writer.open(path, options)){
+    perror("open");
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers{};
+  for(size_t t = 0; t < threads; ++t){
+    workers.emplace_back([&, t](){
+      GC gc{};
+      LogBuffer log(writer);
+      for(size_t i = 0; i < COUNT; ++i){
+        logged_put(tree, log, "thread" + std::to_string(t) + "/" + std::to_string(i), static_cast<int32_t>(i), gc);
+        if(i % 1024 == 0){
+          gc.run();
+        }
+      }
+      log.sync();
+      gc.run();
+    });
+  }
+  for(auto &th: workers){
+    th.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+  auto uring = writer.usingIoUring();
+  writer.close();
+  auto stats = writer.stats();
+  auto sec = std::chrono::duration<double>(end - start).count();
+  printf("backend=%s threads=%zu group_ops=%zu ops/s=%.0f fsyncs=%lu ops/fsync=%.0f MB=%.1f\n",
+         uring ? "io_uring" : "pwritev", threads, group_ops, stats.ops / sec,
+         static_cast<unsigned long>(stats.groups), stats.groups != 0 ? static_cast<double>(stats.ops) / stats.groups : 0.0,
+         stats.bytes / 1e6);
+  unlink(path.c_str());
+}
+
+/**
+ * count個のkeyを入れた木を、1からmax_threadsまでのthread数でcheckpointし、読み直す。
+ */
+static void bench_checkpoint(size_t count, size_t max_threads, const std::string &dir){
+  Masstree tree{};
+  GC gc{};
+  std::mt19937_64 rng(0);
+  // 範囲はlayer0のsliceで分けるので、先頭のsliceが散らばったkeyにする
+  for(auto &key: make_keys(count, 1, rng)){
+    tree.put(key, new Value(1), gc);
+  }
+  for(size_t threads = 1; threads <= max_threads; threads *= 2){
+    CheckpointStats written{};
+    auto start = std::chrono::steady_clock::now();
+    if(!write_checkpoint(tree, dir, threads, written)){
+      perror("checkpoint");
+      return;
+    }
+    auto mid = std::chrono::steady_clock::now();
+    Masstree restored{};
+    CheckpointStats read{};
+    if(!restore_checkpoint(restored, dir, threads, read)){
+      perror("restore");
+      return;
+    }
+    auto end = std::chrono::steady_clock::now();
+    printf("threads=%zu segments=%zu keys=%zu MB=%.1f write=%.3fs restore=%.3fs\n",
+           threads, written.segments, written.keys, written.bytes / 1e6,
+           std::chrono::duration<double>(mid - start).count(), std::chrono::duration<double>(end - mid).count());
+  }
+}
+
+/**
+ * Permutationのinsertとremoveの速さを、1nibbleずつ動かしていた以前の実装と比べる。
+ * 15個まで入れてから全て取り除く事を繰り返す。
+ */
+static void bench_permutation(size_t rounds){
+  // 以前の実装。setKeyIndex/getKeyIndexを1nibbleずつ呼ぶ
+  auto loop_insert = [](Permutation &p, size_t ps, size_t ts){
+    for(size_t i = p.getNumKeys(); i > ps; --i){
+      p.setKeyIndex(i, p.getKeyIndex(i - 1));
+    }
+    p.setKeyIndex(ps, ts);
+    p.incNumKeys();
+  };
+  auto loop_remove = [](Permutation &p, uint8_t ts){
+    size_t removed = 0;
+    for(size_t i = 0; i < p.getNumKeys(); ++i){
+      if(p.getKeyIndex(i) == ts){
+        removed = i;
+        break;
+      }
+    }
+    for(auto i = removed; i + 1 < p.getNumKeys(); ++i){
+      p.setKeyIndex(i, p.getKeyIndex(i + 1));
+    }
+    p.decNumKeys();
+  };
+
+  // 挿入位置と取り除くslotは、乱数で前もって決めておく
+  std::mt19937_64 rng(0);
+  std::vector<uint8_t> positions(15), removals(15);
+  for(size_t i = 0; i < 15; ++i){
+    positions[i] = static_cast<uint8_t>(rng() % (i + 1));
+    removals[i] = static_cast<uint8_t>(i);
+  }
+  std::shuffle(removals.begin(), removals.end(), rng);
+
+  auto run = [&](const char *name, auto &&insert, auto &&remove){
+    uint64_t check = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t r = 0; r < rounds; ++r){
+      Permutation p{};
+      for(size_t i = 0; i < 15; ++i){
+        insert(p, positions[i], i);
+      }
+      check += p.body;
+      for(auto ts: removals){
+        remove(p, ts);
+      }
+      check += p.body;
+    }
+    auto sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%s: %.1f Mops/s (check=%lx)\n", name, rounds * 30 / sec / 1e6, static_cast<unsigned long>(check));
+  };
+  run("loop", loop_insert, loop_remove);
+  run("bit-parallel", [](Permutation &p, size_t ps, size_t ts){ p.insert(ps, ts); },
+      [](Permutation &p, uint8_t ts){ p.removeIndex(ts); });
+}
+
+/**
+ * 小さい順のputと、続くgetの速さを、LeafHintを使う場合と使わない場合で比べる。
+ * version_loadsは一操作あたりのversionのload回数で、NDEBUGが定義されていないbuildでのみ数えられる。
+ */
+static void bench_hint(size_t count){
+  for(size_t slices_len: {1, 2}){
+    std::vector<Key> keys{};
+    keys.reserve(count);
+    for(size_t i = 0; i < count; ++i){
+      std::vector<KeySlice> slices(slices_len, i / 1000);
+      slices.back() = i;
+      keys.emplace_back(slices, 8);
+    }
+    for(bool use_hint: {false, true}){
+      Masstree tree{};
+      GC gc{};
+      LeafHint hint{};
+#ifndef NDEBUG
+      version_load_count = 0;
+#endif
+      auto start = std::chrono::steady_clock::now();
+      for(size_t i = 0; i < count; ++i){
+        if(use_hint){
+          tree.put(keys[i], new Value(i), gc, hint);
+        }else{
+          tree.put(keys[i], new Value(i), gc);
+        }
+      }
+      auto mid = std::chrono::steady_clock::now();
+#ifndef NDEBUG
+      auto put_loads = version_load_count;
+      version_load_count = 0;
+#else
+      size_t put_loads = 0;
+#endif
+      size_t found = 0;
+      for(auto &k: keys){
+        found += (use_hint ? tree.get(k, hint) : tree.get(k)) != nullptr;
+      }
+      auto end = std::chrono::steady_clock::now();
+#ifndef NDEBUG
+      size_t get_loads = version_load_count;
+#else
+      size_t get_loads = 0;
+#endif
+      auto put_sec = std::chrono::duration<double>(mid - start).count();
+      auto get_sec = std::chrono::duration<double>(end - mid).count();
+      printf("slices=%zu hint=%d: put %.2f Mops/s (version_loads=%.2f), get %.2f Mops/s (version_loads=%.2f), found=%zu\n",
+             slices_len, use_hint, count / put_sec / 1e6, static_cast<double>(put_loads) / count,
+             count / get_sec / 1e6, static_cast<double>(get_loads) / count, found);
+    }
+  }
+}
+
+/**
+ * 乱順のkeyをbatch_size個ずつ、putで一つずつ入れる場合と、multiPutで入れる場合を比べる。
+ */
+static void bench_multi_put(size_t count, size_t batch_size){
+  std::mt19937_64 rng(44);
+  auto keys = make_keys(count, 1, rng);
+  for(bool use_batch: {false, true}){
+    Masstree tree{};
+    GC gc{};
+    auto start = std::chrono::steady_clock::now();
+    for(size_t begin = 0; begin < count; begin += batch_size){
+      auto end = std::min(begin + batch_size, count);
+      if(use_batch){
+        std::vector<std::pair<Key, Value *>> batch{};
+        batch.reserve(end - begin);
+        for(size_t i = begin; i < end; ++i){
+          batch.emplace_back(keys[i], new Value(i));
+        }
+        tree.multiPut(batch, gc);
+      }else{
+        for(size_t i = begin; i < end; ++i){
+          tree.put(keys[i], new Value(i), gc);
+        }
+      }
+    }
+    auto sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("batch_size=%zu multiPut=%d: %.2f Mops/s\n", batch_size, use_batch, count / sec / 1e6);
+  }
+}
+
+/**
+ * 一部のkeyに偏ったget/putを複数のthreadで行い、Hotspotが見つけたkeyとBorderNodeを表示する。
+ * MASSTREE_HOTSPOTを定義してbuildした時のみ結果が出る。
+ */
+static void bench_hotspot(size_t threads, uint64_t period){
+  constexpr size_t COUNT = 100000;
+  constexpr size_t OPS = 1000000;
+  if(!Hotspot::enabled()){
+    printf("hotspot sampling is disabled (build with -DMASSTREE_HOTSPOT=ON)\n");
+  }
+  Hotspot::setSamplePeriod(period);
+  Hotspot::reset();
+  Masstree tree{};
+  {
+    GC gc{};
+    for(size_t i = 0; i < COUNT; ++i){
+      Key k({i}, 8);
+      tree.put(k, new Value(i), gc);
+    }
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers{};
+  for(size_t t = 0; t < threads; ++t){
+    workers.emplace_back([&tree, t](){
+      std::mt19937_64 rng(t);
+      GC gc{};
+      for(size_t i = 0; i < OPS; ++i){
+        // 半分は先頭の16個のkeyに、残りは全体に散らす
+        auto r = rng();
+        Key k({r % 2 == 0 ? (r >> 1) % 16 : (r >> 1) % COUNT}, 8);
+        if(i % 8 == 0){
+          tree.put(k, new Value(i), gc);
+        }else{
+          tree.get(k);
+        }
+      }
+    });
+  }
+  for(auto &w: workers){
+    w.join();
+  }
+  auto sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("threads=%zu period=%lu: %.2f Mops/s\n", threads, static_cast<unsigned long>(period),
+         threads * OPS / sec / 1e6);
+  Hotspot::collect(8).print();
+}
+
+/**
+ * threads個のthreadで、同じ範囲のkeyに2 sliceのkeyを混ぜてput/getし、
+ * 操作の中の区間ごとの時間のhistogramを表示する。
+ * MASSTREE_PROFILEを定義してbuildした時のみ結果が出る。
+ */
+static void bench_profile(size_t threads){
+  constexpr size_t OPS = 1000000;
+  if(!Profiler::enabled()){
+    printf("phase profiling is disabled (build with -DMASSTREE_PROFILE=ON)\n");
+  }
+  Profiler::reset();
+  Masstree tree{};
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers{};
+  for(size_t t = 0; t < threads; ++t){
+    workers.emplace_back([&tree, t](){
+      std::mt19937_64 rng(t);
+      GC gc{};
+      for(size_t i = 0; i < OPS; ++i){
+        auto r = rng();
+        // 1/4は下のLayerに入る
+        auto k = r % 4 == 0 ? Key({(r >> 2) % 1024, r >> 20}, 8) : Key({(r >> 2) % 1000000}, 8);
+        if(i % 2 == 0){
+          tree.put(k, new Value(i), gc);
+        }else{
+          tree.get(k);
+        }
+      }
+    });
+  }
+  for(auto &w: workers){
+    w.join();
+  }
+  auto sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("threads=%zu: %.2f Mops/s\n", threads, threads * OPS / sec / 1e6);
+  Profiler::collect().print();
+}
+
+int main(int argc, char **argv){
+  std::string mode = argc >= 2 ? argv[1] : "loads";
+  if(mode == "loads"){
+    bench_loads();
+  }else if(mode == "numa"){
+    bench_numa(argc >= 3 ? std::stoul(argv[2]) : 2);
+  }else if(mode == "server"){
+    bench_server(argc >= 3 ? std::stoul(argv[2]) : 4, argc >= 4 ? std::stoul(argv[3]) : 32, argc >= 5 ? argv[4] : "");
+  }else if(mode == "log"){
+    auto threads = argc >= 3 ? std::stoul(argv[2]) : 4;
+    auto group_ops = argc >= 4 ? std::stoul(argv[3]) : 32768;
+    auto path = argc >= 5 ? argv[4] : "/tmp/masstree_bench.log";
+    bench_log(threads, group_ops, true, path);
+    bench_log(threads, group_ops, false, path);
+  }else if(mode == "checkpoint"){
+    auto count = argc >= 3 ? std::stoul(argv[2]) : 2000000;
+    auto threads = argc >= 4 ? std::stoul(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+    bench_checkpoint(count, threads, argc >= 5 ? argv[4] : "/tmp/masstree_bench_checkpoint");
+  }else if(mode == "permutation"){
+    bench_permutation(argc >= 3 ? std::stoul(argv[2]) : 2000000);
+  }else if(mode == "hint"){
+    bench_hint(argc >= 3 ? std::stoul(argv[2]) : 2000000);
+  }else if(mode == "multiput"){
+    bench_multi_put(argc >= 3 ? std::stoul(argv[2]) : 2000000, argc >= 4 ? std::stoul(argv[3]) : 4096);
+  }else if(mode == "hotspot"){
+    bench_hotspot(argc >= 3 ? std::stoul(argv[2]) : 4, argc >= 4 ? std::stoul(argv[3]) : 128);
+  }else if(mode == "profile"){
+    bench_profile(argc >= 3 ? std::stoul(argv[2]) : 4);
+  }else{
+    fprintf(stderr, "usage: %s [loads | numa [threads_per_node] | server [clients] [depth] [socket] | log [threads] [group_ops] [path] | checkpoint [keys] [max_threads] [dir] | permutation [rounds] | hint [keys] | multiput [keys] [batch_size] | hotspot [threads] [sample_period] | profile [threads]]\n", argv[0]);
+    return 1;
+  }
+  return 0;
+}
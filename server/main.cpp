@@ -0,0 +1,65 @@
+#include "../src/server.h"
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace masstree;
+
+static void usage(const char *name){
+  fprintf(stderr, "usage: %s [--unix PATH | --tcp PORT] [--loops N] [--max-scan N]\n", name);
+}
+
+/**
+ * SIGINTかSIGTERMを受けるまで、一つのMasstreeをServerで公開する。
+ */
+int main(int argc, char **argv){
+  Server::Options options{};
+  options.unix_path = "/tmp/masstree.sock";
+  for(int i = 1; i < argc; ++i){
+    std::string arg = argv[i];
+    if(i + 1 >= argc){
+      usage(argv[0]);
+      return 1;
+    }
+    std::string value = argv[++i];
+    if(arg == "--unix"){
+      options.unix_path = value;
+    }else if(arg == "--tcp"){
+      options.unix_path.clear();
+      options.tcp_port = static_cast<uint16_t>(std::stoul(value));
+    }else if(arg == "--loops"){
+      options.loops = std::max<size_t>(1, std::stoul(value));
+    }else if(arg == "--max-scan"){
+      options.max_scan = static_cast<uint32_t>(std::stoul(value));
+    }else{
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  // loopのthreadに届かないよう、startの前にblockしておく
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  Masstree tree{};
+  Server server(tree, options);
+  if(!server.start()){
+    fprintf(stderr, "failed to listen: %s\n", strerror(errno));
+    return 1;
+  }
+  if(options.unix_path.empty()){
+    printf("listening on 127.0.0.1:%u with %zu loops\n", server.port(), options.loops);
+  }else{
+    printf("listening on %s with %zu loops\n", options.unix_path.c_str(), options.loops);
+  }
+  fflush(stdout);
+
+  int sig;
+  sigwait(&signals, &sig);
+  server.stop();
+  return 0;
+}
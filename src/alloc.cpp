@@ -1,9 +1,9 @@
 #include "alloc.h"
 
-int inc_border_node = 0;
-int dec_border_node = 0;
-int inc_interior_node = 0;
-int dec_interior_node = 0;
-int inc_big_suffix = 0;
-int dec_big_suffix = 0;
-int dec_value = 0;
+std::atomic<int> inc_border_node = 0;
+std::atomic<int> dec_border_node = 0;
+std::atomic<int> inc_interior_node = 0;
+std::atomic<int> dec_interior_node = 0;
+std::atomic<int> inc_big_suffix = 0;
+std::atomic<int> dec_big_suffix = 0;
+std::atomic<int> dec_value = 0;
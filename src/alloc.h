@@ -3,14 +3,16 @@
 
 #include <cstddef>
 #include <iostream>
-
-extern int inc_border_node;
-extern int dec_border_node;
-extern int inc_interior_node;
-extern int dec_interior_node;
-extern int inc_big_suffix;
-extern int dec_big_suffix;
-extern int dec_value;
+#include <atomic>
+
+// 複数のthreadから更新されるので、atomicにしておく
+extern std::atomic<int> inc_border_node;
+extern std::atomic<int> dec_border_node;
+extern std::atomic<int> inc_interior_node;
+extern std::atomic<int> dec_interior_node;
+extern std::atomic<int> inc_big_suffix;
+extern std::atomic<int> dec_big_suffix;
+extern std::atomic<int> dec_value;
 
 class Alloc{
 private:
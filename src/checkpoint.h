@@ -0,0 +1,786 @@
+#ifndef MASSTREE_CHECKPOINT_H
+#define MASSTREE_CHECKPOINT_H
+
+#include "masstree.h"
+#include "crc32c.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace masstree{
+
+/**
+ * checkpointは一つのdirectoryに置く。
+ *
+ *   MANIFEST       1行目が"masstree-checkpoint 2"、以降の各行がsegmentのfile名
+ *   segment-NNNN   layer0の先頭のsliceが[lower, upper)のkeyを小さい順に持つ
+ *
+ * segmentは次の形をとり、固定長の整数は全てlittle endian、varintはLEB128。
+ *
+ *   block:  u32 body_len | u32 crc32c(body) | body
+ *           body = varint count | count個の(varint shared | varint rest_len | rest | varint zigzag(value))
+ *   end:    u32 0
+ *   index:  u64 count | count個の(u64 offset | u64 records_before)
+ *   footer: u64 lower | u64 upper | u8 has_upper | u64 records | u64 index_offset | u32 crc32c(index) | u64 magic
+ *
+ * keyはblockの中で前のkeyとの共通のprefixを除いて書く(front coding)。各blockの先頭のkeyは全て書くので、
+ * blockは他のblockを読まずに復元できる。masstreeのkeyは共通のprefixが長い事が多いので、これで大きく縮む。
+ * blockは先頭から順に読めば、footerを読まずに最後まで辿れる(SegmentReader)。
+ * indexは各blockの位置で、restoreはこれでsegmentを更に分けて読み、crcの合わないblockを飛ばす。
+ * MANIFESTは全てのsegmentを書いてfsyncした後にrenameで置くので、MANIFESTがあれば全て揃っている。
+ */
+static constexpr uint64_t CHECKPOINT_MAGIC = 0x3230544b43544d4dULL; // "MMTCKT02"
+// blockのbodyをこの大きさまで溜める
+static constexpr size_t CHECKPOINT_BLOCK_SIZE = 4096;
+// これより大きいblockは壊れているものとみなす
+static constexpr size_t CHECKPOINT_MAX_BLOCK = 1u << 24;
+// restoreで一つのthreadが一度に取るblockの数
+static constexpr size_t CHECKPOINT_CHUNK_BLOCKS = 64;
+static constexpr size_t CHECKPOINT_BLOCK_HEADER = 2 * sizeof(uint32_t);
+static constexpr size_t CHECKPOINT_FOOTER = 5 * sizeof(uint64_t) + 1 + sizeof(uint32_t);
+static constexpr const char *CHECKPOINT_MANIFEST_HEADER = "masstree-checkpoint 2";
+
+struct CheckpointStats{
+  size_t segments = 0;
+  size_t keys = 0;
+  size_t bytes = 0;
+  // crcが合わずに飛ばしたblockと、その中のkeyの数
+  size_t corrupted_blocks = 0;
+  size_t skipped_keys = 0;
+};
+
+/**
+ * segmentのfooterとindex
+ */
+struct SegmentIndex{
+  KeySlice lower = 0;
+  KeySlice upper = 0;
+  bool has_upper = false;
+  uint64_t records = 0;
+  uint64_t index_offset = 0;
+  // 各blockの(offset, それより前のrecordの数)
+  std::vector<std::pair<uint64_t, uint64_t>> blocks{};
+
+  /**
+   * i番目のblockの終わり
+   */
+  [[nodiscard]]
+  uint64_t blockEnd(size_t i) const{
+    return i + 1 < blocks.size() ? blocks[i + 1].first : index_offset - sizeof(uint32_t);
+  }
+
+  [[nodiscard]]
+  uint64_t blockRecords(size_t i) const{
+    return (i + 1 < blocks.size() ? blocks[i + 1].second : records) - blocks[i].second;
+  }
+};
+
+/**
+ * restoreで一つのthreadが読む単位。segmentの[first_block, end_block)のblock
+ */
+struct SegmentChunk{
+  size_t segment;
+  size_t first_block;
+  size_t end_block;
+};
+
+static std::string segment_name(size_t i){
+  char name[32];
+  snprintf(name, sizeof(name), "segment-%04zu", i);
+  return name;
+}
+
+template<typename T>
+static void append_int(std::string &out, T x){
+  out.append(reinterpret_cast<const char *>(&x), sizeof(T));
+}
+
+static void put_varint(std::string &out, uint64_t x){
+  while(x >= 0x80){
+    out.push_back(static_cast<char>(x | 0x80));
+    x >>= 7;
+  }
+  out.push_back(static_cast<char>(x));
+}
+
+/**
+ * @param[in,out] p 読んだ分だけ進める
+ * @param[out] x
+ * @return endを越える時か、64bitに収まらない時はfalse
+ */
+static bool get_varint(const char *&p, const char *end, uint64_t &x){
+  x = 0;
+  for(unsigned shift = 0; shift < 64; shift += 7){
+    if(p == end){
+      return false;
+    }
+    auto byte = static_cast<uint8_t>(*p++);
+    x |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if((byte & 0x80) == 0){
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint64_t zigzag(int32_t x){
+  return static_cast<uint32_t>((static_cast<uint32_t>(x) << 1) ^ static_cast<uint32_t>(x >> 31));
+}
+
+static int32_t unzigzag(uint64_t x){
+  return static_cast<int32_t>(static_cast<uint32_t>(x >> 1) ^ -static_cast<uint32_t>(x & 1));
+}
+
+/**
+ * 一つのblockを組み立てる。
+ */
+class BlockEncoder{
+public:
+  void add(const std::string &key, int32_t value){
+    size_t shared = 0;
+    auto limit = std::min(prev.size(), key.size());
+    while(shared < limit and prev[shared] == key[shared]){
+      ++shared;
+    }
+    put_varint(records, shared);
+    put_varint(records, key.size() - shared);
+    records.append(key, shared, std::string::npos);
+    put_varint(records, zigzag(value));
+    prev = key;
+    ++count;
+  }
+
+  [[nodiscard]]
+  bool empty() const{
+    return count == 0;
+  }
+
+  [[nodiscard]]
+  bool full() const{
+    return records.size() >= CHECKPOINT_BLOCK_SIZE;
+  }
+
+  /**
+   * blockをheaderを付けてoutに書き、空に戻る。
+   */
+  void finish(std::string &out){
+    std::string body{};
+    put_varint(body, count);
+    body += records;
+    append_int<uint32_t>(out, static_cast<uint32_t>(body.size()));
+    append_int<uint32_t>(out, crc32c(body.data(), body.size()));
+    out += body;
+    records.clear();
+    prev.clear();
+    count = 0;
+  }
+
+private:
+  std::string records{};
+  std::string prev{};
+  uint64_t count = 0;
+};
+
+/**
+ * crcを確かめたblockのbodyを読み、f(key, value)に渡す。
+ * @return bodyが壊れていた時はfalse。それまでのrecordはfに渡っている
+ */
+template<typename F>
+static bool decode_block(const char *body, size_t size, F &&f){
+  auto p = body;
+  auto end = body + size;
+  uint64_t count;
+  if(!get_varint(p, end, count)){
+    return false;
+  }
+  std::string key{};
+  for(uint64_t i = 0; i < count; ++i){
+    uint64_t shared, rest, value;
+    if(!get_varint(p, end, shared) or !get_varint(p, end, rest) or shared > key.size()
+       or rest > static_cast<uint64_t>(end - p) or shared + rest == 0){
+      return false;
+    }
+    key.resize(shared);
+    key.append(p, rest);
+    p += rest;
+    if(!get_varint(p, end, value)){
+      return false;
+    }
+    f(static_cast<const std::string &>(key), unzigzag(value));
+  }
+  return p == end;
+}
+
+/**
+ * bufferに溜めてfdに書く。
+ */
+class SegmentWriter{
+public:
+  explicit SegmentWriter(int fd_)
+  : fd(fd_)
+  {}
+
+  template<typename T>
+  void putInt(T x){
+    char buf[sizeof(T)];
+    std::memcpy(buf, &x, sizeof(T));
+    putBytes(buf, sizeof(T));
+  }
+
+  void putBytes(const char *data, size_t size){
+    buffer.append(data, size);
+    written += size;
+    if(buffer.size() >= FLUSH_SIZE){
+      flush();
+    }
+  }
+
+  bool flush(){
+    size_t pos = 0;
+    while(pos < buffer.size()){
+      auto r = write(fd, buffer.data() + pos, buffer.size() - pos);
+      if(r < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        ok = false;
+        break;
+      }
+      pos += r;
+    }
+    buffer.clear();
+    return ok;
+  }
+
+  [[nodiscard]]
+  uint64_t offset() const{
+    return written;
+  }
+
+private:
+  static constexpr size_t FLUSH_SIZE = 1 << 20;
+
+  int fd;
+  std::string buffer{};
+  uint64_t written = 0;
+  bool ok = true;
+};
+
+/**
+ * layer0の先頭のsliceが[lower, upper)のkeyを、pathのsegmentに書く。
+ * @param upper nullptrの時は上限なし
+ */
+static bool write_segment(Masstree &tree, const std::string &path, KeySlice lower, const KeySlice *upper,
+                          CheckpointStats &stats){
+  auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd < 0){
+    return false;
+  }
+  SegmentWriter out(fd);
+  std::string index{};
+  uint64_t records = 0;
+  uint64_t block_records = 0;
+  BlockEncoder block{};
+  std::string encoded{};
+  auto flush_block = [&](){
+    append_int<uint64_t>(index, out.offset());
+    append_int<uint64_t>(index, records - block_records);
+    encoded.clear();
+    block.finish(encoded);
+    out.putBytes(encoded.data(), encoded.size());
+    block_records = 0;
+  };
+  auto write_record = [&](const Key &key, Value *value){
+    if(upper != nullptr and key.slices[0] >= *upper){
+      return false;
+    }
+    block.add(key_to_bytes(key), value->getBody());
+    ++records;
+    ++block_records;
+    if(block.full()){
+      flush_block();
+    }
+    return true;
+  };
+  if(lower == 0){
+    tree.scan(write_record);
+  }else{
+    // 先頭のsliceがlowerであるkeyの中で最も小さいもの
+    tree.scan(Key({lower}, 1), write_record);
+  }
+  if(!block.empty()){
+    flush_block();
+  }
+  out.putInt<uint32_t>(0);
+
+  auto index_offset = out.offset();
+  out.putInt<uint64_t>(index.size() / 16);
+  out.putBytes(index.data(), index.size());
+  out.putInt<uint64_t>(lower);
+  out.putInt<uint64_t>(upper != nullptr ? *upper : 0);
+  out.putInt<uint8_t>(upper != nullptr);
+  out.putInt<uint64_t>(records);
+  out.putInt<uint64_t>(index_offset);
+  out.putInt<uint32_t>(crc32c(index.data(), index.size()));
+  out.putInt<uint64_t>(CHECKPOINT_MAGIC);
+  auto ok = out.flush() and fsync(fd) == 0;
+  close(fd);
+
+  stats.keys += records;
+  stats.bytes += out.offset();
+  return ok;
+}
+
+/**
+ * treeをdirにcheckpointする。
+ * layer0のkeyをInteriorNodeの子の境界で範囲に分け(Masstree::partition)、
+ * 各範囲をthreads個のthreadが一つずつ別のsegmentに書く。
+ * 全てのkeyが8byte以上の共通のprefixを持つ木では、layer0が分かれないのでsegmentは一つとなる。
+ * 他の操作と並行して呼んでよいが、scanと同じくsnapshotではない。
+ * @param[out] stats
+ * @return 書けなかった時はfalse。errnoに理由が入る
+ */
+[[maybe_unused]]
+static bool write_checkpoint(Masstree &tree, const std::string &dir, size_t threads, CheckpointStats &stats){
+  if(mkdir(dir.c_str(), 0755) != 0 and errno != EEXIST){
+    return false;
+  }
+  threads = std::max<size_t>(threads, 1);
+  auto boundaries = tree.partition(threads);
+  auto segments = boundaries.size() + 1;
+  threads = std::min(threads, segments);
+
+  std::vector<CheckpointStats> per_thread(threads);
+  std::atomic<size_t> next{0};
+  std::atomic<bool> ok{true};
+  std::atomic<int> error{0};
+  auto worker = [&](size_t t){
+    size_t i;
+    while((i = next++) < segments){
+      auto lower = i == 0 ? 0 : boundaries[i - 1];
+      auto upper = i < boundaries.size() ? &boundaries[i] : nullptr;
+      if(!write_segment(tree, dir + "/" + segment_name(i), lower, upper, per_thread[t])){
+        error = errno;
+        ok = false;
+      }
+    }
+  };
+  std::vector<std::thread> workers{};
+  for(size_t t = 1; t < threads; ++t){
+    workers.emplace_back(worker, t);
+  }
+  worker(0);
+  for(auto &th: workers){
+    th.join();
+  }
+  if(!ok){
+    errno = error;
+    return false;
+  }
+
+  auto manifest = dir + "/MANIFEST";
+  auto tmp = manifest + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    out << CHECKPOINT_MANIFEST_HEADER << '\n';
+    for(size_t i = 0; i < segments; ++i){
+      out << segment_name(i) << '\n';
+    }
+    if(!out.flush()){
+      return false;
+    }
+  }
+  if(rename(tmp.c_str(), manifest.c_str()) != 0){
+    return false;
+  }
+  auto dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(dir_fd >= 0){
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+
+  stats.segments += segments;
+  for(auto &s: per_thread){
+    stats.keys += s.keys;
+    stats.bytes += s.bytes;
+  }
+  return true;
+}
+
+/**
+ * fdのoffsetからsize byteを全て読む。
+ */
+static bool read_fully(int fd, uint64_t offset, char *data, size_t size){
+  size_t pos = 0;
+  while(pos < size){
+    auto r = pread(fd, data + pos, size - pos, static_cast<off_t>(offset + pos));
+    if(r < 0 and errno == EINTR){
+      continue;
+    }
+    if(r <= 0){
+      return false;
+    }
+    pos += r;
+  }
+  return true;
+}
+
+/**
+ * segmentのfooterとindexを読む。
+ * @param[out] index
+ * @return footerかindexが壊れていた時はfalse
+ */
+static bool read_segment_index(const std::string &path, SegmentIndex &index){
+  auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0){
+    return false;
+  }
+  struct stat st{};
+  auto ok = fstat(fd, &st) == 0 and static_cast<size_t>(st.st_size) >= CHECKPOINT_FOOTER + sizeof(uint64_t) + sizeof(uint32_t);
+  char buf[CHECKPOINT_FOOTER];
+  std::vector<char> entries{};
+  uint64_t count = 0;
+  uint32_t index_crc = 0;
+  if(!ok or !read_fully(fd, st.st_size - CHECKPOINT_FOOTER, buf, sizeof(buf))){
+    goto fail;
+  }
+  {
+    auto p = buf;
+    std::memcpy(&index.lower, p, 8); p += 8;
+    std::memcpy(&index.upper, p, 8); p += 8;
+    index.has_upper = *p != 0; p += 1;
+    std::memcpy(&index.records, p, 8); p += 8;
+    std::memcpy(&index.index_offset, p, 8); p += 8;
+    std::memcpy(&index_crc, p, 4); p += 4;
+    uint64_t magic;
+    std::memcpy(&magic, p, 8);
+    if(magic != CHECKPOINT_MAGIC or index.index_offset < sizeof(uint32_t)
+       or index.index_offset + sizeof(uint64_t) + CHECKPOINT_FOOTER > static_cast<uint64_t>(st.st_size)){
+      goto fail;
+    }
+  }
+  if(!read_fully(fd, index.index_offset, reinterpret_cast<char *>(&count), sizeof(count))
+     or index.index_offset + sizeof(uint64_t) + count * 16 + CHECKPOINT_FOOTER != static_cast<uint64_t>(st.st_size)){
+    goto fail;
+  }
+  entries.resize(count * 16);
+  if(!read_fully(fd, index.index_offset + sizeof(uint64_t), entries.data(), entries.size())
+     or crc32c(entries.data(), entries.size()) != index_crc){
+    goto fail;
+  }
+  close(fd);
+  index.blocks.resize(count);
+  for(uint64_t i = 0; i < count; ++i){
+    std::memcpy(&index.blocks[i].first, &entries[i * 16], 8);
+    std::memcpy(&index.blocks[i].second, &entries[i * 16 + 8], 8);
+    if(i != 0 and (index.blocks[i].first <= index.blocks[i - 1].first or index.blocks[i].second < index.blocks[i - 1].second)){
+      return false;
+    }
+  }
+  return count == 0 or (index.blockEnd(count - 1) > index.blocks.back().first and index.blocks.back().second <= index.records);
+fail:
+  close(fd);
+  return false;
+}
+
+/**
+ * chunkのblockを一度に読み、crcを確かめてからtreeにputする。
+ * crcが合わないblockは飛ばし、statsに数える。
+ * @return 読めなかった時はfalse
+ */
+static bool restore_chunk(Masstree &tree, int fd, const SegmentIndex &index, const SegmentChunk &chunk, GC &gc,
+                          CheckpointStats &stats){
+  auto begin = index.blocks[chunk.first_block].first;
+  std::vector<char> data(index.blockEnd(chunk.end_block - 1) - begin);
+  if(!read_fully(fd, begin, data.data(), data.size())){
+    return false;
+  }
+  auto put = [&tree, &gc, &stats](const std::string &key, int32_t value){
+    auto k = key_from_bytes(key.data(), key.size());
+    tree.put(k, new Value(value), gc);
+    ++stats.keys;
+  };
+  for(auto b = chunk.first_block; b < chunk.end_block; ++b){
+    auto block = &data[index.blocks[b].first - begin];
+    auto size = index.blockEnd(b) - index.blocks[b].first;
+    uint32_t body_len = 0, crc = 0;
+    if(size >= CHECKPOINT_BLOCK_HEADER){
+      std::memcpy(&body_len, block, sizeof(body_len));
+      std::memcpy(&crc, block + sizeof(body_len), sizeof(crc));
+    }
+    auto body = block + CHECKPOINT_BLOCK_HEADER;
+    auto records = stats.keys;
+    if(size < CHECKPOINT_BLOCK_HEADER or body_len != size - CHECKPOINT_BLOCK_HEADER
+       or crc32c(body, body_len) != crc or !decode_block(body, body_len, put)
+       or stats.keys - records != index.blockRecords(b)){
+      // 途中までputしたrecordは残るが、数えるのはblockの全てのrecordとする
+      stats.keys = records;
+      ++stats.corrupted_blocks;
+      stats.skipped_keys += index.blockRecords(b);
+    }
+  }
+  return true;
+}
+
+/**
+ * write_checkpointで書いたdirを、threads個のthreadでtreeに読み込む。
+ * 各segmentはindexでCHECKPOINT_CHUNK_BLOCKS個ずつのblockに分け、threadが一つずつ取って読む。
+ * 範囲は互いに重ならないので、threadは木の別の部分にputする事になる。
+ * crcの合わないblockは飛ばして続け、飛ばした数をstatsに返す。
+ * @param[out] stats
+ * @return MANIFESTが無いか、segmentのfooterかindexが壊れていた時はfalse。それまでに読んだkeyはtreeに残る
+ */
+[[maybe_unused]]
+static bool restore_checkpoint(Masstree &tree, const std::string &dir, size_t threads, CheckpointStats &stats){
+  std::vector<std::string> names{};
+  {
+    std::ifstream in(dir + "/MANIFEST");
+    std::string line{};
+    if(!std::getline(in, line) or line != CHECKPOINT_MANIFEST_HEADER){
+      errno = ENOENT;
+      return false;
+    }
+    while(std::getline(in, line)){
+      if(!line.empty()){
+        names.push_back(line);
+      }
+    }
+  }
+
+  std::vector<SegmentIndex> indexes(names.size());
+  std::vector<SegmentChunk> chunks{};
+  std::vector<int> fds{};
+  auto ok = true;
+  for(size_t i = 0; i < names.size() and ok; ++i){
+    auto path = dir + "/" + names[i];
+    ok = read_segment_index(path, indexes[i]);
+    if(ok){
+      fds.push_back(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+      ok = fds.back() >= 0;
+      for(size_t b = 0; b < indexes[i].blocks.size(); b += CHECKPOINT_CHUNK_BLOCKS){
+        chunks.push_back(SegmentChunk{i, b, std::min(b + CHECKPOINT_CHUNK_BLOCKS, indexes[i].blocks.size())});
+      }
+    }
+  }
+
+  if(ok){
+    threads = std::max<size_t>(1, std::min(threads, chunks.size()));
+    std::atomic<size_t> next{0};
+    std::atomic<bool> chunks_ok{true};
+    // 他のthreadが読んでいるかもしれないので、gcは全てのthreadが終わってから走らせる
+    std::vector<GC> gcs(threads);
+    std::vector<CheckpointStats> per_thread(threads);
+    auto worker = [&](size_t t){
+      size_t i;
+      while((i = next++) < chunks.size()){
+        auto &chunk = chunks[i];
+        if(!restore_chunk(tree, fds[chunk.segment], indexes[chunk.segment], chunk, gcs[t], per_thread[t])){
+          chunks_ok = false;
+        }
+      }
+    };
+    std::vector<std::thread> workers{};
+    for(size_t t = 1; t < threads; ++t){
+      workers.emplace_back(worker, t);
+    }
+    worker(0);
+    for(auto &th: workers){
+      th.join();
+    }
+    for(auto &gc: gcs){
+      gc.run();
+    }
+    for(auto &s: per_thread){
+      stats.keys += s.keys;
+      stats.corrupted_blocks += s.corrupted_blocks;
+      stats.skipped_keys += s.skipped_keys;
+    }
+    ok = chunks_ok;
+  }
+
+  for(auto fd: fds){
+    if(fd >= 0){
+      close(fd);
+    }
+  }
+  if(!ok){
+    errno = EIO;
+    return false;
+  }
+  stats.segments += names.size();
+  for(auto &index: indexes){
+    stats.bytes += index.index_offset;
+  }
+  return true;
+}
+
+/**
+ * segmentを先頭からblockごとに読む。footerもindexも読まないので、書いている途中のものも読める。
+ * 手元に置くのは一つのblockのみで、fileの大きさによらない。
+ */
+class SegmentReader{
+public:
+  SegmentReader() = default;
+
+  ~SegmentReader(){
+    if(fd >= 0){
+      close(fd);
+    }
+  }
+
+  SegmentReader(const SegmentReader &) = delete;
+  SegmentReader &operator=(const SegmentReader &) = delete;
+
+  /**
+   * @return 開けなかった時はfalse。errnoに理由が入る
+   */
+  bool open(const std::string &path){
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    return fd >= 0;
+  }
+
+  /**
+   * 次のrecordを読む。crcの合わないblockは飛ばす。
+   * @param[out] key 前のkeyとの差分で更新するので、呼び出し側で書き換えない
+   * @param[out] value
+   * @return 終わりに達した時はfalse
+   */
+  bool next(std::string &key, int32_t &value){
+    while(remaining == 0){
+      if(!loadBlock()){
+        return false;
+      }
+    }
+    uint64_t shared, rest, v;
+    if(!get_varint(p, end, shared) or !get_varint(p, end, rest) or shared > key.size()
+       or rest > static_cast<uint64_t>(end - p) or shared + rest == 0){
+      goto corrupted;
+    }
+    key.resize(shared);
+    key.append(p, rest);
+    p += rest;
+    if(!get_varint(p, end, v)){
+      goto corrupted;
+    }
+    value = unzigzag(v);
+    --remaining;
+    return true;
+corrupted:
+    // crcは合っていたので、書いた側の誤り。残りは読めない
+    remaining = 0;
+    finished = true;
+    return false;
+  }
+
+  /**
+   * 最後のblockの後の印まで読めたか。falseの時は、fileが途中で切れている
+   */
+  [[nodiscard]]
+  bool complete() const{
+    return complete_;
+  }
+
+  [[nodiscard]]
+  size_t corruptedBlocks() const{
+    return corrupted;
+  }
+
+private:
+  bool readExactly(char *data, size_t size){
+    size_t pos = 0;
+    while(pos < size){
+      auto r = read(fd, data + pos, size - pos);
+      if(r < 0 and errno == EINTR){
+        continue;
+      }
+      if(r <= 0){
+        return false;
+      }
+      pos += r;
+    }
+    return true;
+  }
+
+  bool loadBlock(){
+    if(finished){
+      return false;
+    }
+    char header[CHECKPOINT_BLOCK_HEADER];
+    uint32_t body_len, crc;
+    uint64_t count;
+    if(!readExactly(header, sizeof(uint32_t))){
+      goto done;
+    }
+    std::memcpy(&body_len, header, sizeof(body_len));
+    if(body_len == 0){
+      complete_ = true;
+      goto done;
+    }
+    if(body_len > CHECKPOINT_MAX_BLOCK or !readExactly(header + sizeof(uint32_t), sizeof(uint32_t))){
+      // 長さが壊れていると、次のblockの位置も分からない
+      goto done;
+    }
+    std::memcpy(&crc, header + sizeof(uint32_t), sizeof(crc));
+    block.resize(body_len);
+    if(!readExactly(&block[0], body_len)){
+      goto done;
+    }
+    p = block.data();
+    end = p + block.size();
+    if(crc32c(block.data(), block.size()) != crc or !get_varint(p, end, count)){
+      ++corrupted;
+      remaining = 0;
+      return true;
+    }
+    remaining = count;
+    return true;
+done:
+    finished = true;
+    return false;
+  }
+
+  int fd = -1;
+  std::string block{};
+  const char *p = nullptr;
+  const char *end = nullptr;
+  uint64_t remaining = 0;
+  size_t corrupted = 0;
+  bool finished = false;
+  bool complete_ = false;
+};
+
+/**
+ * segmentをSegmentReaderで先頭から順に読み、treeにputする。
+ * fileを全て読み込まずに、一つのblockずつ流して入れる。
+ * @param[out] stats
+ * @return 開けなかった時と、fileが途中で切れていた時はfalse。それまでに読んだkeyはtreeに残る
+ */
+[[maybe_unused]]
+static bool bulk_load(Masstree &tree, const std::string &path, GC &gc, CheckpointStats &stats){
+  SegmentReader reader{};
+  if(!reader.open(path)){
+    return false;
+  }
+  std::string key{};
+  int32_t value;
+  while(reader.next(key, value)){
+    auto k = key_from_bytes(key.data(), key.size());
+    tree.put(k, new Value(value), gc);
+    ++stats.keys;
+  }
+  stats.corrupted_blocks += reader.corruptedBlocks();
+  ++stats.segments;
+  return reader.complete();
+}
+
+}
+
+#endif //MASSTREE_CHECKPOINT_H
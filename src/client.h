@@ -0,0 +1,292 @@
+#ifndef MASSTREE_CLIENT_H
+#define MASSTREE_CLIENT_H
+
+#include "protocol.h"
+#include <cassert>
+#include <cerrno>
+#include <deque>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace masstree{
+
+/**
+ * masstree_serverへの一つの接続。一つのthreadからのみ使う。
+ *
+ * sendGetなどはrequestを手元のbufferに積むだけで、flushでまとめて送る。
+ * responseはreceiveでrequestと同じ順に受け取る。
+ * これにより、responseを待たずに複数のrequestを送れる(pipelining)。
+ * get/put/remove/scanは、一つ送って一つ受け取るだけの簡単な版。
+ */
+class Client{
+public:
+  Client() = default;
+
+  ~Client(){
+    disconnect();
+  }
+
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+
+  Client(Client &&other) noexcept
+  : fd(std::exchange(other.fd, -1))
+  , out(std::move(other.out))
+  , in(std::move(other.in))
+  , in_pos(other.in_pos)
+  , ops(std::move(other.ops))
+  {}
+
+  /**
+   * @return 失敗した時はfalse。errnoに理由が入る
+   */
+  bool connectUnix(const std::string &path){
+    disconnect();
+    sockaddr_un addr{};
+    if(path.size() >= sizeof(addr.sun_path)){
+      errno = ENAMETOOLONG;
+      return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    return fd >= 0 and connectTo(reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  }
+
+  /**
+   * @param host IPv4のアドレス
+   */
+  bool connectTcp(const std::string &host, uint16_t port){
+    disconnect();
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1){
+      errno = EINVAL;
+      return false;
+    }
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0 or !connectTo(reinterpret_cast<sockaddr *>(&addr), sizeof(addr))){
+      return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+  }
+
+  void disconnect(){
+    if(fd >= 0){
+      close(fd);
+      fd = -1;
+    }
+    out.clear();
+    in.clear();
+    in_pos = 0;
+    ops.clear();
+  }
+
+  [[nodiscard]]
+  bool connected() const{
+    return fd >= 0;
+  }
+
+  void sendGet(const std::string &key){
+    send(protocol::Request{protocol::Op::Get, key});
+  }
+
+  void sendPut(const std::string &key, int32_t value){
+    send(protocol::Request{protocol::Op::Put, key, value});
+  }
+
+  void sendRemove(const std::string &key){
+    send(protocol::Request{protocol::Op::Remove, key});
+  }
+
+  /**
+   * @param from 空の時は先頭から
+   */
+  void sendScan(const std::string &from, uint32_t limit){
+    send(protocol::Request{protocol::Op::Scan, from, 0, limit});
+  }
+
+  void send(const protocol::Request &req){
+    protocol::encode_request(req, out);
+    ops.push_back(req.op);
+  }
+
+  /**
+   * 積んだrequestを全て送る。
+   * serverはresponseを書き切れない間は読まないので、送りながら届いたresponseも読んでおく。
+   * @return 接続が切れていた時はfalse
+   */
+  bool flush(){
+    size_t pos = 0;
+    while(pos < out.size()){
+      pollfd p{fd, POLLOUT | POLLIN, 0};
+      if(poll(&p, 1, -1) < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        disconnect();
+        return false;
+      }
+      if(p.revents & POLLIN and !fill()){
+        return false;
+      }
+      if(p.revents & (POLLOUT | POLLERR | POLLHUP)){
+        auto r = ::send(fd, out.data() + pos, out.size() - pos, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(r < 0){
+          if(errno == EINTR or errno == EAGAIN or errno == EWOULDBLOCK){
+            continue;
+          }
+          disconnect();
+          return false;
+        }
+        pos += r;
+      }
+    }
+    out.clear();
+    return true;
+  }
+
+  /**
+   * responseをまだ受け取っていないrequestの数
+   */
+  [[nodiscard]]
+  size_t inflight() const{
+    return ops.size();
+  }
+
+  /**
+   * 一番古いrequestのresponseを、届くまで待って受け取る。
+   * @param[out] resp
+   * @return 接続が切れたか、responseが壊れていた時はfalse
+   */
+  bool receive(protocol::Response &resp){
+    assert(!ops.empty());
+    while(true){
+      size_t consumed = 0;
+      auto result = protocol::decode_response(ops.front(), in.data() + in_pos, in.size() - in_pos, resp, consumed);
+      if(result == protocol::DecodeResult::Done){
+        in_pos += consumed;
+        ops.pop_front();
+        return true;
+      }
+      if(result == protocol::DecodeResult::Malformed){
+        disconnect();
+        return false;
+      }
+      if(!fill()){
+        return false;
+      }
+    }
+  }
+
+  /**
+   * @return keyが無い時と、接続が切れた時はnullopt
+   */
+  std::optional<int32_t> get(const std::string &key){
+    sendGet(key);
+    return valueOf(call());
+  }
+
+  bool put(const std::string &key, int32_t value){
+    sendPut(key, value);
+    auto resp = call();
+    return resp and resp->status == protocol::Status::Ok;
+  }
+
+  /**
+   * @return 削除したvalue。keyが無い時と、接続が切れた時はnullopt
+   */
+  std::optional<int32_t> remove(const std::string &key){
+    sendRemove(key);
+    return valueOf(call());
+  }
+
+  /**
+   * from以上のkeyを、小さい順に最大limit個返す。
+   */
+  std::vector<std::pair<std::string, int32_t>> scan(const std::string &from, uint32_t limit){
+    sendScan(from, limit);
+    auto resp = call();
+    if(!resp){
+      return {};
+    }
+    return std::move(resp->entries);
+  }
+
+private:
+  static constexpr size_t READ_SIZE = 64 * 1024;
+
+  bool connectTo(const sockaddr *addr, socklen_t len){
+    if(::connect(fd, addr, len) != 0){
+      auto saved = errno;
+      disconnect();
+      errno = saved;
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * socketから読めるだけinに読む。読めるものが無い時は、届くまで待つ。
+   * @return 接続が切れた時はfalse
+   */
+  bool fill(){
+    in.erase(0, in_pos);
+    in_pos = 0;
+    auto old = in.size();
+    in.resize(old + READ_SIZE);
+    auto r = read(fd, &in[old], READ_SIZE);
+    in.resize(old + std::max<ssize_t>(r, 0));
+    if(r == 0 or (r < 0 and errno != EINTR)){
+      disconnect();
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * 積んだrequestを送り、最後のresponseを受け取る。
+   */
+  std::optional<protocol::Response> call(){
+    protocol::Response resp{};
+    if(!flush()){
+      return std::nullopt;
+    }
+    while(!ops.empty()){
+      if(!receive(resp)){
+        return std::nullopt;
+      }
+    }
+    return resp;
+  }
+
+  static std::optional<int32_t> valueOf(const std::optional<protocol::Response> &resp){
+    if(!resp or resp->status != protocol::Status::Ok){
+      return std::nullopt;
+    }
+    return resp->value;
+  }
+
+  int fd = -1;
+  std::string out{};
+  std::string in{};
+  size_t in_pos = 0;
+  // 送ったrequestのop。responseを読むのに使う
+  std::deque<protocol::Op> ops{};
+};
+
+}
+
+#endif //MASSTREE_CLIENT_H
@@ -0,0 +1,143 @@
+#ifndef MASSTREE_COMBINING_H
+#define MASSTREE_COMBINING_H
+
+#include "tree.h"
+#include <array>
+#include <atomic>
+#include <xmmintrin.h>
+
+namespace masstree{
+
+/**
+ * putのflat combiningに使う、treeごとの公開slotの表。
+ *
+ * putが入れるべきBorderNodeがlockされていたら、lockを待つ代わりに自分のslotに
+ * (BorderNode, key, value)を公開して待つ。lockを持っているputは、unlockする前に
+ * 同じBorderNodeへの公開されたputをまとめて行う(combine_pending)。
+ * 一度のlockで入るので、versionのv_insertも一度だけ進む。
+ *
+ * 入れられなかったもの(splitやLayerの作成が必要なもの)は断られ、公開した側が普通にputする。
+ * lockが外れても誰にも取られていなければ、公開を取り下げて普通にputする。
+ */
+class PutCombiner{
+public:
+  static constexpr size_t SLOTS = 64;
+
+  enum State : uint8_t{
+    Free,
+    // 持ち主がfieldを書いている
+    Filling,
+    Pending,
+    // combinerが処理している
+    Taken,
+    Applied,
+    Rejected
+  };
+
+  struct alignas(64) Slot{
+    std::atomic<uint8_t> state{Free};
+    // combinerはstateを取る前にも読むので、atomicにする
+    std::atomic<BorderNode *> node{nullptr};
+    // 公開した時のnodeのv_split。変わっていたらkeyはnodeに入るとは限らない
+    uint16_t v_split = 0;
+    // cursorはnodeのLayerの深さ
+    Key *key = nullptr;
+    Value *value = nullptr;
+  };
+
+  /**
+   * keyの入るBorderNodeがlockされていれば、公開してcombinerに入れてもらう。
+   * put_withがfindBorderで見つけたBorderNodeで呼ぶので、もう一度降りる事はない。
+   * @param n keyの入るBorderNode
+   * @param v findBorderでnを読んだversion
+   * @param key cursorはnのLayerの深さ。呼んだ後も変わらない
+   * @return 入れてもらえたか。falseの時は何もしていないので、そのままnをlockしてputする
+   */
+  bool tryPublish(BorderNode *n, Version v, Key &key, Value *value){
+    if(v.deleted or !v.locked){
+      return false;
+    }
+    auto &slot = slots[slotIndex()];
+    uint8_t expected = Free;
+    if(!slot.state.compare_exchange_strong(expected, Filling)){
+      // 他のthreadと同じslotになった
+      return false;
+    }
+    slot.node.store(n, std::memory_order_relaxed);
+    slot.v_split = v.v_split;
+    slot.key = &key;
+    slot.value = value;
+    pending.fetch_add(1);
+    slot.state.store(Pending, std::memory_order_release);
+
+    uint8_t s;
+    for(;;){
+      s = slot.state.load(std::memory_order_acquire);
+      if(s == Applied or s == Rejected){
+        break;
+      }
+      if(s == Pending and !n->loadVersion().locked){
+        // lockを持っていたputは、公開する前にunlockした
+        expected = Pending;
+        if(slot.state.compare_exchange_strong(expected, Free)){
+          s = Rejected;
+          break;
+        }
+      }
+      _mm_pause();
+    }
+    pending.fetch_sub(1);
+    slot.state.store(Free, std::memory_order_release);
+    return s == Applied;
+  }
+
+  /**
+   * nへの公開されたputを一つずつ取り出してf(slot)に渡す。
+   * fはStateをApplied, Rejectedのどちらかで返す。nのlockを持った状態で呼ぶ。
+   */
+  template<typename F>
+  void forEachPending(BorderNode *n, F &&f){
+    if(pending.load(std::memory_order_acquire) == 0){
+      return;
+    }
+    for(auto &slot: slots){
+      if(slot.state.load(std::memory_order_acquire) != Pending
+        or slot.node.load(std::memory_order_relaxed) != n){
+        continue;
+      }
+      uint8_t expected = Pending;
+      if(!slot.state.compare_exchange_strong(expected, Taken)){
+        continue;
+      }
+      if(slot.node.load(std::memory_order_relaxed) != n){
+        // 読んだ後に取り下げられ、別のnodeへのputが公開されていた
+        slot.state.store(Pending, std::memory_order_release);
+        continue;
+      }
+      slot.state.store(f(slot), std::memory_order_release);
+    }
+  }
+
+  /**
+   * Pendingか処理中のslotの数
+   */
+  [[nodiscard]]
+  size_t pendingCount() const{
+    return pending.load(std::memory_order_acquire);
+  }
+
+private:
+  static size_t slotIndex(){
+    static std::atomic<size_t> next_index{0};
+    thread_local size_t index = next_index.fetch_add(1) % SLOTS;
+    return index;
+  }
+
+  std::array<Slot, SLOTS> slots{};
+  // Pendingか処理中のslotの数。0の時はslotを見ない
+  std::atomic<size_t> pending{0};
+};
+
+}
+
+#endif //MASSTREE_COMBINING_H
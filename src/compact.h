@@ -0,0 +1,247 @@
+#ifndef MASSTREE_COMPACT_H
+#define MASSTREE_COMPACT_H
+
+#include "tree.h"
+#include "gc.h"
+#include <vector>
+
+namespace masstree{
+
+/**
+ * 一回のcompactionで行った処理の数。
+ */
+struct CompactResult{
+  // removeされたslotを解放したBorderNodeの数
+  size_t purged_nodes = 0;
+  // 解放したslotの数
+  size_t purged_slots = 0;
+  // 左のBorderNodeに併合して消したBorderNodeの数
+  size_t merged_nodes = 0;
+};
+
+/**
+ * 二つのBorderNodeの合計のkeyの数がこれ以下であれば、一つにまとめる。
+ * 満杯にしてしまうと次のinsertですぐにsplitするので、余裕を残しておく。
+ */
+static constexpr size_t COMPACT_MERGE_MAX_KEYS = (Node::ORDER - 1) * 3 / 4;
+
+/**
+ * removeされたslotに残っているValueとBigSuffixをGCに渡し、slotを空(key_len = 0)にする。
+ * 前提: nはlockされている。
+ * slotの中身が変わるので、insertingを立ててreaderにやり直させる。
+ * @return 解放したslotの数
+ */
+static size_t purge_removed_slots(BorderNode *n, GC &gc){
+  assert(n->isLocked());
+  size_t purged = 0;
+  for(size_t i = 0; i < Node::ORDER - 1; ++i){
+    if(!n->isKeyRemoved(i)){
+      continue;
+    }
+    if(purged == 0){
+      n->setInserting(true);
+    }
+    auto suffix = n->getKeySuffixes().get(i);
+    if(suffix != nullptr){
+      gc.add(suffix);
+      n->getKeySuffixes().set(i, nullptr);
+    }
+    auto value = n->getLV(i).value;
+    if(value != nullptr){
+      gc.add(value);
+    }
+    n->setLV(i, LinkOrValue{});
+    n->setKeyLen(i, 0);
+    ++purged;
+  }
+  return purged;
+}
+
+/**
+ * rを左隣のlに併合し、rを木から外す。
+ * lとrは同じparentを持ち、そのparentに他にもchildが残る場合のみ行う。
+ * そうでなければrootの付け替えが必要となるので、何もしない。
+ *
+ * lock順はr -> l -> parentとし、connectPrevAndNext(n -> prev)やsplit(child -> parent)と揃える。
+ * 1. lを、lの生きているkeyとrのkeyで詰め直す(inserting)
+ * 2. parentからrを外す。rの範囲はlが引き継ぐ(inserting)
+ * 3. rをdeletedにする。rを読んでいたreaderとwriterはrootからやり直し、lに辿り着く
+ * 4. prevとnextを繋ぎ直し、rをGCに渡す
+ * @return 併合したか
+ */
+static bool merge_into_prev(BorderNode *l, BorderNode *r, GC &gc){
+  r->lock();
+  if(r->getDeleted() or r->getIsRoot() or r->getPrev() != l){
+    r->unlock();
+    return false;
+  }
+  l->lock();
+  auto lp = l->getPermutation();
+  auto rp = r->getPermutation();
+  if(l->getDeleted() or l->getNext() != r
+    or lp.getNumKeys() + rp.getNumKeys() > COMPACT_MERGE_MAX_KEYS){
+    l->unlock();
+    r->unlock();
+    return false;
+  }
+  auto p = r->lockedParent();
+  assert(p != nullptr);
+  auto r_index = p->findChildIndex(r);
+  if(l->getParent() != p or r_index == 0 or p->getChild(r_index - 1) != l
+    or p->getNumKeys() < 2){
+    p->unlock();
+    l->unlock();
+    r->unlock();
+    return false;
+  }
+
+  // 1. lを詰め直す
+  l->setInserting(true);
+  uint8_t temp_key_len[Node::ORDER - 1] = {};
+  uint64_t temp_key_slice[Node::ORDER - 1] = {};
+  LinkOrValue temp_lv[Node::ORDER - 1] = {};
+  BigSuffix* temp_suffix[Node::ORDER - 1] = {};
+  size_t count = 0;
+  for(auto pair: {std::make_pair(l, lp), std::make_pair(r, rp)}){
+    auto n = pair.first; auto per = pair.second;
+    for(size_t i = 0; i < per.getNumKeys(); ++i){
+      auto index_ts = per(i);
+      temp_key_len[count] = n->getKeyLen(index_ts);
+      temp_key_slice[count] = n->getKeySlice(index_ts);
+      temp_lv[count] = n->getLV(index_ts);
+      temp_suffix[count] = n->getKeySuffixes().get(index_ts);
+      ++count;
+    }
+  }
+  assert(count == 0 or std::is_sorted(temp_key_slice, temp_key_slice + count));
+  for(size_t i = 0; i < Node::ORDER - 1; ++i){
+    // 詰め直すと参照されなくなる、removeされたslotの中身
+    if(l->isKeyRemoved(i)){
+      auto suffix = l->getKeySuffixes().get(i);
+      if(suffix != nullptr) gc.add(suffix);
+      auto value = l->getLV(i).value;
+      if(value != nullptr) gc.add(value);
+    }
+  }
+  for(size_t i = 0; i < Node::ORDER - 1; ++i){
+    l->setKeyLen(i, temp_key_len[i]);
+    l->setKeySlice(i, temp_key_slice[i]);
+    l->setLV(i, temp_lv[i]);
+    l->getKeySuffixes().set(i, temp_suffix[i]);
+    if(i < count and temp_key_len[i] == BorderNode::key_len_layer){
+      temp_lv[i].next_layer->setUpperLayer(l);
+    }
+  }
+  l->setPermutation(Permutation::fromSorted(count));
+
+  // 2. parentからrを外す。r_index >= 1なので、rの範囲は左のlに含まれるようになる
+  p->setInserting(true);
+  for(size_t i = r_index - 1; i + 1 < p->getNumKeys(); ++i){
+    p->setKeySlice(i, p->getKeySlice(i + 1));
+  }
+  for(size_t i = r_index; i < p->getNumKeys(); ++i){
+    p->setChild(i, p->getChild(i + 1));
+  }
+  p->setKeySlice(p->getNumKeys() - 1, 0);
+  p->setChild(p->getNumKeys(), nullptr);
+  p->decNumKeys();
+
+  // 3. rをdeletedにしてから、lに移したslotの参照を外す。
+  // rのremoveされたslotの中身は、rと一緒にGCで解放される。
+  r->setInserting(true);
+  r->setDeleted(true);
+  for(size_t i = 0; i < rp.getNumKeys(); ++i){
+    auto index_ts = rp(i);
+    r->setKeyLen(index_ts, 0);
+    r->setLV(index_ts, LinkOrValue{});
+    r->getKeySuffixes().set(index_ts, nullptr);
+  }
+
+  // 4. prevとnextを繋ぎ直す
+  auto next = r->getNext();
+  l->setNext(next);
+  if(next != nullptr){
+    next->setPrev(l);
+  }
+
+  p->unlock();
+  l->unlock();
+  gc.add(r);
+  r->unlock();
+  return true;
+}
+
+/**
+ * layer_rootから始まるLayerのBorderNodeを左から順に見ていき、
+ * removeされたslotを解放し、疎な隣り合うBorderNodeを併合する。
+ * 下のLayerがあれば、そこでも同じ事を行う。
+ *
+ * 他のthreadのget/put/removeと並行して呼んでよい。
+ * 外したNodeとValueはgcに渡されるので、gc.run()は他のthreadがそれらを
+ * 参照していない事が保証できる時点で呼ぶ。
+ * @param layer_root
+ * @param gc
+ * @param[out] result
+ */
+static void compact_layer(Node *layer_root, GC &gc, CompactResult &result){
+  if(layer_root->getDeleted()){
+    return;
+  }
+  // 一番左のBorderNodeまで、findBorderと同じくversionを検証しながら降りる
+  Node *n = layer_root;
+  while(!n->getIsBorder()){
+    auto v = n->stableVersion();
+    if(v.deleted){
+      // 並行するremoveで形が変わった。次の機会に回す。
+      return;
+    }
+    auto child = reinterpret_cast<InteriorNode *>(n)->getChild(0);
+    if((n->loadVersion() ^ v) > Version::has_locked){
+      continue;
+    }
+    assert(child != nullptr);
+    n = child;
+  }
+
+  std::vector<Node *> next_layers{};
+  auto border = reinterpret_cast<BorderNode *>(n);
+  while(border != nullptr){
+    border->lock();
+    if(border->getDeleted()){
+      // 並行するremoveに消された。次の機会に回す。
+      border->unlock();
+      break;
+    }
+    auto purged = purge_removed_slots(border, gc);
+    if(purged != 0){
+      ++result.purged_nodes;
+      result.purged_slots += purged;
+    }
+    border->unlock();
+
+    auto next = border->getNext();
+    if(next != nullptr and merge_into_prev(border, next, gc)){
+      ++result.merged_nodes;
+      // 併合後のborderは、さらに次と併合できるかもしれない
+      continue;
+    }
+
+    border->lock();
+    auto p = border->getPermutation();
+    for(size_t i = 0; i < p.getNumKeys(); ++i){
+      if(border->getKeyLen(p(i)) == BorderNode::key_len_layer){
+        next_layers.push_back(border->getLV(p(i)).next_layer);
+      }
+    }
+    border->unlock();
+    border = next;
+  }
+
+  for(auto next_layer: next_layers){
+    compact_layer(next_layer, gc, result);
+  }
+}
+
+}
+
+#endif //MASSTREE_COMPACT_H
@@ -0,0 +1,119 @@
+#ifndef MASSTREE_COMPACTOR_H
+#define MASSTREE_COMPACTOR_H
+
+#include "masstree.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace masstree{
+
+/**
+ * 一定時間ごとにMasstree::compactを呼ぶbackground thread。
+ * 外されたNodeはこのクラスの持つGCに溜まっていく。
+ * safe_pointを渡した場合は、各passの後にそれを呼び、trueならGCを走らせる。
+ * safe_pointは、直前のpassが終わってから全てのthreadが一度はMasstreeの操作の外に出た事
+ * (例えばepochが進んだ事)が確かめられた時にのみtrueを返す。
+ * 渡さない場合は、stop()の後、他のthreadが古いNodeを参照していない事が
+ * 保証できる時点で、getGC().run()を呼ぶことで解放する。
+ */
+class BackgroundCompactor{
+public:
+  using SafePoint = std::function<bool()>;
+
+  explicit BackgroundCompactor(Masstree &tree_, std::chrono::milliseconds interval_ = std::chrono::milliseconds(100),
+                               SafePoint safe_point_ = nullptr)
+    : tree(tree_)
+    , interval(interval_)
+    , safe_point(std::move(safe_point_))
+  {}
+
+  BackgroundCompactor(const BackgroundCompactor &other) = delete;
+  BackgroundCompactor &operator=(const BackgroundCompactor &other) = delete;
+
+  ~BackgroundCompactor(){
+    stop();
+  }
+
+  void start(){
+    assert(!worker.joinable());
+    running = true;
+    worker = std::thread([this](){
+      std::unique_lock<std::mutex> lock(mutex);
+      while(running){
+        lock.unlock();
+        auto r = tree.compact(gc);
+        auto reclaimed = false;
+        if(safe_point and !gc.empty() and safe_point()){
+          gc.run();
+          reclaimed = true;
+        }
+        lock.lock();
+        result.purged_nodes += r.purged_nodes;
+        result.purged_slots += r.purged_slots;
+        result.merged_nodes += r.merged_nodes;
+        ++passes;
+        if(reclaimed){
+          ++reclaims;
+        }
+        cv.wait_for(lock, interval, [this](){ return !running; });
+      }
+    });
+  }
+
+  void stop(){
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+    cv.notify_all();
+    if(worker.joinable()){
+      worker.join();
+    }
+  }
+
+  /**
+   * stop()の後にのみ呼ぶ
+   */
+  GC &getGC(){
+    assert(!worker.joinable());
+    return gc;
+  }
+
+  CompactResult getResult(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return result;
+  }
+
+  size_t getPasses(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return passes;
+  }
+
+  /**
+   * safe_pointでGCを走らせた回数
+   */
+  size_t getReclaims(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return reclaims;
+  }
+
+private:
+  Masstree &tree;
+  const std::chrono::milliseconds interval;
+  const SafePoint safe_point;
+  GC gc{};
+  std::thread worker{};
+  std::mutex mutex{};
+  std::condition_variable cv{};
+  bool running = false;
+  CompactResult result{};
+  size_t passes = 0;
+  size_t reclaims = 0;
+};
+
+}
+
+#endif //MASSTREE_COMPACTOR_H
@@ -0,0 +1,59 @@
+#ifndef MASSTREE_CRC32C_H
+#define MASSTREE_CRC32C_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+namespace masstree{
+
+/**
+ * CRC32C(Castagnoli)の、1byteずつ引く表
+ */
+static std::array<uint32_t, 256> make_crc32c_table(){
+  std::array<uint32_t, 256> table{};
+  for(uint32_t i = 0; i < 256; ++i){
+    auto c = i;
+    for(int j = 0; j < 8; ++j){
+      c = (c & 1) ? (c >> 1) ^ 0x82f63b78u : c >> 1;
+    }
+    table[i] = c;
+  }
+  return table;
+}
+
+/**
+ * data[0, size)のCRC32C。crcに前の部分の値を渡すと続けて計算する。
+ * SSE4.2が有効な時はcrc32命令を使う。
+ */
+[[maybe_unused]]
+static uint32_t crc32c(const char *data, size_t size, uint32_t crc = 0){
+  crc = ~crc;
+  size_t i = 0;
+#ifdef __SSE4_2__
+  uint64_t c = crc;
+  for(; i + 8 <= size; i += 8){
+    uint64_t x;
+    std::memcpy(&x, data + i, sizeof(x));
+    c = _mm_crc32_u64(c, x);
+  }
+  crc = static_cast<uint32_t>(c);
+  for(; i < size; ++i){
+    crc = _mm_crc32_u8(crc, static_cast<uint8_t>(data[i]));
+  }
+#else
+  static const auto table = make_crc32c_table();
+  for(; i < size; ++i){
+    crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+  }
+#endif
+  return ~crc;
+}
+
+}
+
+#endif //MASSTREE_CRC32C_H
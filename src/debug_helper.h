@@ -19,9 +19,11 @@ class SequentialHandler{
 public:
   SequentialHandler() = default;
 
+  /**
+   * 最初に来たthreadだけが止まる。giveした後に来たthreadは、そのまま通り過ぎる。
+   */
   inline void giveAndWaitBackIfUsed() noexcept{
-    if(isUsed()){
-      give_flag = true;
+    if(isUsed() and !give_flag.exchange(true)){
       while (!back_flag){
         _mm_pause();
       }
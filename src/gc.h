@@ -38,6 +38,11 @@ public:
     suffixes.push_back(suffix);
   }
 
+  [[nodiscard]]
+  bool empty() const{
+    return borders.empty() and interiors.empty() and values.empty() and suffixes.empty();
+  }
+
   bool contain(BorderNode const *n) const{
     return std::find(borders.begin(), borders.end(), n) != borders.end();
   }
@@ -75,7 +80,7 @@ public:
     interiors.clear();
 
     for(auto &v: values){
-      delete v;
+      Value::destroy(v);
 #ifndef NDEBUG
       Alloc::decValue();
 #endif
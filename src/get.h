@@ -2,6 +2,7 @@
 #define MASSTREE_GET_H
 
 #include "tree.h"
+#include "hint.h"
 #include "debug_helper.h"
 #include <algorithm>
 #include <xmmintrin.h>
@@ -17,15 +18,34 @@ extern Marker has_locked_marker;
 extern Marker was_unstable_marker;
 #endif
 
+/**
+ * getが最後に読んだBorderNodeと、その読み取りを検証したversion。
+ * keyが無かった時は、keyが入るべきBorderNodeとなる。
+ */
+struct BorderObservation{
+  BorderNode *node = nullptr;
+  Version version{};
+};
+
+/**
+ * @param[out] observed nullptrでなければ、最後に読んだBorderNodeを返す。
+ * その時のkのcursorは、そのBorderNodeのLayerの深さとなる。rootがnullptrの時はnodeもnullptr
+ */
 [[maybe_unused]]
-static Value *get(Node *root, Key &k){
+static Value *get(Node *root, Key &k, LeafHint *hint = nullptr, BorderObservation *observed = nullptr){
   if(root == nullptr){
     // Layer0が空の時にのみ、ここにくる
     assert(k.cursor == 0);
+    if(observed != nullptr){
+      *observed = BorderObservation{};
+    }
     return nullptr;
   }
 retry:
-  auto n_v = findBorder(root, k); auto n = n_v.first; auto v = n_v.second;
+  // やり直した時に、捨てた分の時間を数えるため
+  auto attempt = Profiler::now();
+  auto n_v = findBorder(root, k, hint); auto n = n_v.first; auto v = n_v.second;
+  Hotspot::sampleNode(n);
   /**
    * getではlockを取れない。
    * findBorderやextractLinkOrValueの後にnがsplitされる可能性や、探しているkeyが
@@ -33,6 +53,9 @@ retry:
    * has_lockedやUNSTABLEによるチェックで必要な高さからやり直しを行う。
    */
 forward:
+  if(observed != nullptr){
+    *observed = BorderObservation{n, v};
+  }
   if(v.deleted){
     if(v.is_root){
       // 探していたKeyが上のLayerに行ってしまった時、あるいはLayer0が消えた時
@@ -40,6 +63,7 @@ forward:
       // ここではnullptrを返す。
       return nullptr;
     }else{
+      Profiler::record(Phase::Retry, attempt);
       goto retry;
     }
   }
@@ -47,11 +71,15 @@ forward:
 #ifndef NDEBUG
   get_handler1.giveAndWaitBackIfUsed();
 #endif
-  if((n->getVersion() ^ v) > Version::has_locked){
+  auto now = n->loadVersion();
+  if((now ^ v) > Version::has_locked){
 #ifndef NDEBUG
     has_locked_marker.markIfUsed();
 #endif
-    v = n->stableVersion(); auto next = n->getNext();
+    Stats::inc(Stat::HasLockedRetry);
+    Profiler::record(Phase::Retry, attempt);
+    attempt = Profiler::now();
+    v = n->stableVersion(now); auto next = n->getNext();
     while(!v.deleted and next != nullptr and k.getCurrentSlice().slice >= next->lowestKey()){
       n = next; v = n->stableVersion(); next = n->getNext();
     }
@@ -70,7 +98,54 @@ forward:
 #ifndef NDEBUG
     was_unstable_marker.markIfUsed();
 #endif
+    Stats::inc(Stat::UnstableHit);
+    Profiler::record(Phase::Retry, attempt);
+    attempt = Profiler::now();
+    goto forward;
+  }
+}
+
+/**
+ * kの先頭depth個のsliceを辿り、その下のLayerのrootを返す。
+ * kはdepth個より多くのsliceを持つ必要がある。
+ * @return Layerが無い時(keyがsuffixとして入っている時も含む)はnullptr
+ */
+[[maybe_unused]]
+static Node *find_layer(Node *root, Key &k, size_t depth){
+  assert(k.slices.size() > depth);
+  if(root == nullptr or depth == 0){
+    return root;
+  }
+retry:
+  auto n_v = findBorder(root, k); auto n = n_v.first; auto v = n_v.second;
+forward:
+  if(v.deleted){
+    if(v.is_root){
+      // 辿っているLayerが消えた
+      return nullptr;
+    }else{
+      goto retry;
+    }
+  }
+  auto t_lv = n->extractLinkOrValueFor(k); auto t = t_lv.first; auto lv = t_lv.second;
+  auto now = n->loadVersion();
+  if((now ^ v) > Version::has_locked){
+    v = n->stableVersion(now); auto next = n->getNext();
+    while(!v.deleted and next != nullptr and k.getCurrentSlice().slice >= next->lowestKey()){
+      n = next; v = n->stableVersion(); next = n->getNext();
+    }
     goto forward;
+  }else if(t == LAYER){
+    if(k.cursor + 1 == depth){
+      return lv.next_layer;
+    }
+    root = lv.next_layer;
+    k.next();
+    goto retry;
+  }else if(t == UNSTABLE){
+    goto forward;
+  }else{
+    return nullptr;
   }
 }
 
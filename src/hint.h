@@ -0,0 +1,77 @@
+#ifndef MASSTREE_HINT_H
+#define MASSTREE_HINT_H
+
+#include "tree.h"
+#include <vector>
+
+namespace masstree{
+
+/**
+ * 直前の操作で辿り着いたBorderNodeを覚えておき、次の操作で使うためのもの(finger)。
+ * 次のkeyがそのBorderNodeの範囲に入っていて、その後splitもdeleteもされていなければ、
+ * Layerのrootから降りずにそのBorderNodeから始める。
+ * keyが小さい順や近い順に来る時に、InteriorNodeを読む回数が減る。
+ *
+ * 範囲にはlowestKey()ではなく、降りる時に親から読んだ境界を使う。
+ * nextのlowestKey()より小さくても、removeによってnextの範囲に入っているkeyがあるため。
+ *
+ * Layerの深さごとに一つずつ覚え、Layerはrootのポインタで見分ける。
+ * BorderNodeを指したままにするので、どのthreadのGCであっても、
+ * gc.run()でNodeを解放する前にreset()しなければならない。
+ * 一つのthreadからのみ使う。
+ */
+class LeafHint{
+public:
+  void reset(){
+    entries.clear();
+  }
+
+  /**
+   * findBorderの代わりに使う。返すものはfindBorderと同じ。
+   * @param layer_root keyの今のsliceのLayerのroot
+   */
+  std::pair<BorderNode *, Version> findBorder(Node *layer_root, const Key &key){
+    auto depth = key.cursor;
+    if(depth < entries.size()){
+      auto &e = entries[depth];
+      if(e.layer_root == layer_root and e.bounds.contains(key.getCurrentSlice().slice)){
+        auto v = e.border->stableVersion();
+        if(!v.deleted and v.v_split == e.version.v_split){
+          Stats::inc(Stat::HintHit);
+          return std::pair(e.border, v);
+        }
+      }
+    }
+    Stats::inc(Stat::HintMiss);
+    SliceBounds bounds{};
+    auto n_v = ::masstree::findBorder(layer_root, key, bounds);
+    if(entries.size() <= depth){
+      entries.resize(depth + 1);
+    }
+    entries[depth] = Entry{layer_root, n_v.first, n_v.second, bounds};
+    return n_v;
+  }
+
+private:
+  struct Entry{
+    Node *layer_root = nullptr;
+    BorderNode *border = nullptr;
+    // 範囲を読んだ時のversion
+    Version version{};
+    SliceBounds bounds{};
+  };
+
+  std::vector<Entry> entries{};
+};
+
+/**
+ * hintがあればそれを使い、無ければrootから降りる。
+ */
+[[maybe_unused]]
+static std::pair<BorderNode *, Version> findBorder(Node *root, const Key &key, LeafHint *hint){
+  return hint != nullptr ? hint->findBorder(root, key) : findBorder(root, key);
+}
+
+}
+
+#endif //MASSTREE_HINT_H
@@ -0,0 +1,168 @@
+#include "hotspot.h"
+#include <atomic>
+#include <memory>
+
+namespace masstree{
+
+namespace {
+
+std::atomic<uint64_t> sample_period{128};
+
+}
+
+void Hotspot::setSamplePeriod(uint64_t period){
+  assert(period >= 1);
+  sample_period.store(period, std::memory_order_relaxed);
+#ifdef MASSTREE_HOTSPOT
+  // 呼んだthreadでは、次の操作からsampleし直す
+  auto &h = localThreadHotspot();
+  h.key_countdown = 0;
+  h.node_countdown = 0;
+  h.lock_countdown = 0;
+#endif
+}
+
+uint64_t Hotspot::samplePeriod(){
+  return sample_period.load(std::memory_order_relaxed);
+}
+
+#ifdef MASSTREE_HOTSPOT
+
+void ThreadHotspot::addTo(ThreadHotspot &other){
+  other.keys.addAll(keys);
+  other.nodes.addAll(nodes);
+  other.spins.addAll(spins);
+  // 候補は足し合わせた後の推定値で並べ直す
+  for(auto &e: top_keys.getEntries()){
+    other.top_keys.offer(e.first, other.keys.estimate(hash_key(e.first)));
+  }
+  for(auto &e: top_nodes.getEntries()){
+    other.top_nodes.offer(e.first, other.nodes.estimate(Hotspot::hashNode(e.first)));
+  }
+  for(auto &e: top_contended.getEntries()){
+    other.top_contended.offer(e.first, other.spins.estimate(Hotspot::hashNode(e.first)));
+  }
+}
+
+void ThreadHotspot::reset(){
+  keys = CountMinSketch{};
+  nodes = CountMinSketch{};
+  spins = CountMinSketch{};
+  top_keys = TopK<Key>{};
+  top_nodes = TopK<const void *>{};
+  top_contended = TopK<const void *>{};
+}
+
+namespace {
+
+/**
+ * 生きている各threadのThreadHotspotと、終了したthreadの集計結果を持つ。
+ */
+struct HotspotRegistry{
+  std::mutex mutex{};
+  std::vector<ThreadHotspot*> live{};
+  ThreadHotspot retired{};
+};
+
+HotspotRegistry &registry(){
+  // thread終了時のdestructorから触られるので、解放しない
+  static auto r = new HotspotRegistry{};
+  return *r;
+}
+
+/**
+ * threadごとにThreadHotspotを確保し、thread終了時にregistryに退避する。
+ */
+struct LocalHotspotHolder{
+  ThreadHotspot *hotspot = new ThreadHotspot{};
+
+  LocalHotspotHolder(){
+    auto &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.live.push_back(hotspot);
+  }
+
+  ~LocalHotspotHolder(){
+    auto &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    {
+      std::lock_guard<std::mutex> own(hotspot->mutex);
+      hotspot->addTo(r.retired);
+    }
+    r.live.erase(std::find(r.live.begin(), r.live.end(), hotspot));
+    delete hotspot;
+  }
+};
+
+template<typename T>
+void sort_by_count(std::vector<T> &items, size_t top, uint64_t T::*count){
+  std::sort(items.begin(), items.end(), [count](const T &a, const T &b){
+    return a.*count > b.*count;
+  });
+  if(items.size() > top){
+    items.resize(top);
+  }
+}
+
+}
+
+ThreadHotspot &localThreadHotspot(){
+  thread_local LocalHotspotHolder holder{};
+  return *holder.hotspot;
+}
+
+HotspotSnapshot Hotspot::collect(size_t top){
+  auto &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  // sketchが大きいので、stackには置かない
+  auto all_ = std::make_unique<ThreadHotspot>();
+  auto &all = *all_;
+  r.retired.addTo(all);
+  for(auto h: r.live){
+    std::lock_guard<std::mutex> own(h->mutex);
+    h->addTo(all);
+  }
+
+  HotspotSnapshot snap{};
+  snap.sample_period = samplePeriod();
+  for(auto &e: all.top_keys.getEntries()){
+    snap.keys.push_back(HotKey{e.first, e.second});
+  }
+  auto node = [&all](const void *n){
+    auto h = hashNode(n);
+    return HotNode{n, all.nodes.estimate(h), all.spins.estimate(h)};
+  };
+  for(auto &e: all.top_nodes.getEntries()){
+    snap.nodes.push_back(node(e.first));
+  }
+  for(auto &e: all.top_contended.getEntries()){
+    snap.contended.push_back(node(e.first));
+  }
+  sort_by_count(snap.keys, top, &HotKey::count);
+  sort_by_count(snap.nodes, top, &HotNode::accesses);
+  sort_by_count(snap.contended, top, &HotNode::lock_spins);
+  return snap;
+}
+
+void Hotspot::reset(){
+  auto &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  r.retired.reset();
+  for(auto h: r.live){
+    std::lock_guard<std::mutex> own(h->mutex);
+    h->reset();
+  }
+}
+
+#else
+
+HotspotSnapshot Hotspot::collect(size_t top){
+  (void)top;
+  return HotspotSnapshot{};
+}
+
+void Hotspot::reset(){}
+
+#endif
+
+}
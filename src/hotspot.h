@@ -0,0 +1,284 @@
+#ifndef MASSTREE_HOTSPOT_H
+#define MASSTREE_HOTSPOT_H
+
+#include "key.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace masstree{
+
+struct HotKey{
+  Key key;
+  // sampleされた回数の推定値
+  uint64_t count;
+};
+
+struct HotNode{
+  const void *node;
+  // sampleされた回数の推定値
+  uint64_t accesses;
+  // Node::lockで回った回数の推定値
+  uint64_t lock_spins;
+};
+
+/**
+ * 全threadのsampleを集計した結果。
+ * 回数はsampleされた回数なので、おおよその実際の回数はsample_period倍となる。
+ * nodeは集計した時には既に解放されているかもしれないので、アドレスとしてのみ使う。
+ */
+struct HotspotSnapshot{
+  uint64_t sample_period = 0;
+  // 多くsampleされた順
+  std::vector<HotKey> keys{};
+  // 多くsampleされた順
+  std::vector<HotNode> nodes{};
+  // lockで多く回った順
+  std::vector<HotNode> contended{};
+
+  void print() const{
+    std::cout << "sample period: " << sample_period << std::endl;
+    for(auto &k: keys){
+      std::cout << "key";
+      for(auto slice: k.key.slices){
+        std::cout << " " << std::hex << slice << std::dec;
+      }
+      std::cout << ": " << k.count << std::endl;
+    }
+    for(auto &n: nodes){
+      std::cout << "node " << n.node << ": " << n.accesses << " (lock spins " << n.lock_spins << ")" << std::endl;
+    }
+    for(auto &n: contended){
+      std::cout << "contended " << n.node << ": " << n.lock_spins << " (accesses " << n.accesses << ")" << std::endl;
+    }
+  }
+};
+
+#ifdef MASSTREE_HOTSPOT
+
+/**
+ * count-min sketch。DEPTH個の行のうち、最も小さいカウンタを推定値とする。
+ */
+class CountMinSketch{
+public:
+  static constexpr size_t DEPTH = 4;
+  static constexpr size_t WIDTH = 1024;
+
+  /**
+   * @return 加えた後の推定値
+   */
+  uint64_t add(uint64_t h, uint64_t n = 1){
+    uint64_t estimate = UINT64_MAX;
+    for(size_t d = 0; d < DEPTH; ++d){
+      auto &c = rows[d][column(h, d)];
+      c += n;
+      estimate = std::min(estimate, c);
+    }
+    return estimate;
+  }
+
+  [[nodiscard]]
+  uint64_t estimate(uint64_t h) const{
+    uint64_t estimate = UINT64_MAX;
+    for(size_t d = 0; d < DEPTH; ++d){
+      estimate = std::min(estimate, rows[d][column(h, d)]);
+    }
+    return estimate;
+  }
+
+  void addAll(const CountMinSketch &other){
+    for(size_t d = 0; d < DEPTH; ++d){
+      for(size_t i = 0; i < WIDTH; ++i){
+        rows[d][i] += other.rows[d][i];
+      }
+    }
+  }
+
+private:
+  static size_t column(uint64_t h, size_t d){
+    // 行ごとにhashの別の16bitを使う
+    return (h >> (d * 16)) % WIDTH;
+  }
+
+  std::array<std::array<uint64_t, WIDTH>, DEPTH> rows{};
+};
+
+/**
+ * 推定値の大きいK個を覚えておく。
+ */
+template<typename T>
+class TopK{
+public:
+  static constexpr size_t K = 16;
+
+  void offer(const T &item, uint64_t estimate){
+    for(auto &e: entries){
+      if(e.first == item){
+        e.second = estimate;
+        return;
+      }
+    }
+    if(entries.size() < K){
+      entries.emplace_back(item, estimate);
+      return;
+    }
+    auto min = std::min_element(entries.begin(), entries.end(), [](const auto &a, const auto &b){
+      return a.second < b.second;
+    });
+    if(min->second < estimate){
+      *min = std::make_pair(item, estimate);
+    }
+  }
+
+  [[nodiscard]]
+  const std::vector<std::pair<T, uint64_t>> &getEntries() const{
+    return entries;
+  }
+
+private:
+  std::vector<std::pair<T, uint64_t>> entries{};
+};
+
+/**
+ * 一つのthreadのsample。
+ * sampleするのは持ち主のthreadのみだが、集計するthreadも読むのでmutexで守る。
+ * mutexを取るのはsampleする時のみなので、ほとんど競合しない。
+ */
+struct ThreadHotspot{
+  std::mutex mutex{};
+  CountMinSketch keys{};
+  CountMinSketch nodes{};
+  CountMinSketch spins{};
+  TopK<Key> top_keys{};
+  TopK<const void *> top_nodes{};
+  TopK<const void *> top_contended{};
+  // 次のsampleまでの操作の数
+  uint64_t key_countdown = 0;
+  uint64_t node_countdown = 0;
+  uint64_t lock_countdown = 0;
+
+  void addTo(ThreadHotspot &other);
+  void reset();
+};
+
+ThreadHotspot &localThreadHotspot();
+
+// lockを取った時にsampleされ、まだ記録していない競合。unlockの後に記録する
+inline thread_local const void *pending_contended_node = nullptr;
+inline thread_local uint64_t pending_contended_spins = 0;
+
+#endif
+
+/**
+ * keyとBorderNodeへのアクセスを、N回に一回sampleしてthreadごとに数える。
+ * lockの競合も、Node::lockで回った時のN回に一回をsampleする。
+ * critical sectionを延ばさないよう、sampleした競合はunlockの後に記録する。
+ * MASSTREE_HOTSPOTが定義されていない時には、全ての関数は空になる。
+ */
+class Hotspot{
+public:
+  static void sampleKey(const Key &key){
+#ifdef MASSTREE_HOTSPOT
+    auto &h = localThreadHotspot();
+    if(h.key_countdown-- != 0){
+      return;
+    }
+    h.key_countdown = samplePeriod() - 1;
+    auto hash = hash_key(key);
+    std::lock_guard<std::mutex> lock(h.mutex);
+    h.top_keys.offer(key, h.keys.add(hash));
+#else
+    (void)key;
+#endif
+  }
+
+  static void sampleNode(const void *node){
+#ifdef MASSTREE_HOTSPOT
+    auto &h = localThreadHotspot();
+    if(h.node_countdown-- != 0){
+      return;
+    }
+    h.node_countdown = samplePeriod() - 1;
+    std::lock_guard<std::mutex> lock(h.mutex);
+    h.top_nodes.offer(node, h.nodes.add(hashNode(node)));
+#else
+    (void)node;
+#endif
+  }
+
+  /**
+   * lockを取った直後に呼ぶ。sampleした時も、覚えておくだけで記録はしない。
+   * lockを重ねて取った時は、最初の競合だけを覚える。
+   */
+  static void lockContended(const void *node, uint64_t spins){
+#ifdef MASSTREE_HOTSPOT
+    auto &h = localThreadHotspot();
+    if(h.lock_countdown-- != 0){
+      return;
+    }
+    h.lock_countdown = samplePeriod() - 1;
+    if(pending_contended_node == nullptr){
+      pending_contended_node = node;
+      pending_contended_spins = spins;
+    }
+#else
+    (void)node; (void)spins;
+#endif
+  }
+
+  /**
+   * unlockの後に呼び、lockContendedで覚えた競合を記録する。
+   */
+  static void flushContended(){
+#ifdef MASSTREE_HOTSPOT
+    if(pending_contended_node == nullptr){
+      return;
+    }
+    auto &h = localThreadHotspot();
+    {
+      std::lock_guard<std::mutex> lock(h.mutex);
+      h.top_contended.offer(pending_contended_node,
+                            h.spins.add(hashNode(pending_contended_node), pending_contended_spins));
+    }
+    pending_contended_node = nullptr;
+#endif
+  }
+
+  /**
+   * 何回に一回sampleするか。他のthreadでは次のsampleから、呼んだthreadでは次の操作から使われる。
+   */
+  static void setSamplePeriod(uint64_t period);
+
+  static uint64_t samplePeriod();
+
+  /**
+   * 全threadのsampleを集計し、それぞれ多い順にtop個までを返す。
+   * 他のthreadが動いている間に呼んでよい。
+   */
+  static HotspotSnapshot collect(size_t top = 16);
+
+  static void reset();
+
+  static constexpr bool enabled(){
+#ifdef MASSTREE_HOTSPOT
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  static uint64_t hashNode(const void *node){
+    auto h = reinterpret_cast<uint64_t>(node);
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+  }
+};
+
+}
+
+#endif //MASSTREE_HOTSPOT_H
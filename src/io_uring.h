@@ -0,0 +1,198 @@
+#ifndef MASSTREE_IO_URING_H
+#define MASSTREE_IO_URING_H
+
+#if __has_include(<linux/io_uring.h>)
+#define MASSTREE_HAS_IO_URING
+#endif
+
+#ifdef MASSTREE_HAS_IO_URING
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace masstree{
+
+/**
+ * liburingを使わずに、syscallで直接扱うio_uring。
+ * submitもcompletionの刈り取りも一つのthreadからのみ行う。
+ */
+class IoUring{
+public:
+  IoUring() = default;
+
+  ~IoUring(){
+    if(ring_fd < 0){
+      return;
+    }
+    munmap(sqes, sqes_size);
+    if(cq_ptr != sq_ptr){
+      munmap(cq_ptr, cq_size);
+    }
+    munmap(sq_ptr, sq_size);
+    close(ring_fd);
+  }
+
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+  /**
+   * @return kernelが対応していないか、seccompなどで禁止されている時はfalse
+   */
+  bool init(unsigned entries){
+    io_uring_params p{};
+    ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if(ring_fd < 0){
+      return false;
+    }
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    auto single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(single){
+      sq_size = cq_size = std::max(sq_size, cq_size);
+    }
+    sq_ptr = static_cast<char *>(mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING));
+    if(sq_ptr == MAP_FAILED){
+      goto fail;
+    }
+    if(single){
+      cq_ptr = sq_ptr;
+    }else{
+      cq_ptr = static_cast<char *>(mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING));
+      if(cq_ptr == MAP_FAILED){
+        munmap(sq_ptr, sq_size);
+        goto fail;
+      }
+    }
+    sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    if(sqes == MAP_FAILED){
+      if(cq_ptr != sq_ptr){
+        munmap(cq_ptr, cq_size);
+      }
+      munmap(sq_ptr, sq_size);
+      goto fail;
+    }
+    sq_head = reinterpret_cast<unsigned *>(sq_ptr + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq_ptr + p.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned *>(sq_ptr + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq_ptr + p.sq_off.array);
+    sq_entries = p.sq_entries;
+    cq_head = reinterpret_cast<unsigned *>(cq_ptr + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq_ptr + p.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned *>(cq_ptr + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq_ptr + p.cq_off.cqes);
+    local_tail = submitted = *sq_tail;
+    return true;
+fail:
+    close(ring_fd);
+    ring_fd = -1;
+    return false;
+  }
+
+  /**
+   * 次に埋めるsqe。submitまでkernelには見えない。
+   * @return submission queueが埋まっている時はnullptr
+   */
+  io_uring_sqe *nextSqe(){
+    auto head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if(local_tail - head >= sq_entries){
+      return nullptr;
+    }
+    auto index = local_tail & sq_mask;
+    sq_array[index] = index;
+    ++local_tail;
+    auto sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+  }
+
+  /**
+   * nextSqeで埋めたものをkernelに渡す。
+   * @param wait 少なくともこの数のcompletionが届くまで待つ
+   * @return 失敗した時は負のerrno
+   */
+  int submit(unsigned wait = 0){
+    __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    while(true){
+      // 前回渡し切れなかったものも、ここで渡す
+      auto to_submit = local_tail - submitted;
+      auto r = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait, wait != 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if(r >= 0){
+        submitted += static_cast<unsigned>(r);
+        return 0;
+      }
+      if(errno != EINTR){
+        return -errno;
+      }
+    }
+  }
+
+  /**
+   * 届いているcompletionを一つ取り出す。
+   * @param[out] cqe
+   * @return 無い時はfalse
+   */
+  bool peek(io_uring_cqe &cqe){
+    auto head = *cq_head;
+    if(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+      return false;
+    }
+    cqe = cqes[head & cq_mask];
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  static void prepWritev(io_uring_sqe *sqe, int fd, const iovec *iov, unsigned count, off_t offset, uint64_t user_data){
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(iov);
+    sqe->len = count;
+    sqe->off = static_cast<uint64_t>(offset);
+    sqe->user_data = user_data;
+  }
+
+  static void prepFdatasync(io_uring_sqe *sqe, int fd, uint64_t user_data){
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->user_data = user_data;
+  }
+
+private:
+  int ring_fd = -1;
+  char *sq_ptr = nullptr;
+  char *cq_ptr = nullptr;
+  size_t sq_size = 0;
+  size_t cq_size = 0;
+  io_uring_sqe *sqes = nullptr;
+  size_t sqes_size = 0;
+
+  unsigned *sq_head = nullptr;
+  unsigned *sq_tail = nullptr;
+  unsigned sq_mask = 0;
+  unsigned *sq_array = nullptr;
+  unsigned sq_entries = 0;
+  // nextSqeで埋めたが、まだsubmitしていないものも含めたtail
+  unsigned local_tail = 0;
+  // kernelが受け取ったところまでのtail
+  unsigned submitted = 0;
+
+  unsigned *cq_head = nullptr;
+  unsigned *cq_tail = nullptr;
+  unsigned cq_mask = 0;
+  io_uring_cqe *cqes = nullptr;
+};
+
+}
+
+#endif
+
+#endif //MASSTREE_IO_URING_H
@@ -2,9 +2,12 @@
 #define MASSTREE_KEY_H
 
 #include <cstdint>
+#include <cstddef>
 #include <vector>
 #include <tuple>
 #include <cassert>
+#include <algorithm>
+#include <string>
 
 namespace masstree {
 
@@ -99,6 +102,33 @@ struct Key {
     cursor = 0;
   }
 
+  /**
+   * cursorを無視したkeyの順序。
+   * 先頭のsliceから順に、(slice, そのsliceの長さ)の組で比べる。
+   * 次のsliceがある場合、そのsliceの長さは8より大きいものとみなす。
+   * BorderNode中の並び(key_len 1~8 < has_suffix, layer)と同じ順序となる。
+   * @param rhs
+   * @return *this < rhsなら負、等しければ0、*this > rhsなら正
+   */
+  [[nodiscard]]
+  int compare(const Key &rhs) const{
+    for(size_t i = 0;; ++i){
+      if(slices[i] != rhs.slices[i]){
+        return slices[i] < rhs.slices[i] ? -1 : 1;
+      }
+      auto last = i + 1 == slices.size();
+      auto rhs_last = i + 1 == rhs.slices.size();
+      auto len = last ? lastSliceSize : 9;
+      auto rhs_len = rhs_last ? rhs.lastSliceSize : 9;
+      if(len != rhs_len){
+        return len < rhs_len ? -1 : 1;
+      }
+      if(last){
+        return 0;
+      }
+    }
+  }
+
   bool operator==(const Key &rhs) const{
     return lastSliceSize == rhs.lastSliceSize
     && cursor == rhs.cursor
@@ -110,6 +140,86 @@ struct Key {
   }
 };
 
+/**
+ * pathとsliceに続く全てのkey(sliceの長さが8で、さらに次のsliceを持つkey)、
+ * つまりsliceの下のLayerに入る全てのkeyを一つのまとまりとみなし、keyと比べる。
+ * @param key
+ * @param path このLayerに来るまでに辿ったslice
+ * @param slice
+ * @return keyがまとまりより前なら負、後なら正、まとまりの中なら0
+ */
+[[maybe_unused]]
+static int compare_with_layer(const Key &key, const std::vector<KeySlice> &path, KeySlice slice){
+  auto depth = path.size();
+  for(size_t i = 0; i <= depth; ++i){
+    auto s = i < depth ? path[i] : slice;
+    if(key.slices[i] != s){
+      return key.slices[i] < s ? -1 : 1;
+    }
+    if(i + 1 == key.slices.size()){
+      // keyはここで終わるので、まとまりのどのkeyよりも短い
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * byte列をKeyにする。8byteごとにbig endianでsliceに詰め、最後のsliceの残りは0で埋める。
+ * こうすると、Key::compareの順がbyte列の辞書順と一致する。
+ * @param size 1以上
+ */
+[[maybe_unused]]
+static Key key_from_bytes(const char *data, size_t size){
+  assert(size >= 1);
+  std::vector<KeySlice> slices((size + 7) / 8, 0);
+  for(size_t i = 0; i < size; ++i){
+    slices[i / 8] |= static_cast<KeySlice>(static_cast<uint8_t>(data[i])) << (8 * (7 - i % 8));
+  }
+  auto last_size = size - (slices.size() - 1) * 8;
+  return Key(std::move(slices), last_size);
+}
+
+/**
+ * key_from_bytesの逆。
+ */
+[[maybe_unused]]
+static std::string key_to_bytes(const Key &key){
+  std::string bytes{};
+  bytes.reserve(key.slices.size() * 8);
+  for(size_t i = 0; i < key.slices.size(); ++i){
+    auto len = i + 1 == key.slices.size() ? key.lastSliceSize : 8;
+    for(size_t j = 0; j < len; ++j){
+      bytes.push_back(static_cast<char>(key.slices[i] >> (8 * (7 - j))));
+    }
+  }
+  return bytes;
+}
+
+/**
+ * keyがpathで辿ってきたLayerの中に入るか。
+ */
+[[maybe_unused]]
+static bool shares_path(const Key &key, const std::vector<KeySlice> &path){
+  return key.slices.size() > path.size()
+    and std::equal(path.begin(), path.end(), key.slices.begin());
+}
+
+/**
+ * keyのhash。sliceと長さを混ぜ、最後にsplitmix64の仕上げをかける。
+ */
+[[maybe_unused]]
+static uint64_t hash_key(const Key &key){
+  uint64_t h = key.lastSliceSize;
+  for(auto s: key.slices){
+    h ^= s + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  }
+  h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
 }
 
 #endif //MASSTREE_KEY_H
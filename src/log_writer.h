@@ -0,0 +1,727 @@
+#ifndef MASSTREE_LOG_WRITER_H
+#define MASSTREE_LOG_WRITER_H
+
+#include "masstree.h"
+#include "io_uring.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace masstree{
+
+enum class LogOp : uint8_t{
+  Put = 1,
+  Remove = 2
+};
+
+/**
+ * logの一件が書かれた時に、writerのthreadから呼ばれる。
+ * 引数は書けたか。falseの時はI/Oが失敗している。
+ */
+using LogCallback = std::function<void(bool)>;
+
+/**
+ * logの一件は u32 body_len | u32 checksum | body で、
+ * bodyは u8 op | u64 seq | u16 key_len | key | i32 value (Removeでも0を入れる)。
+ *
+ * fileの中の順は、threadごとのLogBufferを集めた順なので、同じkeyへの操作の順とは限らない。
+ * seqは同じkeyへの操作の順を表し、replayはseqの順に行う。
+ */
+static constexpr size_t LOG_HEADER = 2 * sizeof(uint32_t);
+// keyを除いたbodyの大きさ
+static constexpr size_t LOG_BODY_FIXED = 1 + sizeof(uint64_t) + sizeof(uint16_t) + sizeof(int32_t);
+// bodyの中のkeyの位置
+static constexpr size_t LOG_KEY_OFFSET = 1 + sizeof(uint64_t) + sizeof(uint16_t);
+
+struct LogRecord{
+  LogOp op;
+  uint64_t seq;
+  std::string key;
+  int32_t value;
+};
+
+static uint32_t log_checksum(const char *data, size_t size){
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for(size_t i = 0; i < size; ++i){
+    h ^= static_cast<uint8_t>(data[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void encode_log_record(LogOp op, uint64_t seq, const std::string &key, int32_t value, std::string &out){
+  auto body_len = static_cast<uint32_t>(LOG_BODY_FIXED + key.size());
+  auto pos = out.size();
+  out.resize(pos + LOG_HEADER + body_len);
+  auto p = &out[pos];
+  std::memcpy(p, &body_len, sizeof(body_len));
+  auto body = p + LOG_HEADER;
+  body[0] = static_cast<char>(op);
+  std::memcpy(body + 1, &seq, sizeof(seq));
+  auto key_len = static_cast<uint16_t>(key.size());
+  std::memcpy(body + 1 + sizeof(seq), &key_len, sizeof(key_len));
+  std::memcpy(body + LOG_KEY_OFFSET, key.data(), key.size());
+  std::memcpy(body + LOG_KEY_OFFSET + key.size(), &value, sizeof(value));
+  auto sum = log_checksum(body, body_len);
+  std::memcpy(p + sizeof(uint32_t), &sum, sizeof(sum));
+}
+
+/**
+ * pathのlogを先頭から読み、fileの中の順にrecordsに積む。
+ * 途中で書きかけのrecordやchecksumの合わないrecordに当たったら、そこで止める。
+ * @return 読めたrecordが占める、fileの先頭からのbyte数
+ */
+[[maybe_unused]]
+static size_t read_log_records(const std::string &path, std::vector<LogRecord> &records){
+  auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0){
+    return 0;
+  }
+  std::string data{};
+  char buf[64 * 1024];
+  ssize_t r;
+  while((r = read(fd, buf, sizeof(buf))) > 0){
+    data.append(buf, r);
+  }
+  close(fd);
+
+  size_t pos = 0;
+  while(pos + LOG_HEADER <= data.size()){
+    uint32_t body_len, sum;
+    std::memcpy(&body_len, &data[pos], sizeof(body_len));
+    std::memcpy(&sum, &data[pos + sizeof(uint32_t)], sizeof(sum));
+    if(body_len < LOG_BODY_FIXED or pos + LOG_HEADER + body_len > data.size()){
+      break;
+    }
+    auto body = &data[pos + LOG_HEADER];
+    if(log_checksum(body, body_len) != sum){
+      break;
+    }
+    uint64_t seq;
+    std::memcpy(&seq, body + 1, sizeof(seq));
+    uint16_t key_len;
+    std::memcpy(&key_len, body + 1 + sizeof(seq), sizeof(key_len));
+    if(LOG_BODY_FIXED + key_len != body_len){
+      break;
+    }
+    int32_t value;
+    std::memcpy(&value, body + LOG_KEY_OFFSET + key_len, sizeof(value));
+    records.push_back(LogRecord{static_cast<LogOp>(body[0]), seq, std::string(body + LOG_KEY_OFFSET, key_len), value});
+    pos += LOG_HEADER + body_len;
+  }
+  return pos;
+}
+
+/**
+ * pathのlogを読み、seqの順に一件ずつf(op, key, value)に渡す。
+ * 書きかけのrecordやchecksumの合わないrecordより後は読まない。
+ * @return 読んだrecordの数
+ */
+template<typename F>
+static size_t replay_log(const std::string &path, F &&f){
+  std::vector<LogRecord> records{};
+  read_log_records(path, records);
+  std::stable_sort(records.begin(), records.end(), [](const LogRecord &a, const LogRecord &b){
+    return a.seq < b.seq;
+  });
+  for(auto &record: records){
+    f(record.op, record.key, record.value);
+  }
+  return records.size();
+}
+
+class LogWriter;
+
+/**
+ * 一つのthreadがlogを積むbuffer。threadごとに一つ持ち、そのthreadのみが使う。
+ * 積んだrecordはLogWriterのthreadがまとめて持って行き、group commitで書く。
+ * mutexはLogWriterのthreadが持って行く時にしか競合しない。
+ */
+class LogBuffer{
+public:
+  explicit LogBuffer(LogWriter &writer_);
+
+  /**
+   * ここまでに積んだものが書かれるのを待ってから、writerから外れる。
+   */
+  ~LogBuffer();
+
+  LogBuffer(const LogBuffer &) = delete;
+  LogBuffer &operator=(const LogBuffer &) = delete;
+
+  /**
+   * @param seq nextSequence()で取ったもの
+   * @param callback 書かれた後にwriterのthreadから呼ばれる。短くなければならない
+   */
+  void append(LogOp op, uint64_t seq, const std::string &key, int32_t value, LogCallback callback = nullptr);
+
+  /**
+   * 他のthreadと同じkeyを触らない時に使う。seqはここで取る。
+   */
+  void append(LogOp op, const std::string &key, int32_t value, LogCallback callback = nullptr){
+    append(op, nextSequence(), key, value, std::move(callback));
+  }
+
+  /**
+   * replayの順を決める番号を取る。
+   * 同じkeyへの操作の順に並ぶよう、そのkeyのBorderNodeのlockを取ったまま呼ぶ。
+   */
+  uint64_t nextSequence();
+
+  /**
+   * ここまでに積んだものが全て書かれるまで、このthreadを眠らせて待つ。
+   * @return 全て書けたか
+   */
+  bool sync();
+
+private:
+  friend class LogWriter;
+
+  LogWriter &writer;
+  std::mutex mutex{};
+  std::string data{};
+  std::vector<LogCallback> callbacks{};
+  // appendした数
+  uint64_t appended = 0;
+  // writerに知らせていない数
+  size_t unreported = 0;
+  // writerが持って行った数。writerのthreadのみが触る
+  uint64_t collected = 0;
+  // 書けた数。writerのthreadが進める
+  std::atomic<uint64_t> durable{0};
+};
+
+/**
+ * 各threadのLogBufferを集めて、一つのfileに追記するlog writer。
+ *
+ * 集めたものをgroupとし、groupごとにwrite一回とfdatasync一回を行う(group commit)。
+ * groupは積まれた数がgroup_opsに達するか、前のgroupからmax_delayが経つと作る。
+ * io_uringが使える時は、writevとfdatasyncをlinkして渡し、完了を待たずに次のgroupを作る。
+ * 使えない時は、writerのthreadがpwritevとfdatasyncを順に呼ぶ。
+ * どちらの場合も、callbackはgroupの順に呼ぶので、呼ばれた時にはそれより前のlogも全て書かれている。
+ * putのthreadがfsyncを待つ事は無く、待ちたい時はcallbackかLogBuffer::syncを使う。
+ */
+class LogWriter{
+public:
+  struct Options{
+    // groupにする数
+    size_t group_ops = 32768;
+    // group_opsに達しない時に、groupを作る間隔
+    std::chrono::microseconds max_delay{20000};
+    bool use_io_uring = true;
+    // io_uringで、完了を待たずに出しておけるgroupの数
+    size_t max_inflight = 4;
+  };
+
+  struct Stats{
+    uint64_t groups = 0;
+    uint64_t ops = 0;
+    uint64_t bytes = 0;
+  };
+
+  LogWriter() = default;
+
+  ~LogWriter(){
+    close();
+  }
+
+  LogWriter(const LogWriter &) = delete;
+  LogWriter &operator=(const LogWriter &) = delete;
+
+  /**
+   * pathを開き(無ければ作り)、末尾に追記していくthreadを始める。
+   * 既にあるlogは一度読み、seqをその続きから振る。書きかけのrecordがあれば、その上から書く。
+   * @return 開けなかった時はfalse。errnoに理由が入る
+   */
+  bool open(const std::string &path){
+    return open(path, Options{});
+  }
+
+  bool open(const std::string &path, Options options_){
+    assert(fd < 0);
+    options = options_;
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0){
+      return false;
+    }
+    std::vector<LogRecord> records{};
+    offset = static_cast<off_t>(read_log_records(path, records));
+    uint64_t last = 0;
+    for(auto &record: records){
+      last = std::max(last, record.seq + 1);
+    }
+    sequence.store(last);
+#ifdef MASSTREE_HAS_IO_URING
+    if(options.use_io_uring){
+      ring = std::make_unique<IoUring>();
+      if(!ring->init(static_cast<unsigned>(2 * options.max_inflight))){
+        ring.reset();
+      }
+    }
+#endif
+    running = true;
+    thread = std::thread([this](){ run(); });
+    return true;
+  }
+
+  /**
+   * 積まれているものを全て書いてから、threadを止めてfileを閉じる。
+   * LogBufferは先に破棄しておく。
+   */
+  void close(){
+    if(fd < 0){
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+    wake.notify_one();
+    thread.join();
+#ifdef MASSTREE_HAS_IO_URING
+    ring.reset();
+#endif
+    ::close(fd);
+    fd = -1;
+  }
+
+  /**
+   * io_uringで書いているか
+   */
+  [[nodiscard]]
+  bool usingIoUring() const{
+#ifdef MASSTREE_HAS_IO_URING
+    return ring != nullptr;
+#else
+    return false;
+#endif
+  }
+
+  [[nodiscard]]
+  Stats stats() const{
+    std::lock_guard<std::mutex> lock(mutex);
+    return total;
+  }
+
+private:
+  friend class LogBuffer;
+
+  // LogBufferは、この数ごとにまとめてwriterに知らせる
+  static constexpr size_t REPORT_EVERY = 256;
+
+  /**
+   * 一回のwriteとfdatasyncで書くもの。
+   */
+  struct Group{
+    std::vector<std::string> chunks{};
+    std::vector<iovec> iov{};
+    std::vector<LogCallback> callbacks{};
+    // 各LogBufferの、このgroupを書き終えた時のdurable
+    std::vector<std::pair<LogBuffer *, uint64_t>> marks{};
+    size_t ops = 0;
+    size_t bytes = 0;
+    off_t offset = 0;
+    bool ok = true;
+    // io_uringで、writevとfdatasyncのcompletionを受け取ったか
+    bool write_done = false;
+    bool sync_done = false;
+  };
+
+  void attach(LogBuffer *buffer){
+    std::lock_guard<std::mutex> lock(mutex);
+    buffers.push_back(buffer);
+  }
+
+  void detach(LogBuffer *buffer){
+    std::lock_guard<std::mutex> lock(mutex);
+    buffers.erase(std::find(buffers.begin(), buffers.end(), buffer));
+  }
+
+  /**
+   * bufferに積まれたcount件を知らせる。
+   * @param urgent 待っているthreadがいるので、すぐにgroupを作る
+   */
+  void report(size_t count, bool urgent){
+    bool notify;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending += count;
+      flush_requested |= urgent;
+      notify = urgent or pending >= options.group_ops;
+    }
+    if(notify){
+      wake.notify_one();
+    }
+  }
+
+  void run(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true){
+      // group_opsに達しなくても、max_delayごとに積まれているものを書く
+      wake.wait_for(lock, options.max_delay, [this](){
+        return !running or flush_requested or pending >= options.group_ops;
+      });
+      auto stopping = !running;
+      pending = 0;
+      flush_requested = false;
+      auto group = collect();
+      lock.unlock();
+
+      if(group->ops != 0){
+        write(std::move(group));
+      }
+      reap(false);
+      if(stopping){
+        drain();
+        return;
+      }
+      lock.lock();
+    }
+  }
+
+  /**
+   * 全てのLogBufferから、積まれているものを持って行く。
+   * 前提: mutexを持っている。
+   */
+  std::unique_ptr<Group> collect(){
+    auto group = std::make_unique<Group>();
+    for(auto buffer: buffers){
+      std::lock_guard<std::mutex> lock(buffer->mutex);
+      if(buffer->data.empty()){
+        continue;
+      }
+      group->bytes += buffer->data.size();
+      group->chunks.push_back(std::move(buffer->data));
+      buffer->data.clear();
+      for(auto &callback: buffer->callbacks){
+        if(callback){
+          group->callbacks.push_back(std::move(callback));
+        }
+      }
+      buffer->callbacks.clear();
+      group->ops += buffer->appended - buffer->collected;
+      buffer->collected = buffer->appended;
+      group->marks.emplace_back(buffer, buffer->appended);
+    }
+    if(group->chunks.size() > IOV_MAX){
+      // writev一回で渡せる数を超えたら、一つにまとめる
+      std::string all{};
+      all.reserve(group->bytes);
+      for(auto &chunk: group->chunks){
+        all += chunk;
+      }
+      group->chunks.clear();
+      group->chunks.push_back(std::move(all));
+    }
+    for(auto &chunk: group->chunks){
+      group->iov.push_back(iovec{chunk.data(), chunk.size()});
+    }
+    return group;
+  }
+
+  void write(std::unique_ptr<Group> group){
+    group->offset = offset;
+    offset += group->bytes;
+#ifdef MASSTREE_HAS_IO_URING
+    if(ring != nullptr){
+      while(inflight.size() >= options.max_inflight){
+        reap(true);
+      }
+      auto id = next_id++;
+      auto write_sqe = ring->nextSqe();
+      auto sync_sqe = ring->nextSqe();
+      assert(write_sqe != nullptr and sync_sqe != nullptr);
+      IoUring::prepWritev(write_sqe, fd, group->iov.data(), static_cast<unsigned>(group->iov.size()), group->offset, id * 2);
+      write_sqe->flags |= IOSQE_IO_LINK;
+      IoUring::prepFdatasync(sync_sqe, fd, id * 2 + 1);
+      inflight.push_back(std::move(group));
+      int r;
+      while((r = ring->submit()) == -EAGAIN or r == -EBUSY){
+        reap(true);
+      }
+      if(r < 0){
+        // 渡せなかったので、このthreadで書く。遅れて届くcompletionは捨てる
+        auto &g = *inflight.back();
+        g.ok = writeAll(g, 0) and fdatasync(fd) == 0;
+        g.write_done = g.sync_done = true;
+      }
+      return;
+    }
+#endif
+    group->ok = writeAll(*group, 0) and fdatasync(fd) == 0;
+    complete(*group);
+  }
+
+  /**
+   * groupのwritten byte目以降をpwritevで書く。
+   */
+  bool writeAll(Group &group, size_t written){
+    std::vector<iovec> iov{};
+    size_t skip = written;
+    for(auto &chunk: group.chunks){
+      if(skip >= chunk.size()){
+        skip -= chunk.size();
+        continue;
+      }
+      iov.push_back(iovec{chunk.data() + skip, chunk.size() - skip});
+      skip = 0;
+    }
+    size_t index = 0;
+    auto pos = group.offset + static_cast<off_t>(written);
+    while(index < iov.size()){
+      auto r = pwritev(fd, iov.data() + index, static_cast<int>(iov.size() - index), pos);
+      if(r < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        return false;
+      }
+      pos += r;
+      auto n = static_cast<size_t>(r);
+      while(index < iov.size() and n >= iov[index].iov_len){
+        n -= iov[index].iov_len;
+        ++index;
+      }
+      if(index < iov.size()){
+        iov[index].iov_base = static_cast<char *>(iov[index].iov_base) + n;
+        iov[index].iov_len -= n;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * io_uringの完了を受け取り、先頭から完了したgroupのcallbackを呼ぶ。
+   * @param wait 一つも無い時に、一つ届くまで待つ
+   */
+  void reap(bool wait){
+#ifdef MASSTREE_HAS_IO_URING
+    if(ring == nullptr or inflight.empty()){
+      return;
+    }
+    io_uring_cqe cqe{};
+    auto got = false;
+    while(true){
+      if(!ring->peek(cqe)){
+        if(got or !wait){
+          break;
+        }
+        ring->submit(1);
+        continue;
+      }
+      got = true;
+      auto id = cqe.user_data / 2;
+      if(id < inflight_front or id - inflight_front >= inflight.size()){
+        continue;
+      }
+      auto &group = *inflight[id - inflight_front];
+      if(cqe.user_data % 2 == 0){
+        group.write_done = true;
+        if(cqe.res < 0){
+          group.ok = false;
+        }else if(static_cast<size_t>(cqe.res) != group.bytes){
+          // 書き切れなかった時は、linkしたfdatasyncは取り消されるので、ここで書き足す
+          group.ok = writeAll(group, cqe.res) and fdatasync(fd) == 0;
+        }
+      }else{
+        // writevが失敗した時は-ECANCELEDが届くが、その時はwritevの結果で決まる
+        group.sync_done = true;
+        if(cqe.res < 0 and cqe.res != -ECANCELED){
+          group.ok = false;
+        }
+      }
+    }
+    while(!inflight.empty() and inflight.front()->write_done and inflight.front()->sync_done){
+      complete(*inflight.front());
+      inflight.pop_front();
+      ++inflight_front;
+    }
+#else
+    (void)wait;
+#endif
+  }
+
+  /**
+   * 出しているgroupが全て完了するまで待つ。
+   */
+  void drain(){
+#ifdef MASSTREE_HAS_IO_URING
+    while(!inflight.empty()){
+      reap(true);
+    }
+#endif
+  }
+
+  void complete(Group &group){
+    for(auto &callback: group.callbacks){
+      callback(group.ok);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for(auto &mark: group.marks){
+        mark.first->durable.store(mark.second);
+      }
+      if(group.ok){
+        ++total.groups;
+        total.ops += group.ops;
+        total.bytes += group.bytes;
+      }else{
+        failed = true;
+      }
+    }
+    durable_cv.notify_all();
+  }
+
+  Options options{};
+  int fd = -1;
+  // 次のgroupを書く位置。writerのthreadのみが触る
+  off_t offset = 0;
+  std::thread thread{};
+
+  mutable std::mutex mutex{};
+  std::condition_variable wake{};
+  std::condition_variable durable_cv{};
+  bool running = false;
+  bool flush_requested = false;
+  bool failed = false;
+  // LogBufferから知らされた、まだ持って行っていない数
+  size_t pending = 0;
+  std::vector<LogBuffer *> buffers{};
+  Stats total{};
+  // 次に振るseq
+  std::atomic<uint64_t> sequence{0};
+
+#ifdef MASSTREE_HAS_IO_URING
+  std::unique_ptr<IoUring> ring{};
+  // 完了を待っているgroup。idの順に並ぶ
+  std::deque<std::unique_ptr<Group>> inflight{};
+  uint64_t inflight_front = 0;
+  uint64_t next_id = 0;
+#endif
+};
+
+inline LogBuffer::LogBuffer(LogWriter &writer_)
+: writer(writer_)
+{
+  writer.attach(this);
+}
+
+inline LogBuffer::~LogBuffer(){
+  sync();
+  writer.detach(this);
+}
+
+inline uint64_t LogBuffer::nextSequence(){
+  return writer.sequence.fetch_add(1);
+}
+
+inline void LogBuffer::append(LogOp op, uint64_t seq, const std::string &key, int32_t value, LogCallback callback){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    encode_log_record(op, seq, key, value, data);
+    if(callback){
+      callbacks.push_back(std::move(callback));
+    }
+    ++appended;
+  }
+  if(++unreported >= LogWriter::REPORT_EVERY){
+    writer.report(unreported, false);
+    unreported = 0;
+  }
+}
+
+inline bool LogBuffer::sync(){
+  uint64_t target;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    target = appended;
+  }
+  if(durable.load() >= target){
+    return true;
+  }
+  writer.report(unreported, true);
+  unreported = 0;
+  std::unique_lock<std::mutex> lock(writer.mutex);
+  writer.durable_cv.wait(lock, [this, target](){
+    return durable.load() >= target;
+  });
+  return !writer.failed;
+}
+
+/**
+ * treeにputし、同じ内容をlogに積む。
+ * seqはBorderNodeのlockの中で取るので、同じkeyへのputやremoveとはtreeに入った順に並ぶ。
+ * @param callback logが書かれた後に、writerのthreadから呼ばれる
+ */
+[[maybe_unused]]
+static void logged_put(Masstree &tree, LogBuffer &log, const std::string &key, int32_t value, GC &gc,
+                       LogCallback callback = nullptr){
+  auto k = key_from_bytes(key.data(), key.size());
+  uint64_t seq = 0;
+  // 空のtreeの生成で負けるとfは再び呼ばれ、valueはそのまま使われる
+  auto v = new Value(value);
+  tree.upsert(k, [&log, &seq, v](Value *){
+    seq = log.nextSequence();
+    return v;
+  }, gc);
+  log.append(LogOp::Put, seq, key, value, std::move(callback));
+}
+
+/**
+ * treeからremoveし、keyがあった時はlogに積む。seqはlogged_putと同じくlockの中で取る。
+ * @return 削除したvalue。gc.run()までの間だけ参照できる
+ */
+[[maybe_unused]]
+static Value *logged_remove(Masstree &tree, LogBuffer &log, const std::string &key, GC &gc,
+                            LogCallback callback = nullptr){
+  auto k = key_from_bytes(key.data(), key.size());
+  uint64_t seq = 0;
+  auto removed = tree.removeWith(k, gc, [&log, &seq](Value *){
+    seq = log.nextSequence();
+    return true;
+  });
+  if(removed != nullptr){
+    log.append(LogOp::Remove, seq, key, 0, std::move(callback));
+  }else if(callback){
+    callback(true);
+  }
+  return removed;
+}
+
+/**
+ * logを読み直して、treeに反映する。
+ * @return 反映したrecordの数
+ */
+[[maybe_unused]]
+static size_t recover_from_log(Masstree &tree, const std::string &path, GC &gc){
+  return replay_log(path, [&tree, &gc](LogOp op, const std::string &key, int32_t value){
+    auto k = key_from_bytes(key.data(), key.size());
+    if(op == LogOp::Put){
+      tree.put(k, new Value(value), gc);
+    }else{
+      tree.remove(k, gc);
+    }
+  });
+}
+
+}
+
+#endif //MASSTREE_LOG_WRITER_H
@@ -4,22 +4,349 @@
 #include "put.h"
 #include "get.h"
 #include "remove.h"
+#include "remove_range.h"
+#include "scan.h"
+#include "tree_stats.h"
+#include "compact.h"
+#include <memory>
 
 namespace masstree{
+class Subtree;
+class Transaction;
+
 class Masstree{
 public:
   Value *get(Key &key){
+    Stats::inc(Stat::Get);
+    Hotspot::sampleKey(key);
     auto root_ = root.load(std::memory_order_acquire);
     auto v = ::masstree::get(root_, key);
     key.reset();
     return v;
   }
 
+  /**
+   * hintが覚えているBorderNodeにkeyが入るなら、rootから降りずにそこから探す。
+   * keyが小さい順や近い順に来る時に使う。詳しくはLeafHintを参照。
+   */
+  Value *get(Key &key, LeafHint &hint){
+    Stats::inc(Stat::Get);
+    Hotspot::sampleKey(key);
+    auto root_ = root.load(std::memory_order_acquire);
+    auto v = ::masstree::get(root_, key, &hint);
+    key.reset();
+    return v;
+  }
+
   void put(Key &key, Value *value, GC &gc){
+    putWith(key, [value](Value *){ return value; }, gc, nullptr, combiner.get(), value);
+  }
+
+  /**
+   * get(key, hint)と同じく、hintが覚えているBorderNodeから始めるput。
+   */
+  void put(Key &key, Value *value, GC &gc, LeafHint &hint){
+    putWith(key, [value](Value *){ return value; }, gc, &hint);
+  }
+
+  /**
+   * batchのkey-valueをまとめてputする。結果は先頭から順にputした場合と同じになる。
+   * batchはkeyの順に並べ替えられ、同じBorderNodeに入るkeyの並び(run)は
+   * rootから一度だけ降りて、一度のlockで入れる。BorderNodeが溢れる時は、runの残りと合わせて
+   * 一度に必要な数のBorderNodeに分ける。詳しくはput_runを参照。
+   * runに入らなかったkeyは、LeafHintを使って一つずつputする。
+   * @param batch 並べ替えられる。keyのcursorは0
+   */
+  void multiPut(std::vector<std::pair<Key, Value *>> &batch, GC &gc){
+    // 同じkeyは後のものが残るように、元の順を保つ
+    std::stable_sort(batch.begin(), batch.end(), [](const auto &lhs, const auto &rhs){
+      return lhs.first.compare(rhs.first) < 0;
+    });
+    LeafHint hint{};
+    size_t i = 0;
+    while(i < batch.size()){
+      auto root_ = root.load(std::memory_order_acquire);
+      auto next = i;
+      if(root_ != nullptr){
+        auto pair = ::masstree::put_run(root_, batch, i, batch.size(), gc);
+        next = pair.first;
+        if(pair.second != nullptr){
+          // putWithと同じく、splitによるrootの変更は入れ違わない
+          root.store(pair.second, std::memory_order_release);
+        }
+      }
+      if(next == i){
+        auto value = batch[i].second;
+        putWith(batch[i].first, [value](Value *){ return value; }, gc, &hint);
+        ++next;
+      }
+      i = next;
+    }
+  }
+
+  /**
+   * keyが無い時にのみvalueを入れる。
+   * @return 既にあったvalue。valueを入れた場合はnullptr
+   */
+  Value *insertIfAbsent(Key &key, Value *value, GC &gc){
+    Value *found = nullptr;
+    putWith(key, [value, &found](Value *old){
+      found = old;
+      return old == nullptr ? value : nullptr;
+    }, gc);
+    return found;
+  }
+
+  /**
+   * keyのvalueがexpectedである時にのみ、desiredに置き換える。
+   * valueの比較はポインタで行う。expectedがnullptrの時は、keyが無い時にのみ入れる。
+   * 置き換えられた古いvalueはgcに渡される。
+   * @return 置き換えたか
+   */
+  bool compareAndSet(Key &key, Value *expected, Value *desired, GC &gc){
+    bool success = false;
+    putWith(key, [expected, desired, &success](Value *old){
+      success = old == expected;
+      return success ? desired : nullptr;
+    }, gc);
+    return success;
+  }
+
+  /**
+   * keyのvalueを、f(現在のvalue)で置き換える。keyが無ければf(nullptr)が呼ばれる。
+   * fはBorderNodeのlockを取った状態で呼ばれるので、短くなければならない。
+   * fがnullptrか現在のvalueを返した時は、何もしない。古いvalueはgcに渡される。
+   * @param f Value*(Value*)
+   * @return 操作後のvalue
+   */
+  template<typename F>
+  Value *upsert(Key &key, F &&f, GC &gc){
+    Value *result = nullptr;
+    putWith(key, [&f, &result](Value *old){
+      Value *value = f(old);
+      result = value == nullptr ? old : value;
+      return value;
+    }, gc);
+    return result;
+  }
+
+  /**
+   * keyを削除する。
+   * @return 削除したvalue。keyが無ければnullptr。
+   * valueはgcに渡されているので、gc.run()までの間だけ参照できる。
+   */
+  Value *remove(Key &key, GC &gc){
+    return removeWith(key, gc, [](Value *){ return true; });
+  }
+
+  /**
+   * keyがあれば、BorderNodeのlockを取ったままf(現在のvalue)を呼び、trueを返した時に削除する。
+   * fは一度だけ呼ばれ、短くなければならない。
+   * @param f bool(Value*)
+   * @return 削除したvalue。keyが無いか、fがfalseを返した時はnullptr
+   */
+  template<typename F>
+  Value *removeWith(Key &key, GC &gc, F &&f){
+    Stats::inc(Stat::Remove);
+    Hotspot::sampleKey(key);
+    // rootの付け替えに失敗してやり直す場合も、最初に削除したvalueを返す
+    Value *removed = nullptr;
 retry:
     auto old_root = root.load(std::memory_order_acquire);
-    auto pair = ::masstree::put_at_layer0(old_root, key, value, gc); // ここでもretry
+    if(old_root == nullptr){
+      return removed;
+    }
+    // new_treeはnullptrとなる場合もあるので注意
+    auto new_root = ::masstree::remove_with(old_root, key, gc, removed, f).second;
+    key.reset();
+    if(old_root != new_root){
+      auto cas_success = root.compare_exchange_weak(old_root, new_root);
+      if(cas_success){
+        return removed;
+      }else {
+        // new_rootがnullではないのなら、それはrootでないNodeを指すことになる
+        goto retry;
+      }
+    }
+    return removed;
+  }
+
+  /**
+   * [lo, hi)に含まれるkeyを全て削除する。
+   * 下のLayerが丸ごと範囲に含まれる時は、そのLayerを一度に切り離してgcに渡す。
+   * そうでない時は、BorderNodeごとにまとめて削除する。
+   * @return 削除したkeyの数
+   */
+  size_t removeRange(const Key &lo, const Key &hi, GC &gc){
+    return removeRangeFrom(lo, &hi, gc);
+  }
+
+  /**
+   * prefixで始まるkey(prefix自身も含む)を全て削除する。
+   * 最後のsliceが8byteの時はprefixがLayerの境界と一致するので、下のLayerは一度に切り離される。
+   * そうでない時は、prefixの次のbyte列を上限とする範囲削除になる。
+   * @return 削除したkeyの数
+   */
+  size_t removePrefix(const Key &prefix, GC &gc){
+    // prefixで始まる全てのkeyより大きい、最小のkey。
+    // 最後のsliceのlastSliceSize byte目に1を足し、あふれたら前のsliceに繰り上げる
+    auto slices = prefix.slices;
+    auto unit = KeySlice(1) << (8 * (8 - prefix.lastSliceSize));
+    slices.back() &= ~(unit - 1);
+    while(!slices.empty() and slices.back() > UINT64_MAX - unit){
+      slices.pop_back();
+      unit = 1;
+    }
+    if(slices.empty()){
+      return removeRangeFrom(prefix, nullptr, gc);
+    }
+    slices.back() += unit;
+    // 長さ1は、このsliceを持つkeyの中で最も小さい
+    Key hi(std::move(slices), 1);
+    return removeRangeFrom(prefix, &hi, gc);
+  }
+
+
+  /**
+   * putのflat combiningを使うか。詳しくはPutCombinerを参照。
+   * 同じBorderNodeに多くのthreadがputする時に、lockの受け渡しを減らす。
+   * 他のthreadが操作していない時に呼ぶ。
+   */
+  void setCombining(bool enabled){
+    combiner = enabled ? std::make_unique<PutCombiner>() : nullptr;
+  }
+
+  /**
+   * 全てのkeyを小さい順にf(key, value)に渡す。
+   * 他の操作と並行して呼んでよい。各BorderNodeは検証付きで読むが、scan全体としてはsnapshotではない。
+   * @param f bool(const Key &, Value *)。falseを返すとscanを終える
+   */
+  template<typename F>
+  void scan(F &&f){
+    ScanState state{};
+    scanFrom(state, f);
+  }
+
+  /**
+   * from以上のkeyを小さい順にf(key, value)に渡す。
+   */
+  template<typename F>
+  void scan(const Key &from, F &&f){
+    ScanState state{};
+    state.from = from;
+    scanFrom(state, f);
+  }
+
+  /**
+   * layer0のkeyを先頭のsliceで、おおよそparts個の範囲に分ける境界を返す。
+   * 境界はInteriorNodeの子の境界から選ぶので、各範囲は木の別の部分を読む事になる。
+   * 詳しくはpartition_layerを参照。
+   */
+  [[nodiscard]]
+  std::vector<KeySlice> partition(size_t parts) const{
+    std::vector<KeySlice> boundaries{};
+retry:
+    auto root_ = root.load(std::memory_order_acquire);
+    if(root_ == nullptr){
+      return {};
+    }
+    if(!partition_layer(root_, parts, boundaries)){
+      // layer0のrootが消えた
+      goto retry;
+    }
+    return boundaries;
+  }
+
+  /**
+   * prefixで始まるkeyの入る、下のLayerへのhandleを返す。
+   * prefixは8byte単位で、最後のsliceも8byteでなければならない。
+   */
+  Subtree subtree(const Key &prefix);
+
+  /**
+   * 全てのLayerを辿り、木の形とメモリ使用量を集計する。
+   * 書き込みと並行して呼んでよいが、その場合はおおよその値となる。
+   * 各Nodeはversionを検証して読む。詳しくはcollect_node_statsを参照。
+   * @return
+   */
+  TreeStats stats() const{
+    TreeStats result{};
+    auto root_ = root.load(std::memory_order_acquire);
+    if(root_ != nullptr){
+      collect_tree_stats(root_, 0, result);
+    }
+    return result;
+  }
+
+  /**
+   * removeによって疎になったBorderNodeを詰め直し、removeされたslotのメモリを解放する。
+   * 他の操作と並行して呼んでよい。詳しくはcompact_layerを参照。
+   * @param gc 外したNodeとValueを受け取る
+   * @return
+   */
+  CompactResult compact(GC &gc){
+    CompactResult result{};
+    auto root_ = root.load(std::memory_order_acquire);
+    if(root_ != nullptr){
+      compact_layer(root_, gc, result);
+    }
+    return result;
+  }
+
+private:
+  friend class Subtree;
+  friend class Transaction;
+
+  template<typename F>
+  void scanFrom(ScanState &state, F &f){
+retry:
+    auto root_ = root.load(std::memory_order_acquire);
+    if(root_ == nullptr){
+      return;
+    }
+    std::vector<KeySlice> path{};
+    if(scan_layer(root_, path, state, f) == ScanLayerGone){
+      // layer0のrootが消えた
+      goto retry;
+    }
+  }
+
+  /**
+   * remove_rangeをlayer0のrootから行い、rootの変更を反映する。
+   * @param hi nullptrの時は上限なし
+   */
+  size_t removeRangeFrom(const Key &lo, const Key *hi, GC &gc){
+    size_t removed = 0;
+retry:
+    auto old_root = root.load(std::memory_order_acquire);
+    RemoveRange range{lo, hi, gc};
+    ::masstree::remove_range(old_root, range);
+    removed += range.removed;
+    if(range.root_changed and !root.compare_exchange_strong(old_root, range.root)){
+      // rootが他のthreadに変えられていた。残りを消し直す
+      goto retry;
+    }
+    return removed;
+  }
+
+  /**
+   * put_withをlayer0のrootから行い、rootの変更を反映する。
+   * fはput_withと同じく、BorderNodeのlockを取った状態で呼ばれる。
+   * ただし、空のtreeに対する新しいtreeの生成で他のthreadに負けた場合は、
+   * fが再び呼ばれる事がある。
+   */
+  template<typename F>
+  void putWith(Key &key, F &&f, GC &gc, LeafHint *hint = nullptr, PutCombiner *combiner_ = nullptr,
+               Value *published = nullptr){
+    Stats::inc(Stat::Put);
+    Hotspot::sampleKey(key);
+retry:
+    auto old_root = root.load(std::memory_order_acquire);
+    auto pair = ::masstree::put_with(old_root, key, f, gc, hint, combiner_, published);
     if(pair.first == RetryFromUpperLayer){
+      // 下のLayerからのやり直しはput内で処理されるので、ここに来るのは
+      // Layer0のrootがdeleteされた時のみ
+      Stats::inc(Stat::RetryFromUpperLayer);
       goto retry;
     }
     auto new_root = pair.second;
@@ -28,16 +355,22 @@ retry:
     // treeが空だった場合
     // 他のputと、新しいtree生成の競争が発生する
     if(old_root == nullptr){
-      auto cas_success = root.compare_exchange_weak(old_root, new_root);
+      if(new_root == nullptr){
+        // fが何も入れなかった
+        return;
+      }
+      auto cas_success = root.compare_exchange_strong(old_root, new_root);
       if(cas_success){
         return;
       }else{
         // treeが他によって更新された場合はせっかく作った木を消して、もう一度処理をやり直す
         // old_rootがnullだった場合は、new_rootは必ずBorderNodeとなる
-        assert(new_root != nullptr);
         assert(new_root->getIsBorder());
-        new_root->setDeleted(true);
-        gc.add(reinterpret_cast<BorderNode*>(new_root));
+        auto discarded = reinterpret_cast<BorderNode*>(new_root);
+        // valueはやり直しでまた使われるかもしれないので、一緒に解放されないように外しておく
+        discarded->setLV(0, LinkOrValue{});
+        discarded->setDeleted(true);
+        gc.add(discarded);
         goto retry;
       }
     }
@@ -52,31 +385,146 @@ retry:
     }
   }
 
-  void remove(Key &key, GC &gc){
+  std::atomic<Node *> root{nullptr};
+  // nullptrの時はflat combiningを使わない
+  std::unique_ptr<PutCombiner> combiner{};
+};
+
+/**
+ * prefixで始まるkeyだけが入るLayerへのhandle。
+ * そのLayerのrootを覚えておき、get/put/scanを上のLayerを辿らずに行う。
+ * keyは先頭からのkeyを渡し、prefixで始まり、prefixより長くなければならない。
+ *
+ * Layerは最初のkeyがsuffixとして上のLayerに入っている間は無く、
+ * 最後のkeyのremove(handle_delete_layer_in_remove)やremoveRangeでも消える。
+ * rootがdeletedになっていたらlayer0から辿り直し、Layerが無い時はMasstreeの操作に任せる。
+ * 覚えているrootを書き換えるので、一つのthreadで使う。
+ */
+class Subtree{
+public:
+  Subtree(Masstree &tree_, const Key &prefix_)
+  : tree(tree_)
+  , prefix(prefix_.slices)
+  {
+    assert(prefix_.lastSliceSize == 8);
+  }
+
+  Value *get(Key &key){
+    assert(inPrefix(key));
 retry:
-    auto old_root = root.load(std::memory_order_acquire);
-    if(old_root == nullptr){
+    auto root = layerRoot();
+    if(root == nullptr){
+      return tree.get(key);
+    }
+    Stats::inc(Stat::Get);
+    key.cursor = prefix.size();
+    auto v = ::masstree::get(root, key);
+    key.reset();
+    if(v == nullptr and root->getDeleted()){
+      // 読んでいる間にLayerが消えたので、keyは上のLayerに移ったかもしれない
+      cached_root = nullptr;
+      goto retry;
+    }
+    return v;
+  }
+
+  void put(Key &key, Value *value, GC &gc){
+    assert(inPrefix(key));
+retry:
+    auto root = layerRoot();
+    if(root == nullptr){
+      // Layerはputで作られるかもしれないので、次の操作で辿り直す
+      tree.put(key, value, gc);
       return;
     }
-    // new_treeはnullptrとなる場合もあるので注意
-    auto new_root = ::masstree::remove_at_layer0(old_root, key, gc);
+    Stats::inc(Stat::Put);
+    key.cursor = prefix.size();
+    auto pair = put_with(root, key, [value](Value *){ return value; }, gc);
     key.reset();
-    if(old_root != new_root){
-      auto cas_success = root.compare_exchange_weak(old_root, new_root);
-      if(cas_success){
-        return;
-      }else {
-        // new_rootがnullではないのなら、それはrootでないNodeを指すことになる
-        goto retry;
-      }
+    if(pair.first == RetryFromUpperLayer){
+      Stats::inc(Stat::RetryFromUpperLayer);
+      cached_root = nullptr;
+      goto retry;
     }
+    // splitでLayerのrootが変わった。上のLayerからの付け替えはsplitの中で行われている
+    cached_root = pair.second;
   }
 
+  /**
+   * prefixで始まるkeyを小さい順にf(key, value)に渡す。prefix自身は含まない。
+   * @param f bool(const Key &, Value *)。falseを返すとscanを終える
+   */
+  template<typename F>
+  void scan(F &&f){
+    ScanState state{};
+    scanFrom(state, f);
+  }
 
+  template<typename F>
+  void scan(const Key &from, F &&f){
+    ScanState state{};
+    state.from = from;
+    scanFrom(state, f);
+  }
 
 private:
-  std::atomic<Node *> root{nullptr};
+  [[nodiscard]]
+  bool inPrefix(const Key &key) const{
+    return shares_path(key, prefix);
+  }
+
+  /**
+   * 覚えているLayerのrootを返す。消えていたらlayer0から辿り直す。
+   * @return Layerが無い時はnullptr
+   */
+  Node *layerRoot(){
+    if(cached_root != nullptr and !cached_root->getDeleted()){
+      return cached_root;
+    }
+    auto slices = prefix;
+    slices.push_back(0);
+    Key probe(std::move(slices), 8);
+    cached_root = find_layer(tree.root.load(std::memory_order_acquire), probe, prefix.size());
+    return cached_root;
+  }
+
+  template<typename F>
+  void scanFrom(ScanState &state, F &f){
+retry:
+    auto root = layerRoot();
+    if(root == nullptr){
+      // Layerが無い時は、layer0から辿ってprefixで始まるkeyだけを渡す
+      Key begin(prefix, 8);
+      tree.scan(begin, [this, &state, &f](const Key &key, Value *value){
+        if(key.slices.size() == prefix.size()){
+          // prefix自身
+          return true;
+        }
+        if(!inPrefix(key)){
+          return false;
+        }
+        if(!state.wants(key)){
+          return true;
+        }
+        return static_cast<bool>(f(key, value));
+      });
+      return;
+    }
+    auto path = prefix;
+    if(scan_layer(root, path, state, f) == ScanLayerGone){
+      cached_root = nullptr;
+      goto retry;
+    }
+  }
+
+  Masstree &tree;
+  std::vector<KeySlice> prefix;
+  Node *cached_root = nullptr;
 };
+
+inline Subtree Masstree::subtree(const Key &prefix){
+  return Subtree(*this, prefix);
+}
 }
 
 #endif //MASSTREE_MASSTREE_H
@@ -0,0 +1,268 @@
+#ifndef MASSTREE_MVCC_H
+#define MASSTREE_MVCC_H
+
+#include "masstree.h"
+#include <mutex>
+#include <set>
+#include <vector>
+#include <xmmintrin.h>
+
+namespace masstree{
+
+/**
+ * valueを上書きせず、keyごとのversionの列として持つMasstree。
+ * treeに入っているValueが最新のversionで、Value::getOlderで古いversionに辿れる。
+ * 各versionにはputした時のtimestampが付き、Snapshotはそのtimestamp以下の
+ * 最新のversionを読む。scanの間に他のthreadがputしても、Snapshotの時点の値が見える。
+ *
+ * timestampはBorderNodeのlockを取っている間にclockから取るので、一つのkeyのversionの列は
+ * timestampの降順に並ぶ。putはversionを入れた後、timestampの順にcommittedを進める。
+ * Snapshotはcommittedを読むので、それ以下のversionは全て入っている。
+ * 前のtimestampのputが終わるまで次のputは戻らないので、putの途中で止まったthreadがあると
+ * 他のputも待たされる。
+ *
+ * 古いversionは、putの時に、どのSnapshotからも見えなくなったものをgcに渡す。
+ * removeはtombstoneのversionを入れるだけで、keyはtreeに残る。
+ */
+class MvccMasstree{
+public:
+  /**
+   * timestamp以下のversionを読むためのhandle。破棄されるまで、そのversionは解放されない。
+   */
+  class Snapshot{
+  public:
+    Snapshot(const Snapshot &other) = delete;
+    Snapshot &operator=(const Snapshot &other) = delete;
+
+    Snapshot(Snapshot &&other) noexcept
+    : owner(other.owner)
+    , registered(other.registered)
+    , timestamp(other.timestamp)
+    {
+      other.owner = nullptr;
+    }
+
+    ~Snapshot(){
+      if(owner != nullptr){
+        owner->release(registered);
+      }
+    }
+
+    [[nodiscard]]
+    uint64_t getTimestamp() const{
+      return timestamp;
+    }
+
+  private:
+    friend class MvccMasstree;
+
+    Snapshot(MvccMasstree *owner_, uint64_t registered_, uint64_t timestamp_)
+    : owner(owner_)
+    , registered(registered_)
+    , timestamp(timestamp_)
+    {}
+
+    MvccMasstree *owner;
+    // 古いversionを残す境界として登録した値。timestamp以下となる
+    uint64_t registered;
+    uint64_t timestamp;
+  };
+
+  MvccMasstree() = default;
+  MvccMasstree(const MvccMasstree &other) = delete;
+  MvccMasstree &operator=(const MvccMasstree &other) = delete;
+
+  /**
+   * 現在commitされている全てのputが見えるSnapshotを作る。
+   */
+  Snapshot snapshot(){
+    uint64_t registered;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      registered = committed.load();
+      active.insert(registered);
+      oldest_active.store(*active.begin());
+    }
+    /**
+     * 登録してからcommittedを読み直す。
+     * pruneが登録を見なかったなら、pruneの読んだcommittedはこれ以下なので、
+     * このtimestampで見えるversionは消されていない。
+     */
+    return Snapshot(this, registered, committed.load());
+  }
+
+  /**
+   * keyの最新のversionを読む。
+   */
+  Value *get(Key &key){
+    auto v = tree.get(key);
+    return v == nullptr or v->isTombstone() ? nullptr : v;
+  }
+
+  /**
+   * snapshotの時点のversionを読む。
+   */
+  Value *get(Key &key, const Snapshot &snapshot){
+    return visible(tree.get(key), snapshot.getTimestamp());
+  }
+
+  /**
+   * valueをkeyの新しいversionとして入れる。valueは他のputに渡してはならない。
+   */
+  void put(Key &key, Value *value, GC &gc){
+    std::vector<uint64_t> tickets{};
+    tree.upsert(key, [this, value, &tickets, &gc](Value *old){
+      install(value, old, tickets, gc);
+      return value;
+    }, gc);
+    commit(tickets);
+  }
+
+  /**
+   * keyにtombstoneのversionを入れる。
+   * @return keyがあったか
+   */
+  bool remove(Key &key, GC &gc){
+    std::vector<uint64_t> tickets{};
+    Value *tombstone = nullptr;
+    bool found = false;
+    tree.upsert(key, [this, &tombstone, &tickets, &found, &gc](Value *old) -> Value *{
+      found = old != nullptr and !old->isTombstone();
+      if(!found){
+        return nullptr;
+      }
+      if(tombstone == nullptr){
+        tombstone = Value::tombstone();
+      }
+      install(tombstone, old, tickets, gc);
+      return tombstone;
+    }, gc);
+    if(!found and tombstone != nullptr){
+      // 空のtreeへのputとの競争でやり直し、keyが無くなっていた
+      delete tombstone;
+    }
+    commit(tickets);
+    return found;
+  }
+
+  /**
+   * snapshotの時点で見える全てのkeyを、小さい順にf(key, value)に渡す。
+   * @param f bool(const Key &, Value *)。falseを返すとscanを終える
+   */
+  template<typename F>
+  void scan(const Snapshot &snapshot, F &&f){
+    auto ts = snapshot.getTimestamp();
+    tree.scan([ts, &f](const Key &key, Value *head){
+      auto v = visible(head, ts);
+      return v == nullptr or static_cast<bool>(f(key, v));
+    });
+  }
+
+  template<typename F>
+  void scan(const Key &from, const Snapshot &snapshot, F &&f){
+    auto ts = snapshot.getTimestamp();
+    tree.scan(from, [ts, &f](const Key &key, Value *head){
+      auto v = visible(head, ts);
+      return v == nullptr or static_cast<bool>(f(key, v));
+    });
+  }
+
+  /**
+   * 最後にcommitされたputのtimestamp
+   */
+  [[nodiscard]]
+  uint64_t lastCommitted() const{
+    return committed.load(std::memory_order_acquire);
+  }
+
+  /**
+   * 中のMasstreeを直接触る。statsやcompactに使う。valueはversionの列の先頭となる。
+   */
+  Masstree &getTree(){
+    return tree;
+  }
+
+private:
+  /**
+   * headから辿って、timestamp以下で最新のversionを返す。tombstoneの時はnullptr。
+   */
+  static Value *visible(Value *head, uint64_t timestamp){
+    auto v = head;
+    while(v != nullptr and v->getTimestamp() > timestamp){
+      v = v->getOlder();
+    }
+    return v == nullptr or v->isTombstone() ? nullptr : v;
+  }
+
+  /**
+   * BorderNodeのlockを取った状態で、valueにtimestampを付けてoldの前に繋ぐ。
+   * 空のtreeへのputで他のthreadに負けた時は、もう一度呼ばれる。
+   * その時は新しいtimestampを取り、前のtimestampは何も入れずにcommitする。
+   */
+  void install(Value *value, Value *old, std::vector<uint64_t> &tickets, GC &gc){
+    auto ts = clock.fetch_add(1) + 1;
+    tickets.push_back(ts);
+    value->setTimestamp(ts);
+    value->setOlder(old);
+    prune(value, horizon(), gc);
+  }
+
+  /**
+   * timestampの順に、committedをticketsまで進める。
+   */
+  void commit(const std::vector<uint64_t> &tickets){
+    for(auto ts: tickets){
+      while(committed.load(std::memory_order_acquire) + 1 != ts){
+        _mm_pause();
+      }
+      committed.store(ts, std::memory_order_release);
+    }
+  }
+
+  /**
+   * これより古いversionは、どのSnapshotからも見えない
+   */
+  uint64_t horizon() const{
+    auto c = committed.load();
+    auto o = oldest_active.load();
+    return std::min(c, o);
+  }
+
+  /**
+   * headからhorizon以下で最新のversionを探し、それより古いversionを外してgcに渡す。
+   */
+  static void prune(Value *head, uint64_t horizon, GC &gc){
+    auto v = head;
+    while(v != nullptr and v->getTimestamp() > horizon){
+      v = v->getOlder();
+    }
+    if(v == nullptr){
+      return;
+    }
+    auto tail = v->detachOlder();
+    if(tail != nullptr){
+      // 解放されるとtailより古いversionも一緒に解放される
+      gc.add(tail);
+    }
+  }
+
+  void release(uint64_t registered){
+    std::lock_guard<std::mutex> lock(mutex);
+    active.erase(active.find(registered));
+    oldest_active.store(active.empty() ? UINT64_MAX : *active.begin());
+  }
+
+  Masstree tree{};
+  // 最後に配ったtimestamp
+  std::atomic<uint64_t> clock{0};
+  // このtimestamp以下のputは全て入っている
+  std::atomic<uint64_t> committed{0};
+  std::mutex mutex{};
+  std::multiset<uint64_t> active{};
+  // activeの最小値。無ければUINT64_MAX
+  std::atomic<uint64_t> oldest_active{UINT64_MAX};
+};
+
+}
+
+#endif //MASSTREE_MVCC_H
@@ -0,0 +1,7 @@
+#include "node_alloc.h"
+
+namespace masstree{
+
+std::atomic<NodeAllocPolicy *> node_alloc_policy = nullptr;
+
+}
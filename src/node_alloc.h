@@ -0,0 +1,71 @@
+#ifndef MASSTREE_NODE_ALLOC_H
+#define MASSTREE_NODE_ALLOC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <new>
+
+namespace masstree{
+
+enum class NodeKind : uint8_t{
+  Border,
+  Interior
+};
+
+/**
+ * 新しく作るNodeの種類と、それが入るLayerの深さ(layer0が0)。
+ * NodeAllocPolicyが置き場所を決める手がかりにする。
+ */
+struct NodePlacement{
+  NodeKind kind = NodeKind::Border;
+  size_t layer = 0;
+};
+
+/**
+ * Nodeのメモリの確保と解放の方針。
+ * set_node_alloc_policyで差し替える。確保したNodeは同じpolicyで解放されるので、
+ * Nodeが一つでも残っている間に差し替えたり、policyを破棄してはならない。
+ */
+class NodeAllocPolicy{
+public:
+  virtual ~NodeAllocPolicy() = default;
+
+  virtual void *allocate(size_t size, NodePlacement placement) = 0;
+
+  virtual void deallocate(void *p, size_t size) = 0;
+};
+
+// nullptrの時は::operator newで確保する
+extern std::atomic<NodeAllocPolicy *> node_alloc_policy;
+
+/**
+ * @param policy nullptrで元に戻す
+ */
+[[maybe_unused]]
+static void set_node_alloc_policy(NodeAllocPolicy *policy){
+  node_alloc_policy.store(policy, std::memory_order_release);
+}
+
+[[maybe_unused]]
+static void *allocate_node(size_t size, NodePlacement placement){
+  auto policy = node_alloc_policy.load(std::memory_order_acquire);
+  if(policy == nullptr){
+    return ::operator new(size);
+  }
+  return policy->allocate(size, placement);
+}
+
+[[maybe_unused]]
+static void deallocate_node(void *p, size_t size){
+  auto policy = node_alloc_policy.load(std::memory_order_acquire);
+  if(policy == nullptr){
+    ::operator delete(p);
+    return;
+  }
+  policy->deallocate(p, size);
+}
+
+}
+
+#endif //MASSTREE_NODE_ALLOC_H
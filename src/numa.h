@@ -0,0 +1,352 @@
+#ifndef MASSTREE_NUMA_H
+#define MASSTREE_NUMA_H
+
+#include "node_alloc.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace masstree{
+
+/**
+ * sysfsのcpulist形式("0-3,8,10-11")を読む。
+ */
+static std::vector<int> parse_cpulist(const std::string &s){
+  std::vector<int> result{};
+  size_t pos = 0;
+  while(pos < s.size()){
+    auto end = s.find(',', pos);
+    if(end == std::string::npos){
+      end = s.size();
+    }
+    auto item = s.substr(pos, end - pos);
+    pos = end + 1;
+    if(item.empty() or item == "\n"){
+      continue;
+    }
+    auto dash = item.find('-');
+    auto lo = std::stoi(item.substr(0, dash));
+    auto hi = dash == std::string::npos ? lo : std::stoi(item.substr(dash + 1));
+    for(auto i = lo; i <= hi; ++i){
+      result.push_back(i);
+    }
+  }
+  return result;
+}
+
+/**
+ * NUMA nodeと、それぞれに属するCPU。
+ */
+struct NumaTopology{
+  std::vector<int> nodes{};
+  // nodes[i]に属するCPU
+  std::vector<std::vector<int>> cpus{};
+
+  /**
+   * /sys/devices/system/node から読む。
+   * 読めない時は、全てのCPUを持つnode 0が一つだけあるものとする。
+   */
+  static NumaTopology load(){
+    NumaTopology t{};
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string line{};
+    if(online and std::getline(online, line)){
+      for(auto node: parse_cpulist(line)){
+        std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list{};
+        std::getline(cpulist, list);
+        t.nodes.push_back(node);
+        t.cpus.push_back(parse_cpulist(list));
+      }
+    }
+    if(t.nodes.empty()){
+      t.nodes.push_back(0);
+      t.cpus.emplace_back();
+      for(int i = 0; i < static_cast<int>(std::thread::hardware_concurrency()); ++i){
+        t.cpus.back().push_back(i);
+      }
+    }
+    return t;
+  }
+};
+
+/**
+ * このthreadが今動いているNUMA node。分からない時は0。
+ */
+static int current_numa_node(){
+  unsigned cpu = 0, node = 0;
+  if(syscall(SYS_getcpu, &cpu, &node, nullptr) != 0){
+    return 0;
+  }
+  return static_cast<int>(node);
+}
+
+/**
+ * このthreadが作るBorderNodeを置くNUMA node。-1の時はthreadが今動いているnode。
+ * shardを持つthreadが、NumaOwnerScopeでshardのnodeを指定する。
+ */
+inline thread_local int numa_owner_node = -1;
+
+/**
+ * scopeの間だけ、numa_owner_nodeをnodeにする。
+ */
+class NumaOwnerScope{
+public:
+  explicit NumaOwnerScope(int node)
+  : saved(numa_owner_node)
+  {
+    numa_owner_node = node;
+  }
+
+  ~NumaOwnerScope(){
+    numa_owner_node = saved;
+  }
+
+  NumaOwnerScope(const NumaOwnerScope &) = delete;
+  NumaOwnerScope &operator=(const NumaOwnerScope &) = delete;
+
+private:
+  int saved;
+};
+
+/**
+ * 一つの置き場所(あるnode、またはinterleave)からNodeを切り出す。
+ * CHUNK_SIZEに揃えてmmapした領域にmbindで置き場所を指定し、先頭にこのarenaへのpointerを置く。
+ * 解放されたNodeは大きさごとのfree listに戻し、同じarenaで再利用する。
+ * mbindが使えない環境(権限やkernelの設定)では、first touchの置き場所になる。
+ *
+ * 各threadはarenaと大きさごとに自分のfree listを持ち、確保と解放は普段そこで済ませる。
+ * arenaのmutexを取るのは、CACHE_BATCH個ずつまとめて補充する時と戻す時だけである。
+ * threadが終わった時に手元に残っていたNodeはarenaに戻らず、arenaを消す時にchunkごと解放される。
+ */
+class NumaArena{
+public:
+  static constexpr size_t CHUNK_SIZE = 2 * 1024 * 1024;
+  // chunkの先頭に置くarenaへのpointerの分。cache lineに揃えておく
+  static constexpr size_t CHUNK_HEADER = 64;
+  // threadのfree listとarenaの間で、一度に出し入れするNodeの数
+  static constexpr size_t CACHE_BATCH = 32;
+
+  /**
+   * @param node_ -1の時はinterleave_nodesにinterleaveする
+   */
+  NumaArena(int node_, std::vector<int> interleave_nodes_)
+  : node(node_)
+  , interleave_nodes(std::move(interleave_nodes_))
+  , id(next_id.fetch_add(1, std::memory_order_relaxed))
+  {}
+
+  ~NumaArena(){
+    for(auto chunk: chunks){
+      munmap(chunk, CHUNK_SIZE);
+    }
+  }
+
+  NumaArena(const NumaArena &) = delete;
+  NumaArena &operator=(const NumaArena &) = delete;
+
+  void *allocate(size_t size){
+    size = round_up(size);
+    assert(size <= CHUNK_SIZE - CHUNK_HEADER);
+    auto &cache = localCache(size);
+    if(cache.empty()){
+      refill(cache, size);
+    }
+    auto p = cache.back();
+    cache.pop_back();
+    return p;
+  }
+
+  void deallocate(void *p, size_t size){
+    size = round_up(size);
+    auto &cache = localCache(size);
+    cache.push_back(p);
+    if(cache.size() >= 2 * CACHE_BATCH){
+      // 手元に溜め過ぎないよう、半分をarenaに戻して他のthreadが使えるようにする
+      std::lock_guard<std::mutex> lock(mutex);
+      auto &list = free_lists[size];
+      list.insert(list.end(), cache.end() - CACHE_BATCH, cache.end());
+      cache.resize(cache.size() - CACHE_BATCH);
+    }
+  }
+
+  /**
+   * pを切り出したarena
+   */
+  static NumaArena *owner(void *p){
+    auto chunk = reinterpret_cast<uintptr_t>(p) & ~(CHUNK_SIZE - 1);
+    return *reinterpret_cast<NumaArena **>(chunk);
+  }
+
+private:
+  /**
+   * threadが持つ、一つのarenaの一つの大きさのfree list
+   */
+  struct CacheEntry{
+    uint64_t arena;
+    size_t size;
+    std::vector<void *> blocks;
+  };
+
+  static size_t round_up(size_t size){
+    return (size + 15) & ~size_t(15);
+  }
+
+  /**
+   * このthreadの、このarenaのsizeのfree list。
+   * 消えたarenaと同じaddressに新しいarenaが作られても混ざらないよう、arenaはidで見分ける。
+   */
+  std::vector<void *> &localCache(size_t size){
+    thread_local std::vector<CacheEntry> caches{};
+    for(auto &c: caches){
+      if(c.arena == id and c.size == size){
+        return c.blocks;
+      }
+    }
+    caches.push_back(CacheEntry{id, size, {}});
+    return caches.back().blocks;
+  }
+
+  /**
+   * arenaのfree listから、足りなければchunkから切り出して、cacheにCACHE_BATCH個入れる。
+   */
+  void refill(std::vector<void *> &cache, size_t size){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &list = free_lists[size];
+    auto from_list = std::min(list.size(), CACHE_BATCH);
+    cache.insert(cache.end(), list.end() - from_list, list.end());
+    list.resize(list.size() - from_list);
+    for(auto i = from_list; i < CACHE_BATCH; ++i){
+      if(left < size){
+        newChunk();
+      }
+      cache.push_back(cur);
+      cur += size;
+      left -= size;
+    }
+  }
+
+  void newChunk(){
+    // CHUNK_SIZEに揃った領域を得るため、倍の大きさでmapしてから前後を外す
+    auto raw = mmap(nullptr, CHUNK_SIZE * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED){
+      throw std::bad_alloc();
+    }
+    auto begin = reinterpret_cast<uintptr_t>(raw);
+    auto aligned = (begin + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+    if(aligned != begin){
+      munmap(raw, aligned - begin);
+    }
+    munmap(reinterpret_cast<void *>(aligned + CHUNK_SIZE), begin + CHUNK_SIZE - aligned);
+    auto chunk = reinterpret_cast<char *>(aligned);
+    bind(chunk);
+
+    *reinterpret_cast<NumaArena **>(chunk) = this;
+    chunks.push_back(chunk);
+    cur = chunk + CHUNK_HEADER;
+    left = CHUNK_SIZE - CHUNK_HEADER;
+  }
+
+  /**
+   * まだ触っていないchunkのpageの置き場所を指定する。失敗しても無視する。
+   */
+  void bind(char *chunk){
+    // <numaif.h>のMPOL_PREFERRED, MPOL_INTERLEAVE
+    constexpr int mpol_preferred = 1;
+    constexpr int mpol_interleave = 3;
+    constexpr size_t mask_bits = 1024;
+    unsigned long mask[mask_bits / (8 * sizeof(unsigned long))] = {};
+    auto set = [&mask](int n){
+      if(0 <= n and static_cast<size_t>(n) < mask_bits){
+        mask[n / (8 * sizeof(unsigned long))] |= 1UL << (n % (8 * sizeof(unsigned long)));
+      }
+    };
+    if(node < 0){
+      for(auto n: interleave_nodes){
+        set(n);
+      }
+    }else{
+      set(node);
+    }
+    auto mode = node < 0 ? mpol_interleave : mpol_preferred;
+    syscall(SYS_mbind, chunk, CHUNK_SIZE, mode, mask, mask_bits + 1, 0);
+  }
+
+  static inline std::atomic<uint64_t> next_id{0};
+
+  const int node;
+  const std::vector<int> interleave_nodes;
+  const uint64_t id;
+  std::mutex mutex{};
+  std::vector<char *> chunks{};
+  std::unordered_map<size_t, std::vector<void *>> free_lists{};
+  char *cur = nullptr;
+  size_t left = 0;
+};
+
+/**
+ * 上のLayerとInteriorNodeは全てのnodeにinterleaveし、
+ * それより下のLayerのBorderNodeはshardを持つthreadのnode(numa_owner_node)に置く。
+ *
+ * 上のLayerとInteriorNodeはどのthreadのlookupでも辿るので、一つのnodeのメモリ帯域に
+ * 集中しないように散らす。BorderNodeはkeyとvalueを持ち、shardを持つthreadが
+ * 主に読み書きするので、そのthreadの近くに置く。
+ */
+class NumaNodeAllocPolicy: public NodeAllocPolicy{
+public:
+  /**
+   * @param interleave_layers_ この深さより上のLayerのBorderNodeもinterleaveする
+   */
+  explicit NumaNodeAllocPolicy(size_t interleave_layers_ = 1, NumaTopology topology_ = NumaTopology::load())
+  : interleave_layers(interleave_layers_)
+  , topology(std::move(topology_))
+  , interleaved(-1, topology.nodes)
+  {
+    for(auto node: topology.nodes){
+      local.emplace(node, std::make_unique<NumaArena>(node, topology.nodes));
+    }
+  }
+
+  void *allocate(size_t size, NodePlacement placement) override{
+    if(placement.kind == NodeKind::Interior or placement.layer < interleave_layers){
+      return interleaved.allocate(size);
+    }
+    auto node = numa_owner_node >= 0 ? numa_owner_node : current_numa_node();
+    auto it = local.find(node);
+    if(it == local.end()){
+      return interleaved.allocate(size);
+    }
+    return it->second->allocate(size);
+  }
+
+  void deallocate(void *p, size_t size) override{
+    NumaArena::owner(p)->deallocate(p, size);
+  }
+
+  [[nodiscard]]
+  const NumaTopology &getTopology() const{
+    return topology;
+  }
+
+private:
+  const size_t interleave_layers;
+  const NumaTopology topology;
+  NumaArena interleaved;
+  std::unordered_map<int, std::unique_ptr<NumaArena>> local{};
+};
+
+}
+
+#endif //MASSTREE_NUMA_H
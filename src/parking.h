@@ -0,0 +1,40 @@
+#ifndef MASSTREE_PARKING_H
+#define MASSTREE_PARKING_H
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace masstree{
+
+/**
+ * MASSTREE_PARKING_LOCKが定義されている時、Node::lockとNode::stableVersionは
+ * この回数だけ回ってもversionが変わらなければ、futexで眠る。
+ * coreより多くのthreadを動かす時に、lockを持ったthreadが止まっている間、
+ * 待つ側がtime sliceを使い切らないようにする。
+ */
+static constexpr size_t PARK_AFTER_SPINS = 1024;
+
+/**
+ * 4byteのwordがexpectedである間眠る。wordが既に違う時や、signalで起こされた時にも返るので、
+ * 呼び出し側は読み直して確かめる。
+ */
+[[maybe_unused]]
+static void futex_wait(const void *word, uint32_t expected){
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+/**
+ * wordで眠っている全てのthreadを起こす。
+ */
+[[maybe_unused]]
+static void futex_wake_all(const void *word){
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+}
+
+#endif //MASSTREE_PARKING_H
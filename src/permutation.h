@@ -2,11 +2,26 @@
 #define MASSTREE_PERMUTATION_H
 
 #include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <vector>
 
 namespace masstree{
 
+/**
+ * BorderNodeのslotの並びを表す。
+ * 上位のnibbleから順に位置0~14のslotのindexを持ち、最下位のnibbleはkeyの数を持つ。
+ *
+ * 15個の位置には常に0~14のslotが一つずつ入っている。
+ * 先頭のgetNumKeys()個が使われているslotで、残りは空いているslotである。
+ * 空いているslotは、一度も使われていないもの、removeされたものの順に並ぶので、
+ * insertは空いている先頭(back())を取り、removeは外したslotを最後に回す。
+ */
 struct Permutation{
-  uint64_t body = 0;
+  // 位置iにslot iが入った、keyの無いPermutation
+  static constexpr uint64_t EMPTY = 0x0123'4567'89AB'CDE0LLU;
+
+  uint64_t body = EMPTY;
 
   Permutation() = default;
   Permutation(const Permutation &other) = default;
@@ -58,20 +73,49 @@ struct Permutation{
     assert(0 <= check and check <= 14);
   }
 
-  inline void removeIndex(uint8_t true_index){
-    uint8_t removed_ps_index;
-    for(uint8_t i = 0; i < getNumKeys(); ++i){
-      if(getKeyIndex(i) == true_index){
-        removed_ps_index = i;
-        break;
-      }
-    }
-    for(uint8_t target = removed_ps_index; target + 1 <= getNumKeys() - 1; ++target){
-      setKeyIndex(target, getKeyIndex(target+1));
+  /**
+   * true_indexの入っている位置を、先頭のgetNumKeys()個の中から探す。
+   * 各nibbleをtrue_indexとxorし、0になったnibbleを桁上がり無しで見つける。
+   * @return 無い時は15
+   */
+  [[nodiscard]]
+  inline size_t findIndex(uint8_t true_index) const{
+    constexpr uint64_t LOW3 = 0x7777'7777'7777'7777LLU;
+    auto x = body ^ (true_index * 0x1111'1111'1111'1111LLU);
+    // 0のnibbleのみ最上位bitが立つ
+    auto zero = ~(((x & LOW3) + LOW3) | x | LOW3);
+    zero &= ~(~0LLU >> (getNumKeys() * 4));
+    if(zero == 0){
+      return 15;
     }
+    // 位置iはnibble 15 - iにあるので、最も上位のものが最も前
+    return static_cast<size_t>(__builtin_clzll(zero)) / 4;
+  }
+
+  /**
+   * true_indexを取り除き、後ろの位置を一つずつ前に詰める。
+   * 取り除いたtrue_indexは最後の位置に回すので、空いているslotの中で最も後に再利用される。
+   */
+  inline void removeIndex(uint8_t true_index){
+    auto ps = findIndex(true_index);
+    assert(ps < getNumKeys());
+    // [ps, 14]の位置のnibble
+    auto range = (~0LLU >> (ps * 4)) & ~0b1111LLU;
+    body = (body & ~range)
+      | ((body & range) << 4 & range)
+      | (static_cast<uint64_t>(true_index) << 4);
     decNumKeys();
   }
 
+  /**
+   * 次のinsertで使う、空いているslot
+   */
+  [[nodiscard]]
+  inline uint8_t back() const{
+    assert(isNotFull());
+    return (body >> (15 - getNumKeys()) * 4) & 0b1111LLU;
+  }
+
   /**
    * getKeyIndexのsyntax sugar.
    * @param i
@@ -92,11 +136,19 @@ struct Permutation{
     return !isNotFull();
   }
 
+  /**
+   * insertion_point_ps以降の位置を一つずつ後ろにずらし、空いた位置にindex_tsを入れる。
+   * getNumKeys()の位置にあったものは消えるので、index_tsにはback()を渡す。
+   */
   void insert(size_t insertion_point_ps, size_t index_ts){
-    for(size_t i = getNumKeys(); i > insertion_point_ps; --i){ // 右シフト
-      setKeyIndex(i, getKeyIndex(i - 1));
-    }
-    setKeyIndex(insertion_point_ps, index_ts);
+    assert(insertion_point_ps <= getNumKeys() and isNotFull());
+    assert(index_ts <= 14);
+    auto n = getNumKeys();
+    // [insertion_point_ps, n]の位置のnibble
+    auto range = (~0LLU >> (insertion_point_ps * 4)) & ~(~0LLU >> ((n + 1) * 4));
+    body = (body & ~range)
+      | ((body & range) >> 4 & range)
+      | (static_cast<uint64_t>(index_ts) << (15 - insertion_point_ps) * 4);
     incNumKeys();
   }
 
@@ -106,25 +158,32 @@ struct Permutation{
    * @return
    */
   static Permutation sizeOne(){
-    Permutation p{};
-    p.setNumKeys(1);
-    p.setKeyIndex(0,0);
-    return p;
+    return fromSorted(1);
   }
 
+  /**
+   * slot 0~n_keys-1をこの順に使っているPermutation
+   */
   static Permutation fromSorted(size_t n_keys){
     Permutation p{};
-    for(size_t i = 0; i < n_keys; ++i){
-      p.setKeyIndex(i,i);
-    }
     p.setNumKeys(n_keys);
     return p;
   }
 
+  /**
+   * vecの順にslotを使い、残りのslotは小さい順に空いているものとする。
+   */
   static Permutation from(const std::vector<size_t> &vec){
     Permutation p{};
+    uint16_t used = 0;
     for(size_t i = 0; i < vec.size(); ++i){
       p.setKeyIndex(i, vec[i]);
+      used |= 1u << vec[i];
+    }
+    for(size_t i = 0, ps = vec.size(); i < 15; ++i){
+      if((used & (1u << i)) == 0){
+        p.setKeyIndex(ps++, i);
+      }
     }
     p.setNumKeys(vec.size());
     return p;
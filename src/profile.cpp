@@ -0,0 +1,84 @@
+#include "profile.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace masstree{
+
+#ifdef MASSTREE_PROFILE
+
+namespace {
+
+/**
+ * 生きている各threadのThreadProfileと、終了したthreadの集計結果を持つ。
+ */
+struct ProfileRegistry{
+  std::mutex mutex{};
+  std::vector<ThreadProfile*> live{};
+  ProfileSnapshot retired{};
+};
+
+ProfileRegistry &registry(){
+  // thread終了時のdestructorから触られるので、解放しない
+  static auto r = new ProfileRegistry{};
+  return *r;
+}
+
+/**
+ * threadごとにThreadProfileを確保し、thread終了時にregistryに退避する。
+ */
+struct LocalProfileHolder{
+  ThreadProfile *profile = new ThreadProfile{};
+
+  LocalProfileHolder(){
+    auto &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.live.push_back(profile);
+  }
+
+  ~LocalProfileHolder(){
+    auto &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    profile->addTo(r.retired);
+    r.live.erase(std::find(r.live.begin(), r.live.end(), profile));
+    delete profile;
+  }
+};
+
+}
+
+ThreadProfile &localThreadProfile(){
+  thread_local LocalProfileHolder holder{};
+  return *holder.profile;
+}
+
+ProfileSnapshot Profiler::collect(){
+  auto &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  ProfileSnapshot snap = r.retired;
+  for(auto p: r.live){
+    p->addTo(snap);
+  }
+  return snap;
+}
+
+void Profiler::reset(){
+  auto &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  r.retired = ProfileSnapshot{};
+  for(auto p: r.live){
+    p->reset();
+  }
+}
+
+#else
+
+ProfileSnapshot Profiler::collect(){
+  return ProfileSnapshot{};
+}
+
+void Profiler::reset(){}
+
+#endif
+
+}
@@ -0,0 +1,220 @@
+#ifndef MASSTREE_PROFILE_H
+#define MASSTREE_PROFILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <iostream>
+#ifdef MASSTREE_PROFILE
+#include <x86intrin.h>
+#endif
+
+namespace masstree{
+
+/**
+ * 一回の操作の中で、時間を測る区間。
+ * LockWaitはSplitの中でも測られるので、区間は重なる事がある。
+ */
+enum class Phase : size_t{
+  // findBorderでrootからBorderNodeまで降りる
+  Descent,
+  // BorderNodeの中でkeyを探す(extractLinkOrValueWithIndexFor)
+  LeafSearch,
+  // Node::lock
+  LockWait,
+  // splitと、親への挿入を上に辿る処理
+  Split,
+  // 新しいLayerの作成(handle_break_invariant)
+  LayerCreation,
+  // get/putで、途中までの処理を捨ててやり直した時の、捨てた分の時間
+  Retry,
+  Count
+};
+
+static constexpr size_t PHASE_COUNT = static_cast<size_t>(Phase::Count);
+// i番目のbucketには、[2^(i-1), 2^i) cycleの区間を数える。0番目は0 cycle
+static constexpr size_t PROFILE_BUCKETS = 64;
+
+/**
+ * 一つの区間のcycle数のhistogram。
+ */
+struct PhaseHistogram{
+  std::array<uint64_t, PROFILE_BUCKETS> buckets{};
+  uint64_t count = 0;
+  uint64_t cycles = 0;
+
+  [[nodiscard]]
+  double mean() const{
+    return count != 0 ? static_cast<double>(cycles) / count : 0.0;
+  }
+
+  /**
+   * @param q 0以上1以下
+   * @return q分位点が入るbucketの上限のcycle数
+   */
+  [[nodiscard]]
+  uint64_t quantile(double q) const{
+    if(count == 0){
+      return 0;
+    }
+    auto rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1;
+    uint64_t seen = 0;
+    for(size_t i = 0; i < PROFILE_BUCKETS; ++i){
+      seen += buckets[i];
+      if(seen >= rank){
+        return i == 0 ? 0 : (uint64_t(1) << i) - 1;
+      }
+    }
+    return UINT64_MAX;
+  }
+};
+
+/**
+ * 全threadのhistogramを集計した結果。
+ */
+struct ProfileSnapshot{
+  std::array<PhaseHistogram, PHASE_COUNT> phases{};
+
+  const PhaseHistogram &operator[](Phase p) const{
+    return phases[static_cast<size_t>(p)];
+  }
+
+  void print() const{
+    static constexpr const char *names[PHASE_COUNT] = {
+      "Descent", "LeafSearch", "LockWait", "Split", "LayerCreation", "Retry"
+    };
+    for(size_t i = 0; i < PHASE_COUNT; ++i){
+      auto &h = phases[i];
+      std::cout << names[i] << ": count=" << h.count << " mean=" << h.mean()
+                << " p50<=" << h.quantile(0.5) << " p99<=" << h.quantile(0.99)
+                << " p999<=" << h.quantile(0.999) << " max<=" << h.quantile(1.0)
+                << " cycles" << std::endl;
+    }
+  }
+};
+
+#ifdef MASSTREE_PROFILE
+
+/**
+ * 一つのthreadが書き込むhistogram。
+ * 書き込むのは持ち主のthreadのみで、集計するthreadはrelaxedで読む。
+ */
+struct alignas(64) ThreadProfile{
+  struct Histogram{
+    std::array<std::atomic<uint64_t>, PROFILE_BUCKETS> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> cycles{0};
+  };
+  std::array<Histogram, PHASE_COUNT> phases{};
+
+  static void bump(std::atomic<uint64_t> &c, uint64_t n = 1){
+    // 書き込むのは自分のthreadのみなので、fetch_addは必要ない
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  void add(Phase p, uint64_t cycles){
+    auto &h = phases[static_cast<size_t>(p)];
+    size_t bucket = cycles == 0 ? 0 : 64 - __builtin_clzll(cycles);
+    bump(h.buckets[bucket < PROFILE_BUCKETS ? bucket : PROFILE_BUCKETS - 1]);
+    bump(h.count);
+    bump(h.cycles, cycles);
+  }
+
+  void addTo(ProfileSnapshot &snap) const{
+    for(size_t i = 0; i < PHASE_COUNT; ++i){
+      auto &from = phases[i];
+      auto &to = snap.phases[i];
+      for(size_t j = 0; j < PROFILE_BUCKETS; ++j){
+        to.buckets[j] += from.buckets[j].load(std::memory_order_relaxed);
+      }
+      to.count += from.count.load(std::memory_order_relaxed);
+      to.cycles += from.cycles.load(std::memory_order_relaxed);
+    }
+  }
+
+  void reset(){
+    for(auto &h: phases){
+      for(auto &b: h.buckets) b.store(0, std::memory_order_relaxed);
+      h.count.store(0, std::memory_order_relaxed);
+      h.cycles.store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+/**
+ * 現在のthreadのThreadProfileを返す。初回の呼び出しで登録される。
+ * threadが終了すると、その値は集計用に退避される。
+ */
+ThreadProfile &localThreadProfile();
+
+#endif
+
+/**
+ * 操作の中の区間ごとの時間を、rdtscのcycle数でthreadごとのhistogramに数える。
+ * MASSTREE_PROFILEが定義されていない時には、全ての関数は空になる。
+ */
+class Profiler{
+public:
+  /**
+   * 区間の始まりに呼び、返り値をrecordに渡す。
+   */
+  static uint64_t now(){
+#ifdef MASSTREE_PROFILE
+    return __rdtsc();
+#else
+    return 0;
+#endif
+  }
+
+  static void record(Phase p, uint64_t start){
+#ifdef MASSTREE_PROFILE
+    auto end = __rdtsc();
+    localThreadProfile().add(p, end > start ? end - start : 0);
+#else
+    (void)p; (void)start;
+#endif
+  }
+
+  /**
+   * 全threadのhistogramを集計する。
+   * 他のthreadが動いている間に呼んだ場合は、おおよその値となる。
+   */
+  static ProfileSnapshot collect();
+
+  static void reset();
+
+  static constexpr bool enabled(){
+#ifdef MASSTREE_PROFILE
+    return true;
+#else
+    return false;
+#endif
+  }
+};
+
+/**
+ * 作ってから壊すまでを、一つの区間として数える。
+ */
+class PhaseTimer{
+public:
+  explicit PhaseTimer(Phase p_)
+  : p(p_)
+  , start(Profiler::now())
+  {}
+
+  PhaseTimer(const PhaseTimer &other) = delete;
+  PhaseTimer &operator=(const PhaseTimer &other) = delete;
+
+  ~PhaseTimer(){
+    Profiler::record(p, start);
+  }
+
+private:
+  Phase p;
+  uint64_t start;
+};
+
+}
+
+#endif //MASSTREE_PROFILE_H
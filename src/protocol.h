@@ -0,0 +1,244 @@
+#ifndef MASSTREE_PROTOCOL_H
+#define MASSTREE_PROTOCOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace masstree{
+
+/**
+ * masstree_serverとclientの間のbinary protocol。
+ * 整数は全てlittle endianで、一つのframeは次の形をとる。
+ *
+ * request:  u32 body_len | u8 op | u16 key_len | key | (Putの時) i32 value | (Scanの時) u32 limit
+ * response: u32 body_len | u8 status | payload
+ *
+ * responseのpayloadはopとstatusで決まる。
+ *   Get, RemoveでOk: i32 value
+ *   ScanでOk: u32 count | count個の(u16 key_len | key | i32 value)
+ *   それ以外: 無し
+ *
+ * clientはresponseを待たずに次のrequestを送ってよい(pipelining)。
+ * serverは一つの接続のresponseを、requestと同じ順で返す。
+ * Scanのkeyは空でもよく、その時は先頭から読む。それ以外のopのkeyは1byte以上。
+ */
+namespace protocol{
+
+enum class Op : uint8_t{
+  Get = 1,
+  Put = 2,
+  Remove = 3,
+  Scan = 4
+};
+
+enum class Status : uint8_t{
+  Ok = 0,
+  NotFound = 1,
+  BadRequest = 2
+};
+
+// これより大きいframeは壊れているものとみなす
+static constexpr uint32_t MAX_FRAME = 1u << 20;
+static constexpr uint32_t MAX_KEY = UINT16_MAX;
+
+struct Request{
+  Op op = Op::Get;
+  std::string key{};
+  int32_t value = 0;
+  uint32_t limit = 0;
+};
+
+struct Response{
+  Status status = Status::Ok;
+  int32_t value = 0;
+  std::vector<std::pair<std::string, int32_t>> entries{};
+};
+
+enum class DecodeResult : uint8_t{
+  Done,
+  // frameがまだ全て届いていない
+  Incomplete,
+  // 接続を切るしかない
+  Malformed
+};
+
+template<typename T>
+static void put_int(std::string &out, T x){
+  char buf[sizeof(T)];
+  std::memcpy(buf, &x, sizeof(T));
+  out.append(buf, sizeof(T));
+}
+
+template<typename T>
+static T get_int(const char *p){
+  T x;
+  std::memcpy(&x, p, sizeof(T));
+  return x;
+}
+
+/**
+ * body_lenを後で埋めるframeを始める。
+ * @return body_lenの位置
+ */
+static size_t begin_frame(std::string &out){
+  auto pos = out.size();
+  put_int<uint32_t>(out, 0);
+  return pos;
+}
+
+static void end_frame(std::string &out, size_t pos){
+  auto len = static_cast<uint32_t>(out.size() - pos - sizeof(uint32_t));
+  std::memcpy(&out[pos], &len, sizeof(len));
+}
+
+[[maybe_unused]]
+static void encode_request(const Request &req, std::string &out){
+  auto pos = begin_frame(out);
+  put_int<uint8_t>(out, static_cast<uint8_t>(req.op));
+  put_int<uint16_t>(out, static_cast<uint16_t>(req.key.size()));
+  out += req.key;
+  if(req.op == Op::Put){
+    put_int<int32_t>(out, req.value);
+  }else if(req.op == Op::Scan){
+    put_int<uint32_t>(out, req.limit);
+  }
+  end_frame(out, pos);
+}
+
+/**
+ * data[0, size)の先頭のframeを読む。
+ * @param[out] req
+ * @param[out] consumed Doneの時、読んだbyte数
+ */
+[[maybe_unused]]
+static DecodeResult decode_request(const char *data, size_t size, Request &req, size_t &consumed){
+  if(size < sizeof(uint32_t)){
+    return DecodeResult::Incomplete;
+  }
+  auto body_len = get_int<uint32_t>(data);
+  if(body_len > MAX_FRAME or body_len < 3){
+    return DecodeResult::Malformed;
+  }
+  if(size < sizeof(uint32_t) + body_len){
+    return DecodeResult::Incomplete;
+  }
+  auto p = data + sizeof(uint32_t);
+  auto end = p + body_len;
+  req.op = static_cast<Op>(get_int<uint8_t>(p));
+  auto key_len = get_int<uint16_t>(p + 1);
+  p += 3;
+  size_t rest;
+  switch(req.op){
+    case Op::Get:
+    case Op::Remove:
+      rest = 0;
+      break;
+    case Op::Put:
+      rest = sizeof(int32_t);
+      break;
+    case Op::Scan:
+      rest = sizeof(uint32_t);
+      break;
+    default:
+      return DecodeResult::Malformed;
+  }
+  if(static_cast<size_t>(end - p) != key_len + rest){
+    return DecodeResult::Malformed;
+  }
+  req.key.assign(p, key_len);
+  p += key_len;
+  if(req.op == Op::Put){
+    req.value = get_int<int32_t>(p);
+  }else if(req.op == Op::Scan){
+    req.limit = get_int<uint32_t>(p);
+  }
+  consumed = sizeof(uint32_t) + body_len;
+  return DecodeResult::Done;
+}
+
+[[maybe_unused]]
+static void encode_response(Op op, const Response &resp, std::string &out){
+  auto pos = begin_frame(out);
+  put_int<uint8_t>(out, static_cast<uint8_t>(resp.status));
+  if(resp.status == Status::Ok){
+    if(op == Op::Get or op == Op::Remove){
+      put_int<int32_t>(out, resp.value);
+    }else if(op == Op::Scan){
+      put_int<uint32_t>(out, static_cast<uint32_t>(resp.entries.size()));
+      for(auto &entry: resp.entries){
+        put_int<uint16_t>(out, static_cast<uint16_t>(entry.first.size()));
+        out += entry.first;
+        put_int<int32_t>(out, entry.second);
+      }
+    }
+  }
+  end_frame(out, pos);
+}
+
+/**
+ * opのrequestに対するresponseを読む。
+ * @param[out] resp
+ * @param[out] consumed Doneの時、読んだbyte数
+ */
+[[maybe_unused]]
+static DecodeResult decode_response(Op op, const char *data, size_t size, Response &resp, size_t &consumed){
+  if(size < sizeof(uint32_t)){
+    return DecodeResult::Incomplete;
+  }
+  auto body_len = get_int<uint32_t>(data);
+  if(body_len < 1 or body_len > MAX_FRAME){
+    return DecodeResult::Malformed;
+  }
+  if(size < sizeof(uint32_t) + body_len){
+    return DecodeResult::Incomplete;
+  }
+  auto p = data + sizeof(uint32_t);
+  auto end = p + body_len;
+  resp.status = static_cast<Status>(get_int<uint8_t>(p));
+  ++p;
+  resp.entries.clear();
+  if(resp.status == Status::Ok){
+    if(op == Op::Get or op == Op::Remove){
+      if(end - p != sizeof(int32_t)){
+        return DecodeResult::Malformed;
+      }
+      resp.value = get_int<int32_t>(p);
+      p += sizeof(int32_t);
+    }else if(op == Op::Scan){
+      if(end - p < static_cast<ptrdiff_t>(sizeof(uint32_t))){
+        return DecodeResult::Malformed;
+      }
+      auto count = get_int<uint32_t>(p);
+      p += sizeof(uint32_t);
+      for(uint32_t i = 0; i < count; ++i){
+        if(end - p < static_cast<ptrdiff_t>(sizeof(uint16_t))){
+          return DecodeResult::Malformed;
+        }
+        auto key_len = get_int<uint16_t>(p);
+        p += sizeof(uint16_t);
+        if(end - p < static_cast<ptrdiff_t>(key_len + sizeof(int32_t))){
+          return DecodeResult::Malformed;
+        }
+        std::string key(p, key_len);
+        p += key_len;
+        resp.entries.emplace_back(std::move(key), get_int<int32_t>(p));
+        p += sizeof(int32_t);
+      }
+    }
+  }
+  if(p != end){
+    return DecodeResult::Malformed;
+  }
+  consumed = sizeof(uint32_t) + body_len;
+  return DecodeResult::Done;
+}
+
+}
+
+}
+
+#endif //MASSTREE_PROTOCOL_H
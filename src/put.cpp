@@ -4,6 +4,8 @@ namespace masstree{
 
 #ifndef NDEBUG
 Sleeper put_mark_unstable{};
+SequentialHandler put_handler1{};
+Marker put_resume_marker{};
 #endif
 
 }
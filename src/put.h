@@ -2,6 +2,8 @@
 #define MASSTREE_PUT_H
 
 #include "tree.h"
+#include "hint.h"
+#include "combining.h"
 #include "alloc.h"
 #include "gc.h"
 #include "debug_helper.h"
@@ -11,6 +13,10 @@ namespace masstree{
 
 #ifndef NDEBUG
 extern Sleeper put_mark_unstable;
+// 下のLayerでBorderNodeを見つけ、lockする直前のポイント
+extern SequentialHandler put_handler1;
+// 下のLayerが消えて、LayerFrameに記録した上のLayerのBorderNodeから再開したポイント
+extern Marker put_resume_marker;
 #endif
 
 enum PutResult : uint8_t{
@@ -25,7 +31,7 @@ enum PutResult : uint8_t{
  * @return
  */
 static BorderNode *start_new_tree(const Key &key, Value *value){
-  auto root = new BorderNode{};
+  auto root = new (NodePlacement{NodeKind::Border, key.cursor}) BorderNode{};
 #ifndef NDEBUG
   Alloc::incBorder();
 #endif
@@ -87,6 +93,7 @@ static std::optional<size_t> check_break_invariant(BorderNode * const borderNode
  */
 static void handle_break_invariant(BorderNode *n, Key &key, size_t old_index, GC &gc){
   assert(n->isLocked());
+  PhaseTimer timer(Phase::LayerCreation);
   if(n->getKeyLen(old_index) == BorderNode::key_len_has_suffix){
     /**
     * """
@@ -101,7 +108,8 @@ static void handle_break_invariant(BorderNode *n, Key &key, size_t old_index, GC
     *
     * @see §4.6.3
     */
-    auto n1 = new BorderNode{};
+    // 新しいLayerは一つ下の深さに入る
+    auto n1 = new (NodePlacement{NodeKind::Border, key.cursor + 1}) BorderNode{};
 #ifndef NDEBUG
     Alloc::incBorder();
 #endif
@@ -153,6 +161,7 @@ static void handle_break_invariant(BorderNode *n, Key &key, size_t old_index, GC
 /**
  * Corresponds to insert_into_leaf in B+tree.
  * 前提: borderに空きがある。
+ * put_runでは一つのlockの間に何度も呼ばれるので、insertingが既に立っている事がある。
  * @param border
  * @param key
  * @param value
@@ -160,7 +169,6 @@ static void handle_break_invariant(BorderNode *n, Key &key, size_t old_index, GC
 static void insert_into_border(BorderNode *border, const Key &key, Value *value, GC &gc){
   assert(border->isLocked());
   assert(!border->getSplitting());
-  assert(!border->getInserting());
   auto p = border->getPermutation();
   assert(p.isNotFull());
 
@@ -176,18 +184,23 @@ static void insert_into_border(BorderNode *border, const Key &key, Value *value,
   auto insertion_point_ts = pair.first;
   auto reuse = pair.second;
 
+  // v_insertを進め、keyが無い事を読んだTransactionに挿入を知らせる(src/transaction.h)
+  border->setInserting(true);
   if(reuse){
     // key len = 0のslotと違い、ここには古いValueとSuffixが残る。
     // これをどのタイミングでdeleteするのか、どのタイミングで参照を外すのか、また何で初期化するかが非常にキモになる。
     // 下手に0で初期化しても、それは「全てが0のバイナリ列」と区別がつかないので、新しい値と古い値の間にそういった状態を発生させるべきではない。
     // writer-writer conflictはlockで対処、readerはpermutationしか見ないので問題ないのでは？
-    border->setInserting(true);
 
     auto suffix = border->getKeySuffixes().get(insertion_point_ts);
     if(suffix != nullptr){
       gc.add(suffix);
     }
-    gc.add(border->getLV(insertion_point_ts).value);
+    // removeの時点でvalueはGCに渡され、参照は外されている
+    auto old_value = border->getLV(insertion_point_ts).value;
+    if(old_value != nullptr){
+      gc.add(old_value);
+    }
   }
 
   // クリアしておく。ここでクリアしないと、Suffixを上書きし損ねる
@@ -487,15 +500,16 @@ static void split_keys_among(BorderNode *n, BorderNode *n1, const Key &k, Value
  * @param left
  * @param slice
  * @param right
+ * @param layer left, rightが入っているLayerの深さ
  * @return
  */
-static InteriorNode *create_root_with_children(Node *left, KeySlice slice, Node *right){
+static InteriorNode *create_root_with_children(Node *left, KeySlice slice, Node *right, size_t layer){
   assert(left->getIsRoot());
   assert(left->getParent() == nullptr);
   assert(right->getParent() == nullptr);
   assert(left->isLocked());
   assert(right->isLocked());
-  auto root = new InteriorNode{};
+  auto root = new (NodePlacement{NodeKind::Interior, layer}) InteriorNode{};
 #ifndef NDEBUG
   Alloc::incInterior();
 #endif
@@ -504,8 +518,11 @@ static InteriorNode *create_root_with_children(Node *left, KeySlice slice, Node
   root->setIsRoot(true);
   root->setUpperLayer(upper);
   if(upper != nullptr){
-    auto left_index = upper->findNextLayerIndex(left);
-    upper->setLV(left_index, LinkOrValue(root));
+    // removeRangeでLayerごと切り離されていた場合は、付け替える先が無い
+    auto left_index = upper->tryFindNextLayerIndex(left);
+    if(left_index){
+      upper->setLV(left_index.value(), LinkOrValue(root));
+    }
   }
   root->setNumKeys(1);
   root->setKeySlice(0, slice);
@@ -555,25 +572,15 @@ static void insert_into_parent(InteriorNode *p, Node *n1, KeySlice slice, size_t
 }
 
 /**
- *
- * @param n
- * @param k
- * @param value
+ * splitで出来たn1を、nの親に入れる。親がfullなら親もsplitし、rootまで辿る。
+ * 前提: nとn1はlockされていて、n1はnの右に繋がっている。
+ * @param layer nとn1が入っているLayerの深さ
+ * @param keep_n1_locked n1をlockしたまま返す。続けてn1の右のNodeを入れる時に使う
  * @return new root if not nullptr.
  */
-static Node *split(Node *n, const Key &k, Value *value){
-  // precondition: n locked.
-  assert(n->isLocked());
-  Node *n1 = new BorderNode{};
-#ifndef NDEBUG
-    Alloc::incBorder();
-#endif
-  n->setSplitting(true);
-  // n1 is initially locked
-  n1->setVersion(n->getVersion());
-  split_keys_among(
-    reinterpret_cast<BorderNode *>(n),
-    reinterpret_cast<BorderNode *>(n1), k, value);
+static Node *insert_split_into_parents(Node *n, Node *n1, size_t layer, bool keep_n1_locked){
+  // 最後までlockしておくNode
+  Node *keep = keep_n1_locked ? n1 : nullptr;
   std::optional<KeySlice> pull_up = std::nullopt;
 ascend:
   assert(n->isLocked());
@@ -584,9 +591,11 @@ ascend:
 
   if(p == nullptr){
     auto up = pull_up ? pull_up.value() : reinterpret_cast<BorderNode*>(n1)->getKeySlice(0);
-    p = create_root_with_children(n, up, n1);
+    p = create_root_with_children(n, up, n1, layer);
     n->unlock();
-    n1->unlock();
+    if(n1 != keep){
+      n1->unlock();
+    }
     return p;
   }else if(p->isNotFull()){
     p->setInserting(true);
@@ -595,7 +604,9 @@ ascend:
     insert_into_parent(p, n1, up ,n_index);
     // NOTE: ここはreorderできるのかもしれない。
     n->unlock();
-    n1->unlock();
+    if(n1 != keep){
+      n1->unlock();
+    }
     p->unlock();
     return nullptr;
   }else{ // pはfull
@@ -603,7 +614,7 @@ ascend:
     p->setSplitting(true);
     size_t n_index = p->findChildIndex(n);
     n->unlock();
-    Node *p1 = new InteriorNode{};
+    Node *p1 = new (NodePlacement{NodeKind::Interior, layer}) InteriorNode{};
 #ifndef NDEBUG
     Alloc::incInterior();
 #endif
@@ -612,36 +623,135 @@ ascend:
     split_keys_among(
       reinterpret_cast<InteriorNode *>(p),
       reinterpret_cast<InteriorNode *>(p1), up, n1, n_index, pull_up);
-    n1->unlock();
+    if(n1 != keep){
+      n1->unlock();
+    }
     assert(n->getParent()->debug_contain_child(n));
     assert(n1->getParent()->debug_contain_child(n1));
     n = p; n1 = p1; goto ascend;
   }
 }
 
+/**
+ *
+ * @param n
+ * @param k
+ * @param value
+ * @return new root if not nullptr.
+ */
+static Node *split(Node *n, const Key &k, Value *value){
+  // precondition: n locked.
+  assert(n->isLocked());
+  PhaseTimer timer(Phase::Split);
+  Node *n1 = new (NodePlacement{NodeKind::Border, k.cursor}) BorderNode{};
+#ifndef NDEBUG
+    Alloc::incBorder();
+#endif
+  n->setSplitting(true);
+  Stats::incSplit(k.cursor);
+  // n1 is initially locked
+  n1->setVersion(n->getVersion());
+  split_keys_among(
+    reinterpret_cast<BorderNode *>(n),
+    reinterpret_cast<BorderNode *>(n1), k, value);
+  return insert_split_into_parents(n, n1, k.cursor, false);
+}
+
+
+
 
+/**
+ * nに公開されたputを、nのlockを持ったまま行う。PutCombinerを参照。
+ * keyがnに入らない時、splitやLayerの作成が必要な時は断る。
+ * 上書きされた古いvalueは、lockを持っているputのgcに渡す。
+ */
+static void combine_pending(BorderNode *n, PutCombiner &combiner, GC &gc){
+  assert(n->isLocked());
+  combiner.forEachPending(n, [n, &gc](PutCombiner::Slot &slot){
+    auto now = n->getVersion();
+    if(now.deleted or now.v_split != slot.v_split){
+      return PutCombiner::Rejected;
+    }
+    auto &k = *slot.key;
+    auto t_lv_i = n->extractLinkOrValueWithIndexFor(k);
+    auto t = std::get<0>(t_lv_i);
+    if(t == VALUE){
+      auto old = std::get<1>(t_lv_i).value;
+      if(slot.value != old){
+        gc.add(old);
+        n->setLV(std::get<2>(t_lv_i), LinkOrValue(slot.value));
+      }
+    }else if(t == NOTFOUND and n->getPermutation().isNotFull() and !check_break_invariant(n, k)){
+      insert_into_border(n, k, slot.value, gc);
+    }else{
+      return PutCombiner::Rejected;
+    }
+    Stats::inc(Stat::CombinedPut);
+    return PutCombiner::Applied;
+  });
+}
 
+/**
+ * putがnext_layerへ降りる時に、降りる前のLayerの状態を記録しておく。
+ * 下のLayerがdeleteされてRetryFromUpperLayerとなった時には、
+ * layer0から降り直すのではなく、ここに記録されたBorderNodeから再開する。
+ */
+struct LayerFrame{
+  // そのLayerのroot
+  Node *root;
+  // next_layerへのlinkを持っていたBorderNode
+  BorderNode *border;
+  // unlockする直前のborderのversion
+  Version version;
+};
 
 /**
- * treeにkey-valueを配置する。
- * @param root 各layerのroot
+ * treeのkeyに対応するvalueを、fの結果で置き換える。
+ * Layerを降りる処理は再帰ではなくループで行い、通過したLayerをstackに積んでおく。
+ *
+ * fは、keyが入っている(あるいは入るべき)BorderNodeのlockを取った状態で一度だけ呼ばれる。
+ * fの引数は現在のvalueで、keyが無ければnullptrとなる。
+ * fの戻り値が新しいvalueとなる。nullptrか現在のvalueと同じものを返した場合は、何もしない。
+ * 上書きされた古いvalueはgcに渡される。ただし新しいvalueのolderが古いvalueの時は渡さない。
+ * @param root layer0のroot
  * @param key
- * @param value
- * @param upper_layer rootをnext_layerとして持つnode
- * @param upper_index rootをnext_layerとして持つnode中のindex
- * @return
+ * @param f Value*(Value*)
+ * @param hint nullptrでなければ、findBorderの代わりにこれを使う
+ * @param combiner nullptrでなければ、unlockする前に公開されたputを行う
+ * @param published combinerと共に渡すと、見つけたBorderNodeがlockされていた時に、
+ * このvalueを公開してlockを持っているputに入れてもらう。fが常にこれを返す時(put)にのみ使う
+ * @return layer0においてrootが変わった場合は新しいroot
  */
-[[maybe_unused]]
-static std::pair<PutResult,Node*> put(Node *root, Key &k, Value *value, GC &gc){
+template<typename F>
+static std::pair<PutResult,Node*> put_with(Node *root, Key &k, F &&f, GC &gc, LeafHint *hint = nullptr,
+                                           PutCombiner *combiner = nullptr, Value *published = nullptr){
   if(root == nullptr){
     // Layer0が空の時のみここに来る
     assert(k.cursor == 0);
+    Value *value = f(nullptr);
+    if(value == nullptr){
+      return std::make_pair(Done, nullptr);
+    }
     return std::make_pair(Done,start_new_tree(k, value));
   }
+  // 末尾が一つ上のLayerとなる
+  std::vector<LayerFrame> layers{};
+  Node *layer_root = root;
 retry:
-  auto n_v = findBorder(root, k); auto n = n_v.first; auto v = n_v.second;
+  // やり直した時に、捨てた分の時間を数えるため
+  auto attempt = Profiler::now();
+  auto n_v = findBorder(layer_root, k, hint); auto n = n_v.first; auto v = n_v.second;
+  Hotspot::sampleNode(n);
+#ifndef NDEBUG
+  if(!layers.empty()){
+    put_handler1.giveAndWaitBackIfUsed();
+  }
+#endif
+  if(published != nullptr and combiner != nullptr and combiner->tryPublish(n, v, k, published)){
+    // lockを持っているputが、unlockする前に入れてくれた
+    return std::make_pair(Done, root);
+  }
   n->lock();
-  v = n->getVersion();
   /**
    * putの場合はfindBorderでnをゲットしたら、すぐにlockをする
    * lockをする直前にそのnodeがdeletedになるかもしれないし、
@@ -653,15 +763,42 @@ retry:
 forward:
   assert(n->isLocked());
   auto p = n->getPermutation();
-  if(v.deleted){
+  // deletedはlockした後のversionで見る。vはsplitの検出のため、findBorderで読んだものを残しておく
+  auto now = n->getVersion();
+  if(now.deleted){
     n->unlock();
-    if(v.is_root){
+    // 降りてきたLayerのrootがremoveで畳まれてdeletedになっていれば、その子へのpointerは古くなっていく。
+    // そこから探し直しても消えたNodeにしか辿り着かない事があるので、上のLayerのlinkを読み直す。
+    if(now.is_root or (!layers.empty() and layer_root->getDeleted())){
       // 探していたKeyを入れるべきBorderNodeが上のLayerに行ってしまった時、あるいはLayer0が消えた時
       // getの時と同じように、putは途中まではただのreaderなのでこのような状況は
       // 発生しうる。
-      // 一つ上のlayerに戻ってやり直す。
-      return std::make_pair(RetryFromUpperLayer, nullptr);
+      Profiler::record(Phase::Retry, attempt);
+      if(layers.empty()){
+        // Layer0が消えたので、呼び出し元で新しいrootからやり直す。
+        return std::make_pair(RetryFromUpperLayer, nullptr);
+      }
+      // 一つ上のLayerに戻り、降りる前にいたBorderNodeから再開する。
+      Stats::inc(Stat::RetryFromUpperLayer);
+#ifndef NDEBUG
+      put_resume_marker.markIfUsed();
+#endif
+      attempt = Profiler::now();
+      auto frame = layers.back(); layers.pop_back();
+      k.back();
+      layer_root = frame.root;
+      n = frame.border;
+      n->lock();
+      if(n->getDeleted()){
+        // 上のLayerのBorderNodeも既にdeleteされていたなら、そのLayerのrootから探し直す。
+        n->unlock();
+        goto retry;
+      }
+      // splitされていた場合は、forwardでnextを辿る。
+      v = frame.version;
+      goto forward;
     }else{
+      Profiler::record(Phase::Retry, attempt);
       goto retry;
     }
   }
@@ -671,9 +808,14 @@ forward:
   auto index = std::get<2>(t_lv_i);
   if(Version::splitHappened(v, n->getVersion())){
     // findBorderとlockの間でsplit処理が起きたら
+    Profiler::record(Phase::Retry, attempt);
+    attempt = Profiler::now();
     auto next = n->getNext();
+    // nに留まる時に、同じsplitを何度も検出しないようにする
+    v = n->getVersion();
     n->unlock();
-    assert(next != nullptr); // splitが起きたのだから、Nextは必ずある
+    // splitが起きてもNextがあるとは限らない。LayerFrameから再開した時のように、
+    // vを読んでから時間が経っていれば、splitで出来たNodeが既にremoveで消えている事もある
     while (!v.deleted and next != nullptr and k.getCurrentSlice().slice >= next->lowestKey()){
       n = next; v = n->stableVersion(); next = n->getNext();
     }
@@ -683,45 +825,56 @@ forward:
     // insertをする
     auto check = check_break_invariant(n, k);
     if(check){
+      // ここではfを呼ばない。新しいLayerでkeyを入れる時に呼ぶ。
       auto old_index = check.value();
       handle_break_invariant(n, k, old_index, gc);
       auto next_layer = n->getLV(old_index).next_layer;
+      layers.push_back(LayerFrame{layer_root, n, n->getVersion()});
       n->unlock();
       k.next();
-      auto pair = put(next_layer, k, value, gc);
-      if(pair.first == RetryFromUpperLayer){
-        k.back();
-        goto retry;
-      }
+      layer_root = next_layer;
+      goto retry;
     }else{
-      if(p.isNotFull()){
+      Value *value = f(nullptr);
+      if(value == nullptr){
+        n->unlock();
+      }else if(p.isNotFull()){
         insert_into_border(n, k, value, gc);
+        if(combiner != nullptr){
+          combine_pending(n, *combiner, gc);
+        }
         n->unlock();
       }else{
         auto may_new_root = split(n, k, value);
-        if(may_new_root != nullptr){
-          // rootがsplitによって新しくなったので、Layer0以外においては
-          // 上のlayerのlv.next_layerを更新する必要がある
-          // 古いupper layerをlockし、(lockedParent)と同じ要領
-          // それから、upper layerのlvを書き換え。
-          // その入れ替え作業はsplitの中で行おう。
+        if(may_new_root != nullptr and layers.empty()){
+          // rootがsplitによって新しくなった。
+          // Layer0以外においては、上のlayerのlv.next_layerの付け替えは
+          // splitの中(create_root_with_children)で行われる。
           return std::make_pair(Done, may_new_root);
         }
       }
     }
   }else if(t == VALUE){
     // 上書き
-    gc.add(n->getLV(index).value);
-    n->setLV(index, LinkOrValue(value));
+    auto old = lv.value;
+    Value *value = f(old);
+    if(value != nullptr and value != old){
+      // MvccMasstreeでは、oldは新しいversionの後ろに繋がれて残る
+      if(!value->isVersioned() or VersionedValue::from(value)->getOlder() != old){
+        gc.add(old);
+      }
+      n->setLV(index, LinkOrValue(value));
+    }
+    if(combiner != nullptr){
+      combine_pending(n, *combiner, gc);
+    }
     n->unlock();
   }else if(t == LAYER){
+    layers.push_back(LayerFrame{layer_root, n, n->getVersion()});
     n->unlock();
     k.next();
-    auto pair = put(lv.next_layer, k, value, gc);
-    if(pair.first == RetryFromUpperLayer){
-      k.back();
-      goto retry;
-    }
+    layer_root = lv.next_layer;
+    goto retry;
   }else {
     // t == UNSTABLE
     assert(false);
@@ -730,6 +883,242 @@ forward:
   return std::make_pair(Done, root);
 }
 
+// put_runがmulti_splitに回すkeyは、この数のBorderNodeに入る分まで。lockを持つ時間を抑える
+static constexpr size_t PUT_RUN_MAX_SPLIT = 16;
+
+/**
+ * BorderNodeの一つのslotの中身。multi_splitで並べ直すのに使う。
+ */
+struct BorderEntry{
+  uint8_t key_len;
+  KeySlice slice;
+  LinkOrValue lv;
+  BigSuffix *suffix;
+};
+
+/**
+ * fullのnに、batchのpendingに並んだkeyを入れ、必要な数のBorderNodeに一度に分ける。
+ * 一つずつsplitすると、溢れたkeyごとにsplitと親への挿入が起き、その度にlockを取り直す。
+ * ここではnのkeyとpendingのkeyを並べてから均等に分け、新しいBorderNodeを左から順に親に入れる。
+ * 新しいBorderNodeは親に入るまでlockしておくので、nextを辿ったreaderはそこで待つ。
+ * 前提: nはlockされていて、pendingのkeyはnの範囲に入り、nにも互いにもLayerを作らずに入る。
+ * @param pending batchの位置。小さい順に並んでいる
+ * @return new root if not nullptr. nはunlockされる
+ */
+static Node *multi_split(BorderNode *n, std::vector<std::pair<Key, Value *>> &batch, const std::vector<size_t> &pending, GC &gc){
+  assert(n->isLocked());
+  assert(!pending.empty());
+  PhaseTimer timer(Phase::Split);
+  // このrunで先にinsert_into_borderしていても、v_splitが進むのでreaderはやり直す
+  n->setInserting(false);
+  n->setSplitting(true);
+
+  auto p = n->getPermutation();
+  std::vector<BorderEntry> existing{};
+  std::array<bool, Node::ORDER - 1> used{};
+  for(size_t i = 0; i < p.getNumKeys(); ++i){
+    auto index = p(i);
+    used[index] = true;
+    existing.push_back(BorderEntry{n->getKeyLen(index), n->getKeySlice(index), n->getLV(index),
+                                   n->getKeySuffixes().get(index)});
+  }
+  for(size_t i = 0; i < Node::ORDER - 1; ++i){
+    // removeされたslotに残っているsuffixは、insert_into_borderのreuseと同じくここで手放す
+    auto suffix = n->getKeySuffixes().get(i);
+    if(!used[i] and suffix != nullptr){
+      gc.add(suffix);
+    }
+  }
+  std::vector<BorderEntry> added{};
+  for(auto i: pending){
+    auto &k = batch[i].first;
+    auto cursor = k.getCurrentSlice();
+    BorderEntry entry{static_cast<uint8_t>(cursor.size), cursor.slice, LinkOrValue(batch[i].second), nullptr};
+    if(cursor.size == 8 and k.hasNext()){
+      entry.key_len = BorderNode::key_len_has_suffix;
+      entry.suffix = BigSuffix::from(k, k.cursor + 1);
+    }
+    added.push_back(entry);
+  }
+  auto less = [](const BorderEntry &a, const BorderEntry &b){
+    return a.slice < b.slice or (a.slice == b.slice and a.key_len < b.key_len);
+  };
+  // 同じslice内の並びは決まっていないので、nのkeyも並べ直しておく
+  std::sort(existing.begin(), existing.end(), less);
+  std::vector<BorderEntry> entries(existing.size() + added.size());
+  std::merge(existing.begin(), existing.end(), added.begin(), added.end(), entries.begin(), less);
+
+  // 同じsliceのkeyは同じBorderNodeに入れる。一つのsliceのkeyは高々9個なので、必ず分けられる
+  std::vector<std::pair<size_t, size_t>> chunks{};
+  constexpr size_t capacity = Node::ORDER - 1;
+  auto count = (entries.size() + capacity - 1) / capacity;
+  size_t start = 0;
+  while(start < entries.size()){
+    auto remaining = entries.size() - start;
+    auto left = count > chunks.size() ? count - chunks.size() : 1;
+    auto end_ = start + std::min(capacity, (remaining + left - 1) / left);
+    if(end_ < entries.size() and entries[end_ - 1].slice == entries[end_].slice){
+      auto back = end_ - 1;
+      while(back > start and entries[back - 1].slice == entries[end_].slice){
+        --back;
+      }
+      if(back > start){
+        end_ = back;
+      }else{
+        while(end_ < entries.size() and entries[end_].slice == entries[start].slice){
+          ++end_;
+        }
+      }
+    }
+    chunks.emplace_back(start, end_);
+    start = end_;
+  }
+
+  std::vector<BorderNode *> nodes{n};
+  for(size_t c = 1; c < chunks.size(); ++c){
+    auto n1 = new (NodePlacement{NodeKind::Border, 0}) BorderNode{};
+#ifndef NDEBUG
+    Alloc::incBorder();
+#endif
+    Stats::incSplit(0);
+    // n1 is initially locked
+    n1->setVersion(n->getVersion());
+    // rootであるのはnのみ。親はinsert_split_into_parentsで入れる
+    n1->setIsRoot(false);
+    nodes.push_back(n1);
+  }
+  n->resetKeyLen();
+  n->resetKeySlice();
+  n->resetLVs();
+  n->getKeySuffixes().reset();
+  for(size_t c = 0; c < chunks.size(); ++c){
+    auto node = nodes[c];
+    for(size_t i = chunks[c].first, j = 0; i < chunks[c].second; ++i, ++j){
+      auto &entry = entries[i];
+      node->setKeyLen(j, entry.key_len);
+      node->setKeySlice(j, entry.slice);
+      node->setLV(j, entry.lv);
+      node->getKeySuffixes().set(j, entry.suffix);
+      if(entry.key_len == BorderNode::key_len_layer){
+        entry.lv.next_layer->setUpperLayer(node);
+      }
+    }
+    node->setPermutation(Permutation::fromSorted(chunks[c].second - chunks[c].first));
+  }
+  // split_keys_amongと同じく、右から順にnextを繋いでからnに繋ぐ
+  auto last = nodes.back();
+  last->setNext(n->getNext());
+  if(last->getNext() != nullptr){
+    last->getNext()->setPrev(last);
+  }
+  for(size_t c = nodes.size() - 1; c > 0; --c){
+    nodes[c]->setPrev(nodes[c - 1]);
+    if(c > 1){
+      nodes[c - 1]->setNext(nodes[c]);
+    }
+  }
+  n->setNext(nodes[1]);
+
+  Node *new_root = nullptr;
+  for(size_t c = 1; c < nodes.size(); ++c){
+    auto r = insert_split_into_parents(nodes[c - 1], nodes[c], 0, c + 1 < nodes.size());
+    if(r != nullptr){
+      new_root = r;
+    }
+  }
+  return new_root;
+}
+
+/**
+ * 小さい順に並んだbatch[begin, end)の先頭から、layer0の同じBorderNodeに入るkeyを
+ * 一度のlockでまとめて入れる。
+ * 範囲はfindBorderで降りる時に読んだものを使うので、nextのlowestKey()は見ない。(LeafHintを参照)
+ *
+ * BorderNodeが埋まった後も、続くkeyを集めてからmulti_splitで一度に分ける。
+ * 次のLayerに降りるkey、Layerを作るkeyに来たらそこで止め、
+ * それらは呼び出し元がput_withで一つずつ入れる。
+ * @param root layer0のroot。nullptrであってはならない
+ * @param batch keyのcursorは0
+ * @return 入れ終えたkeyの次の位置(batch[begin]を入れられなかった時はbegin)と、
+ * layer0のrootが変わった場合は新しいroot
+ */
+[[maybe_unused]]
+static std::pair<size_t, Node*> put_run(Node *root, std::vector<std::pair<Key, Value *>> &batch, size_t begin, size_t end, GC &gc){
+  assert(root != nullptr);
+  assert(begin < end);
+  SliceBounds bounds{};
+  auto n_v = findBorder(root, batch[begin].first, bounds); auto n = n_v.first; auto v = n_v.second;
+  n->lock();
+  auto now = n->getVersion();
+  if(now.deleted or Version::splitHappened(v, now)){
+    // boundsが古くなっている
+    n->unlock();
+    return std::make_pair(begin, nullptr);
+  }
+  // nが埋まった後に入れるkey。multi_splitで入れる
+  std::vector<size_t> pending{};
+  // pendingの中の、長さ8以上のkeyのslice。同じsliceの二つ目はLayerが要る
+  std::optional<KeySlice> long_slice = std::nullopt;
+  // lockを持っている間はsplitされないので、boundsはそのまま使える
+  size_t i = begin;
+  for(; i < end; ++i){
+    auto &k = batch[i].first;
+    assert(k.cursor == 0);
+    if(!bounds.contains(k.getCurrentSlice().slice)){
+      break;
+    }
+    auto t_lv_i = n->extractLinkOrValueWithIndexFor(k);
+    auto t = std::get<0>(t_lv_i);
+    if(t == VALUE){
+      auto old = std::get<1>(t_lv_i).value;
+      if(batch[i].second != old){
+        gc.add(old);
+        n->setLV(std::get<2>(t_lv_i), LinkOrValue(batch[i].second));
+      }
+    }else if(t != NOTFOUND or check_break_invariant(n, k)){
+      break;
+    }else if(pending.empty() and n->getPermutation().isNotFull()){
+      insert_into_border(n, k, batch[i].second, gc);
+    }else if(!pending.empty() and k.compare(batch[pending.back()].first) == 0){
+      // batchの中の重複は、後のものが残る
+      if(batch[i].second != batch[pending.back()].second){
+        gc.add(batch[pending.back()].second);
+      }
+      pending.back() = i;
+    }else{
+      auto cursor = k.getCurrentSlice();
+      if(cursor.size == 8 and long_slice == cursor.slice){
+        break;
+      }
+      if(pending.size() >= (Node::ORDER - 1) * PUT_RUN_MAX_SPLIT){
+        break;
+      }
+      if(cursor.size == 8){
+        long_slice = cursor.slice;
+      }
+      pending.push_back(i);
+    }
+    Stats::inc(Stat::Put);
+  }
+  if(pending.empty()){
+    n->unlock();
+    return std::make_pair(i, nullptr);
+  }
+  return std::make_pair(i, multi_split(n, batch, pending, gc));
+}
+
+/**
+ * treeにkey-valueを配置する。keyが既にあれば上書きする。
+ * @param root layer0のroot
+ * @param key
+ * @param value
+ * @return layer0においてrootが変わった場合は新しいroot
+ */
+[[maybe_unused]]
+static std::pair<PutResult,Node*> put(Node *root, Key &k, Value *value, GC &gc){
+  return put_with(root, k, [value](Value *){ return value; }, gc);
+}
+
 [[nodiscard]]
 static std::pair<PutResult, Node*>put_at_layer0(Node *root, Key &k, Value *value, GC &gc){
   return put(root, k, value, gc);
@@ -31,6 +31,18 @@ static void handle_delete_layer_in_remove(BorderNode *n, GC &gc){
   assert(n->getUpperLayer() != nullptr);
   assert(n->isLocked());
 
+  // n -> upper_layerの順で
+  auto upper = n->lockedUpperNode();
+  auto n_index = upper->tryFindNextLayerIndex(n);
+  if(!n_index){
+    // removeRangeでLayerごと切り離されていた。残りのkeyはnと一緒に解放される。
+    n->setDeleted(true);
+    gc.add(n);
+    n->unlock();
+    upper->unlock();
+    return;
+  }
+
   BigSuffix *upper_suffix;
   if(n->getKeyLen(p(0)) == BorderNode::key_len_has_suffix){
     auto old_suffix = n->getKeySuffixes().get(p(0));
@@ -46,9 +58,6 @@ static void handle_delete_layer_in_remove(BorderNode *n, GC &gc){
 #endif
   }
 
-  // n -> upper_layerの順で
-  auto upper = n->lockedUpperNode();
-
   /**
    * まず、UNSTABLEとマークする
    * 次に、KeySuffixへのリンクを貼る
@@ -56,12 +65,11 @@ static void handle_delete_layer_in_remove(BorderNode *n, GC &gc){
    * そして、HAS_SUFFIXに書き換える
    * 最後に、nの方のlvとKeySuffixをunrefしておく
    */
-  auto n_index = upper->findNextLayerIndex(n);
-  upper->setKeyLen(n_index, BorderNode::key_len_unstable);
-  assert(upper->getKeySuffixes().get(n_index) == nullptr);
-  upper->getKeySuffixes().set(n_index, upper_suffix);
-  upper->setLV(n_index, n->getLV(p(0)));
-  upper->setKeyLen(n_index, BorderNode::key_len_has_suffix);
+  upper->setKeyLen(n_index.value(), BorderNode::key_len_unstable);
+  assert(upper->getKeySuffixes().get(n_index.value()) == nullptr);
+  upper->getKeySuffixes().set(n_index.value(), upper_suffix);
+  upper->setLV(n_index.value(), n->getLV(p(0)));
+  upper->setKeyLen(n_index.value(), BorderNode::key_len_has_suffix);
 
     // 元のValueをクリアにしておく。
   n->setLV(p(0), LinkOrValue{});
@@ -149,6 +157,8 @@ static std::pair<RootChange, Node*> delete_border_node_in_remove(BorderNode *n,
         pull_up_node->setIsRoot(true);
         pull_up_node->setParent(nullptr);
         pull_up_node->setUpperLayer(nullptr);
+        // 古いrootから探し始めたoperationが、deletedのnに何度も辿り着かないようにする
+        p->setChild(n_index, pull_up_node);
         // TODO: pを先にunlockしても良いのか検討
         p->setDeleted(true);
         gc.add(p);
@@ -162,14 +172,20 @@ static std::pair<RootChange, Node*> delete_border_node_in_remove(BorderNode *n,
         // upper layerの更新
         // is_rootをtrueにしてからparentをnullptrにする
         auto upper = p->lockedUpperNode();
-        auto p_index = upper->findNextLayerIndex(p);
+        // removeRangeでLayerごと切り離されていた場合は、付け替える先が無い
+        auto p_index = upper->tryFindNextLayerIndex(p);
 
         pull_up_node->setIsRoot(true);
         pull_up_node->setParent(nullptr);
-        upper->setLV(p_index, LinkOrValue(pull_up_node));
+        // 新しいLayerのrootとして、上のLayerを辿れるようにする
+        pull_up_node->setUpperLayer(upper);
+        if(p_index){
+          upper->setLV(p_index.value(), LinkOrValue(pull_up_node));
+        }
 
         // TODO: pを先にunlockしても良いのか検討
         upper->unlock();
+        p->setChild(n_index, pull_up_node);
         p->setDeleted(true);
         gc.add(p);
         p->unlock();
@@ -205,12 +221,15 @@ static std::pair<RootChange, Node*> delete_border_node_in_remove(BorderNode *n,
  * treeから該当するkey-valueを削除する。
  * @param root
  * @param k
- * @param upper_layer rootをnext_layerとして持つnode
- * @param upper_index rootをnext_layerとして持つnode中のindex
+ * @param gc
+ * @param[out] removed 削除したvalue。keyが無かった場合はそのまま。
+ * 削除したvalueはgcに渡されているので、gc.run()までの間だけ参照できる。
+ * @param f bool(Value*)。keyがあった時に、BorderNodeのlockを取ったまま現在のvalueで一度だけ呼ばれ、
+ * falseを返すと削除しない。同じkeyへの他の操作との順序を決めるのに使うので、短くなければならない
  * @return 新しいroot
  */
-[[maybe_unused]]
-static std::pair<RootChange, Node*> remove(Node *root, Key &k, GC &gc){
+template<typename F>
+static std::pair<RootChange, Node*> remove_with(Node *root, Key &k, GC &gc, Value *&removed, F &&f){
   if(root == nullptr){
     // Layer0以外では起きえない
     assert(k.cursor == 0);
@@ -219,8 +238,8 @@ static std::pair<RootChange, Node*> remove(Node *root, Key &k, GC &gc){
 
 retry:
   auto n_v = findBorder(root, k); auto n = n_v.first; auto v = n_v.second;
+  Hotspot::sampleNode(n);
   n->lock();
-  v = n->getVersion();
   /**
    * removeの場合はfindBorderでnをゲットしたら、すぐにlockをする
    * findBorderとlockの間にそのnodeがdeletedになるかもしれないし、
@@ -230,9 +249,11 @@ retry:
    */
 forward:
   assert(n->isLocked());
-  if(v.deleted){
+  // deletedはlockした後のversionで見る。vはsplitの検出のため、findBorderで読んだものを残しておく
+  auto now = n->getVersion();
+  if(now.deleted){
     n->unlock();
-    if(v.is_root){
+    if(now.is_root){
       // 他のremoveが代わりに消したことになる
       // よって、ここで処理は終わる。
       return std::make_pair(NotChange, root);
@@ -247,6 +268,8 @@ forward:
   if(Version::splitHappened(v, n->getVersion())){
     // findBorderとlockの間でsplit処理が起きたら
     auto next = n->getNext();
+    // nに留まる時に、同じsplitを何度も検出しないようにする
+    v = n->getVersion();
     n->unlock();
     assert(next != nullptr); // splitが起きたのだから、Nextは必ずある
     while (!v.deleted and next != nullptr and k.getCurrentSlice().slice >= next->lowestKey()){
@@ -295,9 +318,18 @@ forward:
       return std::make_pair(LayerDeleted, nullptr);
     }
 
+    if(!f(lv.value)){
+      n->unlock();
+      return std::make_pair(NotChange, root);
+    }
     n->markKeyRemoved(index);
     p.removeIndex(index);
     n->setPermutation(p);
+    // lockを取った状態で、削除したvalueを取り出してGCに渡す。
+    // 古いpermutationでこのslotを読んだreaderは、nullptrを見てNOTFOUNDと同じ扱いとなる。
+    removed = lv.value;
+    n->setLV(index, LinkOrValue{});
+    gc.add(removed);
 
     auto current_num_keys = p.getNumKeys();
 
@@ -312,8 +344,9 @@ forward:
   }else if(t == LAYER){
     n->unlock();
     k.next();
-    auto pair = remove(lv.next_layer, k, gc);
+    auto pair = remove_with(lv.next_layer, k, gc, removed, f);
     if(pair.first == LayerDeleted){
+      Stats::inc(Stat::RetryFromUpperLayer);
       k.back();
       goto retry;
     }
@@ -325,9 +358,30 @@ forward:
   return std::make_pair(NotChange, root);
 }
 
+[[maybe_unused]]
+static std::pair<RootChange, Node*> remove(Node *root, Key &k, GC &gc, Value *&removed){
+  return remove_with(root, k, gc, removed, [](Value *){ return true; });
+}
+
+[[maybe_unused]]
+static std::pair<RootChange, Node*> remove(Node *root, Key &k, GC &gc){
+  Value *removed = nullptr;
+  return remove(root, k, gc, removed);
+}
+
+/**
+ * @param[out] removed 削除したvalue。keyが無かった場合はそのまま。
+ * @return 新しいroot
+ */
+[[nodiscard]]
+static Node *remove_at_layer0(Node *root, Key &k, GC &gc, Value *&removed){
+  return remove(root, k, gc, removed).second;
+}
+
 [[nodiscard]]
 static Node *remove_at_layer0(Node *root, Key &k, GC &gc){
-  return remove(root, k, gc).second;
+  Value *removed = nullptr;
+  return remove_at_layer0(root, k, gc, removed);
 }
 
 }
@@ -0,0 +1,347 @@
+#ifndef MASSTREE_REMOVE_RANGE_H
+#define MASSTREE_REMOVE_RANGE_H
+
+#include "tree.h"
+#include "gc.h"
+#include "remove.h"
+#include <set>
+#include <vector>
+
+namespace masstree{
+
+/**
+ * removeRangeで消す範囲[lo, hi)と、処理の途中経過。
+ */
+struct RemoveRange{
+  const Key &lo;
+  // nullptrの時は上限なし
+  const Key *hi;
+  GC &gc;
+  // 削除したkeyの数
+  size_t removed = 0;
+  // layer0のrootが変わった時にtrueとなり、rootに新しいrootが入る
+  bool root_changed = false;
+  Node *root = nullptr;
+
+  [[nodiscard]]
+  bool contains(const Key &key) const{
+    return lo.compare(key) <= 0 and (hi == nullptr or key.compare(*hi) < 0);
+  }
+};
+
+/**
+ * BorderNodeのslotにあるkeyを、先頭のsliceから組み立てる。
+ * 前提: nはlockされていて、slotはvalueを持つ。
+ */
+static Key entry_key(BorderNode *n, size_t index, const std::vector<KeySlice> &path){
+  auto slices = path;
+  slices.push_back(n->getKeySlice(index));
+  auto len = n->getKeyLen(index);
+  if(len == BorderNode::key_len_has_suffix){
+    return n->getKeySuffixes().get(index)->appendTo(std::move(slices));
+  }
+  return Key(std::move(slices), len);
+}
+
+/**
+ * nを根とする部分木のInteriorNodeをdeletedにしてGCに渡す。
+ * BorderNodeはkill_layerで既に渡されている。
+ * 並行するremoveが先に消したInteriorNodeの下にも、まだ付け替えられたNodeがあるかもしれないので辿る。
+ */
+static void retire_interior_nodes(Node *n, GC &gc){
+  if(n == nullptr or n->getIsBorder()){
+    return;
+  }
+  auto interior = reinterpret_cast<InteriorNode *>(n);
+  interior->lock();
+  auto retire = !interior->getDeleted();
+  if(retire){
+    interior->setDeleted(true);
+  }
+  std::vector<Node *> children{};
+  for(size_t i = 0; i <= interior->getNumKeys(); ++i){
+    children.push_back(interior->getChild(i));
+  }
+  interior->unlock();
+  if(retire){
+    gc.add(interior);
+  }
+  for(auto child: children){
+    retire_interior_nodes(child, gc);
+  }
+}
+
+/**
+ * layer_rootから始まるLayerと、その下の全てのLayerを丸ごと消す。
+ * 各BorderNodeをlockし、deletedとis_rootを立ててGCに渡す。
+ * これ以降にここへ来たget/put/removeは、Layerが消えた時と同じく上のLayerからやり直すので、
+ * 上のLayerから切り離す前であっても、ここに新しいkeyが入る事はない。
+ * 上のLayerのslotを外すのは呼び出し側が行う。
+ */
+static void kill_layer(Node *layer_root, RemoveRange &range){
+  // 一番左のBorderNodeまで降りる。splitは右に行われるので、古いrootからでも辿れる
+  Node *n = layer_root;
+  while(!n->getIsBorder()){
+    // splitの途中ではchildrenが一度空になるので、findBorderと同じくversionで検証する
+    auto v = n->stableVersion();
+    auto child = reinterpret_cast<InteriorNode *>(n)->getChild(0);
+    if(child == nullptr or (n->loadVersion() ^ v) > Version::has_locked){
+      continue;
+    }
+    n = child;
+  }
+
+  std::vector<Node *> next_layers{};
+  auto border = reinterpret_cast<BorderNode *>(n);
+  while(border != nullptr){
+    border->lock();
+    // 並行するremoveで既に消されたものは、そのremoveがGCに渡している
+    if(!border->getDeleted()){
+      auto p = border->getPermutation();
+      for(size_t i = 0; i < p.getNumKeys(); ++i){
+        auto index = p(i);
+        if(border->getKeyLen(index) == BorderNode::key_len_layer){
+          // 下のLayerは別にGCに渡すので、ここからは外しておく
+          next_layers.push_back(border->getLV(index).next_layer);
+          border->setKeyLen(index, 0);
+          border->setLV(index, LinkOrValue{});
+        }else{
+          ++range.removed;
+        }
+      }
+      border->setDeleted(true);
+      // 途中のBorderNodeに来たoperationにも、Layerが消えた時と同じ扱いをさせる
+      border->setIsRoot(true);
+      range.gc.add(border);
+    }
+    auto next = border->getNext();
+    border->unlock();
+    border = next;
+  }
+
+  for(auto next_layer: next_layers){
+    kill_layer(next_layer, range);
+    retire_interior_nodes(next_layer, range.gc);
+  }
+}
+
+/**
+ * probeの現在のsliceが入るBorderNodeを、lockして返す。
+ * @return Layerが消えていた時はnullptr
+ */
+static BorderNode *locked_border_for(Node *layer_root, const Key &probe){
+retry:
+  auto n_v = findBorder(layer_root, probe); auto n = n_v.first; auto v = n_v.second;
+  n->lock();
+  auto now = n->getVersion();
+  if(now.deleted){
+    n->unlock();
+    if(now.is_root){
+      return nullptr;
+    }
+    goto retry;
+  }
+  if(Version::splitHappened(v, now)){
+    // 右に移ったかもしれないので、探し直す
+    n->unlock();
+    goto retry;
+  }
+  return n;
+}
+
+/**
+ * 一つのLayerの中で、範囲に含まれるkeyを消す。
+ * BorderNodeを左から順にlockし、その中で範囲に含まれるkeyをまとめて消す。
+ * 下のLayerが丸ごと範囲に含まれる時は、kill_layerで一度に消して上のLayerから切り離す。
+ * 一部だけが含まれる時は、そのLayerに降りて同じ事を行う。
+ * BorderNodeが空になった時の処理は、removeと同じくdelete_border_node_in_removeで行う。
+ *
+ * 下のLayerのlockを取る間は、上のLayerのlockを外す。(lock順は下のLayer -> 上のLayer)
+ * @param layer_root
+ * @param path このLayerに来るまでに辿ったslice
+ * @param range
+ * @return このLayerが空になり、上のLayerから切り離す必要があるか
+ */
+static bool remove_range_in_layer(Node *layer_root, std::vector<KeySlice> &path, RemoveRange &range){
+  auto depth = path.size();
+  auto hi = range.hi;
+  // このLayerの中で見るsliceの範囲
+  KeySlice start = shares_path(range.lo, path) ? range.lo.slices[depth] : 0;
+  std::optional<KeySlice> end{};
+  if(hi != nullptr and shares_path(*hi, path)){
+    end = hi->slices[depth];
+  }
+
+  auto slices = path;
+  slices.push_back(start);
+  Key probe(std::move(slices), 8);
+  probe.cursor = depth;
+
+  // 一部だけ消した下のLayerに、何度も降りないようにする
+  std::set<KeySlice> visited{};
+  // 丸ごと消したので、切り離す下のLayer
+  std::set<KeySlice> dead{};
+
+  auto n = locked_border_for(layer_root, probe);
+  if(n == nullptr){
+    return false;
+  }
+  while(true){
+    assert(n->isLocked());
+    auto p = n->getPermutation();
+    assert(p.getNumKeys() > 0);
+
+    // 1. 範囲にかかる下のLayerを処理する
+    std::vector<std::pair<KeySlice, Node *>> next_layers{};
+    for(size_t i = 0; i < p.getNumKeys(); ++i){
+      auto index = p(i);
+      auto slice = n->getKeySlice(index);
+      if(n->getKeyLen(index) != BorderNode::key_len_layer or visited.count(slice) != 0){
+        continue;
+      }
+      if(compare_with_layer(range.lo, path, slice) > 0
+        or (hi != nullptr and compare_with_layer(*hi, path, slice) < 0)){
+        continue;
+      }
+      next_layers.emplace_back(slice, n->getLV(index).next_layer);
+    }
+    if(!next_layers.empty()){
+      n->unlock();
+      for(auto &pair: next_layers){
+        auto slice = pair.first;
+        visited.insert(slice);
+        auto covered = compare_with_layer(range.lo, path, slice) < 0
+          and (hi == nullptr or compare_with_layer(*hi, path, slice) > 0);
+        if(covered){
+          kill_layer(pair.second, range);
+          dead.insert(slice);
+        }else{
+          path.push_back(slice);
+          if(remove_range_in_layer(pair.second, path, range)){
+            dead.insert(slice);
+          }
+          path.pop_back();
+        }
+      }
+      // lockを外している間に動いたかもしれないので、探し直す
+      probe.slices[depth] = next_layers.front().first;
+      n = locked_border_for(layer_root, probe);
+      if(n == nullptr){
+        return false;
+      }
+      continue;
+    }
+
+    // 2. n の中の範囲に含まれるkeyと、消した下のLayerをまとめて外す
+    auto last_slice = n->getKeySlice(p(p.getNumKeys() - 1));
+    auto after = p;
+    std::vector<std::pair<size_t, Value *>> values{};
+    std::vector<std::pair<size_t, Node *>> detached{};
+    for(size_t i = 0; i < p.getNumKeys(); ++i){
+      auto index = p(i);
+      auto len = n->getKeyLen(index);
+      if(len == BorderNode::key_len_layer){
+        if(dead.count(n->getKeySlice(index)) == 0){
+          continue;
+        }
+        detached.emplace_back(index, n->getLV(index).next_layer);
+      }else{
+        if(!range.contains(entry_key(n, index, path))){
+          continue;
+        }
+        n->markKeyRemoved(index);
+        values.emplace_back(index, n->getLV(index).value);
+        ++range.removed;
+      }
+      after.removeIndex(index);
+    }
+    if(!detached.empty()){
+      // slotを空にして再利用させるので、古いpermutationで読んでいるreaderにはやり直させる
+      n->setInserting(true);
+    }
+    if(after.getNumKeys() != p.getNumKeys()){
+      n->setPermutation(after);
+    }
+    for(auto &pair: values){
+      n->setLV(pair.first, LinkOrValue{});
+      range.gc.add(pair.second);
+    }
+    for(auto &pair: detached){
+      n->setLV(pair.first, LinkOrValue{});
+      n->setKeyLen(pair.first, 0);
+    }
+
+    // 3. 次のBorderNodeへ
+    auto next = n->getNext();
+    auto layer_deleted = false;
+    if(after.getNumKeys() != 0){
+      n->unlock();
+    }else if(n->getIsRoot() and depth != 0){
+      // Layerが空になった。上のLayerのslotは呼び出し側が外す
+      n->setDeleted(true);
+      range.gc.add(n);
+      n->unlock();
+      layer_deleted = true;
+    }else{
+      auto pair = delete_border_node_in_remove(n, range.gc);
+      if(pair.first == LayerDeleted){
+        assert(depth == 0);
+        layer_deleted = true;
+      }
+      if(pair.first != NotChange){
+        layer_root = pair.second;
+        if(depth == 0){
+          range.root_changed = true;
+          range.root = pair.second;
+        }
+      }
+    }
+    for(auto &pair: detached){
+      retire_interior_nodes(pair.second, range.gc);
+    }
+    if(layer_deleted){
+      return depth != 0;
+    }
+
+    if(next == nullptr){
+      return false;
+    }
+    next->lock();
+    if(next->getDeleted()){
+      // 並行するremoveやcompactionで消された。見た所から探し直す
+      next->unlock();
+      probe.slices[depth] = last_slice;
+      n = locked_border_for(layer_root, probe);
+      if(n == nullptr){
+        return false;
+      }
+      continue;
+    }
+    if(end and next->lowestKey() > end.value()){
+      next->unlock();
+      return false;
+    }
+    n = next;
+  }
+}
+
+/**
+ * [lo, hi)に含まれるkeyを全て削除する。
+ * 他のthreadのget/put/removeと並行して呼んでよい。
+ * 消したNodeとValueはgcに渡されるので、gc.run()は他のthreadがそれらを
+ * 参照していない事が保証できる時点で呼ぶ。
+ * @param root layer0のroot
+ * @param[out] range 削除したkeyの数と、layer0のrootの変更が入る
+ */
+[[maybe_unused]]
+static void remove_range(Node *root, RemoveRange &range){
+  if(root == nullptr){
+    return;
+  }
+  std::vector<KeySlice> path{};
+  remove_range_in_layer(root, path, range);
+}
+
+}
+
+#endif //MASSTREE_REMOVE_RANGE_H
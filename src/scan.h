@@ -0,0 +1,275 @@
+#ifndef MASSTREE_SCAN_H
+#define MASSTREE_SCAN_H
+
+#include "tree.h"
+#include <optional>
+#include <vector>
+#include <algorithm>
+
+namespace masstree{
+
+enum ScanResult : uint8_t{
+  ScanContinue,
+  // fがfalseを返した
+  ScanStop,
+  // 読んでいたLayerが消えていた。上のLayerから読み直す
+  ScanLayerGone
+};
+
+/**
+ * scanの途中経過。
+ * 最後に返したkeyを覚えておき、読み直した時にそれ以前のkeyを飛ばす。
+ */
+struct ScanState{
+  // このkey以上のkeyから返す。nulloptの時は先頭から
+  std::optional<Key> from{};
+  // 最後に返したkey
+  std::optional<Key> last{};
+
+  /**
+   * keyをまだ返していなくて、fromより後か
+   */
+  [[nodiscard]]
+  bool wants(const Key &key) const{
+    if(last){
+      return last->compare(key) < 0;
+    }
+    return !from or from->compare(key) <= 0;
+  }
+
+  /**
+   * pathとsliceの下のLayerに、まだ返していないkeyがあり得るか
+   */
+  [[nodiscard]]
+  bool wantsLayer(const std::vector<KeySlice> &path, KeySlice slice) const{
+    if(last){
+      return compare_with_layer(last.value(), path, slice) <= 0;
+    }
+    return !from or compare_with_layer(from.value(), path, slice) <= 0;
+  }
+
+  /**
+   * このLayerのどのsliceから読めばよいか
+   */
+  [[nodiscard]]
+  KeySlice startSlice(const std::vector<KeySlice> &path) const{
+    auto &bound = last ? last : from;
+    return bound and shares_path(bound.value(), path) ? bound->slices[path.size()] : 0;
+  }
+};
+
+/**
+ * BorderNodeの一つのslotを、versionの検証付きで読み出したもの。
+ */
+struct ScanEntry{
+  KeySlice slice;
+  uint8_t key_len;
+  LinkOrValue lv;
+  // valueの時のみ、先頭のsliceからのkey
+  Key key{};
+};
+
+/**
+ * nのpermutation中のslotを読み出す。
+ * getと同じく、読んでいる間にversionが変わっていたら読み直す。
+ * @param[out] entries
+ * @param[out] next nの次のBorderNode
+ * @return 読み出した時のversion。deletedの時はentriesは空
+ */
+static Version snapshot_border(BorderNode *n, const std::vector<KeySlice> &path,
+                               std::vector<ScanEntry> &entries, BorderNode *&next){
+retry:
+  auto v = n->stableVersion();
+  entries.clear();
+  if(v.deleted){
+    return v;
+  }
+  auto p = n->getPermutation();
+  for(size_t i = 0; i < p.getNumKeys(); ++i){
+    auto index = p(i);
+    ScanEntry e{n->getKeySlice(index), n->getKeyLen(index), n->getLV(index)};
+    if(e.key_len == BorderNode::key_len_unstable){
+      Stats::inc(Stat::UnstableHit);
+      goto retry;
+    }
+    if(e.key_len == 0 or (BorderNode::key_len_has_suffix < e.key_len and e.key_len != BorderNode::key_len_layer)){
+      // 読んでいる間にremoveされたslot。versionの検証を待たずに読み直す
+      goto retry;
+    }
+    if(e.key_len == BorderNode::key_len_has_suffix){
+      auto suffix = n->getKeySuffixes().get(index);
+      if(suffix == nullptr){
+        goto retry;
+      }
+      auto slices = path;
+      slices.push_back(e.slice);
+      e.key = suffix->appendTo(std::move(slices));
+    }else if(e.key_len != BorderNode::key_len_layer){
+      auto slices = path;
+      slices.push_back(e.slice);
+      e.key = Key(std::move(slices), e.key_len);
+    }
+    entries.push_back(std::move(e));
+  }
+  next = n->getNext();
+  auto now = n->loadVersion();
+  if((now ^ v) > Version::has_locked){
+    Stats::inc(Stat::HasLockedRetry);
+    goto retry;
+  }
+  // permutationはsliceの順だが、同じsliceの中ではkeyの長さの順とは限らない。
+  // key_lenはlayer(255)も含めて、そのままKey::compareの順になる
+  std::sort(entries.begin(), entries.end(), [](const ScanEntry &a, const ScanEntry &b){
+    return a.slice != b.slice ? a.slice < b.slice : a.key_len < b.key_len;
+  });
+  return v;
+}
+
+/**
+ * layer_rootから始まるLayerとその下のLayerのkeyを、小さい順にf(key, value)に渡す。
+ * BorderNodeをnextで辿り、一つずつ検証付きで読み出してから渡す。
+ * 並行するsplitやremoveで読み直した時は、stateの最後に返したkeyより後から続ける。
+ * @param layer_root
+ * @param path このLayerに来るまでに辿ったslice
+ * @param state
+ * @param f bool(const Key &, Value *)。falseを返すとscanを終える
+ * @return
+ */
+template<typename F>
+static ScanResult scan_layer(Node *layer_root, std::vector<KeySlice> &path, ScanState &state, F &f){
+  auto depth = path.size();
+  auto slices = path;
+  slices.push_back(state.startSlice(path));
+  Key probe(std::move(slices), 8);
+  probe.cursor = depth;
+
+  std::vector<ScanEntry> entries{};
+  auto n = findBorder(layer_root, probe).first;
+  while(true){
+    BorderNode *next = nullptr;
+    auto v = snapshot_border(n, path, entries, next);
+    if(v.deleted){
+      if(v.is_root or layer_root->getDeleted()){
+        return ScanLayerGone;
+      }
+      // 並行するremoveやcompactionで消された。最後に見たsliceから探し直す
+      n = findBorder(layer_root, probe).first;
+      continue;
+    }
+
+    auto reread = false;
+    for(auto &e: entries){
+      if(e.key_len == BorderNode::key_len_layer){
+        if(!state.wantsLayer(path, e.slice)){
+          continue;
+        }
+        path.push_back(e.slice);
+        auto result = scan_layer(e.lv.next_layer, path, state, f);
+        path.pop_back();
+        if(result == ScanStop){
+          return result;
+        }
+        probe.slices[depth] = e.slice;
+        if(result == ScanLayerGone){
+          // 下のLayerのkeyは、このLayerに移ったかもしれない
+          reread = true;
+          break;
+        }
+      }else{
+        if(e.lv.value == nullptr or !state.wants(e.key)){
+          continue;
+        }
+        probe.slices[depth] = e.slice;
+        state.last = std::move(e.key);
+        if(!f(static_cast<const Key &>(state.last.value()), e.lv.value)){
+          return ScanStop;
+        }
+      }
+    }
+    if(reread){
+      n = findBorder(layer_root, probe).first;
+      continue;
+    }
+    if(next == nullptr){
+      return ScanContinue;
+    }
+    n = next;
+  }
+}
+
+/**
+ * nからdepth段下までのInteriorNodeのsliceを、小さい順にoutに加える。
+ * @return 読んでいる間にnodeが変わった時はfalse
+ */
+static bool collect_separators(Node *n, size_t depth, std::vector<KeySlice> &out){
+  auto v = n->stableVersion();
+  if(v.deleted){
+    return false;
+  }
+  if(depth == 0 or v.is_border){
+    return true;
+  }
+  auto interior = reinterpret_cast<InteriorNode *>(n);
+  auto num_keys = interior->getNumKeys();
+  for(size_t i = 0; i <= num_keys; ++i){
+    auto child = interior->getChild(i);
+    if(child == nullptr or !collect_separators(child, depth - 1, out)){
+      return false;
+    }
+    if(i < num_keys){
+      out.push_back(interior->getKeySlice(i));
+    }
+  }
+  return (n->loadVersion() ^ v) <= Version::has_locked;
+}
+
+/**
+ * layer_rootのLayerのsliceを、InteriorNodeの子の境界でおおよそparts個の範囲に分ける。
+ * rootの子の境界から始め、足りなければ下の段の境界も使う。
+ * 並行する書き込みで木の形が変わってもよく、その時は範囲の大きさが偏るだけである。
+ * @param[out] boundaries 小さい順の境界。k個の境界は、k + 1個の範囲 [-, b0), [b0, b1), ..., [bk-1, -) を表す
+ * @return layer_rootが消えていた時はfalse。呼び出し側で新しいrootから読み直す
+ */
+[[maybe_unused]]
+static bool partition_layer(Node *layer_root, size_t parts, std::vector<KeySlice> &boundaries){
+  boundaries.clear();
+  if(parts <= 1){
+    return true;
+  }
+  std::vector<KeySlice> found{};
+  for(size_t depth = 1;; ++depth){
+    std::vector<KeySlice> separators{};
+    if(!collect_separators(layer_root, depth, separators)){
+      if(layer_root->stableVersion().deleted){
+        // rootが引き上げられて消えたので、ここから読み直しても終わらない
+        return false;
+      }
+      // 読み直す
+      --depth;
+      continue;
+    }
+    std::sort(separators.begin(), separators.end());
+    separators.erase(std::unique(separators.begin(), separators.end()), separators.end());
+    auto deeper = separators.size() > found.size();
+    if(deeper){
+      found = std::move(separators);
+    }
+    if(!deeper or found.size() + 1 >= parts){
+      break;
+    }
+  }
+  if(found.size() + 1 <= parts){
+    boundaries = std::move(found);
+    return true;
+  }
+  // 多すぎる時は、等間隔に間引く
+  for(size_t i = 1; i < parts; ++i){
+    boundaries.push_back(found[i * found.size() / parts]);
+  }
+  boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+  return true;
+}
+
+}
+
+#endif //MASSTREE_SCAN_H
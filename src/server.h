@@ -0,0 +1,489 @@
+#ifndef MASSTREE_SERVER_H
+#define MASSTREE_SERVER_H
+
+#include "masstree.h"
+#include "protocol.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace masstree{
+
+/**
+ * epoll loopの間で、GCに渡したものを解放してよい時点を決める。
+ * 各loopはepoll_waitから戻ったらenterし、epoll_waitに入る前にidleになる。
+ * その間しかtreeのNodeやValueを参照しないので、retireより後にenterしたか、
+ * idleであるloopは、retireの前に外されたものを参照していない。
+ */
+class Quiescence{
+public:
+  explicit Quiescence(size_t loops)
+  : slots(loops)
+  {}
+
+  void enter(size_t i){
+    slots[i].seen.store(epoch.load());
+  }
+
+  void idle(size_t i){
+    slots[i].seen.store(IDLE);
+  }
+
+  /**
+   * これまでにtreeから外したものに、印を付ける。
+   * @return safe(印)がtrueになれば、それらを解放してよい
+   */
+  uint64_t retire(){
+    return epoch.fetch_add(1) + 1;
+  }
+
+  [[nodiscard]]
+  bool safe(uint64_t mark) const{
+    return std::all_of(slots.begin(), slots.end(), [mark](const Slot &s){
+      return s.seen.load() >= mark;
+    });
+  }
+
+private:
+  static constexpr uint64_t IDLE = UINT64_MAX;
+
+  struct alignas(64) Slot{
+    std::atomic<uint64_t> seen{IDLE};
+  };
+
+  std::atomic<uint64_t> epoch{0};
+  std::vector<Slot> slots;
+};
+
+/**
+ * Masstreeへのget/put/remove/scanを、Unix domain socketかloopbackのTCPで受け付ける。
+ * protocolはprotocol.hを参照。
+ *
+ * loopごとにthreadを一つ立ててCPUに固定し、それぞれがepollとGCを持つ。
+ * listen socketは全てのloopのepollにEPOLLEXCLUSIVEで入れ、acceptしたloopがその接続を持ち続ける。
+ * 一つの接続から届いたrequestは、届いた分をまとめて処理してからresponseをまとめて書く。
+ * responseを書き切れない間は、その接続からは読まない。
+ */
+class Server{
+public:
+  struct Options{
+    // 空でなければ、このpathのUnix domain socketで待つ
+    std::string unix_path{};
+    // unix_pathが空の時、127.0.0.1のこのportで待つ。0の時は空いているport
+    uint16_t tcp_port = 0;
+    size_t loops = std::max(1u, std::thread::hardware_concurrency());
+    // 一回のScanで返すkeyの上限
+    uint32_t max_scan = 1024;
+  };
+
+  Server(Masstree &tree_, Options options_)
+  : tree(tree_)
+  , options(std::move(options_))
+  , quiescence(options.loops)
+  {}
+
+  ~Server(){
+    stop();
+  }
+
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+
+  /**
+   * socketを開いて、loopを始める。
+   * @return socketを開けなかった時はfalse。errnoに理由が入る
+   */
+  bool start(){
+    assert(!running);
+    if(!listen()){
+      return false;
+    }
+    running = true;
+    for(size_t i = 0; i < options.loops; ++i){
+      auto loop = std::make_unique<Loop>();
+      loop->index = i;
+      loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+      loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      add(loop->epfd, listen_fd, EPOLLIN | EPOLLEXCLUSIVE);
+      add(loop->epfd, loop->wake_fd, EPOLLIN);
+      loops.push_back(std::move(loop));
+    }
+    for(auto &loop: loops){
+      auto l = loop.get();
+      l->thread = std::thread([this, l](){ run(*l); });
+      pin(*l);
+    }
+    return true;
+  }
+
+  /**
+   * 全てのloopを止めて、接続を閉じる。
+   */
+  void stop(){
+    if(!running){
+      return;
+    }
+    running = false;
+    for(auto &loop: loops){
+      uint64_t one = 1;
+      [[maybe_unused]] auto r = write(loop->wake_fd, &one, sizeof(one));
+    }
+    for(auto &loop: loops){
+      loop->thread.join();
+    }
+    // 全てのloopが止まったので、残りを解放してよい
+    for(auto &loop: loops){
+      for(auto &pair: loop->conns){
+        close(pair.first);
+      }
+      for(auto &pending: loop->pending){
+        pending.second->run();
+      }
+      loop->gc->run();
+      close(loop->epfd);
+      close(loop->wake_fd);
+    }
+    loops.clear();
+    close(listen_fd);
+    listen_fd = -1;
+    if(!options.unix_path.empty()){
+      unlink(options.unix_path.c_str());
+    }
+  }
+
+  /**
+   * TCPで待っている時の、実際のport
+   */
+  [[nodiscard]]
+  uint16_t port() const{
+    return bound_port;
+  }
+
+private:
+  struct Connection{
+    std::string in{};
+    size_t in_pos = 0;
+    std::string out{};
+    size_t out_pos = 0;
+    // EPOLLOUTを待っている
+    bool writing = false;
+  };
+
+  struct Loop{
+    size_t index = 0;
+    std::thread thread{};
+    int epfd = -1;
+    int wake_fd = -1;
+    std::unordered_map<int, Connection> conns{};
+    std::unique_ptr<GC> gc = std::make_unique<GC>();
+    // Quiescence::retireの印と、その時までにgcに渡したもの
+    std::deque<std::pair<uint64_t, std::unique_ptr<GC>>> pending{};
+  };
+
+  static constexpr int MAX_EVENTS = 64;
+  static constexpr size_t READ_SIZE = 64 * 1024;
+
+  static void add(int epfd, int fd, uint32_t events){
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  static void modify(int epfd, int fd, uint32_t events){
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+  }
+
+  bool listen(){
+    if(!options.unix_path.empty()){
+      sockaddr_un addr{};
+      if(options.unix_path.size() >= sizeof(addr.sun_path)){
+        errno = ENAMETOOLONG;
+        return false;
+      }
+      listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if(listen_fd < 0){
+        return false;
+      }
+      addr.sun_family = AF_UNIX;
+      std::copy(options.unix_path.begin(), options.unix_path.end(), addr.sun_path);
+      unlink(options.unix_path.c_str());
+      if(bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0){
+        goto fail;
+      }
+    }else{
+      listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if(listen_fd < 0){
+        return false;
+      }
+      int one = 1;
+      setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr.sin_port = htons(options.tcp_port);
+      if(bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0){
+        goto fail;
+      }
+      socklen_t len = sizeof(addr);
+      getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+      bound_port = ntohs(addr.sin_port);
+    }
+    if(::listen(listen_fd, SOMAXCONN) != 0){
+      goto fail;
+    }
+    return true;
+fail:
+    auto saved = errno;
+    close(listen_fd);
+    listen_fd = -1;
+    errno = saved;
+    return false;
+  }
+
+  /**
+   * loopのthreadを一つのCPUに固定する。
+   */
+  static void pin(Loop &loop){
+    auto cpus = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(loop.index % cpus, &set);
+    pthread_setaffinity_np(loop.thread.native_handle(), sizeof(set), &set);
+  }
+
+  void run(Loop &loop){
+    epoll_event events[MAX_EVENTS];
+    while(running){
+      quiescence.idle(loop.index);
+      // 解放待ちがある時は、他のloopが進むのを見に来る
+      auto n = epoll_wait(loop.epfd, events, MAX_EVENTS, loop.pending.empty() ? -1 : 10);
+      quiescence.enter(loop.index);
+      for(int i = 0; i < n; ++i){
+        auto fd = events[i].data.fd;
+        if(fd == listen_fd){
+          accept(loop);
+        }else if(fd == loop.wake_fd){
+          uint64_t count;
+          [[maybe_unused]] auto r = read(loop.wake_fd, &count, sizeof(count));
+        }else{
+          handle(loop, fd, events[i].events);
+        }
+      }
+      reclaim(loop);
+    }
+    quiescence.idle(loop.index);
+  }
+
+  void accept(Loop &loop){
+    while(true){
+      auto fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if(fd < 0){
+        return;
+      }
+      if(options.unix_path.empty()){
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      }
+      loop.conns.emplace(fd, Connection{});
+      add(loop.epfd, fd, EPOLLIN);
+    }
+  }
+
+  void closeConnection(Loop &loop, int fd){
+    epoll_ctl(loop.epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    loop.conns.erase(fd);
+  }
+
+  void handle(Loop &loop, int fd, uint32_t events){
+    auto &conn = loop.conns.at(fd);
+    if(events & (EPOLLERR | EPOLLHUP) and !(events & EPOLLIN)){
+      closeConnection(loop, fd);
+      return;
+    }
+    if(conn.writing){
+      if(!flush(fd, conn)){
+        closeConnection(loop, fd);
+        return;
+      }
+      if(conn.out_pos != conn.out.size()){
+        return;
+      }
+    }else{
+      while(true){
+        auto old = conn.in.size();
+        conn.in.resize(old + READ_SIZE);
+        auto r = read(fd, &conn.in[old], READ_SIZE);
+        conn.in.resize(old + std::max<ssize_t>(r, 0));
+        if(r == 0 or (r < 0 and errno != EAGAIN and errno != EWOULDBLOCK)){
+          closeConnection(loop, fd);
+          return;
+        }
+        if(r < static_cast<ssize_t>(READ_SIZE)){
+          break;
+        }
+      }
+    }
+    // 溜まっているrequestをまとめて処理し、responseをまとめて書く
+    if(!process(loop, conn) or !flush(fd, conn)){
+      closeConnection(loop, fd);
+      return;
+    }
+    auto writing = conn.out_pos != conn.out.size();
+    if(writing != conn.writing){
+      conn.writing = writing;
+      modify(loop.epfd, fd, writing ? EPOLLOUT : EPOLLIN);
+    }
+  }
+
+  /**
+   * conn.inにある完全なframeを全て処理し、responseをconn.outに積む。
+   * @return frameが壊れていた時はfalse
+   */
+  bool process(Loop &loop, Connection &conn){
+    protocol::Request req{};
+    protocol::Response resp{};
+    while(true){
+      size_t consumed = 0;
+      auto result = protocol::decode_request(conn.in.data() + conn.in_pos, conn.in.size() - conn.in_pos, req, consumed);
+      if(result == protocol::DecodeResult::Malformed){
+        return false;
+      }
+      if(result == protocol::DecodeResult::Incomplete){
+        break;
+      }
+      conn.in_pos += consumed;
+      execute(loop, req, resp);
+      protocol::encode_response(req.op, resp, conn.out);
+    }
+    conn.in.erase(0, conn.in_pos);
+    conn.in_pos = 0;
+    return true;
+  }
+
+  void execute(Loop &loop, const protocol::Request &req, protocol::Response &resp){
+    using protocol::Op;
+    using protocol::Status;
+    resp.status = Status::Ok;
+    resp.entries.clear();
+    if(req.op == Op::Scan){
+      scan(req, resp);
+      return;
+    }
+    if(req.key.empty()){
+      resp.status = Status::BadRequest;
+      return;
+    }
+    auto key = key_from_bytes(req.key.data(), req.key.size());
+    switch(req.op){
+      case Op::Get:{
+        auto v = tree.get(key);
+        if(v == nullptr){
+          resp.status = Status::NotFound;
+        }else{
+          resp.value = v->getBody();
+        }
+        break;
+      }
+      case Op::Put:
+        tree.put(key, new Value(req.value), *loop.gc);
+        break;
+      case Op::Remove:{
+        auto v = tree.remove(key, *loop.gc);
+        if(v == nullptr){
+          resp.status = Status::NotFound;
+        }else{
+          resp.value = v->getBody();
+        }
+        break;
+      }
+      default:
+        resp.status = Status::BadRequest;
+    }
+  }
+
+  void scan(const protocol::Request &req, protocol::Response &resp){
+    auto limit = std::min(req.limit, options.max_scan);
+    if(limit == 0){
+      return;
+    }
+    // responseのframeがMAX_FRAMEを超えないようにする
+    size_t size = 1 + sizeof(uint32_t);
+    auto collect = [&resp, &size, limit](const Key &key, Value *value){
+      auto bytes = key_to_bytes(key);
+      size += sizeof(uint16_t) + bytes.size() + sizeof(int32_t);
+      if(size > protocol::MAX_FRAME){
+        return false;
+      }
+      resp.entries.emplace_back(std::move(bytes), value->getBody());
+      return resp.entries.size() < limit;
+    };
+    if(req.key.empty()){
+      tree.scan(collect);
+    }else{
+      tree.scan(key_from_bytes(req.key.data(), req.key.size()), collect);
+    }
+  }
+
+  /**
+   * conn.outを書けるだけ書く。
+   * @return 接続が切れていた時はfalse
+   */
+  static bool flush(int fd, Connection &conn){
+    while(conn.out_pos < conn.out.size()){
+      auto r = send(fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+      if(r < 0){
+        return errno == EAGAIN or errno == EWOULDBLOCK;
+      }
+      conn.out_pos += r;
+    }
+    conn.out.clear();
+    conn.out_pos = 0;
+    return true;
+  }
+
+  /**
+   * このloopのgcに溜まったものに印を付け、他のloopが印を過ぎたものから解放する。
+   */
+  void reclaim(Loop &loop){
+    if(!loop.gc->empty()){
+      loop.pending.emplace_back(quiescence.retire(), std::move(loop.gc));
+      loop.gc = std::make_unique<GC>();
+    }
+    while(!loop.pending.empty() and quiescence.safe(loop.pending.front().first)){
+      loop.pending.front().second->run();
+      loop.pending.pop_front();
+    }
+  }
+
+  Masstree &tree;
+  const Options options;
+  Quiescence quiescence;
+  std::atomic<bool> running{false};
+  int listen_fd = -1;
+  uint16_t bound_port = 0;
+  std::vector<std::unique_ptr<Loop>> loops{};
+};
+
+}
+
+#endif //MASSTREE_SERVER_H
@@ -0,0 +1,218 @@
+#ifndef MASSTREE_SHARDED_MASSTREE_H
+#define MASSTREE_SHARDED_MASSTREE_H
+
+#include "masstree.h"
+#include "numa.h"
+#include <memory>
+#include <queue>
+#include <vector>
+
+namespace masstree{
+
+/**
+ * 独立したN個のMasstreeを持ち、keyをhashかrangeでshardに振り分ける。
+ * 各shardはrootを別々に持つので、rootの付け替えやsplitの競合はshardの中に閉じる。
+ *
+ * hashで振り分けた時はshardの間に順序が無いので、scanは各shardから
+ * SCAN_BATCH個ずつ読んでmergeする。
+ * rangeで振り分けた時は、boundariesで区切られた順にshardを読めばよい。
+ */
+class ShardedMasstree{
+public:
+  enum class Routing{
+    Hash,
+    Range
+  };
+
+  // hashで振り分けた時のscanで、一つのshardから一度に読むkeyの数
+  static constexpr size_t SCAN_BATCH = 64;
+
+  /**
+   * keyのhashでshard_count個のshardに振り分ける。
+   */
+  explicit ShardedMasstree(size_t shard_count)
+  : routing(Routing::Hash)
+  , shards(shard_count)
+  {
+    assert(shard_count >= 1);
+  }
+
+  /**
+   * boundariesでkeyの範囲を区切り、boundaries.size() + 1個のshardに振り分ける。
+   * shard iは[boundaries[i - 1], boundaries[i])のkeyを持つ。
+   * @param boundaries 小さい順に並んでいなければならない
+   */
+  explicit ShardedMasstree(std::vector<Key> boundaries_)
+  : routing(Routing::Range)
+  , boundaries(std::move(boundaries_))
+  , shards(boundaries.size() + 1)
+  {
+    assert(std::is_sorted(boundaries.begin(), boundaries.end(), [](const Key &a, const Key &b){
+      return a.compare(b) < 0;
+    }));
+  }
+
+  [[nodiscard]]
+  size_t shardOf(const Key &key) const{
+    if(routing == Routing::Hash){
+      return hash_key(key) % shards.size();
+    }
+    auto it = std::upper_bound(boundaries.begin(), boundaries.end(), key, [](const Key &k, const Key &b){
+      return k.compare(b) < 0;
+    });
+    return it - boundaries.begin();
+  }
+
+  [[nodiscard]]
+  size_t shardCount() const{
+    return shards.size();
+  }
+
+  /**
+   * shardを直接触る。shardごとのstatsやcompactionに使う。
+   */
+  Masstree &shard(size_t i){
+    return shards[i].tree;
+  }
+
+  /**
+   * shard iを持つthreadのNUMA nodeを指定する。
+   * putで新しく作るBorderNodeはnuma_owner_nodeに置かれる(NumaNodeAllocPolicyの時)。
+   * @param node -1の時はputを呼んだthreadのnode
+   */
+  void setShardNode(size_t i, int node){
+    shards[i].numa_node = node;
+  }
+
+  Value *get(Key &key){
+    return shard(shardOf(key)).get(key);
+  }
+
+  void put(Key &key, Value *value, GC &gc){
+    auto &s = shards[shardOf(key)];
+    NumaOwnerScope scope(s.numa_node);
+    s.tree.put(key, value, gc);
+  }
+
+  Value *remove(Key &key, GC &gc){
+    return shard(shardOf(key)).remove(key, gc);
+  }
+
+  /**
+   * 全てのshardのkeyを、小さい順にf(key, value)に渡す。
+   * @param f bool(const Key &, Value *)。falseを返すとscanを終える
+   */
+  template<typename F>
+  void scan(F &&f){
+    scanFrom(std::nullopt, f);
+  }
+
+  template<typename F>
+  void scan(const Key &from, F &&f){
+    scanFrom(from, f);
+  }
+
+private:
+  /**
+   * 他のshardのrootとfalse sharingしないように、cache lineに揃える。
+   */
+  struct alignas(64) Shard{
+    Masstree tree{};
+    int numa_node = -1;
+  };
+
+  /**
+   * hashで振り分けた時のscanで、一つのshardから読んだkeyの列。
+   */
+  struct ShardCursor{
+    std::vector<std::pair<Key, Value *>> buffer{};
+    size_t pos = 0;
+    // このshardにはもうkeyが無い
+    bool exhausted = false;
+  };
+
+  template<typename F>
+  void scanFrom(const std::optional<Key> &from, F &f){
+    if(routing == Routing::Range){
+      auto stopped = false;
+      auto wrapped = [&f, &stopped](const Key &key, Value *value){
+        stopped = !f(key, value);
+        return !stopped;
+      };
+      for(auto i = from ? shardOf(from.value()) : 0; i < shards.size() and !stopped; ++i){
+        if(from){
+          shard(i).scan(from.value(), wrapped);
+        }else{
+          shard(i).scan(wrapped);
+        }
+      }
+      return;
+    }
+
+    std::vector<ShardCursor> cursors(shards.size());
+    // (cursorの今のkey, shard)の小さい順
+    auto greater = [&cursors](size_t a, size_t b){
+      auto &ka = cursors[a].buffer[cursors[a].pos].first;
+      auto &kb = cursors[b].buffer[cursors[b].pos].first;
+      return ka.compare(kb) > 0;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+    for(size_t i = 0; i < shards.size(); ++i){
+      fill(i, cursors[i], from);
+      if(!cursors[i].buffer.empty()){
+        heap.push(i);
+      }
+    }
+    while(!heap.empty()){
+      auto i = heap.top(); heap.pop();
+      auto &c = cursors[i];
+      auto &entry = c.buffer[c.pos];
+      if(!f(static_cast<const Key &>(entry.first), entry.second)){
+        return;
+      }
+      ++c.pos;
+      if(c.pos == c.buffer.size()){
+        if(c.exhausted){
+          continue;
+        }
+        // 最後に読んだkeyの次から読み直す
+        auto last = std::move(c.buffer.back().first);
+        fill(i, c, last);
+        if(c.buffer.empty()){
+          continue;
+        }
+      }
+      heap.push(i);
+    }
+  }
+
+  /**
+   * shard iのfrom以上(resumeの時はfromより大きい)のkeyを、SCAN_BATCH個までcに読む。
+   */
+  void fill(size_t i, ShardCursor &c, const std::optional<Key> &from){
+    auto resume = !c.buffer.empty();
+    c.buffer.clear();
+    c.pos = 0;
+    auto collect = [&c, &from, resume](const Key &key, Value *value){
+      if(resume and key.compare(from.value()) == 0){
+        return true;
+      }
+      c.buffer.emplace_back(key, value);
+      return c.buffer.size() < SCAN_BATCH;
+    };
+    if(from){
+      shard(i).scan(from.value(), collect);
+    }else{
+      shard(i).scan(collect);
+    }
+    c.exhausted = c.buffer.size() < SCAN_BATCH;
+  }
+
+  Routing routing;
+  std::vector<Key> boundaries{};
+  std::vector<Shard> shards;
+};
+
+}
+
+#endif //MASSTREE_SHARDED_MASSTREE_H
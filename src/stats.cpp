@@ -0,0 +1,84 @@
+#include "stats.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace masstree{
+
+#ifdef MASSTREE_STATS
+
+namespace {
+
+/**
+ * 生きている各threadのThreadStatsと、終了したthreadの集計結果を持つ。
+ */
+struct StatsRegistry{
+  std::mutex mutex{};
+  std::vector<ThreadStats*> live{};
+  StatsSnapshot retired{};
+};
+
+StatsRegistry &registry(){
+  // thread終了時のdestructorから触られるので、解放しない
+  static auto r = new StatsRegistry{};
+  return *r;
+}
+
+/**
+ * threadごとにThreadStatsを確保し、thread終了時にregistryに退避する。
+ */
+struct LocalStatsHolder{
+  ThreadStats *stats = new ThreadStats{};
+
+  LocalStatsHolder(){
+    auto &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.live.push_back(stats);
+  }
+
+  ~LocalStatsHolder(){
+    auto &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    stats->addTo(r.retired);
+    r.live.erase(std::find(r.live.begin(), r.live.end(), stats));
+    delete stats;
+  }
+};
+
+}
+
+ThreadStats &localThreadStats(){
+  thread_local LocalStatsHolder holder{};
+  return *holder.stats;
+}
+
+StatsSnapshot Stats::collect(){
+  auto &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  StatsSnapshot snap = r.retired;
+  for(auto s: r.live){
+    s->addTo(snap);
+  }
+  return snap;
+}
+
+void Stats::reset(){
+  auto &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  r.retired = StatsSnapshot{};
+  for(auto s: r.live){
+    s->reset();
+  }
+}
+
+#else
+
+StatsSnapshot Stats::collect(){
+  return StatsSnapshot{};
+}
+
+void Stats::reset(){}
+
+#endif
+
+}
@@ -0,0 +1,167 @@
+#ifndef MASSTREE_STATS_H
+#define MASSTREE_STATS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <iostream>
+
+namespace masstree{
+
+/**
+ * Statsで数える項目。
+ */
+enum class Stat : size_t{
+  Get,
+  Put,
+  Remove,
+  // findBorderで、v_splitが変わっていたためにrootからやり直した回数
+  FindBorderRetry,
+  // getで、読んでいる間にBorderNodeのversionが変わっていた回数
+  HasLockedRetry,
+  // getで、UNSTABLEなslotに当たった回数
+  UnstableHit,
+  // 下のLayerが消えていたために、上のLayerからやり直した回数
+  RetryFromUpperLayer,
+  // Node::lockで、lockが取れずに回った回数
+  LockSpin,
+  // LeafHintが覚えていたBorderNodeを、rootから降りずに使えた回数
+  HintHit,
+  // LeafHintを使ったが、rootから降りた回数
+  HintMiss,
+  // 他のthreadのputが、lockを持っているputによってまとめて行われた回数(PutCombiner)
+  CombinedPut,
+  // Node::lockとNode::stableVersionで、回るのをやめてfutexで眠った回数(MASSTREE_PARKING_LOCK)
+  Park,
+  Count
+};
+
+static constexpr size_t STAT_COUNT = static_cast<size_t>(Stat::Count);
+// これ以上深いLayerでのsplitは、最後の要素にまとめて数える
+static constexpr size_t STAT_MAX_LAYER = 16;
+
+/**
+ * 全threadのStatsを集計した結果。
+ */
+struct StatsSnapshot{
+  std::array<uint64_t, STAT_COUNT> counters{};
+  std::array<uint64_t, STAT_MAX_LAYER> splits{};
+
+  uint64_t operator[](Stat s) const{
+    return counters[static_cast<size_t>(s)];
+  }
+
+  [[nodiscard]]
+  uint64_t totalSplits() const{
+    uint64_t sum = 0;
+    for(auto s: splits) sum += s;
+    return sum;
+  }
+
+  void print() const{
+    std::cout << "Get: " << (*this)[Stat::Get] << std::endl;
+    std::cout << "Put: " << (*this)[Stat::Put] << std::endl;
+    std::cout << "Remove: " << (*this)[Stat::Remove] << std::endl;
+    std::cout << "FindBorderRetry: " << (*this)[Stat::FindBorderRetry] << std::endl;
+    std::cout << "HasLockedRetry: " << (*this)[Stat::HasLockedRetry] << std::endl;
+    std::cout << "UnstableHit: " << (*this)[Stat::UnstableHit] << std::endl;
+    std::cout << "RetryFromUpperLayer: " << (*this)[Stat::RetryFromUpperLayer] << std::endl;
+    std::cout << "LockSpin: " << (*this)[Stat::LockSpin] << std::endl;
+    std::cout << "HintHit: " << (*this)[Stat::HintHit] << std::endl;
+    std::cout << "HintMiss: " << (*this)[Stat::HintMiss] << std::endl;
+    std::cout << "CombinedPut: " << (*this)[Stat::CombinedPut] << std::endl;
+    std::cout << "Park: " << (*this)[Stat::Park] << std::endl;
+    for(size_t i = 0; i < STAT_MAX_LAYER; ++i){
+      if(splits[i] != 0){
+        std::cout << "Split[layer " << i << "]: " << splits[i] << std::endl;
+      }
+    }
+  }
+};
+
+#ifdef MASSTREE_STATS
+
+/**
+ * 一つのthreadが書き込むカウンタ。
+ * 他のthreadのカウンタとfalse sharingしないように、cache lineに揃える。
+ * 書き込むのは持ち主のthreadのみで、集計するthreadはrelaxedで読む。
+ */
+struct alignas(64) ThreadStats{
+  std::array<std::atomic<uint64_t>, STAT_COUNT> counters{};
+  std::array<std::atomic<uint64_t>, STAT_MAX_LAYER> splits{};
+
+  static void bump(std::atomic<uint64_t> &c, uint64_t n = 1){
+    // 書き込むのは自分のthreadのみなので、fetch_addは必要ない
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  void addTo(StatsSnapshot &snap) const{
+    for(size_t i = 0; i < STAT_COUNT; ++i){
+      snap.counters[i] += counters[i].load(std::memory_order_relaxed);
+    }
+    for(size_t i = 0; i < STAT_MAX_LAYER; ++i){
+      snap.splits[i] += splits[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  void reset(){
+    for(auto &c: counters) c.store(0, std::memory_order_relaxed);
+    for(auto &c: splits) c.store(0, std::memory_order_relaxed);
+  }
+};
+
+/**
+ * 現在のthreadのThreadStatsを返す。初回の呼び出しで登録される。
+ * threadが終了すると、その値は集計用に退避される。
+ */
+ThreadStats &localThreadStats();
+
+#endif
+
+/**
+ * 操作とretryの統計を取る。
+ * MASSTREE_STATSが定義されていない時には、全ての関数は空になる。
+ */
+class Stats{
+public:
+  static void inc(Stat s, uint64_t n = 1){
+#ifdef MASSTREE_STATS
+    ThreadStats::bump(localThreadStats().counters[static_cast<size_t>(s)], n);
+#else
+    (void)s; (void)n;
+#endif
+  }
+
+  static void incSplit(size_t layer){
+#ifdef MASSTREE_STATS
+    auto i = layer < STAT_MAX_LAYER ? layer : STAT_MAX_LAYER - 1;
+    ThreadStats::bump(localThreadStats().splits[i]);
+#else
+    (void)layer;
+#endif
+  }
+
+  /**
+   * 全threadのカウンタを集計する。
+   * 他のthreadが動いている間に呼んだ場合は、おおよその値となる。
+   */
+  static StatsSnapshot collect();
+
+  /**
+   * 全threadのカウンタを0にする。
+   */
+  static void reset();
+
+  static constexpr bool enabled(){
+#ifdef MASSTREE_STATS
+    return true;
+#else
+    return false;
+#endif
+  }
+};
+
+}
+
+#endif //MASSTREE_STATS_H
@@ -0,0 +1,421 @@
+#ifndef MASSTREE_TRANSACTION_H
+#define MASSTREE_TRANSACTION_H
+
+#include "masstree.h"
+#include <algorithm>
+#include <vector>
+#include <xmmintrin.h>
+
+namespace masstree{
+
+class Transaction;
+
+/**
+ * Masstreeの上で、Silo[1]と同じ方式の楽観的なTransactionを行う。
+ * epochはadvanceEpochで進める。Siloと同じく、40ms程度ごとに一つのthreadから呼ぶ事を想定している。
+ *
+ * Transactionで書いたkeyは、removeしてもValue::tombstoneとして残る。
+ * Transactionを使わないgetやscanで読む時は、isTombstoneのValueを無いものとして扱う。
+ *
+ * [1] Tu et al., Speedy Transactions in Multicore In-Memory Databases, SOSP'13
+ */
+class TransactionManager{
+public:
+  explicit TransactionManager(Masstree &tree_)
+  : tree(tree_)
+  {}
+
+  TransactionManager(const TransactionManager &other) = delete;
+  TransactionManager &operator=(const TransactionManager &other) = delete;
+
+  void advanceEpoch(){
+    epoch.fetch_add(1);
+  }
+
+  [[nodiscard]]
+  uint64_t currentEpoch() const{
+    return epoch.load();
+  }
+
+  Masstree &getTree(){
+    return tree;
+  }
+
+private:
+  friend class Transaction;
+
+  Masstree &tree;
+  std::atomic<uint64_t> epoch{1};
+};
+
+/**
+ * 一つのthreadで使う、一回分のTransaction。
+ * 読んだkeyとそのValue(read-set)、keyが無かった時に読んだBorderNodeとversion(node-set)、
+ * 書くkeyとValue(write-set)を記録し、commitで次のように検証する。
+ *
+ * 1. 書くkeyの入るBorderNodeを探し、アドレス順にlockする
+ * 2. epochを読む
+ * 3. read-setのkeyを読み直し、Valueが変わっていないこと、他のTransactionにlockされていないことを確かめる。
+ *    node-setのBorderNodeのv_insert, v_splitが変わっていないこと(phantomが無いこと)を確かめる。
+ *    変わっていた時は、そのkeyを読み直して、まだ無い(tombstoneを含む)ことを確かめる。
+ *    自分がtombstoneを先に入れた場合や、近くの他のkeyへの挿入でabortしないため
+ * 4. epochと読んだValueのTIDから、それらより大きいTIDを決めて書き込み、unlockする
+ *
+ * Valueの更新はポインタを付け替えるので、read-setはValueのポインタで比べる。
+ * gc.run()はどのTransactionも古いValueを読んでいない時に呼ぶ。
+ * TIDはValue::getTimestampに入る。Siloのthreadごとの単調性は持たず、同じTIDのcommitもあり得る。
+ *
+ * 他の操作はlockをchild -> parentやnode -> prevの順に取るので、lockはtryLockで取り、
+ * 取れなければ全て外して最初からやり直す。
+ * splitやLayerの作成が必要なkeyは、lockを外してからtombstoneを先に入れておく。
+ */
+class Transaction{
+public:
+  Transaction(TransactionManager &manager_, GC &gc_)
+  : manager(manager_)
+  , gc(gc_)
+  {}
+
+  Transaction(const Transaction &other) = delete;
+  Transaction &operator=(const Transaction &other) = delete;
+
+  ~Transaction(){
+    abort();
+  }
+
+  /**
+   * このTransactionで書いたものがあればそれを、無ければtreeから読む。
+   * @return keyが無いか、removeされていればnullptr
+   */
+  Value *get(Key &key){
+    auto w = findWrite(key);
+    if(w != nullptr){
+      return w->value;
+    }
+    BorderObservation observed{};
+    auto v = read(key, observed);
+    if(v != nullptr){
+      reads.push_back(ReadEntry{key, v});
+      return v->isTombstone() ? nullptr : v;
+    }
+    nodes.push_back(NodeEntry{key, observed});
+    return nullptr;
+  }
+
+  /**
+   * commitした時にkeyをvalueにする。valueはcommitするまでこのTransactionが持つ。
+   */
+  void put(Key &key, Value *value){
+    assert(value != nullptr);
+    write(key, value);
+  }
+
+  void remove(Key &key){
+    write(key, nullptr);
+  }
+
+  /**
+   * @return commitできたか。できなかった時はabortされ、書こうとしたValueは解放される
+   */
+  bool commit(){
+retry:
+    for(auto &w: writes){
+      locate(w);
+      if(w.node == nullptr){
+        // 空のtree
+        prepare(w);
+        goto retry;
+      }
+    }
+    if(!lockAll()){
+      _mm_pause();
+      goto retry;
+    }
+
+    // 書くkeyがlockしたBorderNodeにあるか、挿入できるかを確かめる
+    uint64_t tid = 0;
+    for(size_t i = 0; i < writes.size(); ++i){
+      auto &w = writes[i];
+      auto n = w.node;
+      auto now = n->getVersion();
+      if(now.deleted or now.v_split != w.version.v_split){
+        unlockAll();
+        goto retry;
+      }
+      w.key.cursor = w.depth;
+      auto t_lv_i = n->extractLinkOrValueWithIndexFor(w.key);
+      auto t = std::get<0>(t_lv_i);
+      if(t == VALUE){
+        w.slot = std::get<2>(t_lv_i);
+        w.insert = false;
+        tid = std::max(tid, std::get<1>(t_lv_i).value->getTimestamp());
+      }else if(t == NOTFOUND){
+        w.slot = std::nullopt;
+        w.insert = w.value != nullptr;
+        if(w.insert and !canInsert(i)){
+          w.key.reset();
+          unlockAll();
+          prepare(w);
+          goto retry;
+        }
+      }else{
+        // 探した後にLayerが出来た
+        w.key.reset();
+        unlockAll();
+        goto retry;
+      }
+      w.key.reset();
+    }
+
+    auto epoch = manager.epoch.load();
+
+    for(auto &r: reads){
+      BorderObservation observed{};
+      auto v = read(r.key, observed);
+      if(v != r.observed or (observed.version.locked and !owns(observed.node))){
+        unlockAll();
+        abort();
+        return false;
+      }
+      tid = std::max(tid, v->getTimestamp());
+    }
+    for(auto &e: nodes){
+      if(!validate(e)){
+        unlockAll();
+        abort();
+        return false;
+      }
+    }
+
+    tid = std::max(tid + 1, epoch << 32);
+    for(auto &w: writes){
+      install(w, tid);
+    }
+    unlockAll();
+    commit_tid = tid;
+    clear();
+    return true;
+  }
+
+  /**
+   * 記録を捨て、書こうとしたValueを解放する。
+   */
+  void abort(){
+    for(auto &w: writes){
+      delete w.value;
+    }
+    clear();
+  }
+
+  /**
+   * 最後にcommitした時のTID
+   */
+  [[nodiscard]]
+  uint64_t getCommitTid() const{
+    return commit_tid;
+  }
+
+private:
+  struct ReadEntry{
+    Key key;
+    Value *observed;
+  };
+
+  /**
+   * keyが無い事を読んだ時の、そのkeyが入るべきBorderNode
+   */
+  struct NodeEntry{
+    Key key;
+    BorderObservation observed;
+  };
+
+  struct WriteEntry{
+    Key key;
+    // nullptrの時はremove
+    Value *value;
+    // 以下はcommitの中で使う
+    BorderNode *node = nullptr;
+    Version version{};
+    // nodeのLayerの深さ
+    size_t depth = 0;
+    // 上書きするslot
+    std::optional<size_t> slot{};
+    bool insert = false;
+  };
+
+  WriteEntry *findWrite(const Key &key){
+    for(auto &w: writes){
+      if(w.key.compare(key) == 0){
+        return &w;
+      }
+    }
+    return nullptr;
+  }
+
+  void write(Key &key, Value *value){
+    auto w = findWrite(key);
+    if(w != nullptr){
+      delete w->value;
+      w->value = value;
+      return;
+    }
+    writes.push_back(WriteEntry{key, value});
+    writes.back().key.reset();
+  }
+
+  Value *read(Key &key, BorderObservation &observed){
+    auto root = manager.tree.root.load(std::memory_order_acquire);
+    auto v = ::masstree::get(root, key, nullptr, &observed);
+    key.reset();
+    return v;
+  }
+
+  /**
+   * wのkeyが入っている、あるいは入るべきBorderNodeを探す。
+   */
+  void locate(WriteEntry &w){
+    auto root = manager.tree.root.load(std::memory_order_acquire);
+    BorderObservation observed{};
+    ::masstree::get(root, w.key, nullptr, &observed);
+    w.node = observed.node;
+    w.version = observed.version;
+    w.depth = w.key.cursor;
+    w.key.reset();
+  }
+
+  /**
+   * lockを取ったまま挿入するとsplitやLayerの作成が必要になるkeyに、先にtombstoneを入れておく。
+   * tombstoneは無いkeyとして読まれるので、commitしなくても結果は変わらない。
+   */
+  void prepare(WriteEntry &w){
+    auto tombstone = Value::tombstone();
+    if(manager.tree.insertIfAbsent(w.key, tombstone, gc) != nullptr){
+      delete tombstone;
+    }
+  }
+
+  /**
+   * writes[i]を、lockしたBorderNodeに挿入できるか。
+   * 同じBorderNodeに先に挿入するkeyも数える。
+   */
+  bool canInsert(size_t i){
+    auto &w = writes[i];
+    auto n = w.node;
+    assert(w.key.cursor == w.depth);
+    if(check_break_invariant(n, w.key)){
+      return false;
+    }
+    auto slice = w.key.getCurrentSlice().slice;
+    size_t pending = 0;
+    for(size_t j = 0; j < i; ++j){
+      auto &w2 = writes[j];
+      if(w2.node != n or !w2.insert){
+        continue;
+      }
+      ++pending;
+      // 同じsliceでどちらも次のsliceを持つなら、Layerを作らなければならない
+      if(w2.key.slices[w2.depth] == slice and w2.key.slices.size() > w2.depth + 1 and w.key.hasNext()){
+        return false;
+      }
+    }
+    return n->getPermutation().getNumKeys() + pending < Node::ORDER - 1;
+  }
+
+  /**
+   * writesのBorderNodeを、アドレス順に重複なくlockする。
+   * @return 全て取れたか。取れなかった時は何もlockしていない
+   */
+  bool lockAll(){
+    locked.clear();
+    for(auto &w: writes){
+      locked.push_back(w.node);
+    }
+    std::sort(locked.begin(), locked.end());
+    locked.erase(std::unique(locked.begin(), locked.end()), locked.end());
+    for(size_t i = 0; i < locked.size(); ++i){
+      if(!locked[i]->tryLock()){
+        for(size_t j = 0; j < i; ++j){
+          locked[j]->unlock();
+        }
+        locked.clear();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void unlockAll(){
+    for(auto n: locked){
+      n->unlock();
+    }
+    locked.clear();
+  }
+
+  [[nodiscard]]
+  bool owns(BorderNode *n) const{
+    return std::binary_search(locked.begin(), locked.end(), n);
+  }
+
+  /**
+   * keyが無い事を読んだ時から、keyが挿入されていないか
+   */
+  bool validate(NodeEntry &e){
+    auto &o = e.observed;
+    if(o.node == nullptr){
+      // treeが空だった
+      if(manager.tree.root.load(std::memory_order_acquire) == nullptr){
+        return true;
+      }
+    }else{
+      auto now = o.node->getVersion();
+      if(!now.deleted
+        and now.v_insert == o.version.v_insert
+        and now.v_split == o.version.v_split){
+        return !now.locked or owns(o.node);
+      }
+    }
+    BorderObservation observed{};
+    auto v = read(e.key, observed);
+    return (v == nullptr or v->isTombstone())
+      and !(observed.version.locked and !owns(observed.node));
+  }
+
+  void install(WriteEntry &w, uint64_t tid){
+    auto n = w.node;
+    w.key.cursor = w.depth;
+    if(w.insert){
+      w.value->setTimestamp(tid);
+      insert_into_border(n, w.key, w.value, gc);
+    }else if(w.slot){
+      auto value = w.value != nullptr ? w.value : Value::tombstone();
+      value->setTimestamp(tid);
+      gc.add(n->getLV(w.slot.value()).value);
+      n->setLV(w.slot.value(), LinkOrValue(value));
+    }else{
+      // 無いkeyのremove
+      assert(w.value == nullptr);
+    }
+    w.key.reset();
+    // Valueはtreeのものになった
+    w.value = nullptr;
+  }
+
+  void clear(){
+    reads.clear();
+    nodes.clear();
+    writes.clear();
+  }
+
+  TransactionManager &manager;
+  GC &gc;
+  std::vector<ReadEntry> reads{};
+  std::vector<NodeEntry> nodes{};
+  std::vector<WriteEntry> writes{};
+  // commit中にlockしているBorderNode。アドレス順
+  std::vector<BorderNode *> locked{};
+  uint64_t commit_tid = 0;
+};
+
+}
+
+#endif //MASSTREE_TRANSACTION_H
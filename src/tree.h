@@ -6,12 +6,20 @@
 #include "permutation.h"
 #include "alloc.h"
 #include "value.h"
+#include "stats.h"
+#include "hotspot.h"
+#include "profile.h"
+#ifdef MASSTREE_PARKING_LOCK
+#include "parking.h"
+#endif
+#include "node_alloc.h"
 #include <cstdint>
 #include <cstddef>
 #include <cassert>
 #include <tuple>
 #include <utility>
 #include <vector>
+#include <array>
 #include <algorithm>
 #include <optional>
 #include <tuple>
@@ -25,6 +33,14 @@ static constexpr std::memory_order WRITE_MEMORY_ORDER = std::memory_order_seq_cs
 
 namespace masstree{
 
+#ifndef NDEBUG
+/**
+ * このthreadでNodeのversionをloadした回数。
+ * benchでlookup一回あたりのload回数を測るために使う。
+ */
+inline thread_local size_t version_load_count = 0;
+#endif
+
 struct InteriorNode;
 struct BorderNode;
 
@@ -38,20 +54,60 @@ public:
   Node(Node&& other) = delete;
   Node &operator=(Node&& other) = delete;
 
+  /**
+   * Nodeはnode_alloc_policyで確保し、解放する。
+   * new (NodePlacement{...}) BorderNode{} のように、置き場所の手がかりを渡せる。
+   */
+  static void *operator new(size_t size, NodePlacement placement){
+    return allocate_node(size, placement);
+  }
+
+  static void operator delete(void *p, size_t size){
+    deallocate_node(p, size);
+  }
+
   [[nodiscard]]
   Version stableVersion() const{
-    auto v = getVersion();
+    return stableVersion(loadVersion());
+  }
+
+  /**
+   * 既にloadしたversion vから始めて、inserting/splittingでなくなるまで待つ。
+   * vがすでにstableであれば、追加のloadは発生しない。
+   * @param v
+   * @return
+   */
+  [[nodiscard]]
+  Version stableVersion(Version v) const{
+#ifdef MASSTREE_PARKING_LOCK
+    size_t spins = 0;
+#endif
     while(v.inserting or v.splitting){
-      v = getVersion();
+#ifdef MASSTREE_PARKING_LOCK
+      if(++spins % PARK_AFTER_SPINS == 0){
+        park(v);
+      }
+#endif
+      v = loadVersion();
     }
     return v;
   }
 
   void lock(){
     assert(this != nullptr);
+    PhaseTimer timer(Phase::LockWait);
+    // MASSTREE_HOTSPOTが無い時は、Hotspotに渡らないので消える
+    uint64_t spins = 0;
     for(;;){
       auto expected = getVersion();
       if(expected.locked){
+        Stats::inc(Stat::LockSpin);
+        ++spins;
+#ifdef MASSTREE_PARKING_LOCK
+        if(spins % PARK_AFTER_SPINS == 0){
+          park(expected);
+        }
+#endif
         continue;
       }else{
         // lockが外された！
@@ -61,11 +117,31 @@ public:
         if(version.compare_exchange_weak(expected, desired)){
           break;
         }
+        Stats::inc(Stat::LockSpin);
+        ++spins;
       }
     }
+    if(spins != 0){
+      Hotspot::lockContended(this, spins);
+    }
   }
 
 
+  /**
+   * lockが取れなければ待たずにfalseを返す。
+   * 複数のBorderNodeをlockするTransactionのcommitで、他のlock順との間のdeadlockを避けるのに使う。
+   */
+  bool tryLock(){
+    auto expected = getVersion();
+    if(expected.locked){
+      Stats::inc(Stat::LockSpin);
+      return false;
+    }
+    auto desired = expected;
+    desired.locked = true;
+    return version.compare_exchange_strong(expected, desired);
+  }
+
   void unlock(){
     auto copy_v = getVersion();
     assert(copy_v.locked);
@@ -79,7 +155,17 @@ public:
     copy_v.inserting = false;
     copy_v.splitting = false;
 
+#ifdef MASSTREE_PARKING_LOCK
+    // parkはwaitersを増やしてからversionを見るので、こちらはversionを書いてからwaitersを見る。
+    // seq_cstにして、この二つの順序が入れ替わらないようにする
+    version.store(copy_v, std::memory_order_seq_cst);
+    if(waiters.load(std::memory_order_seq_cst) != 0){
+      futex_wake_all(&version);
+    }
+#else
     setVersion(copy_v);
+#endif
+    Hotspot::flushContended();
   }
 
   [[nodiscard]]
@@ -172,9 +258,26 @@ public:
 
   [[nodiscard]]
   inline Version getVersion() const{
+#ifndef NDEBUG
+    ++version_load_count;
+#endif
     return version.load(READ_MEMORY_ORDER);
   }
 
+  /**
+   * readerの楽観的な読み取りのために、versionをacquireでloadする。
+   * readerはここでloadしたversionを、border判定、childの検証、
+   * 次のnodeへの受け渡しに使い回し、同じnodeのversionを二度loadしないようにする。
+   * @return
+   */
+  [[nodiscard]]
+  inline Version loadVersion() const{
+#ifndef NDEBUG
+    ++version_load_count;
+#endif
+    return version.load(std::memory_order_acquire);
+  }
+
   [[nodiscard]]
   inline bool isLocked() const{
     auto v = getVersion();
@@ -230,7 +333,30 @@ public:
 
 
 private:
+#ifdef MASSTREE_PARKING_LOCK
+  /**
+   * versionがseenから変わるまで、futexで眠る。
+   * unlockはwaitersが0でなければ起こす。
+   */
+  void park(Version seen) const{
+    static_assert(sizeof(version) == sizeof(uint32_t));
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+    if(version.load(std::memory_order_seq_cst) ^ seen){
+      // 増やす前にunlockされていた
+      waiters.fetch_sub(1, std::memory_order_relaxed);
+      return;
+    }
+    Stats::inc(Stat::Park);
+    futex_wait(&version, seen.body);
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+#endif
+
   std::atomic<Version> version = {};
+#ifdef MASSTREE_PARKING_LOCK
+  // parkで眠っているthreadの数。versionの後ろの隙間に入るので、Nodeは大きくならない
+  mutable std::atomic<uint32_t> waiters{0};
+#endif
   std::atomic<InteriorNode*> parent = nullptr;
   // 上のlayerのBorderNodeを指す。
   std::atomic<BorderNode*> upperLayer = nullptr;
@@ -238,6 +364,12 @@ private:
 
 class InteriorNode: public Node{
 public:
+  using Node::operator new;
+
+  static void *operator new(size_t size){
+    return Node::operator new(size, NodePlacement{NodeKind::Interior, 0});
+  }
+
   Node *findChild(KeySlice slice){
     auto num_keys = getNumKeys();
     for(size_t i = 0; i < num_keys; ++i){
@@ -436,6 +568,17 @@ public:
     pop_front(slices);
   }
 
+  /**
+   * keyの先頭にsuffixを繋げたKeyを作る。
+   * @param prefix suffixより前のslice
+   * @return
+   */
+  Key appendTo(std::vector<KeySlice> prefix){
+    std::lock_guard<std::mutex> lock(suffixMutex);
+    prefix.insert(prefix.end(), slices.begin(), slices.end());
+    return Key(std::move(prefix), lastSliceSize);
+  }
+
   /**
    * Stackとしてのslicesのトップに要素を乗っける
    * @param slice
@@ -567,6 +710,12 @@ enum ExtractResult: uint8_t {
 
 class BorderNode: public Node{
 public:
+  using Node::operator new;
+
+  static void *operator new(size_t size){
+    return Node::operator new(size, NodePlacement{NodeKind::Border, 0});
+  }
+
   static constexpr uint8_t key_len_layer = 255;
   static constexpr uint8_t key_len_unstable = 254;
   static constexpr uint8_t key_len_has_suffix = 9;
@@ -609,6 +758,7 @@ public:
      * どれにも該当しない場合、NOTFOUNDを返す
      *
      */
+    PhaseTimer timer(Phase::LeafSearch);
     auto current = key.getCurrentSlice();
     auto p = getPermutation();
 
@@ -686,25 +836,16 @@ retry_prev_lock:
   }
 
   /**
-   * keyをinsertすべきpointを返す。
+   * keyをinsertすべきslotを返す。permutationの空いているslotの先頭(Permutation::back)を使う。
    * もしremoved slotがreuseされることになるならば、二番目の要素がtrueになる。
    * その時にはinsert側はv_insertを更新する必要がある
    * @return
    */
   [[nodiscard]]
   std::pair<size_t, bool> insertPoint() const{
-    // NOTE: ここでなるべくlen=0のslotを使うことにより、性能をあげる事ができる
-    assert(getPermutation().isNotFull());
-    for(size_t i = 0; i < ORDER - 1; ++i){
-      auto len = getKeyLen(i);
-      if(len == 0){
-        return std::make_pair(i, false);
-      }
-      if(10 <= len and len <= 18){
-        return std::make_pair(i, true);
-      }
-    }
-    assert(false);
+    auto index = getPermutation().back();
+    assert(getKeyLen(index) == 0 or isKeyRemoved(index));
+    return std::make_pair(index, isKeyRemoved(index));
   }
 
   void printNode() const{
@@ -771,6 +912,19 @@ retry_prev_lock:
   }
 
   size_t findNextLayerIndex(Node *next_layer) const{
+    auto index = tryFindNextLayerIndex(next_layer);
+    assert(index);
+    return index.value();
+  }
+
+  /**
+   * findNextLayerIndexと同じだが、見つからなければnulloptを返す。
+   * removeRangeによってLayerが切り離された後には、上のLayerからのlinkは無い。
+   * @param next_layer
+   * @return
+   */
+  [[nodiscard]]
+  std::optional<size_t> tryFindNextLayerIndex(Node *next_layer) const{
     assert(this->isLocked());
 
     for(size_t i = 0; i < ORDER - 1; ++i){
@@ -778,8 +932,7 @@ retry_prev_lock:
         return i;
       }
     }
-
-    assert(false);
+    return std::nullopt;
   }
 
   [[nodiscard]]
@@ -873,7 +1026,7 @@ retry_prev_lock:
       assert(getKeyLen(i) != key_len_layer);
       auto value = getLV(i).value;
       if(value != nullptr){
-        delete value;
+        Value::destroy(value);
         setLV(i, LinkOrValue{});
 #ifndef NDEBUG
         Alloc::decValue();
@@ -916,6 +1069,7 @@ private:
 
 
 static std::pair<BorderNode *, Version> findBorder(Node *root, const Key &key){
+  PhaseTimer timer(Phase::Descent);
 retry:
   auto n = root; auto v = n->stableVersion();
 
@@ -923,19 +1077,92 @@ retry:
     root = root->getParent(); goto retry;
   }
 descend:
-  if(n->getIsBorder()){
+  // is_borderは変化しないので、既にloadしたvから判定できる
+  if(v.is_border){
     return std::pair(reinterpret_cast<BorderNode *>(n), v);
   }
   auto interior_n = reinterpret_cast<InteriorNode *>(n);
   // 当然、ここでconcurrent splitによってnの構造がグチャグチャになり、n1 == nullptrとなる可能性がある
   auto n1 = interior_n->findChild(key.getCurrentSlice().slice);
   Version v1 = n1 != nullptr ? n1->stableVersion() : Version();
-  if((n->getVersion() ^ v) <= Version::has_locked){
+  auto now = n->loadVersion();
+  if((now ^ v) <= Version::has_locked){
     assert(n1 != nullptr);
     n = n1; v = v1; goto descend;
   }
-  auto v2 = n->stableVersion();
+  // 検証でloadしたversionがstableなら、それをそのまま使う
+  auto v2 = n->stableVersion(now);
+  if(v2.v_split != v.v_split){
+    Stats::inc(Stat::FindBorderRetry);
+    goto retry;
+  }
+  v = v2; goto descend;
+}
+
+/**
+ * BorderNodeが受け持つkey sliceの範囲[lower, upper)。
+ * has_upperがfalseの時は、上限が無い。
+ */
+struct SliceBounds{
+  KeySlice lower = 0;
+  KeySlice upper = 0;
+  bool has_upper = false;
+
+  [[nodiscard]]
+  bool contains(KeySlice slice) const{
+    return lower <= slice and (!has_upper or slice < upper);
+  }
+};
+
+/**
+ * findBorderと同じだが、返すBorderNodeの範囲も返す。
+ * 範囲は降りる時に通ったInteriorNodeのkey sliceから決まり、それぞれの読み取りは
+ * findBorderと同じくversionで検証される。
+ * splitは親のversionを変えてから子のsplittingを外すので、検証を通った範囲は
+ * 返すversionの時点のものになる。
+ * その後もv_splitが変わらず、deletedでない間は、範囲はこれより狭くならない。
+ * (sibling nodeの削除やcompactで広がる事はある)
+ * @param[out] bounds
+ */
+static std::pair<BorderNode *, Version> findBorder(Node *root, const Key &key, SliceBounds &bounds){
+  PhaseTimer timer(Phase::Descent);
+  auto slice = key.getCurrentSlice().slice;
+retry:
+  auto n = root; auto v = n->stableVersion();
+  bounds = SliceBounds{};
+
+  if(!v.is_root){
+    root = root->getParent(); goto retry;
+  }
+descend:
+  if(v.is_border){
+    return std::pair(reinterpret_cast<BorderNode *>(n), v);
+  }
+  auto interior_n = reinterpret_cast<InteriorNode *>(n);
+  // findChildと同じ選び方をして、選んだ子の両側のkey sliceを範囲とする
+  size_t num_keys = interior_n->getNumKeys();
+  size_t i = 0;
+  while(i < num_keys and interior_n->getKeySlice(i) <= slice){
+    ++i;
+  }
+  auto n1 = interior_n->getChild(i);
+  auto child_bounds = bounds;
+  if(i > 0){
+    child_bounds.lower = interior_n->getKeySlice(i - 1);
+  }
+  if(i < num_keys){
+    child_bounds.upper = interior_n->getKeySlice(i);
+    child_bounds.has_upper = true;
+  }
+  Version v1 = n1 != nullptr ? n1->stableVersion() : Version();
+  auto now = n->loadVersion();
+  if((now ^ v) <= Version::has_locked){
+    assert(n1 != nullptr);
+    n = n1; v = v1; bounds = child_bounds; goto descend;
+  }
+  auto v2 = n->stableVersion(now);
   if(v2.v_split != v.v_split){
+    Stats::inc(Stat::FindBorderRetry);
     goto retry;
   }
   v = v2; goto descend;
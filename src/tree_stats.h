@@ -0,0 +1,191 @@
+#ifndef MASSTREE_TREE_STATS_H
+#define MASSTREE_TREE_STATS_H
+
+#include "tree.h"
+#include <array>
+#include <vector>
+#include <iostream>
+
+namespace masstree{
+
+/**
+ * Masstreeの形とメモリ使用量。
+ * 「Layerの深さ」はkeyの何番目のsliceで引かれるLayerか(layer0が0)、
+ * 「高さ」は一つのLayerの中でのB+treeとしての高さ(BorderNodeのみなら1)を表す。
+ */
+struct TreeStats{
+  size_t border_nodes = 0;
+  size_t interior_nodes = 0;
+  // keyの数(valueを持つslotの数)
+  size_t keys = 0;
+  // removeされ、まだ再利用されていないslotの数
+  size_t removed_slots = 0;
+  // index = Layerの深さ。その深さにあるLayerの数
+  std::vector<size_t> layers_per_depth{};
+  // index = Layerの深さ。その深さにあるLayerの高さの最大値
+  std::vector<size_t> max_height_per_depth{};
+  // index = Layerの深さ。その深さで終わるkeyの数
+  std::vector<size_t> keys_per_depth{};
+  size_t big_suffixes = 0;
+  // BigSuffixが確保しているbyte数
+  size_t suffix_bytes = 0;
+  // permutation中のkeyの数 / BorderNodeのslot数 の合計。平均はborderFillFactor()
+  double fill_sum = 0;
+
+  [[nodiscard]]
+  double borderFillFactor() const{
+    return border_nodes == 0 ? 0 : fill_sum / border_nodes;
+  }
+
+  /**
+   * Node、BigSuffix、Valueが確保しているbyte数の合計
+   */
+  [[nodiscard]]
+  size_t totalBytes() const{
+    return border_nodes * sizeof(BorderNode)
+      + interior_nodes * sizeof(InteriorNode)
+      + suffix_bytes
+      + keys * sizeof(Value);
+  }
+
+  [[nodiscard]]
+  double bytesPerKey() const{
+    return keys == 0 ? 0 : (double) totalBytes() / keys;
+  }
+
+  void print() const{
+    std::cout << "BorderNodes: " << border_nodes << std::endl;
+    std::cout << "InteriorNodes: " << interior_nodes << std::endl;
+    std::cout << "Keys: " << keys << std::endl;
+    std::cout << "RemovedSlots: " << removed_slots << std::endl;
+    for(size_t d = 0; d < layers_per_depth.size(); ++d){
+      std::cout << "Depth " << d << ": layers=" << layers_per_depth[d]
+                << " max_height=" << max_height_per_depth[d]
+                << " keys=" << keys_per_depth[d] << std::endl;
+    }
+    std::cout << "BorderFillFactor: " << borderFillFactor() << std::endl;
+    std::cout << "BigSuffixes: " << big_suffixes << std::endl;
+    std::cout << "SuffixBytes: " << suffix_bytes << std::endl;
+    std::cout << "BytesPerKey: " << bytesPerKey() << std::endl;
+  }
+};
+
+static void collect_tree_stats(Node *layer_root, size_t depth, TreeStats &stats);
+
+/**
+ * 一つのLayerの中のnを根とする部分木を辿り、TreeStatsに加える。
+ * 下のLayerがあれば、そこにも降りる。
+ * 各Nodeは、findBorderと同じく安定したversionで読み、読み終えた後にversionが変わっていたら読み直す。
+ * 検証を通った子だけを辿るので、splitの途中で空になったchildrenを読む事はない。
+ * deletedのNodeは数えない。
+ * @param n
+ * @param depth Layerの深さ
+ * @param[out] stats
+ * @return nを根とする部分木の高さ
+ */
+static size_t collect_node_stats(Node *n, size_t depth, TreeStats &stats){
+  if(!n->getIsBorder()){
+    auto interior = reinterpret_cast<InteriorNode *>(n);
+    std::array<Node *, Node::ORDER> children{};
+    size_t num_keys;
+  retry_interior:
+    auto v = n->stableVersion();
+    if(v.deleted){
+      return 0;
+    }
+    num_keys = interior->getNumKeys();
+    for(size_t i = 0; i <= num_keys; ++i){
+      children[i] = interior->getChild(i);
+    }
+    if((n->loadVersion() ^ v) > Version::has_locked){
+      goto retry_interior;
+    }
+    ++stats.interior_nodes;
+    size_t height = 0;
+    for(size_t i = 0; i <= num_keys; ++i){
+      if(children[i] != nullptr){
+        height = std::max(height, collect_node_stats(children[i], depth, stats));
+      }
+    }
+    return height + 1;
+  }
+
+  auto border = reinterpret_cast<BorderNode *>(n);
+  std::vector<Node *> next_layers{};
+  size_t keys;
+  size_t removed_slots;
+  std::array<BigSuffix *, Node::ORDER - 1> suffixes{};
+  Permutation p;
+retry_border:
+  auto v = n->stableVersion();
+  if(v.deleted){
+    return 0;
+  }
+  next_layers.clear();
+  keys = 0;
+  removed_slots = 0;
+  p = border->getPermutation();
+  for(size_t i = 0; i < p.getNumKeys(); ++i){
+    auto key_len = border->getKeyLen(p(i));
+    if(key_len == BorderNode::key_len_unstable){
+      goto retry_border;
+    }
+    if(key_len == BorderNode::key_len_layer){
+      next_layers.push_back(border->getLV(p(i)).next_layer);
+    }else{
+      ++keys;
+    }
+  }
+  for(size_t i = 0; i < Node::ORDER - 1; ++i){
+    if(border->isKeyRemoved(i)){
+      ++removed_slots;
+    }
+    suffixes[i] = border->getKeySuffixes().get(i);
+  }
+  if((n->loadVersion() ^ v) > Version::has_locked){
+    goto retry_border;
+  }
+
+  ++stats.border_nodes;
+  stats.fill_sum += (double) p.getNumKeys() / (Node::ORDER - 1);
+  stats.keys += keys;
+  stats.keys_per_depth[depth] += keys;
+  stats.removed_slots += removed_slots;
+  for(auto suffix: suffixes){
+    if(suffix != nullptr){
+      ++stats.big_suffixes;
+      // slicesは8byte単位で確保される
+      stats.suffix_bytes += sizeof(BigSuffix) + (suffix->remainLength() + 7) / 8 * sizeof(KeySlice);
+    }
+  }
+  for(auto next_layer: next_layers){
+    if(next_layer != nullptr){
+      collect_tree_stats(next_layer, depth + 1, stats);
+    }
+  }
+  return 1;
+}
+
+/**
+ * layer_rootから始まるLayerと、その下の全てのLayerを辿り、TreeStatsに加える。
+ * 他のthreadが書き込んでいる間に呼んでもよいが、Node毎に別の時点で読むので、おおよその値となる。
+ * 外されたNodeを読むかもしれないので、他のthreadのgc.run()と並行して呼んではならない。
+ * @param layer_root
+ * @param depth Layerの深さ
+ * @param[out] stats
+ */
+static void collect_tree_stats(Node *layer_root, size_t depth, TreeStats &stats){
+  if(stats.layers_per_depth.size() <= depth){
+    stats.layers_per_depth.resize(depth + 1, 0);
+    stats.max_height_per_depth.resize(depth + 1, 0);
+    stats.keys_per_depth.resize(depth + 1, 0);
+  }
+  ++stats.layers_per_depth[depth];
+  auto height = collect_node_stats(layer_root, depth, stats);
+  // collect_node_statsの中でvectorが伸びる事があるので、ここでindexする
+  stats.max_height_per_depth[depth] = std::max(stats.max_height_per_depth[depth], height);
+}
+
+}
+
+#endif //MASSTREE_TREE_STATS_H
@@ -1,14 +1,32 @@
 #ifndef MASSTREE_VALUE_H
 #define MASSTREE_VALUE_H
 
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
 namespace masstree{
 
+/**
+ * Valueの種類。MvccMasstreeとTransactionでのみ、VersionedValueを使う。
+ * NodeのBorderNodeとInteriorNodeと同じく、virtualを持たずにこれで見分ける。
+ */
+enum class ValueKind : uint8_t{
+  Plain,
+  Version,
+  // removeを表すversion。bodyは意味を持たない
+  Tombstone
+};
+
 class Value{
 public:
 
   Value(int body_)
     : body(body_){}
 
+  Value(const Value &other) = delete;
+  Value &operator=(const Value &other) = delete;
+
   bool operator==(const Value &rhs)const{
     return body == rhs.body;
   }
@@ -21,10 +39,115 @@ public:
     return body;
   }
 
+  /**
+   * VersionedValueか
+   */
+  [[nodiscard]]
+  inline bool isVersioned() const{
+    return kind != ValueKind::Plain;
+  }
+
+  [[nodiscard]]
+  inline bool isTombstone() const{
+    return kind == ValueKind::Tombstone;
+  }
+
+  /**
+   * 種類に合わせて解放する。treeやgcが持っていたValueは、deleteではなくこれで解放する。
+   */
+  static void destroy(Value *v);
+
+protected:
+  Value(int body_, ValueKind kind_)
+    : body(body_), kind(kind_){}
+
 private:
   int body;
+  ValueKind kind = ValueKind::Plain;
 };
 
+/**
+ * MvccMasstree(src/mvcc.h)とTransaction(src/transaction.h)で使う、timestampを持つValue。
+ * MvccMasstreeでは、treeに入っているものがそのkeyの最新のversionで、olderを辿ると古いversionとなる。
+ */
+class VersionedValue: public Value{
+public:
+  VersionedValue(int body_)
+    : Value(body_, ValueKind::Version){}
+
+  /**
+   * olderに繋がった古いversionも一緒に解放される。
+   */
+  ~VersionedValue(){
+    auto v = older.exchange(nullptr, std::memory_order_relaxed);
+    while(v != nullptr){
+      auto next = v->older.exchange(nullptr, std::memory_order_relaxed);
+      delete v;
+      v = next;
+    }
+  }
+
+  static VersionedValue *tombstone(){
+    return new VersionedValue(0, ValueKind::Tombstone);
+  }
+
+  /**
+   * 前提: vはnullptrかVersionedValue
+   */
+  static VersionedValue *from(Value *v){
+    assert(v == nullptr or v->isVersioned());
+    return static_cast<VersionedValue *>(v);
+  }
+
+  /**
+   * VersionedValueでない時は0
+   */
+  static uint64_t timestampOf(const Value *v){
+    return v->isVersioned() ? static_cast<const VersionedValue *>(v)->getTimestamp() : 0;
+  }
+
+  [[nodiscard]]
+  inline uint64_t getTimestamp() const{
+    return timestamp;
+  }
+
+  inline void setTimestamp(uint64_t ts){
+    timestamp = ts;
+  }
+
+  [[nodiscard]]
+  inline VersionedValue *getOlder() const{
+    return older.load(std::memory_order_acquire);
+  }
+
+  inline void setOlder(VersionedValue *v){
+    older.store(v, std::memory_order_release);
+  }
+
+  /**
+   * olderとその先を、このversionから外して返す。
+   */
+  inline VersionedValue *detachOlder(){
+    return older.exchange(nullptr, std::memory_order_acq_rel);
+  }
+
+private:
+  VersionedValue(int body_, ValueKind kind_)
+    : Value(body_, kind_){}
+
+  // versionを作ったputのtimestamp、TransactionではTID
+  uint64_t timestamp = 0;
+  std::atomic<VersionedValue *> older{nullptr};
+};
+
+inline void Value::destroy(Value *v){
+  if(v->isVersioned()){
+    delete static_cast<VersionedValue *>(v);
+  }else{
+    delete v;
+  }
+}
+
 }
 
 #endif //MASSTREE_VALUE_H
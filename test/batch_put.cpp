@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include "../src/stats.h"
+#include <map>
+#include <random>
+
+using namespace masstree;
+
+class BatchPutTest: public ::testing::Test{};
+
+TEST(BatchPutTest, sorted_runs){
+  Masstree tree{};
+  GC gc{};
+  constexpr size_t COUNT = 10000;
+  std::vector<std::pair<Key, Value *>> batch{};
+  // 逆順に渡しても、並べ替えてから入れる
+  for(size_t i = COUNT; i > 0; --i){
+    batch.emplace_back(Key({i - 1}, 8), new Value(i - 1));
+  }
+  Stats::reset();
+  tree.multiPut(batch, gc);
+  if(Stats::enabled()){
+    auto snap = Stats::collect();
+    EXPECT_EQ(snap[Stat::Put], COUNT);
+    // 各BorderNodeについて一度だけrootから降りるので、splitの回数程度となる
+    EXPECT_LT(snap[Stat::HintMiss] + snap[Stat::HintHit], COUNT / 4);
+  }
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    ASSERT_EQ(tree.get(k)->getBody(), i);
+  }
+}
+
+/**
+ * 埋まったBorderNodeの間に入るrunは、一つずつsplitせずに一度で必要な数のBorderNodeに分ける。
+ */
+TEST(BatchPutTest, multi_way_split){
+  Masstree tree{};
+  GC gc{};
+  constexpr size_t EXISTING = Node::ORDER - 1;
+  constexpr size_t GAP = 20;
+  // 一つのBorderNodeを埋める
+  for(size_t i = 0; i < EXISTING; ++i){
+    Key k({i * GAP}, 8);
+    tree.put(k, new Value(i * GAP), gc);
+  }
+  std::vector<std::pair<Key, Value *>> batch{};
+  for(size_t i = 0; i < EXISTING * GAP; ++i){
+    if(i % GAP != 0){
+      batch.emplace_back(Key({i}, 8), new Value(i));
+    }
+  }
+  // 同じsliceの短いkeyは、同じBorderNodeに入る
+  batch.emplace_back(Key({GAP + 1}, 3), new Value(1000));
+  Stats::reset();
+  tree.multiPut(batch, gc);
+  if(Stats::enabled()){
+    auto snap = Stats::collect();
+    // 一つずつputされたkeyは無い
+    EXPECT_EQ(snap[Stat::HintMiss] + snap[Stat::HintHit], 0);
+    auto total = EXISTING + batch.size();
+    EXPECT_EQ(snap.totalSplits(), (total + EXISTING - 1) / EXISTING - 1);
+  }
+  for(size_t i = 0; i < EXISTING * GAP; ++i){
+    Key k({i}, 8);
+    auto v = tree.get(k);
+    ASSERT_NE(v, nullptr);
+    EXPECT_EQ(v->getBody(), i);
+  }
+  Key short_key({GAP + 1}, 3);
+  ASSERT_NE(tree.get(short_key), nullptr);
+  EXPECT_EQ(tree.get(short_key)->getBody(), 1000);
+  size_t count = 0;
+  std::vector<KeySlice> previous{};
+  tree.scan([&count, &previous](const Key &k, Value *){
+    EXPECT_TRUE(previous.empty() or previous < k.slices or previous == k.slices);
+    previous = k.slices;
+    ++count;
+    return true;
+  });
+  EXPECT_EQ(count, EXISTING * GAP + 1);
+}
+
+/**
+ * Layerを作るkey、下のLayerに入るkey、上書き、batch中の重複が混ざっていても、
+ * 先頭から順にputした場合と同じになる。
+ */
+TEST(BatchPutTest, same_as_sequential_puts){
+  Masstree tree{};
+  GC gc{};
+  std::map<std::vector<KeySlice>, size_t> model{};
+  std::mt19937_64 rng(44);
+  for(size_t round = 0; round < 20; ++round){
+    std::vector<std::pair<Key, Value *>> batch{};
+    for(size_t i = 0; i < 1000; ++i){
+      std::vector<KeySlice> slices{rng() % 500};
+      if(rng() % 3 == 0){
+        slices.push_back(rng() % 10);
+      }
+      auto body = round * 1000 + i;
+      model[slices] = body;
+      batch.emplace_back(Key(slices, 8), new Value(body));
+    }
+    tree.multiPut(batch, gc);
+  }
+  for(auto &entry: model){
+    Key k(entry.first, 8);
+    ASSERT_EQ(tree.get(k)->getBody(), entry.second);
+  }
+  size_t count = 0;
+  tree.scan([&count](const Key &, Value *){
+    ++count;
+    return true;
+  });
+  EXPECT_EQ(count, model.size());
+}
@@ -0,0 +1,242 @@
+#include <gtest/gtest.h>
+#include "../src/checkpoint.h"
+
+using namespace masstree;
+
+class CheckpointTest: public ::testing::Test{};
+
+static std::string checkpoint_dir(const std::string &name){
+  auto dir = "/tmp/masstree_checkpoint_" + name + "_" + std::to_string(getpid());
+  system(("rm -rf " + dir).c_str());
+  return dir;
+}
+
+static std::string key_of(size_t i){
+  // 共通のprefixを持つ長いkeyと、短いkeyを混ぜる
+  return i % 3 == 0 ? "user/profile/" + std::to_string(i) : std::to_string(i * 7919);
+}
+
+static void put_keys(Masstree &tree, size_t count, GC &gc){
+  for(size_t i = 0; i < count; ++i){
+    auto key = key_of(i);
+    auto k = key_from_bytes(key.data(), key.size());
+    tree.put(k, new Value(static_cast<int>(i)), gc);
+  }
+}
+
+static std::vector<std::pair<std::string, int>> dump(Masstree &tree){
+  std::vector<std::pair<std::string, int>> entries{};
+  tree.scan([&entries](const Key &key, Value *value){
+    entries.emplace_back(key_to_bytes(key), value->getBody());
+    return true;
+  });
+  return entries;
+}
+
+TEST(CheckpointTest, partition){
+  Masstree tree{};
+  GC gc{};
+  EXPECT_TRUE(tree.partition(4).empty());
+  put_keys(tree, 10, gc);
+  // rootがBorderNodeの時は分けられない
+  EXPECT_TRUE(tree.partition(4).empty());
+  put_keys(tree, 20000, gc);
+  auto boundaries = tree.partition(8);
+  EXPECT_FALSE(boundaries.empty());
+  EXPECT_LE(boundaries.size(), 7);
+  EXPECT_TRUE(std::is_sorted(boundaries.begin(), boundaries.end()));
+  EXPECT_TRUE(tree.partition(1).empty());
+  gc.run();
+}
+
+TEST(CheckpointTest, partition_deleted_root){
+  Node *root = nullptr;
+  GC gc{};
+  std::vector<Key> keys{};
+  for(KeySlice i = 1; i <= 20; ++i){
+    keys.emplace_back(std::vector<KeySlice>{i}, 8);
+  }
+  for(auto &k: keys){
+    root = put_at_layer0(root, k, new Value(1), gc).second;
+  }
+  ASSERT_FALSE(root->getIsBorder());
+  auto old_root = root;
+  std::vector<KeySlice> boundaries{};
+  EXPECT_TRUE(partition_layer(old_root, 4, boundaries));
+  EXPECT_EQ(boundaries.size(), 1);
+  // 片方のBorderNodeを空にすると、rootが引き上げられて古いrootは消える
+  for(size_t i = 0; root == old_root; ++i){
+    root = remove_at_layer0(root, keys[i], gc);
+  }
+  EXPECT_FALSE(partition_layer(old_root, 4, boundaries));
+  EXPECT_TRUE(partition_layer(root, 4, boundaries));
+  EXPECT_TRUE(boundaries.empty());
+  gc.run();
+}
+
+TEST(CheckpointTest, write_restore){
+  auto dir = checkpoint_dir("roundtrip");
+  Masstree tree{};
+  GC gc{};
+  put_keys(tree, 30000, gc);
+
+  CheckpointStats written{};
+  ASSERT_TRUE(write_checkpoint(tree, dir, 4, written));
+  EXPECT_EQ(written.keys, 30000);
+  EXPECT_GT(written.segments, 1);
+
+  Masstree restored{};
+  CheckpointStats read{};
+  ASSERT_TRUE(restore_checkpoint(restored, dir, 4, read));
+  EXPECT_EQ(read.keys, 30000);
+  EXPECT_EQ(read.segments, written.segments);
+  EXPECT_EQ(dump(restored), dump(tree));
+
+  // 一つのthreadでも同じものが読める
+  Masstree single{};
+  CheckpointStats single_read{};
+  ASSERT_TRUE(restore_checkpoint(single, dir, 1, single_read));
+  EXPECT_EQ(dump(single), dump(tree));
+  gc.run();
+  system(("rm -rf " + dir).c_str());
+}
+
+TEST(CheckpointTest, empty_and_small){
+  auto dir = checkpoint_dir("small");
+  Masstree tree{};
+  CheckpointStats stats{};
+  ASSERT_TRUE(write_checkpoint(tree, dir, 4, stats));
+  EXPECT_EQ(stats.segments, 1);
+  EXPECT_EQ(stats.keys, 0);
+
+  GC gc{};
+  put_keys(tree, 5, gc);
+  ASSERT_TRUE(write_checkpoint(tree, dir, 4, stats));
+  Masstree restored{};
+  CheckpointStats read{};
+  ASSERT_TRUE(restore_checkpoint(restored, dir, 4, read));
+  EXPECT_EQ(dump(restored), dump(tree));
+  gc.run();
+  system(("rm -rf " + dir).c_str());
+}
+
+TEST(CheckpointTest, corrupted){
+  auto dir = checkpoint_dir("corrupted");
+  Masstree tree{};
+  GC gc{};
+  put_keys(tree, 20000, gc);
+  CheckpointStats stats{};
+  ASSERT_TRUE(write_checkpoint(tree, dir, 2, stats));
+
+  Masstree missing{};
+  CheckpointStats read{};
+  EXPECT_FALSE(restore_checkpoint(missing, dir + "_none", 2, read));
+
+  // footerが欠けたsegment
+  auto path = dir + "/" + segment_name(0);
+  struct stat st{};
+  ASSERT_EQ(stat(path.c_str(), &st), 0);
+  ASSERT_EQ(truncate(path.c_str(), st.st_size - 3), 0);
+  Masstree restored{};
+  EXPECT_FALSE(restore_checkpoint(restored, dir, 2, read));
+  gc.run();
+  system(("rm -rf " + dir).c_str());
+}
+
+TEST(CheckpointTest, block_encoding){
+  BlockEncoder encoder{};
+  encoder.add("user/profile/1", 1);
+  encoder.add("user/profile/12", -2);
+  encoder.add("user/z", INT32_MAX);
+  std::string block{};
+  encoder.finish(block);
+  EXPECT_TRUE(encoder.empty());
+  // 共通のprefixを除くので、keyをそのまま並べるより短い
+  EXPECT_LT(block.size(), CHECKPOINT_BLOCK_HEADER + 14 + 15 + 6);
+
+  uint32_t body_len, crc;
+  std::memcpy(&body_len, block.data(), 4);
+  std::memcpy(&crc, block.data() + 4, 4);
+  ASSERT_EQ(body_len, block.size() - CHECKPOINT_BLOCK_HEADER);
+  EXPECT_EQ(crc32c(block.data() + 8, body_len), crc);
+  std::vector<std::pair<std::string, int32_t>> decoded{};
+  ASSERT_TRUE(decode_block(block.data() + 8, body_len, [&decoded](const std::string &key, int32_t value){
+    decoded.emplace_back(key, value);
+  }));
+  std::vector<std::pair<std::string, int32_t>> expected{{"user/profile/1", 1}, {"user/profile/12", -2}, {"user/z", INT32_MAX}};
+  EXPECT_EQ(decoded, expected);
+  EXPECT_FALSE(decode_block(block.data() + 8, body_len - 1, [](const std::string &, int32_t){}));
+
+  // "123456789"のCRC32C
+  EXPECT_EQ(crc32c("123456789", 9), 0xe3069283u);
+}
+
+TEST(CheckpointTest, skip_corrupted_block){
+  auto dir = checkpoint_dir("skip");
+  Masstree tree{};
+  GC gc{};
+  put_keys(tree, 20000, gc);
+  CheckpointStats stats{};
+  ASSERT_TRUE(write_checkpoint(tree, dir, 1, stats));
+  ASSERT_EQ(stats.segments, 1);
+
+  // 二つ目のblockの中の1byteを壊す
+  auto path = dir + "/" + segment_name(0);
+  SegmentIndex index{};
+  ASSERT_TRUE(read_segment_index(path, index));
+  ASSERT_GT(index.blocks.size(), 2);
+  auto fd = open(path.c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  char c;
+  auto pos = static_cast<off_t>(index.blocks[1].first + CHECKPOINT_BLOCK_HEADER + 10);
+  ASSERT_EQ(pread(fd, &c, 1, pos), 1);
+  c ^= 0x40;
+  ASSERT_EQ(pwrite(fd, &c, 1, pos), 1);
+  close(fd);
+
+  Masstree restored{};
+  CheckpointStats read{};
+  ASSERT_TRUE(restore_checkpoint(restored, dir, 2, read));
+  EXPECT_EQ(read.corrupted_blocks, 1);
+  EXPECT_EQ(read.skipped_keys, index.blockRecords(1));
+  EXPECT_EQ(read.keys + read.skipped_keys, 20000);
+
+  // 先頭から流して読んでも、同じblockを飛ばす
+  Masstree streamed{};
+  CheckpointStats loaded{};
+  EXPECT_TRUE(bulk_load(streamed, path, gc, loaded));
+  EXPECT_EQ(loaded.corrupted_blocks, 1);
+  EXPECT_EQ(loaded.keys, read.keys);
+  EXPECT_EQ(dump(streamed).size(), read.keys);
+  gc.run();
+  system(("rm -rf " + dir).c_str());
+}
+
+TEST(CheckpointTest, bulk_load){
+  auto dir = checkpoint_dir("bulk");
+  Masstree tree{};
+  GC gc{};
+  put_keys(tree, 20000, gc);
+  CheckpointStats stats{};
+  ASSERT_TRUE(write_checkpoint(tree, dir, 4, stats));
+
+  Masstree loaded{};
+  CheckpointStats read{};
+  for(size_t i = 0; i < stats.segments; ++i){
+    ASSERT_TRUE(bulk_load(loaded, dir + "/" + segment_name(i), gc, read));
+  }
+  EXPECT_EQ(read.keys, 20000);
+  EXPECT_EQ(dump(loaded), dump(tree));
+
+  // 途中で切れたsegmentは、そこまで読んでfalseを返す
+  auto path = dir + "/" + segment_name(0);
+  struct stat st{};
+  ASSERT_EQ(stat(path.c_str(), &st), 0);
+  ASSERT_EQ(truncate(path.c_str(), st.st_size / 2), 0);
+  Masstree truncated{};
+  CheckpointStats partial{};
+  EXPECT_FALSE(bulk_load(truncated, path, gc, partial));
+  EXPECT_GT(partial.keys, 0);
+  gc.run();
+  system(("rm -rf " + dir).c_str());
+}
@@ -0,0 +1,217 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include "../src/compactor.h"
+#include <thread>
+
+using namespace masstree;
+
+class CompactTest: public ::testing::Test{};
+
+/**
+ * 大半のkeyを消した後にcompactすると、BorderNodeは併合され、
+ * removeされたslotは無くなり、残ったkeyは引き続き取得できる。
+ */
+TEST(CompactTest, merge_sparse_borders){
+  Masstree tree{};
+  GC gc{};
+  constexpr size_t COUNT = 300;
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  for(size_t i = 0; i < COUNT; ++i){
+    if(i % 10 != 0){
+      Key k({i}, 8);
+      tree.remove(k, gc);
+    }
+  }
+  auto before = tree.stats();
+  EXPECT_GT(before.removed_slots, 0);
+
+  GC compact_gc{};
+  auto result = tree.compact(compact_gc);
+  auto after = tree.stats();
+  EXPECT_GT(result.merged_nodes, 0);
+  EXPECT_LT(after.border_nodes, before.border_nodes);
+  EXPECT_EQ(after.removed_slots, 0);
+  EXPECT_EQ(after.keys, COUNT / 10);
+  EXPECT_GT(after.borderFillFactor(), before.borderFillFactor());
+
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    auto v = tree.get(k);
+    if(i % 10 == 0){
+      ASSERT_NE(v, nullptr);
+      EXPECT_EQ(v->getBody(), i);
+    }else{
+      EXPECT_EQ(v, nullptr);
+    }
+  }
+
+  // 詰め直した後も、putとremoveは正しく行える
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i + 1), gc);
+  }
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    EXPECT_EQ(tree.get(k)->getBody(), i + 1);
+  }
+}
+
+/**
+ * 下のLayerも詰め直され、removeされたslotのsuffixが解放される。
+ */
+TEST(CompactTest, lower_layer_and_suffix){
+  Masstree tree{};
+  GC gc{};
+  constexpr size_t COUNT = 200;
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({1, i, 7}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  for(size_t i = 0; i < COUNT; ++i){
+    if(i % 20 != 0){
+      Key k({1, i, 7}, 8);
+      tree.remove(k, gc);
+    }
+  }
+  auto before = tree.stats();
+  ASSERT_EQ(before.layers_per_depth.size(), 2);
+
+  GC compact_gc{};
+  auto result = tree.compact(compact_gc);
+  auto after = tree.stats();
+  EXPECT_GT(result.merged_nodes, 0);
+  EXPECT_GT(result.purged_slots, 0);
+  EXPECT_EQ(after.removed_slots, 0);
+  EXPECT_EQ(after.big_suffixes, COUNT / 20);
+  EXPECT_LT(after.suffix_bytes, before.suffix_bytes);
+
+  for(size_t i = 0; i < COUNT; i += 20){
+    Key k({1, i, 7}, 8);
+    ASSERT_NE(tree.get(k), nullptr);
+    EXPECT_EQ(tree.get(k)->getBody(), i);
+  }
+  compact_gc.run();
+}
+
+/**
+ * background threadでcompactionを行いながら、put/remove/getを行う。
+ */
+TEST(CompactTest, background){
+  Masstree tree{};
+  constexpr size_t COUNT = 2000;
+  {
+    GC gc{};
+    for(size_t i = 0; i < COUNT; ++i){
+      Key k({i % 3, i}, 8);
+      tree.put(k, new Value(i), gc);
+    }
+  }
+
+  BackgroundCompactor compactor(tree, std::chrono::milliseconds(1));
+  compactor.start();
+
+  auto remover = [&tree](){
+    GC gc{};
+    for(size_t i = 0; i < COUNT; ++i){
+      if(i % 4 != 0){
+        Key k({i % 3, i}, 8);
+        tree.remove(k, gc);
+      }
+    }
+  };
+  auto reader = [&tree](){
+    for(size_t n = 0; n < 3; ++n){
+      for(size_t i = 0; i < COUNT; i += 4){
+        Key k({i % 3, i}, 8);
+        auto v = tree.get(k);
+        ASSERT_NE(v, nullptr);
+        EXPECT_EQ(v->getBody(), i);
+      }
+    }
+  };
+  auto writer = [&tree](){
+    GC gc{};
+    for(size_t i = 0; i < COUNT; i += 2){
+      Key k({i % 3, COUNT + i}, 8);
+      tree.put(k, new Value(i), gc);
+    }
+  };
+  std::thread a(remover);
+  std::thread b(reader);
+  std::thread c(writer);
+  a.join();
+  b.join();
+  c.join();
+  while(compactor.getPasses() < 2){
+    std::this_thread::yield();
+  }
+  compactor.stop();
+
+  EXPECT_GT(compactor.getResult().merged_nodes, 0);
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i % 3, i}, 8);
+    auto v = tree.get(k);
+    if(i % 4 == 0){
+      ASSERT_NE(v, nullptr);
+      EXPECT_EQ(v->getBody(), i);
+    }else{
+      EXPECT_EQ(v, nullptr);
+    }
+  }
+  for(size_t i = 0; i < COUNT; i += 2){
+    Key k({i % 3, COUNT + i}, 8);
+    auto v = tree.get(k);
+    ASSERT_NE(v, nullptr);
+    EXPECT_EQ(v->getBody(), i);
+  }
+}
+
+/**
+ * safe_pointを渡すと、stop()を待たずに外したNodeが解放される。
+ */
+TEST(CompactTest, background_reclaim){
+  Masstree tree{};
+  constexpr size_t COUNT = 2000;
+  GC gc{};
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+
+  // 他に読み書きするthreadがいない間だけ、safe pointとみなす
+  std::atomic<bool> quiescent{false};
+  BackgroundCompactor compactor(tree, std::chrono::milliseconds(1), [&quiescent](){
+    return quiescent.load();
+  });
+  compactor.start();
+  std::thread remover([&tree, &gc](){
+    for(size_t i = 0; i < COUNT; ++i){
+      if(i % 8 != 0){
+        Key k({i}, 8);
+        tree.remove(k, gc);
+      }
+    }
+  });
+  remover.join();
+  quiescent = true;
+  while(compactor.getReclaims() == 0){
+    std::this_thread::yield();
+  }
+  compactor.stop();
+
+  EXPECT_GT(compactor.getResult().merged_nodes, 0);
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    auto v = tree.get(k);
+    if(i % 8 == 0){
+      ASSERT_NE(v, nullptr);
+      EXPECT_EQ(v->getBody(), i);
+    }else{
+      EXPECT_EQ(v, nullptr);
+    }
+  }
+  gc.run();
+}
@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include "sample.h"
+
+using namespace masstree;
+
+class ConditionalTest: public ::testing::Test{};
+
+TEST(ConditionalTest, insertIfAbsent){
+  Masstree tree{};
+  GC gc{};
+  Key k({ONE, TWO}, 3);
+  auto v1 = new Value(1);
+  auto v2 = new Value(2);
+  EXPECT_EQ(tree.insertIfAbsent(k, v1, gc), nullptr);
+  EXPECT_EQ(tree.insertIfAbsent(k, v2, gc), v1);
+  EXPECT_EQ(tree.get(k), v1);
+  EXPECT_FALSE(gc.contain(v1));
+  delete v2;
+}
+
+TEST(ConditionalTest, compareAndSet){
+  Masstree tree{};
+  GC gc{};
+  Key k({ONE}, 8);
+  auto v1 = new Value(1);
+  auto v2 = new Value(2);
+  auto v3 = new Value(3);
+  // keyが無いので、expectedがnullptrの時のみ成功する
+  EXPECT_FALSE(tree.compareAndSet(k, v2, v3, gc));
+  EXPECT_EQ(tree.get(k), nullptr);
+  EXPECT_TRUE(tree.compareAndSet(k, nullptr, v1, gc));
+  EXPECT_EQ(tree.get(k), v1);
+
+  EXPECT_FALSE(tree.compareAndSet(k, v2, v3, gc));
+  EXPECT_EQ(tree.get(k), v1);
+  EXPECT_TRUE(tree.compareAndSet(k, v1, v2, gc));
+  EXPECT_EQ(tree.get(k), v2);
+  EXPECT_TRUE(gc.contain(v1));
+  EXPECT_FALSE(tree.compareAndSet(k, nullptr, v3, gc));
+  delete v3;
+}
+
+TEST(ConditionalTest, upsert){
+  Masstree tree{};
+  GC gc{};
+  auto increment = [](Value *old){
+    return new Value(old == nullptr ? 1 : old->getBody() + 1);
+  };
+  for(size_t i = 0; i < 50; ++i){
+    Key k({i % 5, i % 3}, 8);
+    tree.upsert(k, increment, gc);
+  }
+  for(size_t i = 0; i < 15; ++i){
+    Key k({i % 5, i % 3}, 8);
+    auto expected = 50 / 15 + (i < 50 % 15 ? 1 : 0);
+    EXPECT_EQ(tree.get(k)->getBody(), expected);
+  }
+
+  // nullptrを返した場合は何もしない
+  Key absent({9}, 1);
+  EXPECT_EQ(tree.upsert(absent, [](Value *){ return nullptr; }, gc), nullptr);
+  EXPECT_EQ(tree.get(absent), nullptr);
+}
+
+/**
+ * fは新しいLayerが作られる場合にも一度だけ呼ばれる。
+ */
+TEST(ConditionalTest, upsert_new_layer){
+  Masstree tree{};
+  GC gc{};
+  Key k1({ONE, TWO}, 8);
+  Key k2({ONE, THREE}, 8);
+  tree.put(k1, new Value(1), gc);
+  size_t calls = 0;
+  auto v = tree.upsert(k2, [&calls](Value *old){
+    ++calls;
+    EXPECT_EQ(old, nullptr);
+    return new Value(2);
+  }, gc);
+  EXPECT_EQ(calls, 1);
+  EXPECT_EQ(v->getBody(), 2);
+  EXPECT_EQ(tree.get(k1)->getBody(), 1);
+  EXPECT_EQ(tree.get(k2)->getBody(), 2);
+}
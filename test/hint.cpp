@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include "../src/stats.h"
+#include <map>
+#include <random>
+
+using namespace masstree;
+
+class HintTest: public ::testing::Test{};
+
+TEST(HintTest, sequential_skips_descent){
+  Masstree tree{};
+  GC gc{};
+  LeafHint hint{};
+  constexpr size_t COUNT = 10000;
+  Stats::reset();
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc, hint);
+  }
+  if(Stats::enabled()){
+    auto put_snap = Stats::collect();
+    // 小さい順に入れると、splitで新しく出来たBorderNodeの時だけ降りる
+    EXPECT_GT(put_snap[Stat::HintHit], COUNT * 3 / 4);
+  }
+
+  Stats::reset();
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    ASSERT_EQ(tree.get(k, hint)->getBody(), i);
+  }
+  if(Stats::enabled()){
+    auto get_snap = Stats::collect();
+    EXPECT_GT(get_snap[Stat::HintHit], COUNT * 3 / 4);
+    EXPECT_EQ(get_snap[Stat::HintHit] + get_snap[Stat::HintMiss], COUNT);
+  }
+
+  // hintを使わないgetからも、同じように見える
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    ASSERT_EQ(tree.get(k)->getBody(), i);
+  }
+}
+
+TEST(HintTest, lower_layers){
+  Masstree tree{};
+  GC gc{};
+  LeafHint hint{};
+  for(size_t i = 0; i < 1000; ++i){
+    Key k({i / 100, i, i}, 8);
+    tree.put(k, new Value(i), gc, hint);
+  }
+  for(size_t i = 0; i < 1000; ++i){
+    Key k({i / 100, i, i}, 8);
+    ASSERT_EQ(tree.get(k, hint)->getBody(), i);
+    Key other({i / 100 + 1000, i, i}, 8);
+    ASSERT_EQ(tree.get(other, hint), nullptr);
+  }
+}
+
+/**
+ * removeでnextのlowestKey()が境界より大きくなっていても、
+ * その間のkeyはnextに入れなければならない。
+ */
+TEST(HintTest, gap_before_next_lowest_key){
+  Masstree tree{};
+  GC gc{};
+  constexpr size_t COUNT = 200;
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  // 各BorderNodeの先頭付近を消す
+  for(size_t i = 0; i < COUNT; ++i){
+    if(i % 10 < 5){
+      Key k({i}, 8);
+      tree.remove(k, gc);
+    }
+  }
+  LeafHint hint{};
+  for(size_t i = 0; i < COUNT; ++i){
+    if(i % 10 < 5){
+      Key k({i}, 8);
+      tree.put(k, new Value(i + 1000), gc, hint);
+    }
+  }
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    auto expected = i % 10 < 5 ? i + 1000 : i;
+    ASSERT_EQ(tree.get(k)->getBody(), expected);
+  }
+  size_t count = 0;
+  tree.scan([&count](const Key &key, Value *){
+    EXPECT_EQ(key.slices[0], count);
+    ++count;
+    return true;
+  });
+  EXPECT_EQ(count, COUNT);
+}
+
+TEST(HintTest, random_with_remove){
+  Masstree tree{};
+  GC gc{};
+  LeafHint hint{};
+  std::map<size_t, size_t> model{};
+  std::mt19937_64 rng(43);
+  for(size_t round = 0; round < 20000; ++round){
+    // 近い範囲を行き来する
+    size_t key = (round / 64) * 16 + rng() % 256;
+    Key k({key}, 8);
+    switch(rng() % 4){
+      case 0:{
+        auto removed = tree.remove(k, gc);
+        auto it = model.find(key);
+        if(it == model.end()){
+          ASSERT_EQ(removed, nullptr);
+        }else{
+          ASSERT_EQ(removed->getBody(), it->second);
+          model.erase(it);
+        }
+        break;
+      }
+      case 1:{
+        auto found = tree.get(k, hint);
+        auto it = model.find(key);
+        if(it == model.end()){
+          ASSERT_EQ(found, nullptr);
+        }else{
+          ASSERT_EQ(found->getBody(), it->second);
+        }
+        break;
+      }
+      default:
+        tree.put(k, new Value(round), gc, hint);
+        model[key] = round;
+    }
+  }
+  for(auto &entry: model){
+    Key k({entry.first}, 8);
+    ASSERT_EQ(tree.get(k)->getBody(), entry.second);
+  }
+  hint.reset();
+}
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include "../src/hotspot.h"
+#include <thread>
+
+using namespace masstree;
+
+class HotspotTest: public ::testing::Test{
+protected:
+  void SetUp() override{
+    period = Hotspot::samplePeriod();
+    Hotspot::setSamplePeriod(1);
+    Hotspot::reset();
+  }
+
+  void TearDown() override{
+    Hotspot::setSamplePeriod(period);
+    Hotspot::reset();
+  }
+
+  uint64_t period = 0;
+};
+
+#ifdef MASSTREE_HOTSPOT
+
+TEST_F(HotspotTest, hot_key_is_first){
+  Masstree tree{};
+  GC gc{};
+  for(size_t i = 0; i < 100; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  for(size_t round = 0; round < 50; ++round){
+    Key hot({7}, 8);
+    tree.get(hot);
+    Key cold({round}, 8);
+    tree.get(cold);
+  }
+  auto snap = Hotspot::collect(4);
+  ASSERT_FALSE(snap.keys.empty());
+  EXPECT_LE(snap.keys.size(), 4);
+  EXPECT_EQ(snap.keys[0].key, Key({7}, 8));
+  // put一回と、getの50回と、coldとして一回
+  EXPECT_GE(snap.keys[0].count, 52);
+  ASSERT_FALSE(snap.nodes.empty());
+  // keyの7が入っているBorderNodeには、少なくともgetの50回と、coldとして一回
+  EXPECT_GE(snap.nodes[0].accesses, 51);
+  EXPECT_EQ(snap.sample_period, 1);
+}
+
+/**
+ * 終了したthreadのsampleも集計に含まれる。
+ */
+TEST_F(HotspotTest, aggregate_threads){
+  Masstree tree{};
+  auto w = [&tree](size_t from){
+    GC gc{};
+    for(size_t i = from; i < from + 50; ++i){
+      Key k({i}, 8);
+      tree.put(k, new Value(i), gc);
+      Key hot({1000}, 8);
+      tree.put(hot, new Value(i), gc);
+    }
+  };
+  std::thread a(w, 0);
+  std::thread b(w, 50);
+  a.join();
+  b.join();
+
+  auto snap = Hotspot::collect();
+  ASSERT_FALSE(snap.keys.empty());
+  EXPECT_EQ(snap.keys[0].key, Key({1000}, 8));
+  EXPECT_GE(snap.keys[0].count, 100);
+  Hotspot::reset();
+  EXPECT_TRUE(Hotspot::collect().keys.empty());
+}
+
+// putがlockを待ち始めた事を、Stat::LockSpinで知る
+#ifdef MASSTREE_STATS
+TEST_F(HotspotTest, lock_contention){
+  GC gc{};
+  Key k({1}, 8);
+  Node *root = put_at_layer0(nullptr, k, new Value(1), gc).second;
+  k.reset();
+  auto n = findBorder(root, k).first;
+  n->lock();
+  std::thread t([root](){
+    GC gc{};
+    Key k({1}, 8);
+    put_at_layer0(root, k, new Value(2), gc);
+  });
+  // putがlockを待つまで待つ
+  auto spins = Stats::collect()[Stat::LockSpin];
+  while(Stats::collect()[Stat::LockSpin] == spins){
+    std::this_thread::yield();
+  }
+  n->unlock();
+  t.join();
+
+  auto snap = Hotspot::collect();
+  ASSERT_EQ(snap.contended.size(), 1);
+  EXPECT_EQ(snap.contended[0].node, n);
+  EXPECT_GT(snap.contended[0].lock_spins, 0);
+}
+#endif
+
+#endif
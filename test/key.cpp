@@ -53,3 +53,31 @@ TEST(KeyTest, getCurrentSlice){
   a.next();
   EXPECT_EQ(a.getCurrentSlice().size, 4);
 }
+
+TEST(KeyTest, compare){
+  Key a({ONE}, 3);
+  Key b({ONE}, 8);
+  Key c({ONE, ONE}, 1);
+  Key d({TWO}, 1);
+  // 同じsliceでは短い方が前で、次のsliceを持つkeyはさらに後
+  EXPECT_LT(a.compare(b), 0);
+  EXPECT_LT(b.compare(c), 0);
+  EXPECT_LT(c.compare(d), 0);
+  EXPECT_GT(d.compare(a), 0);
+  EXPECT_EQ(c.compare(Key({ONE, ONE}, 1)), 0);
+}
+
+TEST(KeyTest, bytes){
+  auto a = key_from_bytes("abcdefghij", 10);
+  EXPECT_EQ(a.slices.size(), 2);
+  EXPECT_EQ(a.slices[0], 0x6162636465666768ULL);
+  EXPECT_EQ(a.slices[1], 0x696a000000000000ULL);
+  EXPECT_EQ(a.lastSliceSize, 2);
+  EXPECT_EQ(key_to_bytes(a), "abcdefghij");
+  // byte列の辞書順と同じ順になる
+  auto b = key_from_bytes("abcdefgh", 8);
+  auto c = key_from_bytes("abcdefgh\0", 9);
+  EXPECT_LT(b.compare(c), 0);
+  EXPECT_LT(c.compare(a), 0);
+  EXPECT_EQ(key_to_bytes(c), std::string("abcdefgh\0", 9));
+}
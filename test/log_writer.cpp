@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include "../src/log_writer.h"
+
+using namespace masstree;
+
+class LogWriterTest: public ::testing::Test{};
+
+static std::string log_path(const std::string &name){
+  auto path = "/tmp/masstree_log_" + name + "_" + std::to_string(getpid()) + ".log";
+  unlink(path.c_str());
+  return path;
+}
+
+static void write_and_replay(bool use_io_uring){
+  auto path = log_path(use_io_uring ? "uring" : "pwritev");
+  LogWriter writer{};
+  LogWriter::Options options{};
+  options.use_io_uring = use_io_uring;
+  options.group_ops = 100;
+  ASSERT_TRUE(writer.open(path, options));
+  if(!use_io_uring){
+    EXPECT_FALSE(writer.usingIoUring());
+  }
+  size_t called = 0;
+  {
+    LogBuffer log(writer);
+    for(int i = 0; i < 1000; ++i){
+      log.append(LogOp::Put, "key" + std::to_string(i), i, [&called](bool ok){
+        EXPECT_TRUE(ok);
+        ++called;
+      });
+    }
+    log.append(LogOp::Remove, "key0", 0);
+    EXPECT_TRUE(log.sync());
+    // syncの後には、それまでのcallbackは全て呼ばれている
+    EXPECT_EQ(called, 1000);
+  }
+  writer.close();
+  auto stats = writer.stats();
+  EXPECT_EQ(stats.ops, 1001);
+  EXPECT_GE(stats.groups, 1);
+
+  std::vector<std::pair<LogOp, std::string>> records{};
+  auto count = replay_log(path, [&records](LogOp op, const std::string &key, int32_t value){
+    if(op == LogOp::Put){
+      EXPECT_EQ(key, "key" + std::to_string(value));
+    }
+    records.emplace_back(op, key);
+  });
+  EXPECT_EQ(count, 1001);
+  ASSERT_EQ(records.size(), 1001);
+  EXPECT_EQ(records[999].second, "key999");
+  EXPECT_EQ(records[1000].first, LogOp::Remove);
+  unlink(path.c_str());
+}
+
+TEST(LogWriterTest, io_uring){
+  write_and_replay(true);
+}
+
+TEST(LogWriterTest, pwritev){
+  write_and_replay(false);
+}
+
+TEST(LogWriterTest, torn_tail){
+  auto path = log_path("torn");
+  std::string data{};
+  encode_log_record(LogOp::Put, 0, "a", 1, data);
+  encode_log_record(LogOp::Put, 1, "b", 2, data);
+  auto first = data.size();
+  encode_log_record(LogOp::Put, 2, "c", 3, data);
+  {
+    // 三つ目を書きかけにする
+    auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, data.data(), data.size() - 2), static_cast<ssize_t>(data.size() - 2));
+    close(fd);
+  }
+  EXPECT_EQ(replay_log(path, [](LogOp, const std::string &, int32_t){}), 2);
+
+  // checksumが合わない所で止まる
+  data[first - 1] ^= 1;
+  {
+    auto fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+    ASSERT_EQ(write(fd, data.data(), data.size()), static_cast<ssize_t>(data.size()));
+    close(fd);
+  }
+  EXPECT_EQ(replay_log(path, [](LogOp, const std::string &, int32_t){}), 1);
+  unlink(path.c_str());
+}
+
+/**
+ * fileの中の順ではなく、seqの順にreplayする。
+ */
+TEST(LogWriterTest, replay_in_seq_order){
+  auto path = log_path("seq");
+  std::string data{};
+  encode_log_record(LogOp::Put, 2, "a", 2, data);
+  encode_log_record(LogOp::Remove, 1, "a", 0, data);
+  encode_log_record(LogOp::Put, 0, "a", 1, data);
+  {
+    auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, data.data(), data.size()), static_cast<ssize_t>(data.size()));
+    close(fd);
+  }
+  std::vector<int32_t> values{};
+  EXPECT_EQ(replay_log(path, [&values](LogOp op, const std::string &, int32_t value){
+    values.push_back(op == LogOp::Put ? value : -1);
+  }), 3);
+  EXPECT_EQ(values, (std::vector<int32_t>{1, -1, 2}));
+
+  Masstree tree{};
+  GC gc{};
+  EXPECT_EQ(recover_from_log(tree, path, gc), 3);
+  auto a = key_from_bytes("a", 1);
+  ASSERT_NE(tree.get(a), nullptr);
+  EXPECT_EQ(tree.get(a)->getBody(), 2);
+  gc.run();
+  unlink(path.c_str());
+}
+
+TEST(LogWriterTest, recover){
+  auto path = log_path("recover");
+  {
+    Masstree tree{};
+    GC gc{};
+    LogWriter writer{};
+    ASSERT_TRUE(writer.open(path));
+    {
+      LogBuffer log(writer);
+      logged_put(tree, log, "apple", 1, gc);
+      logged_put(tree, log, "a long key over eight bytes", 2, gc);
+      logged_put(tree, log, "banana", 3, gc);
+      EXPECT_NE(logged_remove(tree, log, "banana", gc), nullptr);
+      // 無いkeyはlogに積まない
+      EXPECT_EQ(logged_remove(tree, log, "cherry", gc), nullptr);
+    }
+    writer.close();
+    gc.run();
+  }
+  {
+    // 既にあるlogには追記する
+    LogWriter writer{};
+    ASSERT_TRUE(writer.open(path));
+    LogBuffer log(writer);
+    log.append(LogOp::Put, "cherry", 4);
+    // seqは前のlogの続きから振られるので、前のputより後に反映される
+    log.append(LogOp::Put, "apple", 5);
+  }
+
+  Masstree tree{};
+  GC gc{};
+  EXPECT_EQ(recover_from_log(tree, path, gc), 6);
+  auto apple = key_from_bytes("apple", 5);
+  ASSERT_NE(tree.get(apple), nullptr);
+  EXPECT_EQ(tree.get(apple)->getBody(), 5);
+  auto banana = key_from_bytes("banana", 6);
+  EXPECT_EQ(tree.get(banana), nullptr);
+  auto cherry = key_from_bytes("cherry", 6);
+  ASSERT_NE(tree.get(cherry), nullptr);
+  EXPECT_EQ(tree.get(cherry)->getBody(), 4);
+  gc.run();
+  unlink(path.c_str());
+}
@@ -0,0 +1,95 @@
+#include "../../src/masstree.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace masstree;
+
+class MultiBatchPutTest: public ::testing::Test{};
+
+/**
+ * 各threadが互いに重なるkeyの範囲をmultiPutで入れる。
+ * runを入れている間に隣のBorderNodeが他のthreadによってsplitされても、全てのkeyが入る。
+ */
+TEST(MultiBatchPutTest, interleaved_batches){
+  Masstree tree{};
+  constexpr size_t THREADS = 4;
+  constexpr size_t BATCHES = 20;
+  constexpr size_t BATCH_SIZE = 1000;
+  std::vector<std::unique_ptr<GC>> gcs{};
+  for(size_t t = 0; t < THREADS; ++t){
+    gcs.push_back(std::make_unique<GC>());
+  }
+  std::vector<std::thread> threads{};
+  for(size_t t = 0; t < THREADS; ++t){
+    threads.emplace_back([&tree, &gcs, t](){
+      for(size_t b = 0; b < BATCHES; ++b){
+        std::vector<std::pair<Key, Value *>> batch{};
+        for(size_t i = 0; i < BATCH_SIZE; ++i){
+          size_t key = (b * BATCH_SIZE + i) * THREADS + t;
+          batch.emplace_back(Key({key}, 8), new Value(key));
+        }
+        tree.multiPut(batch, *gcs[t]);
+      }
+    });
+  }
+  for(auto &th: threads){
+    th.join();
+  }
+  for(size_t i = 0; i < THREADS * BATCHES * BATCH_SIZE; ++i){
+    Key k({i}, 8);
+    auto v = tree.get(k);
+    ASSERT_NE(v, nullptr);
+    EXPECT_EQ(v->getBody(), i);
+  }
+}
+
+/**
+ * multiPutが一度に複数のBorderNodeへ分けている間も、既にあるkeyはgetから見え続ける。
+ */
+TEST(MultiBatchPutTest, readers_during_multi_way_split){
+  constexpr size_t EXISTING = 200;
+  constexpr size_t GAP = 50;
+  for(size_t round = 0; round < 20; ++round){
+    Masstree tree{};
+    GC gc{};
+    for(size_t i = 0; i < EXISTING; ++i){
+      Key k({i * GAP}, 8);
+      tree.put(k, new Value(i * GAP), gc);
+    }
+    std::atomic_bool done{false};
+    auto reader = [&tree, &done](){
+      while(!done){
+        for(size_t i = 0; i < EXISTING; ++i){
+          Key k({i * GAP}, 8);
+          auto v = tree.get(k);
+          ASSERT_NE(v, nullptr);
+          EXPECT_EQ(v->getBody(), i * GAP);
+        }
+      }
+    };
+    std::vector<std::thread> readers{};
+    for(size_t t = 0; t < 2; ++t){
+      readers.emplace_back(reader);
+    }
+    std::vector<std::pair<Key, Value *>> batch{};
+    for(size_t i = 0; i < EXISTING * GAP; ++i){
+      if(i % GAP != 0){
+        batch.emplace_back(Key({i}, 8), new Value(i));
+      }
+    }
+    tree.multiPut(batch, gc);
+    done.store(true);
+    for(auto &th: readers){
+      th.join();
+    }
+    for(size_t i = 0; i < EXISTING * GAP; ++i){
+      Key k({i}, 8);
+      auto v = tree.get(k);
+      ASSERT_NE(v, nullptr);
+      EXPECT_EQ(v->getBody(), i);
+    }
+  }
+}
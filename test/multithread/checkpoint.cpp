@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include "../../src/checkpoint.h"
+#include <thread>
+
+using namespace masstree;
+
+class MultiCheckpointTest: public ::testing::Test{};
+
+TEST(MultiCheckpointTest, concurrent_put){
+  auto dir = "/tmp/masstree_multi_checkpoint_" + std::to_string(getpid());
+  system(("rm -rf " + dir).c_str());
+  constexpr size_t COUNT = 30000;
+  Masstree tree{};
+  GC gc{};
+  for(size_t i = 0; i < COUNT; ++i){
+    auto key = "before/" + std::to_string(i);
+    auto k = key_from_bytes(key.data(), key.size());
+    tree.put(k, new Value(static_cast<int>(i)), gc);
+  }
+
+  // checkpointの間に、splitを起こしながら別のkeyを入れる
+  std::atomic<bool> done{false};
+  GC writer_gc{};
+  std::thread writer([&](){
+    for(size_t i = 0; !done; ++i){
+      auto key = "during/" + std::to_string(i);
+      auto k = key_from_bytes(key.data(), key.size());
+      tree.put(k, new Value(static_cast<int>(i)), writer_gc);
+    }
+  });
+  CheckpointStats stats{};
+  auto ok = write_checkpoint(tree, dir, 4, stats);
+  done = true;
+  writer.join();
+  ASSERT_TRUE(ok);
+  EXPECT_GE(stats.keys, COUNT);
+
+  // 始める前からあったkeyは、全て読める
+  Masstree restored{};
+  CheckpointStats read{};
+  ASSERT_TRUE(restore_checkpoint(restored, dir, 4, read));
+  EXPECT_EQ(read.keys, stats.keys);
+  for(size_t i = 0; i < COUNT; ++i){
+    auto key = "before/" + std::to_string(i);
+    auto k = key_from_bytes(key.data(), key.size());
+    auto v = restored.get(k);
+    ASSERT_NE(v, nullptr);
+    EXPECT_EQ(v->getBody(), static_cast<int>(i));
+  }
+  gc.run();
+  writer_gc.run();
+  system(("rm -rf " + dir).c_str());
+}
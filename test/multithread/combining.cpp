@@ -0,0 +1,85 @@
+#include "../../src/masstree.h"
+#include "../../src/stats.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace masstree;
+
+class MultiCombiningTest: public ::testing::Test{};
+
+/**
+ * BorderNodeをlockしている間に他のthreadがputすると、そのputは公開され、
+ * lockを持っている側のcombine_pendingで入れられる。
+ */
+TEST(MultiCombiningTest, lock_holder_applies_published_put){
+  GC gc{};
+  PutCombiner combiner{};
+  Key k1({1}, 8);
+  Node *root = put_at_layer0(nullptr, k1, new Value(1), gc).second;
+  k1.reset();
+
+  auto n = findBorder(root, k1).first;
+  n->lock();
+  bool applied = false;
+  std::thread waiter([&combiner, root, &applied](){
+    Key k2({2}, 8);
+    auto n_v = findBorder(root, k2);
+    applied = combiner.tryPublish(n_v.first, n_v.second, k2, new Value(2));
+  });
+  while(combiner.pendingCount() == 0){
+    _mm_pause();
+  }
+  Stats::reset();
+  combine_pending(n, combiner, gc);
+  if(Stats::enabled()){
+    EXPECT_EQ(Stats::collect()[Stat::CombinedPut], 1);
+  }
+  n->unlock();
+  waiter.join();
+  EXPECT_TRUE(applied);
+
+  Key k2({2}, 8);
+  EXPECT_EQ(get(root, k2)->getBody(), 2);
+  delete n;
+}
+
+/**
+ * 全てのthreadが同じ狭い範囲にputする。splitやLayerの作成が必要なものは断られ、
+ * 普通のputで入る。
+ */
+TEST(MultiCombiningTest, hot_range){
+  Masstree tree{};
+  tree.setCombining(true);
+  constexpr size_t THREADS = 4;
+  constexpr size_t COUNT = 5000;
+  std::vector<std::unique_ptr<GC>> gcs{};
+  for(size_t t = 0; t < THREADS; ++t){
+    gcs.push_back(std::make_unique<GC>());
+  }
+  std::vector<std::thread> threads{};
+  for(size_t t = 0; t < THREADS; ++t){
+    threads.emplace_back([&tree, &gcs, t](){
+      for(size_t i = 0; i < COUNT; ++i){
+        // 上書きと挿入、下のLayerへのputを混ぜる
+        Key k({i % 64, i % 3 == 0 ? t : 0}, i % 3 == 0 ? 8 : 1);
+        tree.put(k, new Value(i), *gcs[t]);
+      }
+      for(size_t i = COUNT - 192; i < COUNT; ++i){
+        Key k({i % 64, i % 3 == 0 ? t : 0}, i % 3 == 0 ? 8 : 1);
+        EXPECT_NE(tree.get(k), nullptr);
+      }
+    });
+  }
+  for(auto &th: threads){
+    th.join();
+  }
+  size_t count = 0;
+  tree.scan([&count](const Key &, Value *){
+    ++count;
+    return true;
+  });
+  // i % 3 == 0のkeyはthreadごと、それ以外はthreadの間で共有
+  EXPECT_EQ(count, 64 * THREADS + 64);
+}
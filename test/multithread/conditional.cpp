@@ -0,0 +1,65 @@
+#include "../../src/masstree.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace masstree;
+
+class MultiConditionalTest: public ::testing::Test{};
+
+/**
+ * 複数のthreadからupsertで同じkeyを更新しても、更新が失われない。
+ */
+TEST(MultiConditionalTest, upsert_counter){
+  Masstree tree{};
+  constexpr size_t COUNT = 2000;
+  std::atomic_bool ready{false};
+  auto w = [&tree, &ready](){
+    while (!ready){ _mm_pause(); }
+    GC gc{};
+    for(size_t i = 0; i < COUNT; ++i){
+      Key k({i % 4}, 1);
+      tree.upsert(k, [](Value *old){
+        return new Value(old == nullptr ? 1 : old->getBody() + 1);
+      }, gc);
+    }
+  };
+  std::thread a(w);
+  std::thread b(w);
+  std::thread c(w);
+  ready = true;
+  a.join();
+  b.join();
+  c.join();
+  for(size_t i = 0; i < 4; ++i){
+    Key k({i}, 1);
+    EXPECT_EQ(tree.get(k)->getBody(), COUNT * 3 / 4);
+  }
+}
+
+/**
+ * insertIfAbsentは、同じkeyについてただ一つのthreadのみが成功する。
+ */
+TEST(MultiConditionalTest, insertIfAbsent_once){
+  for(size_t n = 0; n < 100; ++n){
+    Masstree tree{};
+    std::atomic_bool ready{false};
+    std::atomic<size_t> success{0};
+    auto w = [&tree, &ready, &success](int id){
+      while (!ready){ _mm_pause(); }
+      GC gc{};
+      Key k({1, 2}, 8);
+      auto v = new Value(id);
+      if(tree.insertIfAbsent(k, v, gc) == nullptr){
+        ++success;
+      }else{
+        delete v;
+      }
+    };
+    std::thread a(w, 0);
+    std::thread b(w, 1);
+    ready = true;
+    a.join();
+    b.join();
+    EXPECT_EQ(success, 1);
+  }
+}
@@ -0,0 +1,92 @@
+#include "../../src/masstree.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace masstree;
+
+class MultiHintTest: public ::testing::Test{};
+
+/**
+ * 各threadが自分の分を小さい順に入れるので、hintのBorderNodeは他のthreadによって
+ * 何度もsplitされる。
+ */
+TEST(MultiHintTest, interleaved_ordered_puts){
+  Masstree tree{};
+  constexpr size_t THREADS = 4;
+  constexpr size_t COUNT = 20000;
+  std::vector<std::unique_ptr<GC>> gcs{};
+  for(size_t t = 0; t < THREADS; ++t){
+    gcs.push_back(std::make_unique<GC>());
+  }
+  std::vector<std::thread> threads{};
+  for(size_t t = 0; t < THREADS; ++t){
+    threads.emplace_back([&tree, &gcs, t](){
+      LeafHint hint{};
+      for(size_t i = 0; i < COUNT; ++i){
+        Key k({i * THREADS + t}, 8);
+        tree.put(k, new Value(i), *gcs[t], hint);
+      }
+      for(size_t i = 0; i < COUNT; ++i){
+        Key k({i * THREADS + t}, 8);
+        auto v = tree.get(k, hint);
+        ASSERT_NE(v, nullptr);
+        EXPECT_EQ(v->getBody(), i);
+      }
+    });
+  }
+  for(auto &th: threads){
+    th.join();
+  }
+  for(size_t i = 0; i < COUNT * THREADS; ++i){
+    Key k({i}, 8);
+    auto v = tree.get(k);
+    ASSERT_NE(v, nullptr);
+    EXPECT_EQ(v->getBody(), i / THREADS);
+  }
+}
+
+/**
+ * hintを使うwriterと、同じ範囲を消すremoverを並行に走らせる。
+ * hintのBorderNodeがdeleteされても、正しいBorderNodeに入れる。
+ */
+TEST(MultiHintTest, puts_with_concurrent_removes){
+  for(size_t round = 0; round < 20; ++round){
+    Masstree tree{};
+    GC gc_writer{};
+    GC gc_remover{};
+    constexpr size_t COUNT = 3000;
+    for(size_t i = 0; i < COUNT; ++i){
+      Key k({i * 2 + 1}, 8);
+      tree.put(k, new Value(i), gc_writer);
+    }
+    std::thread writer([&tree, &gc_writer](){
+      LeafHint hint{};
+      for(size_t i = 0; i < COUNT; ++i){
+        Key k({i * 2}, 8);
+        tree.put(k, new Value(i), gc_writer, hint);
+      }
+    });
+    std::thread remover([&tree, &gc_remover](){
+      for(size_t i = 0; i < COUNT; ++i){
+        Key k({i * 2 + 1}, 8);
+        tree.remove(k, gc_remover);
+      }
+    });
+    writer.join();
+    remover.join();
+    size_t count = 0;
+    tree.scan([&count](const Key &key, Value *value){
+      EXPECT_EQ(key.slices[0], count * 2);
+      EXPECT_EQ(value->getBody(), count);
+      ++count;
+      return true;
+    });
+    ASSERT_EQ(count, COUNT);
+    for(size_t i = 0; i < COUNT; ++i){
+      Key k({i * 2}, 8);
+      ASSERT_NE(tree.get(k), nullptr);
+    }
+  }
+}
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include "../../src/log_writer.h"
+#include <thread>
+
+using namespace masstree;
+
+class MultiLogWriterTest: public ::testing::Test{};
+
+static void concurrent_logged_put(bool use_io_uring){
+  constexpr size_t THREADS = 4;
+  constexpr size_t COUNT = 20000;
+  auto path = "/tmp/masstree_multi_log_" + std::to_string(getpid()) + ".log";
+  unlink(path.c_str());
+
+  Masstree tree{};
+  LogWriter writer{};
+  LogWriter::Options options{};
+  options.use_io_uring = use_io_uring;
+  options.group_ops = 4096;
+  ASSERT_TRUE(writer.open(path, options));
+  std::atomic<size_t> durable{0};
+  std::vector<std::thread> threads{};
+  for(size_t t = 0; t < THREADS; ++t){
+    threads.emplace_back([&, t](){
+      GC gc{};
+      LogBuffer log(writer);
+      for(size_t i = 0; i < COUNT; ++i){
+        auto key = "thread" + std::to_string(t) + "/" + std::to_string(i);
+        logged_put(tree, log, key, static_cast<int32_t>(i), gc, [&durable](bool ok){
+          if(ok){
+            ++durable;
+          }
+        });
+      }
+      EXPECT_TRUE(log.sync());
+      gc.run();
+    });
+  }
+  for(auto &th: threads){
+    th.join();
+  }
+  EXPECT_EQ(durable.load(), THREADS * COUNT);
+  writer.close();
+  auto stats = writer.stats();
+  EXPECT_EQ(stats.ops, THREADS * COUNT);
+  // group commitにより、fsyncはopよりずっと少ない
+  EXPECT_LT(stats.groups, THREADS * COUNT / 10);
+
+  Masstree recovered{};
+  GC gc{};
+  EXPECT_EQ(recover_from_log(recovered, path, gc), THREADS * COUNT);
+  for(size_t t = 0; t < THREADS; ++t){
+    for(size_t i = 0; i < COUNT; i += 97){
+      auto key = "thread" + std::to_string(t) + "/" + std::to_string(i);
+      auto k = key_from_bytes(key.data(), key.size());
+      auto v = recovered.get(k);
+      ASSERT_NE(v, nullptr);
+      EXPECT_EQ(v->getBody(), static_cast<int32_t>(i));
+    }
+  }
+  gc.run();
+  unlink(path.c_str());
+}
+
+TEST(MultiLogWriterTest, io_uring){
+  concurrent_logged_put(true);
+}
+
+TEST(MultiLogWriterTest, pwritev){
+  concurrent_logged_put(false);
+}
+
+/**
+ * 複数のthreadが同じkeyにputとremoveをする。
+ * logはthreadごとのLogBufferを集めた順に並ぶが、replayした結果は最後にtreeに入ったものと同じになる。
+ */
+TEST(MultiLogWriterTest, same_key){
+  constexpr size_t THREADS = 4;
+  constexpr size_t COUNT = 20000;
+  constexpr size_t KEYS = 3;
+  auto path = "/tmp/masstree_multi_log_same_" + std::to_string(getpid()) + ".log";
+  unlink(path.c_str());
+
+  Masstree tree{};
+  LogWriter writer{};
+  LogWriter::Options options{};
+  // 各LogBufferが一つのgroupの中で何件も積むようにする
+  options.group_ops = 4096;
+  ASSERT_TRUE(writer.open(path, options));
+  std::atomic_bool ready{false};
+  std::vector<std::thread> threads{};
+  for(size_t t = 0; t < THREADS; ++t){
+    threads.emplace_back([&, t](){
+      while (!ready){ _mm_pause(); }
+      GC gc{};
+      LogBuffer log(writer);
+      for(size_t i = 0; i < COUNT; ++i){
+        auto key = "key" + std::to_string(i % KEYS);
+        if(i % 7 == 6){
+          logged_remove(tree, log, key, gc);
+        }else{
+          logged_put(tree, log, key, static_cast<int32_t>(t * COUNT + i), gc);
+        }
+      }
+      EXPECT_TRUE(log.sync());
+      gc.run();
+    });
+  }
+  ready.store(true);
+  for(auto &th: threads){
+    th.join();
+  }
+  writer.close();
+
+  Masstree recovered{};
+  GC gc{};
+  recover_from_log(recovered, path, gc);
+  for(size_t i = 0; i < KEYS; ++i){
+    auto key = "key" + std::to_string(i);
+    auto k = key_from_bytes(key.data(), key.size());
+    auto expected = tree.get(k);
+    auto v = recovered.get(k);
+    if(expected == nullptr){
+      EXPECT_EQ(v, nullptr);
+    }else{
+      ASSERT_NE(v, nullptr);
+      EXPECT_EQ(v->getBody(), expected->getBody());
+    }
+  }
+  gc.run();
+  unlink(path.c_str());
+}
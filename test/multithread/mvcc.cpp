@@ -0,0 +1,62 @@
+#include "../../src/mvcc.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace masstree;
+
+class MultiMvccTest: public ::testing::Test{};
+
+/**
+ * writerは各roundで全てのkeyを小さい順にroundで上書きする。
+ * どの時点のsnapshotでも、先頭からいくつかのkeyがround、残りがround - 1となる。
+ * snapshotを使わないscanでは、writerに追い越されてround - 1の後にroundが見える事がある。
+ */
+TEST(MultiMvccTest, scan_is_consistent){
+  MvccMasstree tree{};
+  constexpr size_t KEYS = 2000;
+  constexpr int ROUNDS = 20;
+  GC gc_writer{};
+  for(size_t i = 0; i < KEYS; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(0), gc_writer);
+  }
+  std::atomic_bool done{false};
+  std::thread writer([&tree, &gc_writer, &done](){
+    for(int round = 1; round <= ROUNDS; ++round){
+      for(size_t i = 0; i < KEYS; ++i){
+        Key k({i}, 8);
+        tree.put(k, new Value(round), gc_writer);
+      }
+    }
+    done = true;
+  });
+  size_t scans = 0;
+  while(!done){
+    auto s = tree.snapshot();
+    int first = -1;
+    bool stepped = false;
+    size_t count = 0;
+    tree.scan(s, [&](const Key &, Value *v){
+      auto body = v->getBody();
+      if(first == -1){
+        first = body;
+      }else if(body != first){
+        EXPECT_EQ(body, first - 1);
+        stepped = true;
+      }else{
+        EXPECT_FALSE(stepped);
+      }
+      ++count;
+      return true;
+    });
+    EXPECT_EQ(count, KEYS);
+    ++scans;
+  }
+  writer.join();
+  EXPECT_GT(scans, 0);
+  auto s = tree.snapshot();
+  for(size_t i = 0; i < KEYS; ++i){
+    Key k({i}, 8);
+    ASSERT_EQ(tree.get(k, s)->getBody(), ROUNDS);
+  }
+}
@@ -0,0 +1,100 @@
+#include "../../src/masstree.h"
+#include "../../src/stats.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace masstree;
+
+class MultiParkingTest: public ::testing::Test{};
+
+#ifdef MASSTREE_PARKING_LOCK
+
+/**
+ * lockを持ったままにすると、待っているlockは回るのをやめて眠り、unlockで起こされる。
+ */
+TEST(MultiParkingTest, lock_waiter_parks_and_wakes){
+  GC gc{};
+  Key k({1}, 8);
+  Node *root = put_at_layer0(nullptr, k, new Value(1), gc).second;
+  k.reset();
+  auto n = findBorder(root, k).first;
+  n->lock();
+  Stats::reset();
+  std::thread waiter([root](){
+    GC gc{};
+    Key k({1}, 8);
+    put_at_layer0(root, k, new Value(2), gc);
+  });
+  while(Stats::collect()[Stat::Park] == 0){
+    std::this_thread::yield();
+  }
+  n->unlock();
+  waiter.join();
+  Key k2({1}, 8);
+  EXPECT_EQ(get(root, k2)->getBody(), 2);
+}
+
+/**
+ * insertingのBorderNodeを読むreaderも眠り、unlockで起こされる。
+ */
+TEST(MultiParkingTest, reader_parks_on_unstable_version){
+  GC gc{};
+  Key k({1}, 8);
+  Node *root = put_at_layer0(nullptr, k, new Value(1), gc).second;
+  k.reset();
+  auto n = findBorder(root, k).first;
+  n->lock();
+  n->setInserting(true);
+  auto before = n->getVersion().v_insert;
+  Stats::reset();
+  Version seen{};
+  std::thread reader([n, &seen](){
+    seen = n->stableVersion();
+  });
+  while(Stats::collect()[Stat::Park] == 0){
+    std::this_thread::yield();
+  }
+  n->unlock();
+  reader.join();
+  EXPECT_FALSE(seen.inserting);
+  EXPECT_EQ(seen.v_insert, static_cast<uint8_t>(before + 1));
+}
+
+#endif
+
+/**
+ * coreより多くのthreadで、狭い範囲のkeyにputする。
+ * lockを持ったthreadが止まっても、他のthreadは眠って待ち、全てのputが入る。
+ */
+TEST(MultiParkingTest, oversubscribed_puts){
+  Masstree tree{};
+  auto threads = std::max(16u, std::thread::hardware_concurrency() * 4);
+  constexpr size_t COUNT = 2000;
+  std::vector<std::unique_ptr<GC>> gcs{};
+  for(size_t t = 0; t < threads; ++t){
+    gcs.push_back(std::make_unique<GC>());
+  }
+  std::vector<std::thread> workers{};
+  for(size_t t = 0; t < threads; ++t){
+    workers.emplace_back([&tree, &gcs, t, threads](){
+      for(size_t i = 0; i < COUNT; ++i){
+        // 各threadは自分のkeyと、全員で共有する64個のkeyに交互に書く
+        Key own({i * threads + t + 64}, 8);
+        tree.put(own, new Value(i), *gcs[t]);
+        Key shared({i % 64}, 8);
+        tree.put(shared, new Value(i), *gcs[t]);
+      }
+    });
+  }
+  for(auto &w: workers){
+    w.join();
+  }
+  size_t count = 0;
+  tree.scan([&count](const Key &, Value *){
+    ++count;
+    return true;
+  });
+  EXPECT_EQ(count, COUNT * threads + 64);
+}
@@ -105,9 +105,12 @@ TEST(MultiPutTest, border_inserts2){
       auto w2 = [&root, &k1, &v1](){
         get_handler1.waitGive();
         GC gc{};
-        Key k2({2}, 2);
         root = remove_at_layer0(root, k1, gc);
-        root = put_at_layer0(root, k2, new Value(2), gc).second;
+        // removeしたslotは空いているslotの最後に回るので、他の空いているslotを使い切ってからreuseされる
+        for(size_t i = 2; i <= 15; ++i){
+          Key k2({i}, 2);
+          root = put_at_layer0(root, k2, new Value(i), gc).second;
+        }
         get_handler1.back();
         EXPECT_TRUE(gc.contain(v1));
       };
@@ -210,4 +213,167 @@ TEST(MultiPutTest, new_layers2){
       b.join();
     });
   });
-}
\ No newline at end of file
+}
+/**
+ * 複数のthreadが、同じ下のLayerを作ってsplitする。
+ * 下のLayerのrootのsplitでは、上のLayerのlinkが付け替えられる。
+ */
+TEST(MultiPutTest, split_lower_layer){
+  constexpr size_t THREADS = 3;
+  constexpr size_t KEYS = 200;
+  Masstree tree{};
+  std::atomic_bool ready{false};
+  auto w = [&tree, &ready](size_t t){
+    while (!ready){ _mm_pause(); }
+    GC gc{};
+    for(size_t j = 0; j < KEYS; ++j){
+      Key k({ONE, j * THREADS + t}, 8);
+      tree.put(k, new Value(j * THREADS + t), gc);
+    }
+  };
+  std::vector<std::thread> threads{};
+  for(size_t t = 0; t < THREADS; ++t){
+    threads.emplace_back(w, t);
+  }
+  ready.store(true);
+  for(auto &th: threads){
+    th.join();
+  }
+  for(size_t i = 0; i < KEYS * THREADS; ++i){
+    Key k({ONE, i}, 8);
+    auto p = tree.get(k);
+    ASSERT_TRUE(p != nullptr);
+    EXPECT_EQ(p->getBody(), i);
+  }
+}
+
+/**
+ * putが下のLayerに降りた後、他のthreadのremoveでそのLayerが消えるケース。
+ * putはlayer0からではなく、LayerFrameに記録した上のLayerのBorderNodeから再開する。
+ */
+TEST(MultiPutTest, resume_from_upper_layer){
+  Masstree tree{};
+  GC gc{};
+  Key a({ONE, ONE}, 8);
+  Key b({ONE, TWO}, 8);
+  tree.put(a, new Value(1), gc);
+  tree.put(b, new Value(2), gc);
+  put_handler1.use([&tree, &a, &b](){
+    put_resume_marker.use([&tree, &a, &b](){
+      auto w1 = [&tree](){
+        GC gc{};
+        Key c({ONE, THREE}, 8);
+        tree.put(c, new Value(3), gc);
+        EXPECT_TRUE(put_resume_marker.isMarked());
+      };
+      auto w2 = [&tree, &a, &b](){
+        put_handler1.waitGive();
+        GC gc{};
+        // Layerの最後のkeyをremoveすると、Layerが消える
+        tree.remove(a, gc);
+        tree.remove(b, gc);
+        put_handler1.back();
+      };
+
+      std::thread t1(w1);
+      std::thread t2(w2);
+      t1.join();
+      t2.join();
+
+      EXPECT_EQ(tree.get(a), nullptr);
+      EXPECT_EQ(tree.get(b), nullptr);
+      Key c({ONE, THREE}, 8);
+      ASSERT_TRUE(tree.get(c) != nullptr);
+      EXPECT_EQ(tree.get(c)->getBody(), 3);
+    });
+  });
+}
+
+/**
+ * findBorderとlockの間にBorderNodeがsplitされても、keyは右のBorderNodeに入る。
+ * lockした後のversionでsplitを見ると、splitに気付かずに左のBorderNodeに入れてしまい、
+ * そのkeyはgetから見えなくなる。
+ */
+TEST(MultiPutTest, split_between_find_and_lock){
+  Masstree tree{};
+  GC gc{};
+  Key a({ONE, 1}, 8);
+  Key b({ONE, 2}, 8);
+  tree.put(a, new Value(1), gc);
+  tree.put(b, new Value(2), gc);
+  put_handler1.use([&tree](){
+    auto w1 = [&tree](){
+      GC gc{};
+      Key c({ONE, 100}, 8);
+      tree.put(c, new Value(100), gc);
+    };
+    auto w2 = [&tree](){
+      put_handler1.waitGive();
+      GC gc{};
+      // w1だけが止まっているので、これらのputはそのまま入り、w1が見つけたBorderNodeをsplitする
+      for(size_t i = 3; i <= 16; ++i){
+        Key k({ONE, i}, 8);
+        tree.put(k, new Value(i), gc);
+      }
+      put_handler1.back();
+    };
+
+    std::thread t1(w1);
+    std::thread t2(w2);
+    t1.join();
+    t2.join();
+  });
+  for(size_t i = 1; i <= 16; ++i){
+    Key k({ONE, i}, 8);
+    ASSERT_NE(tree.get(k), nullptr);
+    EXPECT_EQ(tree.get(k)->getBody(), i);
+  }
+  Key c({ONE, 100}, 8);
+  ASSERT_NE(tree.get(c), nullptr);
+  EXPECT_EQ(tree.get(c)->getBody(), 100);
+}
+
+/**
+ * 同じ下のLayerに、複数のthreadがkeyを入れてはremoveする。
+ * Layerは最後のkeyのremoveで消え、また次のputで作られる。
+ */
+TEST(MultiPutTest, lower_layer_churn){
+  constexpr size_t THREADS = 3;
+  // 下のLayerが一つのBorderNodeに収まるようにする
+  constexpr size_t KEYS = 4;
+  for(size_t round = 0; round < 50; ++round){
+    Masstree tree{};
+    std::atomic_bool ready{false};
+    auto w = [&tree, &ready](size_t t){
+      while (!ready){ _mm_pause(); }
+      GC gc{};
+      for(size_t i = 0; i < 20; ++i){
+        for(size_t j = 0; j < KEYS; ++j){
+          Key k({ONE, t * KEYS + j}, 8);
+          tree.put(k, new Value(i), gc);
+        }
+        for(size_t j = 0; j < KEYS; ++j){
+          Key k({ONE, t * KEYS + j}, 8);
+          auto p = tree.get(k);
+          ASSERT_TRUE(p != nullptr);
+          EXPECT_EQ(p->getBody(), i);
+        }
+        for(size_t j = 0; j < KEYS; ++j){
+          Key k({ONE, t * KEYS + j}, 8);
+          EXPECT_TRUE(tree.remove(k, gc) != nullptr);
+        }
+      }
+    };
+    std::vector<std::thread> threads{};
+    for(size_t t = 0; t < THREADS; ++t){
+      threads.emplace_back(w, t);
+    }
+    ready.store(true);
+    for(auto &th: threads){
+      th.join();
+    }
+    size_t count = 0;
+    tree.scan([&count](const Key &, Value *){ ++count; return true; });
+    EXPECT_EQ(count, 0);
+  }
+}
@@ -2,6 +2,7 @@
 #include "../../src/get.h"
 #include "../../src/remove.h"
 #include "../sample.h"
+#include "../../src/masstree.h"
 #include <gtest/gtest.h>
 #include <thread>
 
@@ -73,4 +74,83 @@ TEST(MutiRemoveTest, new_layers1){
   get_handler1.use([](){
 
   });
-}
\ No newline at end of file
+}
+/**
+ * 二つのthreadが同じkeyをremoveした時、削除したvalueを受け取るのはどちらか一方のみ。
+ */
+TEST(MutiRemoveTest, pop_once){
+  for(size_t n = 0; n < 100; ++n){
+    Masstree tree{};
+    constexpr size_t COUNT = 100;
+    {
+      GC gc{};
+      for(size_t i = 0; i < COUNT; ++i){
+        Key k({i % 7, i}, 8);
+        tree.put(k, new Value(i), gc);
+      }
+    }
+    std::atomic_bool ready{false};
+    std::array<std::atomic<size_t>, COUNT> popped{};
+    auto w = [&tree, &ready, &popped](){
+      while (!ready){ _mm_pause(); }
+      GC gc{};
+      for(size_t i = 0; i < COUNT; ++i){
+        Key k({i % 7, i}, 8);
+        auto v = tree.remove(k, gc);
+        if(v != nullptr){
+          ++popped[v->getBody()];
+        }
+      }
+    };
+    std::thread a(w);
+    std::thread b(w);
+    ready = true;
+    a.join();
+    b.join();
+    for(size_t i = 0; i < COUNT; ++i){
+      EXPECT_EQ(popped[i], 1);
+    }
+  }
+}
+
+/**
+ * removePrefixで下のLayerを切り離している間に、同じprefixと別のprefixにputが走る場合。
+ * 別のprefixのkeyは失われず、同じprefixのkeyは最後のremovePrefixの後に入れたものだけが残る。
+ */
+TEST(MutiRemoveTest, remove_prefix_with_put){
+  for(size_t n = 0; n < 20; ++n){
+    Masstree tree{};
+    constexpr size_t COUNT = 300;
+    GC put_gc{};
+    GC remove_gc{};
+    std::atomic_bool ready{false};
+    auto writer = [&tree, &ready, &put_gc](){
+      while (!ready){ _mm_pause(); }
+      for(size_t i = 0; i < COUNT; ++i){
+        Key k1({1, i}, 8);
+        tree.put(k1, new Value(i), put_gc);
+        Key k2({2, i, i}, 8);
+        tree.put(k2, new Value(i), put_gc);
+      }
+    };
+    auto remover = [&tree, &ready, &remove_gc](){
+      while (!ready){ _mm_pause(); }
+      for(size_t i = 0; i < 20; ++i){
+        tree.removePrefix(Key({1}, 8), remove_gc);
+      }
+    };
+    std::thread a(writer);
+    std::thread b(remover);
+    ready = true;
+    a.join();
+    b.join();
+    for(size_t i = 0; i < COUNT; ++i){
+      Key k2({2, i, i}, 8);
+      auto v = tree.get(k2);
+      ASSERT_NE(v, nullptr);
+      EXPECT_EQ(v->getBody(), i);
+    }
+    tree.removePrefix(Key({1}, 8), remove_gc);
+    EXPECT_EQ(tree.stats().keys, COUNT);
+  }
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+#include "../../src/masstree.h"
+#include <thread>
+
+using namespace masstree;
+
+class MultiScanTest: public ::testing::Test{};
+
+/**
+ * putとremoveが走る間のscanでも、keyは小さい順に一度ずつ返り、
+ * 最初から最後まで入っているkeyは必ず返る。
+ * 書き込みはSubtreeを通して行い、最後のkeyのremoveでLayerが消える事もある。
+ */
+TEST(MultiScanTest, scan_with_writers){
+  for(size_t n = 0; n < 20; ++n){
+    Masstree tree{};
+    GC gc{};
+    constexpr size_t COUNT = 300;
+    for(size_t i = 0; i < COUNT; i += 2){
+      Key k({i % 5, i}, 8);
+      tree.put(k, new Value(i), gc);
+    }
+    std::atomic_bool ready{false};
+    std::atomic_bool done{false};
+    GC writer_gc{};
+    auto writer = [&tree, &ready, &done, &writer_gc](){
+      while (!ready){ _mm_pause(); }
+      for(size_t round = 0; round < 3; ++round){
+        for(KeySlice prefix = 0; prefix < 5; ++prefix){
+          auto sub = tree.subtree(Key({prefix}, 8));
+          for(size_t i = 1; i < COUNT; i += 2){
+            Key k({prefix, i, i}, 8);
+            sub.put(k, new Value(i), writer_gc);
+          }
+          for(size_t i = 1; i < COUNT; i += 2){
+            Key k({prefix, i, i}, 8);
+            tree.remove(k, writer_gc);
+          }
+        }
+      }
+      done = true;
+    };
+    auto scanner = [&tree, &ready, &done](){
+      while (!ready){ _mm_pause(); }
+      while(!done){
+        std::optional<Key> last{};
+        size_t stable = 0;
+        tree.scan([&last, &stable](const Key &key, Value *){
+          if(last){
+            EXPECT_LT(last->compare(key), 0);
+          }
+          last = key;
+          if(key.slices.size() == 2){
+            ++stable;
+          }
+          return true;
+        });
+        EXPECT_EQ(stable, COUNT / 2);
+      }
+    };
+    std::thread a(writer);
+    std::thread b(scanner);
+    ready = true;
+    a.join();
+    b.join();
+  }
+}
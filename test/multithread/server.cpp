@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include "../../src/server.h"
+#include "../../src/client.h"
+#include <thread>
+
+using namespace masstree;
+
+class MultiServerTest: public ::testing::Test{};
+
+static std::string socket_path(){
+  return "/tmp/masstree_test_" + std::to_string(getpid()) + ".sock";
+}
+
+TEST(MultiServerTest, get_put_remove_scan){
+  Masstree tree{};
+  Server::Options options{};
+  options.unix_path = socket_path();
+  options.loops = 2;
+  Server server(tree, options);
+  ASSERT_TRUE(server.start());
+
+  Client client{};
+  ASSERT_TRUE(client.connectUnix(options.unix_path));
+  EXPECT_TRUE(client.put("apple", 1));
+  EXPECT_TRUE(client.put("banana", 2));
+  EXPECT_TRUE(client.put("a long key over eight bytes", 3));
+  EXPECT_EQ(client.get("apple"), 1);
+  EXPECT_EQ(client.get("cherry"), std::nullopt);
+  EXPECT_EQ(client.remove("banana"), 2);
+  EXPECT_EQ(client.remove("banana"), std::nullopt);
+
+  auto entries = client.scan("", 10);
+  ASSERT_EQ(entries.size(), 2);
+  EXPECT_EQ(entries[0].first, "a long key over eight bytes");
+  EXPECT_EQ(entries[1].first, "apple");
+  EXPECT_EQ(client.scan("apple", 10).size(), 1);
+
+  // 空のkeyは受け付けない
+  client.sendGet("");
+  client.flush();
+  protocol::Response resp{};
+  ASSERT_TRUE(client.receive(resp));
+  EXPECT_EQ(resp.status, protocol::Status::BadRequest);
+  server.stop();
+}
+
+TEST(MultiServerTest, tcp){
+  Masstree tree{};
+  Server::Options options{};
+  options.loops = 2;
+  Server server(tree, options);
+  ASSERT_TRUE(server.start());
+  ASSERT_NE(server.port(), 0);
+
+  Client client{};
+  ASSERT_TRUE(client.connectTcp("127.0.0.1", server.port()));
+  EXPECT_TRUE(client.put("key", 7));
+  EXPECT_EQ(client.get("key"), 7);
+  server.stop();
+}
+
+/**
+ * 複数の接続からpipeliningしたrequestが、順番通りに処理される。
+ */
+TEST(MultiServerTest, pipelined_clients){
+  Masstree tree{};
+  Server::Options options{};
+  options.unix_path = socket_path();
+  options.loops = 4;
+  Server server(tree, options);
+  ASSERT_TRUE(server.start());
+
+  constexpr size_t CLIENTS = 4;
+  // socketのbufferに収まらない量を、読まずに送り続ける
+  constexpr size_t COUNT = 20000;
+  std::vector<std::thread> threads{};
+  std::atomic<size_t> failures{0};
+  for(size_t c = 0; c < CLIENTS; ++c){
+    threads.emplace_back([&, c](){
+      Client client{};
+      if(!client.connectUnix(options.unix_path)){
+        ++failures;
+        return;
+      }
+      auto key_of = [c](size_t i){
+        return "c" + std::to_string(c) + "-" + std::to_string(i);
+      };
+      // 同じkeyへのput, get, remove, getを、responseを待たずに送る
+      for(size_t i = 0; i < COUNT; ++i){
+        client.sendPut(key_of(i), static_cast<int32_t>(i));
+        client.sendGet(key_of(i));
+        if(i % 2 == 0){
+          client.sendRemove(key_of(i));
+          client.sendGet(key_of(i));
+        }
+      }
+      if(!client.flush()){
+        ++failures;
+        return;
+      }
+      protocol::Response resp{};
+      for(size_t i = 0; i < COUNT; ++i){
+        client.receive(resp);
+        failures += resp.status != protocol::Status::Ok;
+        client.receive(resp);
+        failures += resp.status != protocol::Status::Ok or resp.value != static_cast<int32_t>(i);
+        if(i % 2 == 0){
+          client.receive(resp);
+          failures += resp.status != protocol::Status::Ok;
+          client.receive(resp);
+          failures += resp.status != protocol::Status::NotFound;
+        }
+      }
+    });
+  }
+  for(auto &th: threads){
+    th.join();
+  }
+  EXPECT_EQ(failures, 0);
+  server.stop();
+
+  for(size_t c = 0; c < CLIENTS; ++c){
+    for(size_t i = 0; i < COUNT; ++i){
+      auto bytes = "c" + std::to_string(c) + "-" + std::to_string(i);
+      auto key = key_from_bytes(bytes.data(), bytes.size());
+      EXPECT_EQ(tree.get(key) != nullptr, i % 2 == 1);
+    }
+  }
+}
@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+#include "../../src/sharded_masstree.h"
+#include <thread>
+
+using namespace masstree;
+
+class MultiShardedTest: public ::testing::Test{};
+
+/**
+ * 別々のthreadからのputが、全てのshardで失われない。
+ */
+TEST(MultiShardedTest, put_put){
+  ShardedMasstree tree(8);
+  constexpr size_t COUNT = 2000;
+  constexpr size_t THREADS = 4;
+  std::vector<GC> gcs(THREADS);
+  std::vector<std::thread> threads{};
+  for(size_t t = 0; t < THREADS; ++t){
+    threads.emplace_back([&tree, &gcs, t](){
+      for(size_t i = t; i < COUNT; i += THREADS){
+        Key k({i, i}, 8);
+        tree.put(k, new Value(i), gcs[t]);
+      }
+    });
+  }
+  for(auto &th: threads){
+    th.join();
+  }
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i, i}, 8);
+    auto v = tree.get(k);
+    ASSERT_NE(v, nullptr);
+    EXPECT_EQ(v->getBody(), i);
+  }
+  size_t count = 0;
+  tree.scan([&count](const Key &, Value *){ ++count; return true; });
+  EXPECT_EQ(count, COUNT);
+}
@@ -0,0 +1,82 @@
+#include "../../src/transaction.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace masstree;
+
+class MultiTransactionTest: public ::testing::Test{};
+
+/**
+ * 口座の間で送金するTransactionと、全ての口座を読むTransactionを並行に走らせる。
+ * commitできた読み取りでは、合計はいつも変わらない。
+ */
+TEST(MultiTransactionTest, transfer){
+  Masstree tree{};
+  TransactionManager manager(tree);
+  constexpr size_t ACCOUNTS = 100;
+  constexpr int INITIAL = 1000;
+  constexpr size_t THREADS = 4;
+  constexpr size_t TRANSFERS = 3000;
+  GC gc_init{};
+  for(size_t i = 0; i < ACCOUNTS; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(INITIAL), gc_init);
+  }
+  std::vector<std::unique_ptr<GC>> gcs{};
+  for(size_t t = 0; t <= THREADS; ++t){
+    gcs.push_back(std::make_unique<GC>());
+  }
+  std::atomic_bool done{false};
+  std::vector<std::thread> threads{};
+  for(size_t t = 0; t < THREADS; ++t){
+    threads.emplace_back([&manager, &gcs, t](){
+      std::mt19937_64 rng(t);
+      Transaction tx(manager, *gcs[t]);
+      for(size_t i = 0; i < TRANSFERS; ++i){
+        Key from({rng() % ACCOUNTS}, 8);
+        Key to({rng() % ACCOUNTS}, 8);
+        if(from == to){
+          continue;
+        }
+        int amount = static_cast<int>(rng() % 10);
+        do{
+          auto f = tx.get(from)->getBody();
+          auto g = tx.get(to)->getBody();
+          tx.put(from, new Value(f - amount));
+          tx.put(to, new Value(g + amount));
+        }while(!tx.commit());
+      }
+    });
+  }
+  size_t consistent_reads = 0;
+  std::thread reader([&manager, &gcs, &done, &consistent_reads](){
+    Transaction tx(manager, *gcs[THREADS]);
+    // writerが多いとabortが続くので、終わった後にも一度はcommitする
+    while(!done or consistent_reads == 0){
+      int sum = 0;
+      for(size_t i = 0; i < ACCOUNTS; ++i){
+        Key k({i}, 8);
+        sum += tx.get(k)->getBody();
+      }
+      if(tx.commit()){
+        EXPECT_EQ(sum, static_cast<int>(ACCOUNTS) * INITIAL);
+        ++consistent_reads;
+      }
+    }
+  });
+  for(auto &th: threads){
+    th.join();
+  }
+  done = true;
+  reader.join();
+  int sum = 0;
+  for(size_t i = 0; i < ACCOUNTS; ++i){
+    Key k({i}, 8);
+    sum += tree.get(k)->getBody();
+  }
+  EXPECT_EQ(sum, static_cast<int>(ACCOUNTS) * INITIAL);
+  EXPECT_GT(consistent_reads, 0);
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include "../src/mvcc.h"
+
+using namespace masstree;
+
+class MvccTest: public ::testing::Test{};
+
+static size_t chain_length(Value *head){
+  size_t len = 0;
+  for(auto v = head; v != nullptr; v = v->getOlder()){
+    ++len;
+  }
+  return len;
+}
+
+TEST(MvccTest, snapshot_sees_old_versions){
+  MvccMasstree tree{};
+  GC gc{};
+  Key k({1}, 8);
+  Key other({2}, 8);
+  tree.put(k, new Value(1), gc);
+  auto s1 = tree.snapshot();
+  tree.put(k, new Value(2), gc);
+  tree.put(other, new Value(20), gc);
+  auto s2 = tree.snapshot();
+  EXPECT_TRUE(tree.remove(k, gc));
+  EXPECT_FALSE(tree.remove(k, gc));
+
+  EXPECT_EQ(tree.get(k), nullptr);
+  EXPECT_EQ(tree.get(k, s1)->getBody(), 1);
+  EXPECT_EQ(tree.get(k, s2)->getBody(), 2);
+  EXPECT_EQ(tree.get(other, s1), nullptr);
+  EXPECT_EQ(tree.get(other, s2)->getBody(), 20);
+
+  std::vector<int> seen{};
+  tree.scan(s1, [&seen](const Key &, Value *v){
+    seen.push_back(v->getBody());
+    return true;
+  });
+  EXPECT_EQ(seen, std::vector<int>({1}));
+  seen.clear();
+  tree.scan(s2, [&seen](const Key &, Value *v){
+    seen.push_back(v->getBody());
+    return true;
+  });
+  EXPECT_EQ(seen, std::vector<int>({2, 20}));
+
+  tree.put(k, new Value(3), gc);
+  EXPECT_EQ(tree.get(k)->getBody(), 3);
+  EXPECT_EQ(tree.get(k, s1)->getBody(), 1);
+}
+
+/**
+ * Snapshotが無い時は、最新と、committedで見えるversionの他はgcに渡される。
+ * Snapshotがある間は、それから見えるversionが残る。
+ */
+TEST(MvccTest, prune_old_versions){
+  MvccMasstree tree{};
+  GC gc{};
+  Key k({1}, 8);
+  for(int i = 0; i < 100; ++i){
+    tree.put(k, new Value(i), gc);
+  }
+  EXPECT_LE(chain_length(tree.getTree().get(k)), 2);
+
+  {
+    auto s = tree.snapshot();
+    for(int i = 100; i < 200; ++i){
+      tree.put(k, new Value(i), gc);
+    }
+    EXPECT_EQ(tree.get(k, s)->getBody(), 99);
+    EXPECT_GE(chain_length(tree.getTree().get(k)), 100);
+  }
+  tree.put(k, new Value(200), gc);
+  EXPECT_LE(chain_length(tree.getTree().get(k)), 2);
+  EXPECT_EQ(tree.get(k)->getBody(), 200);
+  gc.run();
+  EXPECT_EQ(tree.get(k)->getBody(), 200);
+}
@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include "../src/numa.h"
+#include "../src/sharded_masstree.h"
+#include <set>
+#include <thread>
+
+using namespace masstree;
+
+class NodeAllocTest: public ::testing::Test{};
+
+/**
+ * 確保の手がかりを記録するだけのpolicy。
+ */
+class RecordingPolicy: public NodeAllocPolicy{
+public:
+  void *allocate(size_t size, NodePlacement placement) override{
+    placements.push_back(placement);
+    return ::operator new(size);
+  }
+
+  void deallocate(void *p, size_t) override{
+    ++deallocated;
+    ::operator delete(p);
+  }
+
+  std::vector<NodePlacement> placements{};
+  size_t deallocated = 0;
+};
+
+TEST(NodeAllocTest, parse_cpulist){
+  EXPECT_EQ(parse_cpulist("0-3,8,10-11\n"), std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(parse_cpulist("5"), std::vector<int>({5}));
+  EXPECT_TRUE(parse_cpulist("").empty());
+  auto t = NumaTopology::load();
+  ASSERT_FALSE(t.nodes.empty());
+  EXPECT_EQ(t.nodes.size(), t.cpus.size());
+}
+
+TEST(NodeAllocTest, placement){
+  RecordingPolicy policy{};
+  set_node_alloc_policy(&policy);
+  {
+    Masstree tree{};
+    GC gc{};
+    // layer0でInteriorNodeができるまで入れ、slice 1の下にLayerを作る
+    for(uint64_t i = 0; i < 200; ++i){
+      Key k({i}, 8);
+      tree.put(k, new Value(i), gc);
+    }
+    for(uint64_t i = 0; i < 200; ++i){
+      Key k({1, i}, 8);
+      tree.put(k, new Value(i), gc);
+    }
+    auto has = [&policy](NodeKind kind, size_t layer){
+      return std::any_of(policy.placements.begin(), policy.placements.end(), [&](const NodePlacement &p){
+        return p.kind == kind and p.layer == layer;
+      });
+    };
+    EXPECT_TRUE(has(NodeKind::Border, 0));
+    EXPECT_TRUE(has(NodeKind::Interior, 0));
+    EXPECT_TRUE(has(NodeKind::Border, 1));
+    EXPECT_TRUE(has(NodeKind::Interior, 1));
+
+    for(uint64_t i = 0; i < 200; ++i){
+      Key k({1, i}, 8);
+      tree.remove(k, gc);
+    }
+    gc.run();
+    EXPECT_GT(policy.deallocated, 0);
+  }
+  set_node_alloc_policy(nullptr);
+}
+
+TEST(NodeAllocTest, numa_policy){
+  NumaNodeAllocPolicy policy{};
+  set_node_alloc_policy(&policy);
+  {
+    ShardedMasstree tree(2);
+    tree.setShardNode(0, policy.getTopology().nodes.front());
+    GC gc{};
+    constexpr uint64_t COUNT = 3000;
+    // 2回目は1回目で解放したNodeを再利用する
+    for(size_t round = 0; round < 2; ++round){
+      for(uint64_t i = 0; i < COUNT; ++i){
+        Key k({i % 5, i}, 8);
+        tree.put(k, new Value(i), gc);
+      }
+      for(uint64_t i = 0; i < COUNT; ++i){
+        Key k({i % 5, i}, 8);
+        ASSERT_EQ(tree.get(k)->getBody(), i);
+      }
+      for(uint64_t i = 0; i < COUNT; ++i){
+        Key k({i % 5, i}, 8);
+        ASSERT_EQ(tree.remove(k, gc)->getBody(), i);
+      }
+      gc.run();
+    }
+  }
+  set_node_alloc_policy(nullptr);
+}
+
+/**
+ * 複数のthreadが同じarenaから確保しても、同時に使われているNodeは重ならない。
+ * 他のthreadが解放したNodeは、threadのfree listからarenaに戻って再利用される。
+ */
+TEST(NodeAllocTest, arena_thread_cache){
+  NumaArena arena(-1, NumaTopology::load().nodes);
+  constexpr size_t THREADS = 4;
+  constexpr size_t COUNT = 1000;
+  constexpr size_t SIZE = 8 * sizeof(uint64_t);
+  std::vector<std::vector<uint64_t *>> blocks(THREADS);
+  std::vector<std::thread> threads{};
+  for(size_t t = 0; t < THREADS; ++t){
+    threads.emplace_back([&arena, &blocks, t](){
+      for(size_t i = 0; i < COUNT; ++i){
+        auto p = static_cast<uint64_t *>(arena.allocate(SIZE));
+        p[0] = t * COUNT + i;
+        blocks[t].push_back(p);
+      }
+    });
+  }
+  for(auto &th: threads){
+    th.join();
+  }
+  std::set<void *> all{};
+  for(size_t t = 0; t < THREADS; ++t){
+    for(size_t i = 0; i < COUNT; ++i){
+      EXPECT_EQ(blocks[t][i][0], t * COUNT + i);
+      all.insert(blocks[t][i]);
+    }
+  }
+  EXPECT_EQ(all.size(), THREADS * COUNT);
+
+  threads.clear();
+  for(size_t t = 0; t < THREADS; ++t){
+    // 他のthreadが確保したNodeを解放する
+    threads.emplace_back([&arena, &blocks, t](){
+      for(auto p: blocks[(t + 1) % THREADS]){
+        arena.deallocate(p, SIZE);
+      }
+    });
+  }
+  for(auto &th: threads){
+    th.join();
+  }
+  // 終わったthreadの手元に残った分を除き、全て再利用される
+  size_t reused = 0;
+  for(size_t i = 0; i < THREADS * COUNT; ++i){
+    if(all.count(arena.allocate(SIZE)) != 0){
+      ++reused;
+    }
+  }
+  EXPECT_GE(reused, THREADS * (COUNT - 2 * NumaArena::CACHE_BATCH));
+}
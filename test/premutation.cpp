@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include "../src/tree.h"
 #include "sample.h"
+#include <random>
 
 using namespace masstree;
 
@@ -74,3 +75,84 @@ TEST(PermutationTest, removeIndex){
 }
 
 
+
+TEST(PermutationTest, findIndex){
+  auto p = Permutation::from({3,4,5,0,1});
+  EXPECT_EQ(p.findIndex(3), 0);
+  EXPECT_EQ(p.findIndex(0), 3);
+  EXPECT_EQ(p.findIndex(1), 4);
+  // numKeysより後ろや、numKeysのnibbleとは一致させない
+  EXPECT_EQ(p.findIndex(2), 15);
+  EXPECT_EQ(p.findIndex(5), 2);
+  Permutation empty{};
+  EXPECT_EQ(empty.findIndex(0), 15);
+}
+
+TEST(PermutationTest, insert_remove_random){
+  // 1nibbleずつ動かす素朴な実装と比べる
+  std::mt19937 rng(1);
+  for(int round = 0; round < 1000; ++round){
+    Permutation p{};
+    std::vector<size_t> model{};
+    std::vector<size_t> unused{};
+    for(size_t i = 0; i < 15; ++i){
+      unused.push_back(i);
+    }
+    for(int step = 0; step < 40; ++step){
+      if(model.size() < 15 and (model.empty() or rng() % 3 != 0)){
+        auto pos = rng() % (model.size() + 1);
+        // 空いているslotは、removeされた順に後ろに並ぶ
+        auto index = unused.front();
+        EXPECT_EQ(p.back(), index);
+        unused.erase(unused.begin());
+        p.insert(pos, index);
+        model.insert(model.begin() + pos, index);
+      }else{
+        auto pos = rng() % model.size();
+        auto index = model[pos];
+        EXPECT_EQ(p.findIndex(index), pos);
+        p.removeIndex(index);
+        model.erase(model.begin() + pos);
+        unused.push_back(index);
+      }
+      ASSERT_EQ(p.getNumKeys(), model.size());
+      for(size_t i = 0; i < model.size(); ++i){
+        ASSERT_EQ(p(i), model[i]);
+      }
+    }
+  }
+}
+
+TEST(PermutationTest, free_slots){
+  Permutation p{};
+  EXPECT_EQ(p.getNumKeys(), 0);
+  EXPECT_EQ(p.back(), 0);
+  p.insert(0, p.back());
+  p.insert(0, p.back());
+  p.insert(1, p.back());
+  // [1|2|0]
+  EXPECT_EQ(p(0), 1);
+  EXPECT_EQ(p(1), 2);
+  EXPECT_EQ(p(2), 0);
+  EXPECT_EQ(p.back(), 3);
+
+  // removeしたslotは、一度も使っていないslotの後に使う
+  p.removeIndex(2);
+  EXPECT_EQ(p.getNumKeys(), 2);
+  EXPECT_EQ(p.back(), 3);
+  for(size_t i = 3; i < 15; ++i){
+    EXPECT_EQ(p.back(), i);
+    p.insert(p.getNumKeys(), p.back());
+  }
+  EXPECT_EQ(p.back(), 2);
+
+  // 空いているslotも含めて、常に0~14が一つずつある
+  auto q = Permutation::from({3, 4, 5, 0, 1});
+  EXPECT_EQ(q.back(), 2);
+  uint16_t seen = 0;
+  for(size_t i = 0; i < 15; ++i){
+    seen |= 1u << ((q.body >> (15 - i) * 4) & 0b1111);
+  }
+  EXPECT_EQ(seen, 0x7fff);
+  EXPECT_EQ(Permutation::fromSorted(4).back(), 4);
+}
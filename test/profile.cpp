@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include "../src/profile.h"
+#include <thread>
+
+using namespace masstree;
+
+class ProfileTest: public ::testing::Test{};
+
+#ifdef MASSTREE_PROFILE
+
+TEST(ProfileTest, phases_of_put_and_get){
+  Profiler::reset();
+  Masstree tree{};
+  GC gc{};
+  for(size_t i = 0; i < 100; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  // 同じsliceで次のsliceを持つkeyを二つ入れると、Layerが作られる
+  Key a({200, 1}, 8);
+  tree.put(a, new Value(1), gc);
+  Key b({200, 2}, 8);
+  tree.put(b, new Value(2), gc);
+  for(size_t i = 0; i < 100; ++i){
+    Key k({i}, 8);
+    tree.get(k);
+  }
+
+  auto snap = Profiler::collect();
+  // Layer0のputとgetは一回ずつ降りる。Layer1に入るputは二回降りる事がある
+  EXPECT_GE(snap[Phase::Descent].count, 202);
+  EXPECT_GE(snap[Phase::LeafSearch].count, 202);
+  EXPECT_GE(snap[Phase::LockWait].count, 102);
+  EXPECT_GT(snap[Phase::Split].count, 0);
+  EXPECT_EQ(snap[Phase::LayerCreation].count, 1);
+  EXPECT_EQ(snap[Phase::Retry].count, 0);
+  EXPECT_GT(snap[Phase::Descent].cycles, 0);
+
+  auto &descent = snap[Phase::Descent];
+  uint64_t total = 0;
+  for(auto c: descent.buckets) total += c;
+  EXPECT_EQ(total, descent.count);
+  EXPECT_LE(descent.quantile(0.5), descent.quantile(0.99));
+  EXPECT_LE(descent.quantile(0.99), descent.quantile(1.0));
+}
+
+/**
+ * 終了したthreadのhistogramも集計に含まれる。
+ */
+TEST(ProfileTest, aggregate_threads){
+  Profiler::reset();
+  Masstree tree{};
+  auto w = [&tree](size_t from){
+    GC gc{};
+    for(size_t i = from; i < from + 50; ++i){
+      Key k({i}, 8);
+      tree.put(k, new Value(i), gc);
+    }
+  };
+  std::thread a(w, 0);
+  std::thread b(w, 50);
+  a.join();
+  b.join();
+
+  EXPECT_GE(Profiler::collect()[Phase::LockWait].count, 100);
+  Profiler::reset();
+  EXPECT_EQ(Profiler::collect()[Phase::LockWait].count, 0);
+}
+
+#endif
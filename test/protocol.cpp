@@ -0,0 +1,46 @@
+#include <gtest/gtest.h>
+#include "../src/protocol.h"
+
+using namespace masstree;
+using namespace masstree::protocol;
+
+class ProtocolTest: public ::testing::Test{};
+
+TEST(ProtocolTest, request){
+  std::string buf{};
+  encode_request(Request{Op::Put, "key", 42}, buf);
+  encode_request(Request{Op::Scan, "", 0, 10}, buf);
+
+  Request req{};
+  size_t consumed = 0;
+  // 途中までしか届いていない
+  EXPECT_EQ(decode_request(buf.data(), 6, req, consumed), DecodeResult::Incomplete);
+  ASSERT_EQ(decode_request(buf.data(), buf.size(), req, consumed), DecodeResult::Done);
+  EXPECT_EQ(req.op, Op::Put);
+  EXPECT_EQ(req.key, "key");
+  EXPECT_EQ(req.value, 42);
+  ASSERT_EQ(decode_request(buf.data() + consumed, buf.size() - consumed, req, consumed), DecodeResult::Done);
+  EXPECT_EQ(req.op, Op::Scan);
+  EXPECT_TRUE(req.key.empty());
+  EXPECT_EQ(req.limit, 10);
+
+  // 知らないop
+  buf[4] = 9;
+  EXPECT_EQ(decode_request(buf.data(), buf.size(), req, consumed), DecodeResult::Malformed);
+}
+
+TEST(ProtocolTest, response){
+  std::string buf{};
+  Response scan{};
+  scan.entries = {{"a", 1}, {"bc", 2}};
+  encode_response(Op::Scan, scan, buf);
+  encode_response(Op::Get, Response{Status::NotFound}, buf);
+
+  Response resp{};
+  size_t consumed = 0;
+  ASSERT_EQ(decode_response(Op::Scan, buf.data(), buf.size(), resp, consumed), DecodeResult::Done);
+  EXPECT_EQ(resp.status, Status::Ok);
+  EXPECT_EQ(resp.entries, scan.entries);
+  ASSERT_EQ(decode_response(Op::Get, buf.data() + consumed, buf.size() - consumed, resp, consumed), DecodeResult::Done);
+  EXPECT_EQ(resp.status, Status::NotFound);
+}
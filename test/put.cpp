@@ -307,3 +307,26 @@ TEST(PutTest, update_and_gc){
   root = put_at_layer0(root, k, new Value(2), gc).second;
   EXPECT_TRUE(gc.contain(v1));
 }
+
+/**
+ * 何段にも重なったLayerに対してputし、Layerをまたいだputが
+ * 正しく行われる事を確認する。
+ */
+TEST(PutTest, deep_layers){
+  GC gc{};
+  Node *root = nullptr;
+  for(size_t i = 1; i <= 5; ++i){
+    std::vector<KeySlice> slices(i, ONE);
+    Key k(slices, 8);
+    root = put_at_layer0(root, k, new Value(i), gc).second;
+  }
+  for(size_t i = 1; i <= 5; ++i){
+    std::vector<KeySlice> slices(i, ONE);
+    Key k(slices, 8);
+    EXPECT_EQ(get(root, k)->getBody(), i);
+  }
+  Key k({ONE, ONE, ONE, ONE, ONE}, 8);
+  root = put_at_layer0(root, k, new Value(50), gc).second;
+  k.reset();
+  EXPECT_EQ(get(root, k)->getBody(), 50);
+}
@@ -3,6 +3,7 @@
 #include "../src/get.h"
 #include "../src/remove.h"
 #include "sample.h"
+#include "../src/masstree.h"
 
 using namespace masstree;
 
@@ -584,4 +585,77 @@ TEST(RemoveTest, handle_delete_layer_in_remove){
   EXPECT_EQ(upper->getKeyLen(upper_index), BorderNode::key_len_has_suffix);
   EXPECT_EQ(upper->getLV(upper_index).value, &v);
   EXPECT_EQ(gc.contain(n), true);
-}
\ No newline at end of file
+}
+/**
+ * removeは削除したvalueを返し、それはgcに渡されている。
+ */
+TEST(RemoveTest, returns_removed_value){
+  Masstree tree{};
+  GC gc{};
+  Key k1({ONE}, 8);
+  Key k2({ONE, TWO}, 8);
+  Key k3({ONE, THREE}, 3);
+  auto v1 = new Value(1);
+  auto v2 = new Value(2);
+  auto v3 = new Value(3);
+  tree.put(k1, v1, gc);
+  tree.put(k2, v2, gc);
+  tree.put(k3, v3, gc);
+
+  EXPECT_EQ(tree.remove(k2, gc), v2);
+  EXPECT_TRUE(gc.contain(v2));
+  EXPECT_EQ(tree.remove(k2, gc), nullptr);
+  // layer1に一つしか残っていないので、layerの削除を経由する
+  EXPECT_EQ(tree.remove(k3, gc), v3);
+  EXPECT_EQ(tree.remove(k1, gc), v1);
+  EXPECT_EQ(tree.get(k1), nullptr);
+  EXPECT_EQ(tree.remove(k1, gc), nullptr);
+}
+
+/**
+ * removeされたslotが再利用される時に、valueが二重にgcに渡されない。
+ */
+TEST(RemoveTest, reuse_after_removed_value){
+  Masstree tree{};
+  GC gc{};
+  for(size_t i = 0; i < 10; ++i){
+    Key k({i}, 1);
+    tree.put(k, new Value(i), gc);
+  }
+  Key k({3}, 1);
+  auto removed = tree.remove(k, gc);
+  EXPECT_EQ(removed->getBody(), 3);
+  Key k2({20}, 1);
+  tree.put(k2, new Value(20), gc);
+  EXPECT_EQ(tree.get(k2)->getBody(), 20);
+  gc.run();
+}
+
+/**
+ * 下のLayerのInteriorNodeのrootが一つの子に縮んだ後も、その子から上のLayerを辿れる。
+ * そうでないと、そのLayerの最後のkeyのremoveでLayerを消せない。
+ */
+TEST(RemoveTest, collapsed_layer_root_keeps_upper_layer){
+  Masstree tree{};
+  GC gc{};
+  constexpr size_t COUNT = 20;
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({ONE, i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  ASSERT_EQ(tree.stats().max_height_per_depth[1], 2);
+  // 左のBorderNodeを空にすると、rootは右のBorderNodeに縮む
+  size_t i = 0;
+  while(tree.stats().max_height_per_depth[1] == 2){
+    Key k({ONE, i++}, 8);
+    tree.remove(k, gc);
+  }
+  for(; i < COUNT; ++i){
+    Key k({ONE, i}, 8);
+    EXPECT_EQ(tree.remove(k, gc)->getBody(), i);
+  }
+  Key k({ONE, 0}, 8);
+  EXPECT_EQ(tree.get(k), nullptr);
+  tree.put(k, new Value(100), gc);
+  EXPECT_EQ(tree.get(k)->getBody(), 100);
+}
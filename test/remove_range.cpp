@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include <random>
+
+using namespace masstree;
+
+class RemoveRangeTest: public ::testing::Test{};
+
+/**
+ * Layerの境界と一致するprefixの削除では、下のLayerが丸ごと切り離される。
+ * prefix自身は消え、prefixより短いkeyや他のprefixのkeyは残る。
+ */
+TEST(RemoveRangeTest, prefix_detaches_layer){
+  Masstree tree{};
+  GC gc{};
+  constexpr size_t COUNT = 200;
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k1({1, i, i % 3}, 8);
+    tree.put(k1, new Value(i), gc);
+    Key k2({2, i}, 5);
+    tree.put(k2, new Value(i), gc);
+  }
+  Key exact({1}, 8);
+  tree.put(exact, new Value(1000), gc);
+  Key shorter({1}, 3);
+  tree.put(shorter, new Value(1001), gc);
+  auto before = tree.stats();
+
+  GC range_gc{};
+  EXPECT_EQ(tree.removePrefix(Key({1}, 8), range_gc), COUNT + 1);
+  auto after = tree.stats();
+  EXPECT_EQ(after.keys, COUNT + 1);
+  EXPECT_LT(after.border_nodes, before.border_nodes);
+  EXPECT_LT(after.layers_per_depth[1], before.layers_per_depth[1]);
+
+  EXPECT_EQ(tree.get(exact), nullptr);
+  EXPECT_EQ(tree.get(shorter)->getBody(), 1001);
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k1({1, i, i % 3}, 8);
+    EXPECT_EQ(tree.get(k1), nullptr);
+    Key k2({2, i}, 5);
+    EXPECT_EQ(tree.get(k2)->getBody(), i);
+  }
+  EXPECT_EQ(tree.removePrefix(Key({1}, 8), range_gc), 0);
+
+  // 切り離した後も、同じprefixに入れ直せる
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k1({1, i, i % 3}, 8);
+    tree.put(k1, new Value(i + 1), gc);
+  }
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k1({1, i, i % 3}, 8);
+    EXPECT_EQ(tree.get(k1)->getBody(), i + 1);
+  }
+}
+
+/**
+ * 最後のsliceが8byteでないprefixでは、prefixの次のbyte列までを消す。
+ */
+TEST(RemoveRangeTest, prefix_not_aligned){
+  Masstree tree{};
+  GC gc{};
+  std::vector<std::string> removed{"user/", "user/a", "user/b", "user/bb", "user/profile/1234567890"};
+  std::vector<std::string> kept{"use", "user", "user0", "users/x", "usex", "user.profile/1234567890"};
+  // 最後のsliceが桁あふれするprefix
+  std::vector<std::string> carried{"\xff\xff", "\xff\xff\x01", "\xff\xff\xff\xff\xff\xff\xff\xff\xff"};
+  int body = 0;
+  for(auto keys: {&removed, &kept, &carried}){
+    for(auto &key: *keys){
+      auto k = key_from_bytes(key.data(), key.size());
+      tree.put(k, new Value(body++), gc);
+    }
+  }
+  std::string last = "\xff\xfe";
+  auto last_key = key_from_bytes(last.data(), last.size());
+  tree.put(last_key, new Value(body++), gc);
+
+  GC range_gc{};
+  EXPECT_EQ(tree.removePrefix(key_from_bytes("user/", 5), range_gc), removed.size());
+  for(auto &key: removed){
+    auto k = key_from_bytes(key.data(), key.size());
+    EXPECT_EQ(tree.get(k), nullptr) << key;
+  }
+  for(auto &key: kept){
+    auto k = key_from_bytes(key.data(), key.size());
+    EXPECT_NE(tree.get(k), nullptr) << key;
+  }
+
+  EXPECT_EQ(tree.removePrefix(key_from_bytes("\xff\xff", 2), range_gc), carried.size());
+  for(auto &key: carried){
+    auto k = key_from_bytes(key.data(), key.size());
+    EXPECT_EQ(tree.get(k), nullptr);
+  }
+  EXPECT_NE(tree.get(last_key), nullptr);
+  range_gc.run();
+}
+
+/**
+ * layer0の範囲削除では、空になったBorderNodeも消え、全て消すと空のtreeに戻る。
+ */
+TEST(RemoveRangeTest, range_at_layer0){
+  Masstree tree{};
+  GC gc{};
+  constexpr size_t COUNT = 300;
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  EXPECT_EQ(tree.removeRange(Key({50}, 8), Key({250}, 8), gc), 200);
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i}, 8);
+    auto v = tree.get(k);
+    if(50 <= i and i < 250){
+      EXPECT_EQ(v, nullptr);
+    }else{
+      ASSERT_NE(v, nullptr);
+      EXPECT_EQ(v->getBody(), i);
+    }
+  }
+  EXPECT_EQ(tree.stats().keys, 100);
+
+  EXPECT_EQ(tree.removeRange(Key({0}, 1), Key({COUNT}, 8), gc), 100);
+  EXPECT_EQ(tree.stats().border_nodes, 0);
+  Key k({1}, 8);
+  tree.put(k, new Value(1), gc);
+  EXPECT_EQ(tree.get(k)->getBody(), 1);
+}
+
+/**
+ * ランダムなkeyとランダムな範囲で、std::setを使った結果と比べる。
+ * 範囲の端が下のLayerの中にある場合も含む。
+ */
+TEST(RemoveRangeTest, random_ranges){
+  std::mt19937_64 rng(7);
+  for(size_t round = 0; round < 30; ++round){
+    Masstree tree{};
+    GC gc{};
+    auto random_key = [&rng](){
+      std::vector<KeySlice> slices{};
+      auto len = rng() % 3 + 1;
+      for(size_t i = 0; i < len; ++i){
+        slices.push_back(rng() % 4);
+      }
+      return Key(slices, rng() % 8 + 1);
+    };
+    auto less = [](const Key &a, const Key &b){ return a.compare(b) < 0; };
+    std::set<Key, decltype(less)> expected(less);
+    for(size_t i = 0; i < 200; ++i){
+      auto k = random_key();
+      expected.insert(k);
+      tree.put(k, new Value(i), gc);
+    }
+    for(size_t i = 0; i < 3; ++i){
+      auto lo = random_key();
+      auto hi = random_key();
+      if(hi.compare(lo) < 0){
+        std::swap(lo, hi);
+      }
+      size_t count = 0;
+      for(auto it = expected.lower_bound(lo); it != expected.end() and it->compare(hi) < 0;){
+        it = expected.erase(it);
+        ++count;
+      }
+      EXPECT_EQ(tree.removeRange(lo, hi, gc), count);
+    }
+    EXPECT_EQ(tree.stats().keys, expected.size());
+    for(auto &k: expected){
+      auto key = k;
+      EXPECT_NE(tree.get(key), nullptr);
+    }
+  }
+}
@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include <random>
+
+using namespace masstree;
+
+class ScanTest: public ::testing::Test{};
+
+/**
+ * Layerやsuffixを含むkeyが、Key::compareの順で全て返る。
+ */
+TEST(ScanTest, ordered){
+  std::mt19937_64 rng(3);
+  Masstree tree{};
+  GC gc{};
+  auto less = [](const Key &a, const Key &b){ return a.compare(b) < 0; };
+  std::set<Key, decltype(less)> expected(less);
+  for(size_t i = 0; i < 500; ++i){
+    std::vector<KeySlice> slices{};
+    auto len = rng() % 3 + 1;
+    for(size_t j = 0; j < len; ++j){
+      slices.push_back(rng() % 5);
+    }
+    Key k(slices, rng() % 8 + 1);
+    expected.insert(k);
+    tree.put(k, new Value(i), gc);
+  }
+
+  std::vector<Key> keys{};
+  tree.scan([&keys](const Key &key, Value *){
+    keys.push_back(key);
+    return true;
+  });
+  ASSERT_EQ(keys.size(), expected.size());
+  size_t i = 0;
+  for(auto &k: expected){
+    EXPECT_EQ(keys[i++].compare(k), 0);
+  }
+
+  // fromからの途中で終える
+  auto from = *std::next(expected.begin(), expected.size() / 2);
+  std::vector<Key> partial{};
+  tree.scan(from, [&partial](const Key &key, Value *){
+    partial.push_back(key);
+    return partial.size() < 10;
+  });
+  ASSERT_EQ(partial.size(), 10);
+  auto it = expected.find(from);
+  for(auto &k: partial){
+    EXPECT_EQ(k.compare(*it++), 0);
+  }
+}
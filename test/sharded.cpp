@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include "../src/sharded_masstree.h"
+
+using namespace masstree;
+
+class ShardedTest: public ::testing::Test{};
+
+TEST(ShardedTest, hash_routing){
+  ShardedMasstree tree(4);
+  GC gc{};
+  constexpr size_t COUNT = 500;
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i % 7, i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  // 全てのshardが使われる
+  for(size_t s = 0; s < tree.shardCount(); ++s){
+    EXPECT_GT(tree.shard(s).stats().keys, 0);
+  }
+  for(size_t i = 0; i < COUNT; ++i){
+    Key k({i % 7, i}, 8);
+    EXPECT_EQ(tree.get(k)->getBody(), i);
+  }
+  for(size_t i = 0; i < COUNT; i += 2){
+    Key k({i % 7, i}, 8);
+    EXPECT_EQ(tree.remove(k, gc)->getBody(), i);
+  }
+
+  // shardをまたいで、小さい順にmergeされる
+  std::vector<Key> keys{};
+  tree.scan([&keys](const Key &key, Value *value){
+    EXPECT_EQ(value->getBody(), key.slices[1]);
+    keys.push_back(key);
+    return true;
+  });
+  ASSERT_EQ(keys.size(), COUNT / 2);
+  for(size_t i = 1; i < keys.size(); ++i){
+    EXPECT_LT(keys[i - 1].compare(keys[i]), 0);
+  }
+
+  size_t count = 0;
+  tree.scan(Key({3}, 8), [&count](const Key &key, Value *){
+    EXPECT_GE(key.slices[0], 3);
+    return ++count < 100;
+  });
+  EXPECT_EQ(count, 100);
+}
+
+TEST(ShardedTest, range_routing){
+  ShardedMasstree tree({Key({100}, 8), Key({200}, 8)});
+  GC gc{};
+  for(size_t i = 0; i < 300; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  EXPECT_EQ(tree.shardOf(Key({99}, 8)), 0);
+  EXPECT_EQ(tree.shardOf(Key({100}, 8)), 1);
+  EXPECT_EQ(tree.shardOf(Key({250, 1}, 8)), 2);
+  EXPECT_EQ(tree.shard(0).stats().keys, 100);
+  EXPECT_EQ(tree.shard(1).stats().keys, 100);
+  EXPECT_EQ(tree.shard(2).stats().keys, 100);
+
+  KeySlice expected = 150;
+  tree.scan(Key({150}, 8), [&expected](const Key &key, Value *value){
+    EXPECT_EQ(key.slices[0], expected);
+    EXPECT_EQ(value->getBody(), expected);
+    ++expected;
+    return expected < 250;
+  });
+  EXPECT_EQ(expected, 250);
+}
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include "../src/stats.h"
+#include <thread>
+
+using namespace masstree;
+
+class StatsTest: public ::testing::Test{};
+
+#ifdef MASSTREE_STATS
+
+TEST(StatsTest, count_operations){
+  Stats::reset();
+  Masstree tree{};
+  GC gc{};
+  for(size_t i = 0; i < 100; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  for(size_t i = 0; i < 100; ++i){
+    Key k({i}, 8);
+    tree.get(k);
+  }
+  Key k({0}, 8);
+  tree.remove(k, gc);
+
+  auto snap = Stats::collect();
+  EXPECT_EQ(snap[Stat::Put], 100);
+  EXPECT_EQ(snap[Stat::Get], 100);
+  EXPECT_EQ(snap[Stat::Remove], 1);
+  // 100個のkeyは一つのBorderNodeには入りきらない
+  EXPECT_GT(snap.splits[0], 0);
+  EXPECT_EQ(snap.totalSplits(), snap.splits[0]);
+}
+
+TEST(StatsTest, split_per_layer){
+  Stats::reset();
+  Masstree tree{};
+  GC gc{};
+  for(size_t i = 0; i < 100; ++i){
+    Key k({1, i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  auto snap = Stats::collect();
+  EXPECT_GT(snap.splits[1], 0);
+}
+
+/**
+ * 終了したthreadのカウンタも集計に含まれる。
+ */
+TEST(StatsTest, aggregate_threads){
+  Stats::reset();
+  Masstree tree{};
+  auto w = [&tree](size_t from){
+    GC gc{};
+    for(size_t i = from; i < from + 50; ++i){
+      Key k({i}, 8);
+      tree.put(k, new Value(i), gc);
+    }
+  };
+  std::thread a(w, 0);
+  std::thread b(w, 50);
+  a.join();
+  b.join();
+
+  auto snap = Stats::collect();
+  EXPECT_EQ(snap[Stat::Put], 100);
+  Stats::reset();
+  EXPECT_EQ(Stats::collect()[Stat::Put], 0);
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+
+using namespace masstree;
+
+class SubtreeTest: public ::testing::Test{};
+
+TEST(SubtreeTest, get_put_scan){
+  Masstree tree{};
+  GC gc{};
+  for(size_t i = 0; i < 100; ++i){
+    Key k({8, i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  auto sub = tree.subtree(Key({7}, 8));
+  for(size_t i = 0; i < 200; ++i){
+    Key k({7, i, i % 2}, 8);
+    sub.put(k, new Value(i), gc);
+  }
+  for(size_t i = 0; i < 200; ++i){
+    Key k({7, i, i % 2}, 8);
+    EXPECT_EQ(sub.get(k)->getBody(), i);
+    EXPECT_EQ(tree.get(k)->getBody(), i);
+  }
+  Key other({7, 1000}, 3);
+  EXPECT_EQ(sub.get(other), nullptr);
+
+  size_t count = 0;
+  sub.scan([&count](const Key &key, Value *value){
+    EXPECT_EQ(key.slices[0], 7);
+    EXPECT_EQ(key.slices[1], count);
+    EXPECT_EQ(value->getBody(), count);
+    ++count;
+    return true;
+  });
+  EXPECT_EQ(count, 200);
+}
+
+/**
+ * 覚えているLayerが、最後のkeyのremoveで上のLayerに移った後も、辿り直して続けられる。
+ */
+TEST(SubtreeTest, layer_moved){
+  Masstree tree{};
+  GC gc{};
+  Key a({7, 1}, 8);
+  Key b({7, 2}, 8);
+  tree.put(a, new Value(1), gc);
+  tree.put(b, new Value(2), gc);
+  EXPECT_EQ(tree.stats().layers_per_depth.size(), 2);
+
+  auto sub = tree.subtree(Key({7}, 8));
+  EXPECT_EQ(sub.get(a)->getBody(), 1);
+  tree.remove(a, gc);
+  // 残りが一つになったLayerから最後のkeyを消すと、Layerは消える
+  tree.remove(b, gc);
+  EXPECT_EQ(sub.get(b), nullptr);
+
+  // Layerが無い間は、上のLayerのsuffixとして入る
+  sub.put(a, new Value(3), gc);
+  EXPECT_EQ(tree.stats().layers_per_depth.size(), 1);
+  EXPECT_EQ(sub.get(a)->getBody(), 3);
+  size_t count = 0;
+  sub.scan([&count](const Key &, Value *){ ++count; return true; });
+  EXPECT_EQ(count, 1);
+
+  // 二つ目のkeyで再びLayerが作られる
+  sub.put(b, new Value(4), gc);
+  EXPECT_EQ(tree.stats().layers_per_depth.size(), 2);
+  EXPECT_EQ(sub.get(a)->getBody(), 3);
+  EXPECT_EQ(sub.get(b)->getBody(), 4);
+
+  tree.removePrefix(Key({7}, 8), gc);
+  EXPECT_EQ(sub.get(a), nullptr);
+  sub.put(b, new Value(5), gc);
+  EXPECT_EQ(tree.get(b)->getBody(), 5);
+}
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include "../src/transaction.h"
+
+using namespace masstree;
+
+class TransactionTest: public ::testing::Test{};
+
+TEST(TransactionTest, read_own_writes){
+  Masstree tree{};
+  TransactionManager manager(tree);
+  GC gc{};
+  Key a({1}, 8);
+  Key b({1, 2}, 3);
+  Transaction tx(manager, gc);
+  EXPECT_EQ(tx.get(a), nullptr);
+  tx.put(a, new Value(1));
+  tx.put(b, new Value(2));
+  EXPECT_EQ(tx.get(a)->getBody(), 1);
+  tx.put(a, new Value(3));
+  EXPECT_EQ(tx.get(a)->getBody(), 3);
+  // commitまでは見えない
+  EXPECT_EQ(tree.get(a), nullptr);
+  ASSERT_TRUE(tx.commit());
+  EXPECT_EQ(tree.get(a)->getBody(), 3);
+  EXPECT_EQ(tree.get(b)->getBody(), 2);
+  EXPECT_GE(tx.getCommitTid(), manager.currentEpoch() << 32);
+
+  tx.remove(a);
+  ASSERT_TRUE(tx.commit());
+  EXPECT_TRUE(tree.get(a)->isTombstone());
+  EXPECT_EQ(tx.get(a), nullptr);
+  ASSERT_TRUE(tx.commit());
+}
+
+TEST(TransactionTest, read_write_conflict){
+  Masstree tree{};
+  TransactionManager manager(tree);
+  GC gc{};
+  Key x({1}, 8);
+  Key y({2}, 8);
+  tree.put(x, new Value(1), gc);
+
+  Transaction t1(manager, gc);
+  Transaction t2(manager, gc);
+  EXPECT_EQ(t1.get(x)->getBody(), 1);
+  t1.put(y, new Value(10));
+  t2.put(x, new Value(2));
+  ASSERT_TRUE(t2.commit());
+  EXPECT_FALSE(t1.commit());
+  EXPECT_EQ(tree.get(y), nullptr);
+
+  // やり直せば通る
+  EXPECT_EQ(t1.get(x)->getBody(), 2);
+  t1.put(y, new Value(20));
+  ASSERT_TRUE(t1.commit());
+  EXPECT_EQ(tree.get(y)->getBody(), 20);
+}
+
+/**
+ * 無いと読んだkeyが、commitまでに他から挿入されていたらabortする。
+ */
+TEST(TransactionTest, phantom){
+  Masstree tree{};
+  TransactionManager manager(tree);
+  GC gc{};
+  for(size_t i = 0; i < 100; i += 2){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  Key absent({51}, 8);
+  Key other({200}, 8);
+  Transaction tx(manager, gc);
+  EXPECT_EQ(tx.get(absent), nullptr);
+  tx.put(other, new Value(1));
+  tree.put(absent, new Value(51), gc);
+  EXPECT_FALSE(tx.commit());
+
+  EXPECT_EQ(tx.get(absent)->getBody(), 51);
+  tx.put(other, new Value(1));
+  ASSERT_TRUE(tx.commit());
+}
+
+/**
+ * 一つのBorderNodeに入りきらない数のkeyを一度に入れる。
+ * splitが必要なkeyやLayerを作るkeyは、先にtombstoneが入る。
+ */
+TEST(TransactionTest, large_write_set){
+  Masstree tree{};
+  TransactionManager manager(tree);
+  GC gc{};
+  Transaction tx(manager, gc);
+  for(size_t i = 0; i < 200; ++i){
+    Key k({i % 50, i}, 8);
+    tx.put(k, new Value(i));
+  }
+  ASSERT_TRUE(tx.commit());
+  for(size_t i = 0; i < 200; ++i){
+    Key k({i % 50, i}, 8);
+    ASSERT_EQ(tree.get(k)->getBody(), i);
+  }
+}
@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+#include "../src/masstree.h"
+#include "sample.h"
+
+using namespace masstree;
+
+class TreeStatsTest: public ::testing::Test{};
+
+TEST(TreeStatsTest, empty){
+  Masstree tree{};
+  auto stats = tree.stats();
+  EXPECT_EQ(stats.border_nodes, 0);
+  EXPECT_EQ(stats.keys, 0);
+  EXPECT_EQ(stats.bytesPerKey(), 0);
+}
+
+TEST(TreeStatsTest, single_layer){
+  Masstree tree{};
+  GC gc{};
+  for(size_t i = 0; i < 100; ++i){
+    Key k({i}, 8);
+    tree.put(k, new Value(i), gc);
+  }
+  auto stats = tree.stats();
+  EXPECT_EQ(stats.keys, 100);
+  EXPECT_GE(stats.border_nodes, 100 / 15 + 1);
+  EXPECT_GE(stats.interior_nodes, 1);
+  ASSERT_EQ(stats.layers_per_depth.size(), 1);
+  EXPECT_EQ(stats.layers_per_depth[0], 1);
+  EXPECT_EQ(stats.max_height_per_depth[0], 2);
+  EXPECT_GT(stats.borderFillFactor(), 0.4);
+  EXPECT_LE(stats.borderFillFactor(), 1.0);
+  EXPECT_EQ(stats.big_suffixes, 0);
+  EXPECT_GT(stats.bytesPerKey(), sizeof(Value));
+}
+
+TEST(TreeStatsTest, layers_and_suffixes){
+  Masstree tree{};
+  GC gc{};
+  // ONEから始まる二つのkeyは、layer1を作る
+  Key k1({ONE, TWO}, 8);
+  Key k2({ONE, THREE}, 8);
+  // suffixとして保存される
+  Key k3({TWO, ONE, TWO}, 4);
+  tree.put(k1, new Value(1), gc);
+  tree.put(k2, new Value(2), gc);
+  tree.put(k3, new Value(3), gc);
+
+  auto stats = tree.stats();
+  EXPECT_EQ(stats.keys, 3);
+  ASSERT_EQ(stats.layers_per_depth.size(), 2);
+  EXPECT_EQ(stats.layers_per_depth[1], 1);
+  EXPECT_EQ(stats.keys_per_depth[0], 1);
+  EXPECT_EQ(stats.keys_per_depth[1], 2);
+  EXPECT_EQ(stats.big_suffixes, 1);
+  EXPECT_EQ(stats.suffix_bytes, sizeof(BigSuffix) + 2 * sizeof(KeySlice));
+
+  tree.remove(k1, gc);
+  EXPECT_EQ(tree.stats().removed_slots, 1);
+}